@@ -0,0 +1,70 @@
+"""Compares two JSON reports of the cpu_kernel_bench target.
+
+    python benchmarks/kernels/compare_cpu_kernel_bench.py base.json new.json
+
+Besides the kernel times, the barrier wait of each call summed over the
+OpenMP threads is compared, e.g. of a report without and one with
+--subteams.
+"""
+import argparse
+import json
+from typing import Dict, Tuple
+
+Key = Tuple[str, str, int, str]
+
+
+def load_results(path: str) -> Tuple[dict, Dict[Key, dict]]:
+    with open(path) as f:
+        report = json.load(f)
+    results = {(r["kernel"], r["dtype"], r["threads"], r["shape"]): r
+               for r in report["results"]}
+    return report["machine"], results
+
+
+def main(base_path: str, new_path: str, threshold: float) -> None:
+    base_machine, base = load_results(base_path)
+    new_machine, new = load_results(new_path)
+    if base_machine["isa"] != new_machine["isa"]:
+        print(f"warning: comparing {base_machine['isa']} with "
+              f"{new_machine['isa']}")
+    print(f"subteams: base={base_machine.get('subteams', 0)} "
+          f"new={new_machine.get('subteams', 0)}")
+    for machine in (base_machine, new_machine):
+        for roofline in machine["roofline"]:
+            print(f"{machine['hostname']} threads={roofline['threads']} "
+                  f"stream={roofline['stream_gbps']:.1f} GB/s "
+                  f"peak={roofline['peak_gflops']:.1f} GFLOP/s")
+
+    print(f"{'kernel':<28}{'dtype':<10}{'threads':>8} {'shape':<64}"
+          f"{'base us':>12}{'new us':>12}{'speedup':>9}"
+          f"{'base bar us':>13}{'new bar us':>13}")
+    regressions = 0
+    for key in sorted(base.keys() & new.keys()):
+        speedup = base[key]["time_us"] / new[key]["time_us"]
+        kernel, dtype, threads, shape = key
+        mark = ""
+        if speedup < 1.0 - threshold:
+            mark = " <- regression"
+            regressions += 1
+        print(f"{kernel:<28}{dtype:<10}{threads:>8} {shape:<64}"
+              f"{base[key]['time_us']:>12.1f}{new[key]['time_us']:>12.1f}"
+              f"{speedup:>9.2f}"
+              f"{base[key].get('barrier_us', 0.0):>13.1f}"
+              f"{new[key].get('barrier_us', 0.0):>13.1f}{mark}")
+    for key in sorted(base.keys() ^ new.keys()):
+        side = "base" if key in base else "new"
+        print(f"only in {side}: {' '.join(map(str, key))}")
+    print(f"{regressions} regression(s) beyond {threshold:.0%}")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Compare two cpu_kernel_bench JSON reports.")
+    parser.add_argument("base", type=str)
+    parser.add_argument("new", type=str)
+    parser.add_argument("--threshold",
+                        type=float,
+                        default=0.05,
+                        help="Relative slowdown reported as a regression.")
+    args = parser.parse_args()
+    main(args.base, args.new, args.threshold)
@@ -8,6 +8,12 @@ if(DEFINED ENV{VLLM_CPU_AVX512BF16})
     set(ENABLE_AVX512BF16 ON)
 endif()
 
+# Build the kernels on the portable scalar vec_op implementation
+# (csrc/cpu/cpu_types_scalar.hpp) instead of the SIMD backend of the host.
+if(DEFINED ENV{VLLM_CPU_SCALAR_VEC_OP})
+    set(ENABLE_SCALAR_VEC_OP ON)
+endif()
+
 include_directories("${CMAKE_SOURCE_DIR}/csrc")
 
 #
@@ -51,12 +57,16 @@ find_isa(${CPUINFO} "POWER10" POWER10_FOUND)
 find_isa(${CPUINFO} "POWER9" POWER9_FOUND)
 find_isa(${CPUINFO} "S390" S390_FOUND)
 
-if (AVX512_FOUND AND NOT AVX512_DISABLED)
+if (ENABLE_SCALAR_VEC_OP)
+    list(APPEND CXX_COMPILE_FLAGS "-DVLLM_CPU_SCALAR_VEC_OP")
+    message(WARNING "vLLM CPU backend using the scalar vec_op implementation")
+elseif (AVX512_FOUND AND NOT AVX512_DISABLED)
     list(APPEND CXX_COMPILE_FLAGS
         "-mavx512f"
         "-mavx512vl"
         "-mavx512bw"
-        "-mavx512dq")
+        "-mavx512dq"
+        "-mf16c")
 
     find_isa(${CPUINFO} "avx512_bf16" AVX512BF16_FOUND)
     if (AVX512BF16_FOUND OR ENABLE_AVX512BF16)
@@ -70,7 +80,7 @@ if (AVX512_FOUND AND NOT AVX512_DISABLED)
         message(WARNING "Disable AVX512-BF16 ISA support, no avx512_bf16 found in local CPU flags." " If cross-compilation is required, please set env VLLM_CPU_AVX512BF16=1.")
     endif()
 elseif (AVX2_FOUND)
-    list(APPEND CXX_COMPILE_FLAGS "-mavx2")
+    list(APPEND CXX_COMPILE_FLAGS "-mavx2" "-mf16c")
     message(WARNING "vLLM CPU backend using AVX2 ISA")
 elseif (POWER9_FOUND OR POWER10_FOUND)
     message(STATUS "PowerPC detected")
@@ -102,12 +112,23 @@ set(VLLM_EXT_SRC
     "csrc/cpu/activation.cpp"
     "csrc/cpu/attention.cpp"
     "csrc/cpu/cache.cpp"
+    "csrc/cpu/caching_allocator.cpp"
+    "csrc/cpu/convert.cpp"
+    "csrc/cpu/decoder_layer.cpp"
     "csrc/cpu/utils.cpp"
+    "csrc/cpu/kernel_profiler.cpp"
+    "csrc/cpu/kernel_tuner.cpp"
     "csrc/cpu/layernorm.cpp"
+    "csrc/cpu/lora.cpp"
+    "csrc/cpu/numa_memory.cpp"
     "csrc/cpu/pos_encoding.cpp"
-    "csrc/cpu/torch_bindings.cpp")
+    "csrc/cpu/shm_broadcast.cpp"
+    "csrc/cpu/thread_subteams.cpp"
+    "csrc/cpu/torch_bindings.cpp"
+    "csrc/cpu/weight_streamer.cpp"
+    "csrc/cpu/workspace.cpp")
 
-if (AVX512_FOUND AND NOT AVX512_DISABLED)
+if (AVX512_FOUND AND NOT AVX512_DISABLED AND NOT ENABLE_SCALAR_VEC_OP)
     set(VLLM_EXT_SRC
         "csrc/cpu/quant.cpp"
         ${VLLM_EXT_SRC})
@@ -129,3 +150,35 @@ define_gpu_extension_target(
 )
 
 message(STATUS "Enabling C extension.")
+
+#
+# cpu_kernel_bench: standalone microbenchmarks of the kernels above, not built
+# by default. Build with `cmake --build <build dir> --target cpu_kernel_bench`.
+#
+set(CPU_KERNEL_BENCH_SRC ${VLLM_EXT_SRC})
+list(REMOVE_ITEM CPU_KERNEL_BENCH_SRC "csrc/cpu/torch_bindings.cpp")
+
+add_executable(cpu_kernel_bench EXCLUDE_FROM_ALL
+    "csrc/cpu/bench/cpu_kernel_bench.cpp"
+    ${CPU_KERNEL_BENCH_SRC})
+set_property(TARGET cpu_kernel_bench PROPERTY CXX_STANDARD 17)
+target_compile_options(cpu_kernel_bench PRIVATE ${CXX_COMPILE_FLAGS})
+target_include_directories(cpu_kernel_bench PRIVATE csrc)
+target_link_libraries(cpu_kernel_bench PRIVATE ${TORCH_LIBRARIES} ${LIBS})
+target_link_options(cpu_kernel_bench PRIVATE "-fopenmp")
+if (AVX512_FOUND AND NOT AVX512_DISABLED AND NOT ENABLE_SCALAR_VEC_OP)
+    target_compile_definitions(cpu_kernel_bench PRIVATE VLLM_CPU_BENCH_QUANT)
+endif()
+
+#
+# cpu_vec_op_tests: conformance tests of the vec_op backend against the scalar
+# implementation, not built by default. Build with
+# `cmake --build <build dir> --target cpu_vec_op_tests`.
+#
+add_executable(cpu_vec_op_tests EXCLUDE_FROM_ALL
+    "csrc/cpu/tests/vec_op_conformance.cpp")
+set_property(TARGET cpu_vec_op_tests PROPERTY CXX_STANDARD 17)
+target_compile_options(cpu_vec_op_tests PRIVATE ${CXX_COMPILE_FLAGS})
+target_include_directories(cpu_vec_op_tests PRIVATE csrc)
+target_link_libraries(cpu_vec_op_tests PRIVATE ${TORCH_LIBRARIES})
+target_link_options(cpu_vec_op_tests PRIVATE "-fopenmp")
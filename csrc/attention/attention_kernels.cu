@@ -821,7 +821,10 @@ void paged_attention_v1(
     const std::string& kv_cache_dtype, double k_scale, double v_scale,
     const int64_t tp_rank, const int64_t blocksparse_local_blocks,
     const int64_t blocksparse_vert_stride, const int64_t blocksparse_block_size,
-    const int64_t blocksparse_head_sliding_step) {
+    const int64_t blocksparse_head_sliding_step, const int64_t sliding_window) {
+  TORCH_CHECK(sliding_window <= 0,
+              "Sliding window is not supported by the CUDA paged attention, "
+              "the block tables need to be trimmed to the window instead.");
   const bool is_block_sparse = (blocksparse_vert_stride > 1);
 
   DISPATCH_BY_KV_CACHE_DTYPE(query.dtype(), kv_cache_dtype,
@@ -990,7 +993,10 @@ void paged_attention_v2(
     const std::string& kv_cache_dtype, double k_scale, double v_scale,
     const int64_t tp_rank, const int64_t blocksparse_local_blocks,
     const int64_t blocksparse_vert_stride, const int64_t blocksparse_block_size,
-    const int64_t blocksparse_head_sliding_step) {
+    const int64_t blocksparse_head_sliding_step, const int64_t sliding_window) {
+  TORCH_CHECK(sliding_window <= 0,
+              "Sliding window is not supported by the CUDA paged attention, "
+              "the block tables need to be trimmed to the window instead.");
   const bool is_block_sparse = (blocksparse_vert_stride > 1);
   DISPATCH_BY_KV_CACHE_DTYPE(query.dtype(), kv_cache_dtype,
                              CALL_V2_LAUNCHER_BLOCK_SIZE)
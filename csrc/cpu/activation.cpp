@@ -1,4 +1,5 @@
 #include "cpu_types.hpp"
+#include "thread_subteams.hpp"
 
 namespace {
 template <typename scalar_t, vec_op::FP32Vec8 (*func)(const vec_op::FP32Vec8&),
@@ -10,28 +11,28 @@ void activation_kernel(int num_tokens, int d, scalar_t* __restrict__ input,
 
   TORCH_CHECK(d % VEC_ELEM_NUM == 0);
 
-#pragma omp parallel for
-  for (int i = 0; i < num_tokens; ++i) {
-    for (int j = 0; j < d; j += VEC_ELEM_NUM) {
-      int start = i * d;
-      if constexpr (is_gated) {
-        start *= 2;
-      }
-
-      const scalar_vec_t x(input + start + j);
-      const vec_op::FP32Vec8 f32_x(x);
-      vec_op::FP32Vec8 f32_ans = func(f32_x);
-
-      if constexpr (is_gated) {
-        const scalar_vec_t y(input + start + d + j);
-        const vec_op::FP32Vec8 f32_y(y);
-        f32_ans = f32_y * f32_ans;
-      }
-
-      const scalar_vec_t result(f32_ans);
-      result.save(output + i * d + j);
-    }
-  }
+  cpu_threads::parallel_for(
+      num_tokens, 1, omp_get_max_threads(), false, [&](const int64_t i) {
+        for (int j = 0; j < d; j += VEC_ELEM_NUM) {
+          int start = i * d;
+          if constexpr (is_gated) {
+            start *= 2;
+          }
+
+          const scalar_vec_t x(input + start + j);
+          const vec_op::FP32Vec8 f32_x(x);
+          vec_op::FP32Vec8 f32_ans = func(f32_x);
+
+          if constexpr (is_gated) {
+            const scalar_vec_t y(input + start + d + j);
+            const vec_op::FP32Vec8 f32_y(y);
+            f32_ans = f32_y * f32_ans;
+          }
+
+          const scalar_vec_t result(f32_ans);
+          result.save(output + i * d + j);
+        }
+      });
 }
 
 FORCE_INLINE vec_op::FP32Vec8 silu_act(const vec_op::FP32Vec8& x) {
@@ -90,6 +91,8 @@ void silu_and_mul(torch::Tensor& out, torch::Tensor& input) {
 
   VLLM_DISPATCH_FLOATING_TYPES(input.scalar_type(), "silu_and_mul_impl", [&] {
     CPU_KERNEL_GUARD_IN(silu_and_mul_impl)
+    CPU_KERNEL_GUARD_ANNOTATE(silu_and_mul_impl, num_tokens,
+                              input.nbytes() + out.nbytes())
     activation_kernel<scalar_t, silu_act, true>(
         num_tokens, d, input.data_ptr<scalar_t>(), out.data_ptr<scalar_t>());
     CPU_KERNEL_GUARD_OUT(silu_and_mul_impl)
@@ -104,6 +107,8 @@ void gelu_and_mul(torch::Tensor& out,    // [..., d]
 
   VLLM_DISPATCH_FLOATING_TYPES(input.scalar_type(), "gelu_and_mul_impl", [&] {
     CPU_KERNEL_GUARD_IN(gelu_and_mul_impl)
+    CPU_KERNEL_GUARD_ANNOTATE(gelu_and_mul_impl, num_tokens,
+                              input.nbytes() + out.nbytes())
     activation_kernel<scalar_t, gelu_act, true>(
         num_tokens, d, input.data_ptr<scalar_t>(), out.data_ptr<scalar_t>());
     CPU_KERNEL_GUARD_OUT(gelu_and_mul_impl)
@@ -119,6 +124,8 @@ void gelu_tanh_and_mul(torch::Tensor& out,    // [..., d]
   VLLM_DISPATCH_FLOATING_TYPES(
       input.scalar_type(), "gelu_tanh_and_mul_impl", [&] {
         CPU_KERNEL_GUARD_IN(gelu_tanh_and_mul_impl)
+        CPU_KERNEL_GUARD_ANNOTATE(gelu_tanh_and_mul_impl, num_tokens,
+                                  input.nbytes() + out.nbytes())
         activation_kernel<scalar_t, gelu_tanh_act, true>(
             num_tokens, d, input.data_ptr<scalar_t>(),
             out.data_ptr<scalar_t>());
@@ -132,6 +139,8 @@ void gelu_new(torch::Tensor& out, torch::Tensor& input) {
 
   VLLM_DISPATCH_FLOATING_TYPES(input.scalar_type(), "gelu_new_impl", [&] {
     CPU_KERNEL_GUARD_IN(gelu_new_impl)
+    CPU_KERNEL_GUARD_ANNOTATE(gelu_new_impl, num_tokens,
+                              input.nbytes() + out.nbytes())
     activation_kernel<scalar_t, gelu_new_act, false>(
         num_tokens, d, input.data_ptr<scalar_t>(), out.data_ptr<scalar_t>());
     CPU_KERNEL_GUARD_OUT(gelu_new_impl)
@@ -144,6 +153,8 @@ void gelu_fast(torch::Tensor& out, torch::Tensor& input) {
 
   VLLM_DISPATCH_FLOATING_TYPES(input.scalar_type(), "gelu_fast_impl", [&] {
     CPU_KERNEL_GUARD_IN(gelu_fast_impl)
+    CPU_KERNEL_GUARD_ANNOTATE(gelu_fast_impl, num_tokens,
+                              input.nbytes() + out.nbytes())
     activation_kernel<scalar_t, gelu_fast_act, false>(
         num_tokens, d, input.data_ptr<scalar_t>(), out.data_ptr<scalar_t>());
     CPU_KERNEL_GUARD_OUT(gelu_fast_impl)
@@ -156,6 +167,8 @@ void gelu_quick(torch::Tensor& out, torch::Tensor& input) {
 
   VLLM_DISPATCH_FLOATING_TYPES(input.scalar_type(), "gelu_quick_impl", [&] {
     CPU_KERNEL_GUARD_IN(gelu_quick_impl)
+    CPU_KERNEL_GUARD_ANNOTATE(gelu_quick_impl, num_tokens,
+                              input.nbytes() + out.nbytes())
     activation_kernel<scalar_t, gelu_quick_act, false>(
         num_tokens, d, input.data_ptr<scalar_t>(), out.data_ptr<scalar_t>());
     CPU_KERNEL_GUARD_OUT(gelu_quick_impl)
@@ -1,74 +1,16 @@
+#include "attention_kernels.hpp"
 #include "cpu_types.hpp"
+#include "kernel_tuner.hpp"
+#include "thread_subteams.hpp"
+#include "workspace.hpp"
 
-namespace {
-
-template <typename scalar_t>
-struct KernelVecType {
-  using q_load_vec_type = void;
-  using q_vec_type = void;
-  using k_load_vec_type = void;
-  using k_vec_type = void;
-  using qk_acc_vec_type = void;
-  using v_load_vec_type = void;
-};
-
-template <>
-struct KernelVecType<float> {
-  using q_load_vec_type = vec_op::FP32Vec4;
-  using q_vec_type = vec_op::FP32Vec16;
-  using k_load_vec_type = vec_op::FP32Vec16;
-  using k_vec_type = vec_op::FP32Vec16;
-  using qk_acc_vec_type = vec_op::FP32Vec16;
-  using v_load_vec_type = vec_op::FP32Vec16;
-};
-
-#ifdef __AVX512BF16__
-template <>
-struct KernelVecType<c10::BFloat16> {
-  using q_load_vec_type = vec_op::BF16Vec8;
-  using q_vec_type = vec_op::BF16Vec32;
-  using k_load_vec_type = vec_op::BF16Vec32;
-  using k_vec_type = vec_op::BF16Vec32;
-  using qk_acc_vec_type = vec_op::FP32Vec16;
-  using v_load_vec_type = vec_op::BF16Vec16;
-};
-#else
-template <>
-struct KernelVecType<c10::BFloat16> {
-  using q_load_vec_type = vec_op::BF16Vec8;
-  using q_vec_type = vec_op::FP32Vec16;
-  using k_load_vec_type = vec_op::BF16Vec16;
-  using k_vec_type = vec_op::FP32Vec16;
-  using qk_acc_vec_type = vec_op::FP32Vec16;
-  using v_load_vec_type = vec_op::BF16Vec16;
-};
-#endif
-
-template <typename T>
-FORCE_INLINE std::pair<T, T> reduceSoftmax(T* data, const int size,
-                                           const int capacity) {
-  T max = data[0];
-  for (int i = 1; i < size; ++i) {
-    max = max >= data[i] ? max : data[i];
-  }
-
-  T sum = 0;
-  for (int i = 0; i < size; ++i) {
-    data[i] = std::exp(data[i] - max);
-    sum += data[i];
-  }
-
-  int i = 0;
-  for (; i < size; ++i) {
-    data[i] /= sum;
-  }
+#include <cfloat>
+#include <unordered_map>
+#include <vector>
 
-  for (; i < capacity; ++i) {
-    data[i] = 0;
-  }
+namespace {
 
-  return {max, sum};
-}
+using namespace cpu_attention;
 
 template <typename T>
 FORCE_INLINE std::pair<T, T> reduceSoftmaxAlibi(T* data, const int size,
@@ -121,112 +63,121 @@ FORCE_INLINE void reducePartitonSoftmax(const T* max_data, T* sum_data,
   }
 }
 
-template <typename scalar_t, int HEAD_SIZE, int BLOCK_SIZE, int x>
-struct reduceQKBlockKernel {
-  using q_load_vec_type = typename KernelVecType<scalar_t>::q_load_vec_type;
-  using q_vec_type = typename KernelVecType<scalar_t>::q_vec_type;
-  using k_load_vec_type = typename KernelVecType<scalar_t>::k_load_vec_type;
-  using k_vec_type = typename KernelVecType<scalar_t>::k_vec_type;
-  using qk_acc_vec_type = typename KernelVecType<scalar_t>::qk_acc_vec_type;
-
-  constexpr static int TOKEN_PER_GROUP = k_load_vec_type::get_elem_num() / x;
-  constexpr static int MAX_GROUP_NUM = 16 / TOKEN_PER_GROUP;
-  constexpr static int UNROLL_GROUP_NUM = MAX_GROUP_NUM / 4;
-
-  static_assert(MAX_GROUP_NUM == 8 || MAX_GROUP_NUM == 4);
-  static_assert(k_load_vec_type::get_elem_num() % x == 0);
-  static_assert(q_load_vec_type::get_elem_num() * sizeof(scalar_t) == 16);
-
-  FORCE_INLINE static void call(const scalar_t* __restrict__ q,
-                                const scalar_t* __restrict__ k_block,
-                                float* __restrict__ logits, float scale,
-                                const int token_num) {
-    const int group_num = (token_num + TOKEN_PER_GROUP - 1) / TOKEN_PER_GROUP;
-
-    qk_acc_vec_type group_accums[MAX_GROUP_NUM];
-    if (token_num == BLOCK_SIZE) {
-      for (int q_offset = 0; q_offset < HEAD_SIZE;
-           q_offset += x, k_block += x * BLOCK_SIZE) {
-        q_load_vec_type q_load_group_vec(q + q_offset);
-        q_vec_type q_group_vec(q_load_group_vec);
-
-        vec_op::unroll_loop<int, MAX_GROUP_NUM>(
-            [k_block, &q_group_vec, &group_accums](int token_group_idx) {
-              k_load_vec_type k_load_group_vec(k_block + token_group_idx * x *
-                                                             TOKEN_PER_GROUP);
-              k_vec_type k_group_vec(k_load_group_vec);
-              vec_op::fma(group_accums[token_group_idx], q_group_vec,
-                          k_group_vec);
-              vec_op::prefetch(k_block + x * BLOCK_SIZE +
-                               token_group_idx * x * TOKEN_PER_GROUP);
-            });
-      }
-    } else {
-      for (int q_offset = 0; q_offset < HEAD_SIZE;
-           q_offset += x, k_block += x * BLOCK_SIZE) {
-        q_load_vec_type q_load_group_vec(q + q_offset);
-        q_vec_type q_group_vec(q_load_group_vec);
-        for (int token_group_start = 0; token_group_start < group_num;
-             token_group_start += UNROLL_GROUP_NUM) {
-          vec_op::unroll_loop<int, UNROLL_GROUP_NUM>(
-              [token_group_start, k_block, &q_group_vec,
-               &group_accums](int token_group_idx) {
-                token_group_idx += token_group_start;
-                k_load_vec_type k_load_group_vec(k_block + token_group_idx * x *
-                                                               TOKEN_PER_GROUP);
-                k_vec_type k_group_vec(k_load_group_vec);
-                vec_op::fma(group_accums[token_group_idx], q_group_vec,
-                            k_group_vec);
-                vec_op::prefetch(k_block + x * BLOCK_SIZE +
-                                 token_group_idx * x * TOKEN_PER_GROUP);
-              });
-        }
-      }
+FORCE_INLINE int getWindowStartToken(const int* __restrict__ block_table,
+                                     const int seq_len,
+                                     const int sliding_window,
+                                     const int block_size) {
+  if (sliding_window <= 0 || seq_len <= sliding_window) return 0;
+  const int start_token_idx = seq_len - sliding_window;
+  const int start_block_idx = start_token_idx / block_size;
+  const int last_block_idx = (seq_len - 1) / block_size;
+  for (int block_idx = start_block_idx + 1; block_idx <= last_block_idx;
+       ++block_idx) {
+    if (block_table[block_idx] == block_table[start_block_idx]) {
+      return (start_block_idx + 1) * block_size;
     }
+  }
+  return start_token_idx;
+}
 
-    for (int token_group_idx = 0; token_group_idx < group_num;
-         ++token_group_idx) {
-      vec_op::unroll_loop<int, TOKEN_PER_GROUP>(
-          [&group_accums, logits, scale, token_group_idx](int token_idx) {
-            float dot_v =
-                group_accums[token_group_idx]
-                    .template reduce_sub_sum<qk_acc_vec_type::get_elem_num() /
-                                             TOKEN_PER_GROUP>(token_idx);
-            logits[token_group_idx * TOKEN_PER_GROUP + token_idx] =
-                dot_v * scale;
-          });
+// Local + vertical stride block-sparse pattern of the blocksparse attention
+// backend, in units of sparse blocks of `block_size` tokens. A query attends to
+// the last `local_blocks` sparse blocks up to itself and to every sparse block
+// on the vertical stride of its head. Disabled if vert_stride <= 1.
+struct BlockSparsePattern {
+  int tp_rank;
+  int local_blocks;
+  int vert_stride;
+  int block_size;
+  int head_sliding_step;
+
+  FORCE_INLINE bool enabled() const { return vert_stride > 1; }
+
+  // Offset of the vertical stride of a head. A negative sliding step slides
+  // the stride per KV head instead of per query head.
+  FORCE_INLINE int headOffset(const int head_idx, const int num_heads,
+                              const int kv_head_idx,
+                              const int num_kv_heads) const {
+    if (head_sliding_step >= 0) {
+      return (tp_rank * num_heads + head_idx) * head_sliding_step + 1;
     }
+    return (tp_rank * num_kv_heads + kv_head_idx) * (-head_sliding_step) + 1;
+  }
+
+  // Whether the query at q_token_idx attends to the sparse block holding
+  // k_token_idx.
+  FORCE_INLINE bool keep(const int k_token_idx, const int q_token_idx,
+                         const int head_offset) const {
+    if (!enabled()) return true;
+    const int k_bs_block_idx = k_token_idx / block_size;
+    const int q_bs_block_idx = q_token_idx / block_size;
+    return (k_bs_block_idx + head_offset) % vert_stride == 0 ||
+           k_bs_block_idx > q_bs_block_idx - local_blocks;
   }
 };
 
-template <typename scalar_t, int HEAD_SIZE, int BLOCK_SIZE,
-          int HEAD_PARTITION_SIZE, typename acc_t>
-FORCE_INLINE void reduceValueBlock(const float* prob, const scalar_t* v_block,
-                                   acc_t&& acc) {
-  using v_load_vec_type = typename KernelVecType<scalar_t>::v_load_vec_type;
-  constexpr int ELEM_NUM = v_load_vec_type::get_elem_num();
-  static_assert(BLOCK_SIZE == ELEM_NUM);
-  vec_op::FP32Vec16 prob_vec(prob);
-
-  vec_op::unroll_loop<int, HEAD_PARTITION_SIZE>([&](int head_elem_idx) {
-    v_load_vec_type v_vec(v_block + BLOCK_SIZE * head_elem_idx);
-    vec_op::FP32Vec16 fp32_v_vec(v_vec);
-    acc[head_elem_idx] = acc[head_elem_idx] + prob_vec * fp32_v_vec;
-  });
+BlockSparsePattern makeBlockSparsePattern(
+    const int64_t block_size, const int64_t tp_rank, const int64_t local_blocks,
+    const int64_t vert_stride, const int64_t sparse_block_size,
+    const int64_t head_sliding_step) {
+  if (vert_stride > 1) {
+    TORCH_CHECK(sparse_block_size > 0 && sparse_block_size % block_size == 0,
+                "Blocksparse block size ", sparse_block_size,
+                " must be a multiple of the KV cache block size ", block_size);
+  }
+  return {static_cast<int>(tp_rank), static_cast<int>(local_blocks),
+          static_cast<int>(vert_stride), static_cast<int>(sparse_block_size),
+          static_cast<int>(head_sliding_step)};
+}
+
+// Masks the logits of a KV block skipped by the block-sparse pattern.
+FORCE_INLINE void maskBlockLogits(float* __restrict__ logits,
+                                  const int token_num) {
+  for (int i = 0; i < token_num; ++i) {
+    logits[i] = -FLT_MAX;
+  }
+}
+
+// Bytes of the query, the output and the KV of the context read by a paged
+// attention call, reported to the kernel profiler.
+int64_t pagedAttentionBytes(const torch::Tensor& query,
+                            const torch::Tensor& key_cache,
+                            const torch::Tensor& seq_lens) {
+  const int64_t kv_bytes_per_token = 2 * key_cache.stride(0) /
+                                     key_cache.size(3) *
+                                     key_cache.element_size();
+  return 2 * query.nbytes() +
+         seq_lens.sum().item<int64_t>() * kv_bytes_per_token;
+}
+
+// Tuned configuration of a paged attention call, keyed by the element size,
+// the head layout and the batch and context length buckets.
+cpu_tuner::KernelConfig lookupAttentionConfig(const char* kernel,
+                                              const torch::Tensor& query,
+                                              const int64_t num_kv_heads,
+                                              const int64_t max_seq_len) {
+  return cpu_tuner::lookup(
+      kernel, {query.element_size(), query.size(1), num_kv_heads,
+               query.size(2), cpu_tuner::shape_bucket(query.size(0)),
+               cpu_tuner::shape_bucket(max_seq_len)});
 }
 };  // namespace
 
 // Paged attention v1
 namespace {
-template <typename scalar_t, int HEAD_SIZE, int BLOCK_SIZE>
+// HEAD_SIZE 0 instantiates the generic kernel, which takes the query/key and
+// the value head sizes at runtime (multiples of 8, which may differ). The
+// other instantiations ignore them and keep their head size a constant.
+template <typename scalar_t, int HEAD_SIZE, int BLOCK_SIZE,
+          int HEAD_PARTITION_SIZE>
 struct paged_attention_v1_impl {
   static void call(
-      scalar_t* __restrict__ out,            // [num_seqs, num_heads, head_size]
-      const scalar_t* __restrict__ q,        // [num_seqs, num_heads, head_size]
+      scalar_t* __restrict__ out,  // [num_seqs, num_heads, v_head_size]
+      const scalar_t* __restrict__ q,  // [num_seqs, num_heads, qk_head_size]
       const scalar_t* __restrict__ k_cache,  // [num_blocks, num_kv_heads,
-                                             // head_size/x, block_size, x]
+                                             // qk_head_size/x, block_size, x]
       const scalar_t* __restrict__ v_cache,  // [num_blocks, num_kv_heads,
-                                             // head_size, block_size]
+                                             // v_head_size, block_size]
       const int num_kv_heads, const float scale,
       const int* __restrict__ block_tables,  // [num_seqs,
                                              // max_num_blocks_per_seq]
@@ -234,132 +185,226 @@ struct paged_attention_v1_impl {
       const int max_num_blocks_per_seq,
       const float* __restrict__ alibi_slopes,  // [num_heads]
       const int q_stride, const int kv_block_stride, const int kv_head_stride,
-      const int num_seqs, const int num_heads) {
+      const int v_block_stride, const int v_head_stride, const int num_seqs,
+      const int num_heads, const int sliding_window,
+      const BlockSparsePattern sparse, const int thread_num,
+      const int runtime_qk_head_size, const int runtime_v_head_size) {
     constexpr int x = 16 / sizeof(scalar_t);
+    const int qk_head_size = HEAD_SIZE > 0 ? HEAD_SIZE : runtime_qk_head_size;
+    const int v_head_size = HEAD_SIZE > 0 ? HEAD_SIZE : runtime_v_head_size;
     const int num_queries_per_kv = num_heads / num_kv_heads;
+    const int prefetch_distance = cpu_tuner::prefetch_distance();
 
-    static_assert(BLOCK_SIZE == 16);
+    int* window_start_tokens = cpu_memory::thread_buffer<int>(
+        cpu_memory::Buffer::SEQ_METADATA, num_seqs);
+    for (int seq_idx = 0; seq_idx < num_seqs; ++seq_idx) {
+      window_start_tokens[seq_idx] =
+          sliding_window > 0
+              ? getWindowStartToken(
+                    block_tables + max_num_blocks_per_seq * seq_idx,
+                    seq_lens[seq_idx], sliding_window, BLOCK_SIZE)
+              : 0;
+    }
 
     int max_seq_len = max_num_blocks_per_seq * BLOCK_SIZE;
     int max_seq_len_padded = (max_seq_len + 15) & 0xFFFFFFF0;
     TORCH_CHECK((max_seq_len_padded * sizeof(float)) % 64 == 0);
 
-    const int parallel_work_item_num = omp_get_max_threads();
 
-    size_t logits_bytes =
-        parallel_work_item_num * max_seq_len_padded * sizeof(float);
-    float* logits = (float*)std::aligned_alloc(
-        64, logits_bytes);  // Cacheline alignment for each context token.
-                            // [parallel_work_item_num, max_seq_len_padded]
-
-#pragma omp parallel for collapse(2) schedule(dynamic, 1)
-    for (int seq_idx = 0; seq_idx < num_seqs; ++seq_idx) {
-      for (int head_idx = 0; head_idx < num_heads; ++head_idx) {
-        int seq_len = seq_lens[seq_idx];
-        const int* seq_block_table =
-            block_tables + max_num_blocks_per_seq * seq_idx;
-        const int block_num = (seq_len + BLOCK_SIZE - 1) / BLOCK_SIZE;
-        const int64_t kv_head_idx = head_idx / num_queries_per_kv;
-        const scalar_t* __restrict__ q_vec_ptr =
-            q + seq_idx * q_stride + head_idx * HEAD_SIZE;
-        const int last_block_token_num = seq_len - (block_num - 1) * BLOCK_SIZE;
-        float* __restrict__ thread_block_logits =
-            logits + omp_get_thread_num() * max_seq_len_padded;
+    // The heads of a sequence share its queue and, with GQA, their KV
+    // blocks in the cache of one thread subteam.
+    cpu_threads::parallel_for(
+        static_cast<int64_t>(num_seqs) * num_heads, num_heads, thread_num,
+        true, [&](const int64_t item) {
+          const int seq_idx = item / num_heads;
+          const int head_idx = item % num_heads;
+          int seq_len = seq_lens[seq_idx];
+          const int* seq_block_table =
+              block_tables + max_num_blocks_per_seq * seq_idx;
+          const int block_num = (seq_len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+          // Blocks before the sliding window are skipped, the tokens before
+          // the window in its first block are masked.
+          const int window_start_token_idx = window_start_tokens[seq_idx];
+          const int start_block_idx = window_start_token_idx / BLOCK_SIZE;
+          const int window_offset =
+              window_start_token_idx - start_block_idx * BLOCK_SIZE;
+          const int token_num = seq_len - window_start_token_idx;
+          const int64_t kv_head_idx = head_idx / num_queries_per_kv;
+          const scalar_t* __restrict__ q_vec_ptr =
+              q + seq_idx * q_stride + head_idx * qk_head_size;
+          const int last_block_token_num =
+              seq_len - (block_num - 1) * BLOCK_SIZE;
+          const int sparse_head_offset =
+              sparse.headOffset(head_idx, num_heads, kv_head_idx, num_kv_heads);
+          // Logits are stored from the first block of the window on, cache
+          // line aligned for each context token.
+          float* __restrict__ thread_block_logits =
+              cpu_memory::thread_buffer<float>(cpu_memory::Buffer::SCRATCH,
+                                               max_seq_len_padded);
 
-        // Compute logits
-        for (int block_idx = 0; block_idx < block_num; ++block_idx) {
-          const int64_t physical_block_idx = seq_block_table[block_idx];
-          const scalar_t* __restrict__ k_block_cache_ptr =
-              k_cache + physical_block_idx * kv_block_stride +
-              kv_head_idx * kv_head_stride;
-          float* __restrict__ head_block_logits =
-              thread_block_logits + block_idx * BLOCK_SIZE;
+          // Compute logits
+          for (int block_idx = start_block_idx; block_idx < block_num;
+               ++block_idx) {
+            if (sparse.keep((block_idx + prefetch_distance) * BLOCK_SIZE,
+                            seq_len - 1, sparse_head_offset)) {
+              prefetchKVBlock(k_cache + kv_head_idx * kv_head_stride,
+                              seq_block_table, kv_block_stride, block_idx,
+                              block_num, prefetch_distance,
+                              qk_head_size * BLOCK_SIZE);
+            }
+            const int64_t physical_block_idx = seq_block_table[block_idx];
+            const scalar_t* __restrict__ k_block_cache_ptr =
+                k_cache + physical_block_idx * kv_block_stride +
+                kv_head_idx * kv_head_stride;
+            float* __restrict__ head_block_logits =
+                thread_block_logits +
+                (block_idx - start_block_idx) * BLOCK_SIZE;
+            const int block_token_num =
+                block_idx == block_num - 1 ? last_block_token_num : BLOCK_SIZE;
+
+            // Blocks skipped by the block-sparse pattern are never loaded.
+            if (!sparse.keep(block_idx * BLOCK_SIZE, seq_len - 1,
+                             sparse_head_offset)) {
+              maskBlockLogits(head_block_logits, block_token_num);
+              continue;
+            }
 
-          reduceQKBlockKernel<scalar_t, HEAD_SIZE, BLOCK_SIZE, x>::call(
-              q_vec_ptr, k_block_cache_ptr, head_block_logits, scale,
-              block_idx == block_num - 1 ? last_block_token_num : BLOCK_SIZE);
-        }
+            reduceQKBlockKernel<scalar_t, HEAD_SIZE, BLOCK_SIZE, x>::call(
+                q_vec_ptr, k_block_cache_ptr, head_block_logits, scale,
+                block_token_num, qk_head_size);
+          }
 
-        // Compute softmax
-        if (alibi_slopes) {
-          reduceSoftmaxAlibi(thread_block_logits, seq_len,
-                             block_num * BLOCK_SIZE, alibi_slopes[head_idx], 0,
-                             seq_len);
-        } else {
-          reduceSoftmax(thread_block_logits, seq_len, block_num * BLOCK_SIZE);
-        }
+          // Compute softmax
+          float* __restrict__ window_logits =
+              thread_block_logits + window_offset;
+          const int window_capacity =
+              (block_num - start_block_idx) * BLOCK_SIZE - window_offset;
+          if (alibi_slopes) {
+            reduceSoftmaxAlibi(window_logits, token_num, window_capacity,
+                               alibi_slopes[head_idx], window_start_token_idx,
+                               seq_len);
+          } else {
+            reduceSoftmax(window_logits, token_num, window_capacity);
+          }
+          for (int i = 0; i < window_offset; ++i) {
+            thread_block_logits[i] = 0;
+          }
 
-        // Compute value
-        constexpr int head_elem_num_per_partition = 16;
-        constexpr int head_partition_num =
-            HEAD_SIZE / head_elem_num_per_partition;
-        for (int head_part_idx = 0; head_part_idx < head_partition_num;
-             ++head_part_idx) {
-          vec_op::FP32Vec16 accums[head_elem_num_per_partition];
-          scalar_t* __restrict__ out_ptr =
-              out + seq_idx * num_heads * HEAD_SIZE + head_idx * HEAD_SIZE +
-              head_part_idx * head_elem_num_per_partition;
-          for (int block_idx = 0; block_idx < block_num; ++block_idx) {
-            const int64_t physical_block_idx = seq_block_table[block_idx];
-            const float* __restrict__ prob_vec_ptr =
-                thread_block_logits + block_idx * BLOCK_SIZE;
-            const scalar_t* __restrict__ v_block_cache_ptr =
-                v_cache + physical_block_idx * kv_block_stride +
-                kv_head_idx * kv_head_stride +
+          // Compute value
+          constexpr int head_elem_num_per_partition = HEAD_PARTITION_SIZE;
+          const int head_partition_num =
+              v_head_size / head_elem_num_per_partition;
+          for (int head_part_idx = 0; head_part_idx < head_partition_num;
+               ++head_part_idx) {
+            vec_op::FP32Vec16 accums[head_elem_num_per_partition];
+            scalar_t* __restrict__ out_ptr =
+                out + seq_idx * num_heads * v_head_size +
+                head_idx * v_head_size +
+                head_part_idx * head_elem_num_per_partition;
+            const scalar_t* __restrict__ v_head_cache_ptr =
+                v_cache + kv_head_idx * v_head_stride +
                 BLOCK_SIZE * head_part_idx * head_elem_num_per_partition;
-            reduceValueBlock<scalar_t, HEAD_SIZE, BLOCK_SIZE,
-                             head_elem_num_per_partition>(
-                prob_vec_ptr, v_block_cache_ptr, accums);
-
-            if (block_idx != block_num - 1) {
-              const int64_t next_physical_block_idx =
-                  seq_block_table[block_idx + 1];
-              const scalar_t* __restrict__ next_v_block_cache_ptr =
-                  v_cache + next_physical_block_idx * kv_block_stride +
-                  kv_head_idx * kv_head_stride +
-                  BLOCK_SIZE * head_part_idx * head_elem_num_per_partition;
-              vec_op::unroll_loop<int, head_elem_num_per_partition>(
-                  [&](int head_elem_idx) {
-                    if (head_elem_idx % 2 == 0) {
-                      vec_op::prefetch(next_v_block_cache_ptr +
-                                       BLOCK_SIZE * head_elem_idx);
-                    }
-                  });
+            for (int block_idx = start_block_idx; block_idx < block_num;
+                 ++block_idx) {
+              if (sparse.keep((block_idx + prefetch_distance) * BLOCK_SIZE,
+                              seq_len - 1, sparse_head_offset)) {
+                prefetchKVBlock(v_head_cache_ptr, seq_block_table,
+                                v_block_stride, block_idx, block_num,
+                                prefetch_distance,
+                                BLOCK_SIZE * head_elem_num_per_partition);
+              }
+              if (!sparse.keep(block_idx * BLOCK_SIZE, seq_len - 1,
+                               sparse_head_offset)) {
+                continue;
+              }
+              const int64_t physical_block_idx = seq_block_table[block_idx];
+              const float* __restrict__ prob_vec_ptr =
+                  thread_block_logits +
+                  (block_idx - start_block_idx) * BLOCK_SIZE;
+              const scalar_t* __restrict__ v_block_cache_ptr =
+                  v_head_cache_ptr + physical_block_idx * v_block_stride;
+              reduceValueBlock<scalar_t, HEAD_SIZE, BLOCK_SIZE,
+                               head_elem_num_per_partition>(
+                  prob_vec_ptr, v_block_cache_ptr, accums);
             }
-          }
 
-          vec_op::unroll_loop<int, head_elem_num_per_partition>(
-              [&](int head_elem_idx) {
-                float value = accums[head_elem_idx].reduce_sum();
-                vec_op::storeFP32(value, out_ptr + head_elem_idx);
-              });
-        }
-      }
-    }
-    std::free(logits);
+            vec_op::unroll_loop<int, head_elem_num_per_partition>(
+                [&](int head_elem_idx) {
+                  float value = accums[head_elem_idx].reduce_sum();
+                  vec_op::storeFP32(value, out_ptr + head_elem_idx);
+                });
+          }
+        });
   }
 };
 
-#define LAUNCH_V1_ATTENTION_KERNEL(T, HEAD_SIZE, BLOCK_SIZE)                   \
-  paged_attention_v1_impl<T, HEAD_SIZE, BLOCK_SIZE>::call(                     \
-      out_ptr, query_ptr, key_cache_ptr, value_cache_ptr, num_kv_heads, scale, \
-      block_tables_ptr, seq_lens_ptr, max_num_blocks_per_seq,                  \
-      alibi_slopes_ptr, q_stride, kv_block_stride, kv_head_stride, num_seqs,   \
-      num_heads);
+#define LAUNCH_V1_ATTENTION_IMPL(T, HEAD_SIZE, BLOCK_SIZE, HEAD_PART_SIZE) \
+  paged_attention_v1_impl<T, HEAD_SIZE, BLOCK_SIZE, HEAD_PART_SIZE>::call(  \
+      out_ptr, query_ptr, key_cache_ptr, value_cache_ptr, num_kv_heads,     \
+      scale, block_tables_ptr, seq_lens_ptr, max_num_blocks_per_seq,        \
+      alibi_slopes_ptr, q_stride, kv_block_stride, kv_head_stride,          \
+      v_block_stride, v_head_stride, num_seqs, num_heads, sliding_window,   \
+      sparse, config.threads(), head_size, v_head_size);
+
+#define LAUNCH_V1_ATTENTION_KERNEL(T, HEAD_SIZE, BLOCK_SIZE)  \
+  if (config.head_unroll == 8) {                              \
+    LAUNCH_V1_ATTENTION_IMPL(T, HEAD_SIZE, BLOCK_SIZE, 8)     \
+  } else {                                                    \
+    LAUNCH_V1_ATTENTION_IMPL(T, HEAD_SIZE, BLOCK_SIZE, 16)    \
+  }
+
+// The generic kernel reduces value heads which are not a multiple of 16
+// elements 8 head elements at a time.
+#define LAUNCH_V1_GENERIC_ATTENTION_KERNEL(T, BLOCK_SIZE)       \
+  if (config.head_unroll == 8 || v_head_size % 16 != 0) {       \
+    LAUNCH_V1_ATTENTION_IMPL(T, 0, BLOCK_SIZE, 8)               \
+  } else {                                                      \
+    LAUNCH_V1_ATTENTION_IMPL(T, 0, BLOCK_SIZE, 16)              \
+  }
+
+// Head sizes with templated kernels, the others are computed by the generic
+// kernel.
+bool isTemplatedHeadSize(const int head_size) {
+  switch (head_size) {
+    case 64:
+    case 80:
+    case 96:
+    case 112:
+    case 128:
+    case 192:
+    case 256:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void checkGenericHeadSizes(const int qk_head_size, const int v_head_size) {
+  TORCH_CHECK(qk_head_size > 0 && qk_head_size % 8 == 0,
+              "Unsupported head size: ", qk_head_size,
+              ", must be a multiple of 8");
+  TORCH_CHECK(v_head_size > 0 && v_head_size % 8 == 0,
+              "Unsupported value head size: ", v_head_size,
+              ", must be a multiple of 8");
+}
 
 template <typename T, int BLOCK_SIZE>
 void paged_attention_v1_impl_launcher(
     torch::Tensor& out, torch::Tensor& query, torch::Tensor& key_cache,
     torch::Tensor& value_cache, int num_kv_heads, float scale,
     torch::Tensor& block_tables, torch::Tensor& seq_lens, int max_seq_len,
-    const c10::optional<torch::Tensor>& alibi_slopes) {
+    const c10::optional<torch::Tensor>& alibi_slopes, int sliding_window,
+    const BlockSparsePattern& sparse) {
   int num_seqs = query.size(0);
   int num_heads = query.size(1);
   int head_size = query.size(2);
+  int v_head_size = value_cache.size(2);
   int max_num_blocks_per_seq = block_tables.size(1);
   int q_stride = query.stride(0);
   int kv_block_stride = key_cache.stride(0);
   int kv_head_stride = key_cache.stride(1);
+  int v_block_stride = value_cache.stride(0);
+  int v_head_stride = value_cache.stride(1);
 
   // NOTE: alibi_slopes is optional.
   const float* alibi_slopes_ptr =
@@ -374,6 +419,16 @@ void paged_attention_v1_impl_launcher(
   int* block_tables_ptr = block_tables.data_ptr<int>();
   int* seq_lens_ptr = seq_lens.data_ptr<int>();
 
+  const cpu_tuner::KernelConfig config = lookupAttentionConfig(
+      "paged_attention_v1", query, num_kv_heads, max_seq_len);
+  config.applySchedule(cpu_tuner::Schedule::DYNAMIC);
+
+  if (head_size != v_head_size || !isTemplatedHeadSize(head_size)) {
+    checkGenericHeadSizes(head_size, v_head_size);
+    LAUNCH_V1_GENERIC_ATTENTION_KERNEL(T, BLOCK_SIZE);
+    return;
+  }
+
   switch (head_size) {
     case 64:
       LAUNCH_V1_ATTENTION_KERNEL(T, 64, BLOCK_SIZE);
@@ -405,17 +460,10 @@ void paged_attention_v1_impl_launcher(
 #define CALL_V1_KERNEL_LAUNCHER(T, BLOCK_SIZE)                               \
   paged_attention_v1_impl_launcher<T, BLOCK_SIZE>(                           \
       out, query, key_cache, value_cache, num_kv_heads, scale, block_tables, \
-      seq_lens, max_seq_len, alibi_slopes);
-
-#define CALL_V1_KERNEL_LAUNCHER_BLOCK_SIZE(T)                     \
-  switch (block_size) {                                           \
-    case 16:                                                      \
-      CALL_V1_KERNEL_LAUNCHER(T, 16);                             \
-      break;                                                      \
-    default:                                                      \
-      TORCH_CHECK(false, "Unsupported block size: ", block_size); \
-      break;                                                      \
-  }
+      seq_lens, max_seq_len, alibi_slopes, sliding_window, sparse);
+
+#define CALL_V1_KERNEL_LAUNCHER_BLOCK_SIZE(T) \
+  CALL_KERNEL_LAUNCHER_BLOCK_SIZE(CALL_V1_KERNEL_LAUNCHER, T)
 }  // namespace
 
 void paged_attention_v1(
@@ -426,13 +474,18 @@ void paged_attention_v1(
     const std::string& kv_cache_dtype, double k_scale, double v_scale,
     const int64_t tp_rank, const int64_t blocksparse_local_blocks,
     const int64_t blocksparse_vert_stride, const int64_t blocksparse_block_size,
-    const int64_t blocksparse_head_sliding_step) {
+    const int64_t blocksparse_head_sliding_step, const int64_t sliding_window) {
   TORCH_CHECK(k_scale == 1.0f && v_scale == 1.0f);
-  TORCH_CHECK(blocksparse_vert_stride <= 1,
-              "CPU backend does not support blocksparse attention yet.");
+  const BlockSparsePattern sparse = makeBlockSparsePattern(
+      block_size, tp_rank, blocksparse_local_blocks, blocksparse_vert_stride,
+      blocksparse_block_size, blocksparse_head_sliding_step);
   VLLM_DISPATCH_FLOATING_TYPES(query.scalar_type(), "paged_attention_v1_impl",
                                [&] {
                                  CPU_KERNEL_GUARD_IN(paged_attention_v1_impl)
+                                 CPU_KERNEL_GUARD_ANNOTATE(
+                                     paged_attention_v1_impl, query.size(0),
+                                     pagedAttentionBytes(query, key_cache,
+                                                         seq_lens))
                                  CALL_V1_KERNEL_LAUNCHER_BLOCK_SIZE(scalar_t);
                                  CPU_KERNEL_GUARD_OUT(paged_attention_v1_impl)
                                });
@@ -440,7 +493,22 @@ void paged_attention_v1(
 
 // Paged attention v2
 namespace {
-template <typename scalar_t, int HEAD_SIZE, int BLOCK_SIZE, int PARTITION_SIZE>
+// The partition size follows from the partitions allocated by the caller: the
+// longest context is split into max_num_partitions partitions of equal size,
+// rounded up to whole blocks and to whole cache lines of logits (16 tokens,
+// for blocks of 8). vllm/worker/cpu_tuner.py tunes the number of partitions
+// through the partition size it allocates the buffers for.
+int getPartitionSize(const int max_seq_len, const int max_num_partitions,
+                     const int block_size) {
+  const int granule = std::max(block_size, 16);
+  const int partition_size =
+      std::max((max_seq_len + max_num_partitions - 1) / max_num_partitions,
+               granule);
+  return (partition_size + granule - 1) / granule * granule;
+}
+
+template <typename scalar_t, int HEAD_SIZE, int BLOCK_SIZE,
+          int HEAD_PARTITION_SIZE>
 struct paged_attention_v2_impl {
   static void call(
       scalar_t* __restrict__ out,            // [num_seqs, num_heads, head_size]
@@ -462,64 +530,117 @@ struct paged_attention_v2_impl {
       const int max_num_blocks_per_seq,
       const float* __restrict__ alibi_slopes,  // [num_heads]
       const int q_stride, const int kv_block_stride, const int kv_head_stride,
-      const int num_seqs, const int num_heads, const int max_num_partitions) {
+      const int num_seqs, const int num_heads, const int max_num_partitions,
+      const int partition_size, const int sliding_window,
+      const BlockSparsePattern sparse, const int thread_num) {
     constexpr int x = 16 / sizeof(scalar_t);
     const int num_queries_per_kv = num_heads / num_kv_heads;
+    const int prefetch_distance = cpu_tuner::prefetch_distance();
 
-    static_assert(BLOCK_SIZE == 16);
-    static_assert(PARTITION_SIZE * sizeof(float) % 64 == 0);
-    static_assert(PARTITION_SIZE % BLOCK_SIZE == 0);
+    TORCH_CHECK(partition_size * sizeof(float) % 64 == 0 &&
+                partition_size % BLOCK_SIZE == 0);
+
+    int* window_start_tokens = cpu_memory::thread_buffer<int>(
+        cpu_memory::Buffer::SEQ_METADATA, num_seqs);
+    for (int seq_idx = 0; seq_idx < num_seqs; ++seq_idx) {
+      window_start_tokens[seq_idx] =
+          sliding_window > 0
+              ? getWindowStartToken(
+                    block_tables + max_num_blocks_per_seq * seq_idx,
+                    seq_lens[seq_idx], sliding_window, BLOCK_SIZE)
+              : 0;
+    }
 
-#pragma omp parallel for collapse(3) schedule(static, 1)
+    cpu_profiler::RegionTimer partition_timer(thread_num);
+#pragma omp parallel for collapse(3) schedule(runtime) num_threads(thread_num)
     for (int seq_idx = 0; seq_idx < num_seqs; ++seq_idx) {
       for (int partition_idx = 0; partition_idx < max_num_partitions;
            ++partition_idx) {
         for (int head_idx = 0; head_idx < num_heads; ++head_idx) {
+          const cpu_profiler::FinishScope finish(partition_timer);
           const int seq_len = seq_lens[seq_idx];
-          const int start_token_idx = partition_idx * PARTITION_SIZE;
+          const int start_token_idx = partition_idx * partition_size;
+          const int window_start_token_idx = window_start_tokens[seq_idx];
+          const int first_partition_idx =
+              window_start_token_idx / partition_size;
 
-          if (start_token_idx >= seq_len) continue;
+          if (start_token_idx >= seq_len ||
+              partition_idx < first_partition_idx)
+            continue;
 
           const int partition_num =
-              (seq_len + PARTITION_SIZE - 1) / PARTITION_SIZE;
-          const bool no_reduce = (partition_num == 1);
-          const int token_num =
-              (std::min(seq_len, start_token_idx + PARTITION_SIZE) -
-               start_token_idx);
-          const int block_num = (token_num + BLOCK_SIZE - 1) / BLOCK_SIZE;
+              (seq_len + partition_size - 1) / partition_size;
+          const bool no_reduce = (partition_num - first_partition_idx == 1);
+          const int end_token_idx =
+              std::min(seq_len, start_token_idx + partition_size);
+          // Blocks before the sliding window are skipped, the tokens before
+          // the window in its first block are masked.
+          const int window_offset =
+              std::max(window_start_token_idx - start_token_idx, 0);
+          const int start_block_idx = window_offset / BLOCK_SIZE;
+          const int token_num = end_token_idx - start_token_idx - window_offset;
+          const int block_num =
+              (end_token_idx - start_token_idx + BLOCK_SIZE - 1) / BLOCK_SIZE;
           const int last_block_token_num =
-              token_num - (block_num - 1) * BLOCK_SIZE;
+              end_token_idx - start_token_idx - (block_num - 1) * BLOCK_SIZE;
           const int* seq_block_table = block_tables +
                                        max_num_blocks_per_seq * seq_idx +
                                        start_token_idx / BLOCK_SIZE;
           const int64_t kv_head_idx = head_idx / num_queries_per_kv;
           const scalar_t* __restrict__ q_vec_ptr =
               q + seq_idx * q_stride + head_idx * HEAD_SIZE;
+          const int sparse_head_offset = sparse.headOffset(
+              head_idx, num_heads, kv_head_idx, num_kv_heads);
 
-          float logits[PARTITION_SIZE] __attribute__((aligned(64))) = {0};
+          float* __restrict__ logits = cpu_memory::thread_buffer<float>(
+              cpu_memory::Buffer::SCRATCH, partition_size);
+          std::fill(logits, logits + partition_size, 0.0f);
 
           // Compute logits
-          for (int block_idx = 0; block_idx < block_num; ++block_idx) {
+          for (int block_idx = start_block_idx; block_idx < block_num;
+               ++block_idx) {
+            if (sparse.keep(start_token_idx +
+                                (block_idx + prefetch_distance) * BLOCK_SIZE,
+                            seq_len - 1, sparse_head_offset)) {
+              prefetchKVBlock(k_cache + kv_head_idx * kv_head_stride,
+                              seq_block_table, kv_block_stride, block_idx,
+                              block_num, prefetch_distance,
+                              HEAD_SIZE * BLOCK_SIZE);
+            }
             const int64_t physical_block_idx = seq_block_table[block_idx];
             const scalar_t* __restrict__ k_block_cache_ptr =
                 k_cache + physical_block_idx * kv_block_stride +
                 kv_head_idx * kv_head_stride;
             float* __restrict__ head_block_logits =
                 logits + block_idx * BLOCK_SIZE;
+            const int block_token_num =
+                block_idx == block_num - 1 ? last_block_token_num : BLOCK_SIZE;
+
+            // Blocks skipped by the block-sparse pattern are never loaded.
+            if (!sparse.keep(start_token_idx + block_idx * BLOCK_SIZE,
+                             seq_len - 1, sparse_head_offset)) {
+              maskBlockLogits(head_block_logits, block_token_num);
+              continue;
+            }
 
             reduceQKBlockKernel<scalar_t, HEAD_SIZE, BLOCK_SIZE, x>::call(
                 q_vec_ptr, k_block_cache_ptr, head_block_logits, scale,
-                block_idx == block_num - 1 ? last_block_token_num : BLOCK_SIZE);
+                block_token_num);
           }
 
           std::pair<float, float> max_and_sum;
           if (alibi_slopes) {
             max_and_sum = reduceSoftmaxAlibi(
-                logits, token_num, block_num * BLOCK_SIZE,
-                alibi_slopes[head_idx], start_token_idx, seq_len);
+                logits + window_offset, token_num,
+                block_num * BLOCK_SIZE - window_offset,
+                alibi_slopes[head_idx], start_token_idx + window_offset,
+                seq_len);
           } else {
-            max_and_sum =
-                reduceSoftmax(logits, token_num, block_num * BLOCK_SIZE);
+            max_and_sum = reduceSoftmax(logits + window_offset, token_num,
+                                        block_num * BLOCK_SIZE - window_offset);
+          }
+          for (int i = start_block_idx * BLOCK_SIZE; i < window_offset; ++i) {
+            logits[i] = 0;
           }
 
           auto&& [max_logit, exp_sum] = max_and_sum;
@@ -540,7 +661,7 @@ struct paged_attention_v2_impl {
           }
 
           // Compute value
-          constexpr int head_elem_num_per_partition = 16;
+          constexpr int head_elem_num_per_partition = HEAD_PARTITION_SIZE;
           constexpr int head_partition_num =
               HEAD_SIZE / head_elem_num_per_partition;
           for (int head_part_idx = 0; head_part_idx < head_partition_num;
@@ -548,33 +669,31 @@ struct paged_attention_v2_impl {
             vec_op::FP32Vec16 accums[head_elem_num_per_partition];
             scalar_t* __restrict__ out_ptr =
                 output_buffer + head_part_idx * head_elem_num_per_partition;
-            for (int block_idx = 0; block_idx < block_num; ++block_idx) {
+            const scalar_t* __restrict__ v_head_cache_ptr =
+                v_cache + kv_head_idx * kv_head_stride +
+                BLOCK_SIZE * head_part_idx * head_elem_num_per_partition;
+            for (int block_idx = start_block_idx; block_idx < block_num;
+                 ++block_idx) {
+              if (sparse.keep(start_token_idx +
+                                  (block_idx + prefetch_distance) * BLOCK_SIZE,
+                              seq_len - 1, sparse_head_offset)) {
+                prefetchKVBlock(v_head_cache_ptr, seq_block_table,
+                                kv_block_stride, block_idx, block_num,
+                                prefetch_distance,
+                                BLOCK_SIZE * head_elem_num_per_partition);
+              }
+              if (!sparse.keep(start_token_idx + block_idx * BLOCK_SIZE,
+                               seq_len - 1, sparse_head_offset)) {
+                continue;
+              }
               const int64_t physical_block_idx = seq_block_table[block_idx];
               const float* __restrict__ prob_vec_ptr =
                   logits + block_idx * BLOCK_SIZE;
               const scalar_t* __restrict__ v_block_cache_ptr =
-                  v_cache + physical_block_idx * kv_block_stride +
-                  kv_head_idx * kv_head_stride +
-                  BLOCK_SIZE * head_part_idx * head_elem_num_per_partition;
+                  v_head_cache_ptr + physical_block_idx * kv_block_stride;
               reduceValueBlock<scalar_t, HEAD_SIZE, BLOCK_SIZE,
                                head_elem_num_per_partition>(
                   prob_vec_ptr, v_block_cache_ptr, accums);
-
-              if (block_idx != block_num - 1) {
-                const int64_t next_physical_block_idx =
-                    seq_block_table[block_idx + 1];
-                const scalar_t* __restrict__ next_v_block_cache_ptr =
-                    v_cache + next_physical_block_idx * kv_block_stride +
-                    kv_head_idx * kv_head_stride +
-                    BLOCK_SIZE * head_part_idx * head_elem_num_per_partition;
-                vec_op::unroll_loop<int, head_elem_num_per_partition>(
-                    [&](int head_elem_idx) {
-                      if (head_elem_idx % 2 == 0) {
-                        vec_op::prefetch(next_v_block_cache_ptr +
-                                         BLOCK_SIZE * head_elem_idx);
-                      }
-                    });
-              }
             }
 
             vec_op::unroll_loop<int, head_elem_num_per_partition>(
@@ -588,42 +707,50 @@ struct paged_attention_v2_impl {
     }
 
     // Rescale partition softmax and store the factors to exp_sums
-#pragma omp parallel for collapse(2) schedule(static, 1)
+    cpu_profiler::RegionTimer softmax_timer(thread_num);
+#pragma omp parallel for collapse(2) schedule(static, 1) num_threads(thread_num)
     for (int seq_idx = 0; seq_idx < num_seqs; ++seq_idx) {
       for (int head_idx = 0; head_idx < num_heads; ++head_idx) {
+        const cpu_profiler::FinishScope finish(softmax_timer);
         const int seq_len = seq_lens[seq_idx];
+        const int first_partition_idx =
+            window_start_tokens[seq_idx] / partition_size;
         const int partition_num =
-            (seq_len + PARTITION_SIZE - 1) / PARTITION_SIZE;
+            (seq_len + partition_size - 1) / partition_size;
 
-        if (partition_num == 1) continue;
+        if (partition_num - first_partition_idx == 1) continue;
 
         reducePartitonSoftmax(
             max_logits + seq_idx * num_heads * max_num_partitions +
-                head_idx * max_num_partitions,
+                head_idx * max_num_partitions + first_partition_idx,
             exp_sums + seq_idx * num_heads * max_num_partitions +
-                head_idx * max_num_partitions,
-            partition_num);
+                head_idx * max_num_partitions + first_partition_idx,
+            partition_num - first_partition_idx);
       }
     }
 
     // Reduce values
     using v_load_vec_type = typename KernelVecType<scalar_t>::v_load_vec_type;
-    static_assert(v_load_vec_type::get_elem_num() == BLOCK_SIZE);
     constexpr int head_elem_num_per_group =
         16;  // Note: didn't align with the cacheline size, due to some
              // HEAD_SIZE didn't align with 64 bytes
+    static_assert(v_load_vec_type::get_elem_num() == head_elem_num_per_group);
     static_assert(HEAD_SIZE % head_elem_num_per_group == 0);
     constexpr int head_group_num = HEAD_SIZE / head_elem_num_per_group;
     const float* __restrict__ rescale_factors = exp_sums;
-#pragma omp parallel for collapse(3) schedule(static, 1)
+    cpu_profiler::RegionTimer reduce_timer(thread_num);
+#pragma omp parallel for collapse(3) schedule(static, 1) num_threads(thread_num)
     for (int seq_idx = 0; seq_idx < num_seqs; ++seq_idx) {
       for (int head_idx = 0; head_idx < num_heads; ++head_idx) {
         for (int group_idx = 0; group_idx < head_group_num; ++group_idx) {
+          const cpu_profiler::FinishScope finish(reduce_timer);
           const int seq_len = seq_lens[seq_idx];
+          const int first_partition_idx =
+              window_start_tokens[seq_idx] / partition_size;
           const int partition_num =
-              (seq_len + PARTITION_SIZE - 1) / PARTITION_SIZE;
+              (seq_len + partition_size - 1) / partition_size;
 
-          if (partition_num == 1) continue;
+          if (partition_num - first_partition_idx == 1) continue;
 
           const float* __restrict__ seq_head_rescale_factors =
               rescale_factors + seq_idx * num_heads * max_num_partitions +
@@ -637,7 +764,7 @@ struct paged_attention_v2_impl {
               group_idx * head_elem_num_per_group;
 
           vec_op::FP32Vec16 acc;
-          for (int i = 0; i < partition_num; ++i) {
+          for (int i = first_partition_idx; i < partition_num; ++i) {
             vec_op::FP32Vec16 rescale_factor(seq_head_rescale_factors[i]);
             v_load_vec_type value(seq_head_tmp_out + i * HEAD_SIZE);
             vec_op::FP32Vec16 fp32_value(value);
@@ -651,21 +778,40 @@ struct paged_attention_v2_impl {
   }
 };
 
-#define LAUNCH_V2_ATTENTION_KERNEL(T, HEAD_SIZE, BLOCK_SIZE)                 \
-  paged_attention_v2_impl<T, HEAD_SIZE, BLOCK_SIZE, PARTITION_SIZE>::call(   \
-      out_ptr, exp_sums_ptr, max_logits_ptr, tmp_out_ptr, query_ptr,         \
-      key_cache_ptr, value_cache_ptr, num_kv_heads, scale, block_tables_ptr, \
-      seq_lens_ptr, max_num_blocks_per_seq, alibi_slopes_ptr, q_stride,      \
-      kv_block_stride, kv_head_stride, num_seqs, num_heads,                  \
-      max_num_partitions);
+#define LAUNCH_V2_ATTENTION_IMPL(T, HEAD_SIZE, BLOCK_SIZE, HEAD_PART_SIZE) \
+  paged_attention_v2_impl<T, HEAD_SIZE, BLOCK_SIZE, HEAD_PART_SIZE>::call(  \
+      out_ptr, exp_sums_ptr, max_logits_ptr, tmp_out_ptr, query_ptr,        \
+      key_cache_ptr, value_cache_ptr, num_kv_heads, scale,                  \
+      block_tables_ptr, seq_lens_ptr, max_num_blocks_per_seq,               \
+      alibi_slopes_ptr, q_stride, kv_block_stride, kv_head_stride,          \
+      num_seqs, num_heads, max_num_partitions, partition_size,              \
+      sliding_window, sparse, config.threads());
+
+#define LAUNCH_V2_ATTENTION_KERNEL(T, HEAD_SIZE, BLOCK_SIZE) \
+  if (config.head_unroll == 8) {                             \
+    LAUNCH_V2_ATTENTION_IMPL(T, HEAD_SIZE, BLOCK_SIZE, 8)    \
+  } else {                                                   \
+    LAUNCH_V2_ATTENTION_IMPL(T, HEAD_SIZE, BLOCK_SIZE, 16)   \
+  }
 
-template <typename T, int BLOCK_SIZE, int PARTITION_SIZE = 512>
+template <typename T, int BLOCK_SIZE>
 void paged_attention_v2_impl_launcher(
     torch::Tensor& out, torch::Tensor& exp_sums, torch::Tensor& max_logits,
     torch::Tensor& tmp_out, torch::Tensor& query, torch::Tensor& key_cache,
     torch::Tensor& value_cache, int num_kv_heads, float scale,
     torch::Tensor& block_tables, torch::Tensor& seq_lens, int block_size,
-    int max_seq_len, const c10::optional<torch::Tensor>& alibi_slopes) {
+    int max_seq_len, const c10::optional<torch::Tensor>& alibi_slopes,
+    int sliding_window, const BlockSparsePattern& sparse) {
+  // The generic kernel is not partitioned: head sizes without templated
+  // kernels are computed by v1 directly into out.
+  if (query.size(2) != value_cache.size(2) ||
+      !isTemplatedHeadSize(query.size(2))) {
+    paged_attention_v1_impl_launcher<T, BLOCK_SIZE>(
+        out, query, key_cache, value_cache, num_kv_heads, scale, block_tables,
+        seq_lens, max_seq_len, alibi_slopes, sliding_window, sparse);
+    return;
+  }
+
   int num_seqs = query.size(0);
   int num_heads = query.size(1);
   int head_size = query.size(2);
@@ -674,6 +820,8 @@ void paged_attention_v2_impl_launcher(
   int kv_block_stride = key_cache.stride(0);
   int kv_head_stride = key_cache.stride(1);
   int max_num_partitions = exp_sums.size(-1);
+  int partition_size =
+      getPartitionSize(max_seq_len, max_num_partitions, BLOCK_SIZE);
 
   // NOTE: alibi_slopes is optional.
   const float* alibi_slopes_ptr =
@@ -681,16 +829,44 @@ void paged_attention_v2_impl_launcher(
           ? reinterpret_cast<const float*>(alibi_slopes.value().data_ptr())
           : nullptr;
 
+  // The reduction buffers are exp_sums, max_logits and tmp_out. Without rows
+  // they are borrowed from the workspace of the calling thread instead, and
+  // exp_sums only passes the number of partitions.
+  const size_t partition_slot_num =
+      size_t(num_seqs) * num_heads * max_num_partitions;
+  const bool borrowed = exp_sums.size(0) == 0;
+  if (!borrowed) {
+    const int64_t slot_num = partition_slot_num;
+    TORCH_CHECK(exp_sums.numel() == slot_num &&
+                    max_logits.numel() == slot_num &&
+                    tmp_out.numel() == slot_num * head_size,
+                "exp_sums, max_logits and tmp_out must hold ", num_seqs,
+                " rows of ", num_heads, " heads and ", max_num_partitions,
+                " partitions, or no rows");
+  }
   T* out_ptr = reinterpret_cast<T*>(out.data_ptr());
-  float* exp_sums_ptr = reinterpret_cast<float*>(exp_sums.data_ptr());
-  float* max_logits_ptr = reinterpret_cast<float*>(max_logits.data_ptr());
-  T* tmp_out_ptr = reinterpret_cast<T*>(tmp_out.data_ptr());
+  float* exp_sums_ptr =
+      borrowed ? cpu_memory::thread_buffer<float>(
+                     cpu_memory::Buffer::EXP_SUMS, partition_slot_num)
+               : exp_sums.data_ptr<float>();
+  float* max_logits_ptr =
+      borrowed ? cpu_memory::thread_buffer<float>(
+                     cpu_memory::Buffer::MAX_LOGITS, partition_slot_num)
+               : max_logits.data_ptr<float>();
+  T* tmp_out_ptr = borrowed ? cpu_memory::thread_buffer<T>(
+                                  cpu_memory::Buffer::PARTIAL_OUT,
+                                  partition_slot_num * head_size)
+                            : reinterpret_cast<T*>(tmp_out.data_ptr());
   T* query_ptr = reinterpret_cast<T*>(query.data_ptr());
   T* key_cache_ptr = reinterpret_cast<T*>(key_cache.data_ptr());
   T* value_cache_ptr = reinterpret_cast<T*>(value_cache.data_ptr());
   int* block_tables_ptr = block_tables.data_ptr<int>();
   int* seq_lens_ptr = seq_lens.data_ptr<int>();
 
+  const cpu_tuner::KernelConfig config = lookupAttentionConfig(
+      "paged_attention_v2", query, num_kv_heads, max_seq_len);
+  config.applySchedule(cpu_tuner::Schedule::STATIC);
+
   switch (head_size) {
     case 64:
       LAUNCH_V2_ATTENTION_KERNEL(T, 64, BLOCK_SIZE);
@@ -723,17 +899,10 @@ void paged_attention_v2_impl_launcher(
   paged_attention_v2_impl_launcher<T, BLOCK_SIZE>(                          \
       out, exp_sums, max_logits, tmp_out, query, key_cache, value_cache,    \
       num_kv_heads, scale, block_tables, seq_lens, block_size, max_seq_len, \
-      alibi_slopes);
-
-#define CALL_V2_KERNEL_LAUNCHER_BLOCK_SIZE(T)                     \
-  switch (block_size) {                                           \
-    case 16:                                                      \
-      CALL_V2_KERNEL_LAUNCHER(T, 16);                             \
-      break;                                                      \
-    default:                                                      \
-      TORCH_CHECK(false, "Unsupported block size: ", block_size); \
-      break;                                                      \
-  }
+      alibi_slopes, sliding_window, sparse);
+
+#define CALL_V2_KERNEL_LAUNCHER_BLOCK_SIZE(T) \
+  CALL_KERNEL_LAUNCHER_BLOCK_SIZE(CALL_V2_KERNEL_LAUNCHER, T)
 }  // namespace
 
 void paged_attention_v2(
@@ -745,14 +914,839 @@ void paged_attention_v2(
     const std::string& kv_cache_dtype, double k_scale, double v_scale,
     const int64_t tp_rank, const int64_t blocksparse_local_blocks,
     const int64_t blocksparse_vert_stride, const int64_t blocksparse_block_size,
-    const int64_t blocksparse_head_sliding_step) {
+    const int64_t blocksparse_head_sliding_step, const int64_t sliding_window) {
   TORCH_CHECK(k_scale == 1.0f && v_scale == 1.0f);
-  TORCH_CHECK(blocksparse_vert_stride <= 1,
-              "CPU backend does not support blocksparse attention yet.");
+  const BlockSparsePattern sparse = makeBlockSparsePattern(
+      block_size, tp_rank, blocksparse_local_blocks, blocksparse_vert_stride,
+      blocksparse_block_size, blocksparse_head_sliding_step);
   VLLM_DISPATCH_FLOATING_TYPES(query.scalar_type(), "paged_attention_v2_impl",
                                [&] {
                                  CPU_KERNEL_GUARD_IN(paged_attention_v2_impl)
+                                 CPU_KERNEL_GUARD_ANNOTATE(
+                                     paged_attention_v2_impl, query.size(0),
+                                     pagedAttentionBytes(query, key_cache,
+                                                         seq_lens))
                                  CALL_V2_KERNEL_LAUNCHER_BLOCK_SIZE(scalar_t);
                                  CPU_KERNEL_GUARD_OUT(paged_attention_v2_impl)
                                });
 }
+
+// Cascade paged attention for decoding batches whose sequences share a common
+// prefix of physical KV blocks (e.g. a long system prompt). The shared blocks
+// of each group are processed once for all queries of the group, and the
+// results are merged with the attention over each sequence's private suffix.
+namespace {
+struct CascadeGroup {
+  std::vector<int> seq_idxs;
+  int shared_block_num;
+};
+
+// Groups sequences either by the caller provided group ids or, if not given,
+// by their first physical block. The shared prefix of a group is the longest
+// common prefix of the block tables of its members, restricted to full blocks
+// and leaving at least one private token per sequence.
+std::vector<CascadeGroup> build_cascade_groups(
+    const int* __restrict__ block_tables, const int* __restrict__ seq_lens,
+    const int* __restrict__ group_ids, const int num_seqs,
+    const int max_num_blocks_per_seq, const int block_size,
+    const int min_shared_blocks) {
+  std::unordered_map<int, int> key_to_group;
+  std::vector<CascadeGroup> candidates;
+  for (int seq_idx = 0; seq_idx < num_seqs; ++seq_idx) {
+    if (seq_lens[seq_idx] <= block_size) continue;
+    const int key = group_ids ? group_ids[seq_idx]
+                              : block_tables[seq_idx * max_num_blocks_per_seq];
+    if (key < 0) continue;
+    auto iter = key_to_group.find(key);
+    if (iter == key_to_group.end()) {
+      key_to_group.emplace(key, candidates.size());
+      candidates.push_back({{seq_idx}, 0});
+    } else {
+      candidates[iter->second].seq_idxs.push_back(seq_idx);
+    }
+  }
+
+  std::vector<CascadeGroup> groups;
+  for (auto& group : candidates) {
+    if (group.seq_idxs.size() < 2) continue;
+    const int* first_block_table =
+        block_tables + group.seq_idxs[0] * max_num_blocks_per_seq;
+    int shared_block_num = max_num_blocks_per_seq;
+    for (int seq_idx : group.seq_idxs) {
+      shared_block_num =
+          std::min(shared_block_num, (seq_lens[seq_idx] - 1) / block_size);
+    }
+    for (int seq_idx : group.seq_idxs) {
+      const int* seq_block_table =
+          block_tables + seq_idx * max_num_blocks_per_seq;
+      int block_idx = 0;
+      while (block_idx < shared_block_num &&
+             seq_block_table[block_idx] == first_block_table[block_idx]) {
+        ++block_idx;
+      }
+      shared_block_num = block_idx;
+    }
+    if (shared_block_num < std::max(min_shared_blocks, 1)) continue;
+    group.shared_block_num = shared_block_num;
+    groups.push_back(std::move(group));
+  }
+  return groups;
+}
+
+template <typename scalar_t, int HEAD_SIZE, int BLOCK_SIZE, int PARTITION_SIZE,
+          int ROW_TILE_SIZE>
+struct paged_attention_cascade_impl {
+  static void call(
+      scalar_t* __restrict__ out,            // [num_seqs, num_heads, head_size]
+      const scalar_t* __restrict__ q,        // [num_seqs, num_heads, head_size]
+      const scalar_t* __restrict__ k_cache,  // [num_blocks, num_kv_heads,
+                                             // head_size/x, block_size, x]
+      const scalar_t* __restrict__ v_cache,  // [num_blocks, num_kv_heads,
+                                             // head_size, block_size]
+      const int num_kv_heads, const float scale,
+      const int* __restrict__ block_tables,  // [num_seqs,
+                                             // max_num_blocks_per_seq]
+      const int* __restrict__ seq_lens,      // [num_seqs]
+      const int max_num_blocks_per_seq,
+      const float* __restrict__ alibi_slopes,  // [num_heads]
+      const int* __restrict__ group_ids,       // [num_seqs]
+      const int min_shared_blocks, const int q_stride,
+      const int kv_block_stride, const int kv_head_stride, const int num_seqs,
+      const int num_heads) {
+    constexpr int x = 16 / sizeof(scalar_t);
+    const int num_queries_per_kv = num_heads / num_kv_heads;
+    const int prefetch_distance = cpu_tuner::prefetch_distance();
+
+    static_assert(PARTITION_SIZE * sizeof(float) % 64 == 0);
+    static_assert(PARTITION_SIZE % BLOCK_SIZE == 0);
+
+    const std::vector<CascadeGroup> groups = build_cascade_groups(
+        block_tables, seq_lens, group_ids, num_seqs, max_num_blocks_per_seq,
+        BLOCK_SIZE, min_shared_blocks);
+
+    int* seq_shared_block_nums = cpu_memory::thread_buffer<int>(
+        cpu_memory::Buffer::SEQ_METADATA, num_seqs);
+    std::fill(seq_shared_block_nums, seq_shared_block_nums + num_seqs, 0);
+    int max_prefix_partitions = 0;
+    for (const auto& group : groups) {
+      for (int seq_idx : group.seq_idxs) {
+        seq_shared_block_nums[seq_idx] = group.shared_block_num;
+      }
+      max_prefix_partitions =
+          std::max(max_prefix_partitions,
+                   (group.shared_block_num * BLOCK_SIZE + PARTITION_SIZE - 1) /
+                       PARTITION_SIZE);
+    }
+
+    // One slot per prefix partition plus one for the private suffix.
+    const int max_num_partitions = max_prefix_partitions + 1;
+    const size_t partition_slot_num =
+        groups.empty() ? 0 : size_t(num_seqs) * num_heads * max_num_partitions;
+    float* __restrict__ max_logits = cpu_memory::thread_buffer<float>(
+        cpu_memory::Buffer::MAX_LOGITS, partition_slot_num);
+    float* __restrict__ exp_sums = cpu_memory::thread_buffer<float>(
+        cpu_memory::Buffer::EXP_SUMS, partition_slot_num);
+    float* __restrict__ partial_out = cpu_memory::thread_buffer<float>(
+        cpu_memory::Buffer::PARTIAL_OUT, partition_slot_num * HEAD_SIZE);
+
+    int max_seq_len = max_num_blocks_per_seq * BLOCK_SIZE;
+    int max_seq_len_padded = (max_seq_len + 15) & 0xFFFFFFF0;
+    TORCH_CHECK((max_seq_len_padded * sizeof(float)) % 64 == 0);
+    // Cache line aligned for each context token.
+    const int thread_logits_size =
+        std::max(max_seq_len_padded, ROW_TILE_SIZE * PARTITION_SIZE);
+
+    // Shared prefix: each work item covers one partition of a group's prefix
+    // for a tile of (sequence, query head) rows mapped to the same KV head, so
+    // every K/V block is loaded from memory once per tile instead of once per
+    // row.
+    struct PrefixWorkItem {
+      int group_idx;
+      int partition_idx;
+      int row_start;
+    };
+    std::vector<PrefixWorkItem> prefix_work_items;
+    const int group_num = groups.size();
+    for (int group_idx = 0; group_idx < group_num; ++group_idx) {
+      const auto& group = groups[group_idx];
+      const int row_num = group.seq_idxs.size() * num_queries_per_kv;
+      const int partition_num =
+          (group.shared_block_num * BLOCK_SIZE + PARTITION_SIZE - 1) /
+          PARTITION_SIZE;
+      for (int partition_idx = 0; partition_idx < partition_num;
+           ++partition_idx) {
+        for (int row_start = 0; row_start < row_num;
+             row_start += ROW_TILE_SIZE) {
+          prefix_work_items.push_back({group_idx, partition_idx, row_start});
+        }
+      }
+    }
+    const int prefix_work_item_num = prefix_work_items.size();
+
+    cpu_profiler::RegionTimer prefix_timer(omp_get_max_threads());
+#pragma omp parallel for collapse(2) schedule(dynamic, 1)
+    for (int item_idx = 0; item_idx < prefix_work_item_num; ++item_idx) {
+      for (int kv_head_idx = 0; kv_head_idx < num_kv_heads; ++kv_head_idx) {
+        const cpu_profiler::FinishScope finish(prefix_timer);
+        const PrefixWorkItem& item = prefix_work_items[item_idx];
+        const CascadeGroup& group = groups[item.group_idx];
+        const int shared_token_num = group.shared_block_num * BLOCK_SIZE;
+        const int start_token_idx = item.partition_idx * PARTITION_SIZE;
+        const int token_num =
+            std::min(shared_token_num, start_token_idx + PARTITION_SIZE) -
+            start_token_idx;
+        const int block_num = token_num / BLOCK_SIZE;
+        const int row_num =
+            std::min<int>(ROW_TILE_SIZE,
+                          group.seq_idxs.size() * num_queries_per_kv -
+                              item.row_start);
+        const int* seq_block_table =
+            block_tables + max_num_blocks_per_seq * group.seq_idxs[0] +
+            start_token_idx / BLOCK_SIZE;
+        float* __restrict__ tile_logits = cpu_memory::thread_buffer<float>(
+            cpu_memory::Buffer::SCRATCH, thread_logits_size);
+
+        int row_seq_idxs[ROW_TILE_SIZE];
+        int row_head_idxs[ROW_TILE_SIZE];
+        for (int row_idx = 0; row_idx < row_num; ++row_idx) {
+          const int row = item.row_start + row_idx;
+          row_seq_idxs[row_idx] = group.seq_idxs[row / num_queries_per_kv];
+          row_head_idxs[row_idx] =
+              kv_head_idx * num_queries_per_kv + row % num_queries_per_kv;
+        }
+
+        // Compute logits, [row_num, BLOCK_SIZE] per K block
+        for (int block_idx = 0; block_idx < block_num; ++block_idx) {
+          prefetchKVBlock(k_cache + kv_head_idx * kv_head_stride,
+                          seq_block_table, kv_block_stride, block_idx,
+                          block_num, prefetch_distance, HEAD_SIZE * BLOCK_SIZE);
+          const int64_t physical_block_idx = seq_block_table[block_idx];
+          const scalar_t* __restrict__ k_block_cache_ptr =
+              k_cache + physical_block_idx * kv_block_stride +
+              kv_head_idx * kv_head_stride;
+          for (int row_idx = 0; row_idx < row_num; ++row_idx) {
+            const scalar_t* __restrict__ q_vec_ptr =
+                q + row_seq_idxs[row_idx] * q_stride +
+                row_head_idxs[row_idx] * HEAD_SIZE;
+            reduceQKBlockKernel<scalar_t, HEAD_SIZE, BLOCK_SIZE, x>::call(
+                q_vec_ptr, k_block_cache_ptr,
+                tile_logits + row_idx * PARTITION_SIZE + block_idx * BLOCK_SIZE,
+                scale, BLOCK_SIZE);
+          }
+        }
+
+        // Compute softmax
+        for (int row_idx = 0; row_idx < row_num; ++row_idx) {
+          const int seq_idx = row_seq_idxs[row_idx];
+          const int head_idx = row_head_idxs[row_idx];
+          float* __restrict__ row_logits =
+              tile_logits + row_idx * PARTITION_SIZE;
+          std::pair<float, float> max_and_sum;
+          if (alibi_slopes) {
+            max_and_sum = reduceSoftmaxAlibi(
+                row_logits, token_num, token_num, alibi_slopes[head_idx],
+                start_token_idx, seq_lens[seq_idx]);
+          } else {
+            max_and_sum = reduceSoftmax(row_logits, token_num, token_num);
+          }
+          auto idx = (seq_idx * num_heads + head_idx) * max_num_partitions +
+                     item.partition_idx;
+          max_logits[idx] = max_and_sum.first;
+          exp_sums[idx] = max_and_sum.second;
+        }
+
+        // Compute value. The V slice of a head partition stays in cache while
+        // it is reduced for all rows of the tile.
+        constexpr int head_elem_num_per_partition = 16;
+        constexpr int head_partition_num =
+            HEAD_SIZE / head_elem_num_per_partition;
+        for (int head_part_idx = 0; head_part_idx < head_partition_num;
+             ++head_part_idx) {
+          for (int row_idx = 0; row_idx < row_num; ++row_idx) {
+            vec_op::FP32Vec16 accums[head_elem_num_per_partition];
+            const float* __restrict__ row_logits =
+                tile_logits + row_idx * PARTITION_SIZE;
+            const scalar_t* __restrict__ v_head_cache_ptr =
+                v_cache + kv_head_idx * kv_head_stride +
+                BLOCK_SIZE * head_part_idx * head_elem_num_per_partition;
+            for (int block_idx = 0; block_idx < block_num; ++block_idx) {
+              prefetchKVBlock(v_head_cache_ptr, seq_block_table,
+                              kv_block_stride, block_idx, block_num,
+                              prefetch_distance,
+                              BLOCK_SIZE * head_elem_num_per_partition);
+              const int64_t physical_block_idx = seq_block_table[block_idx];
+              const scalar_t* __restrict__ v_block_cache_ptr =
+                  v_head_cache_ptr + physical_block_idx * kv_block_stride;
+              reduceValueBlock<scalar_t, HEAD_SIZE, BLOCK_SIZE,
+                               head_elem_num_per_partition>(
+                  row_logits + block_idx * BLOCK_SIZE, v_block_cache_ptr,
+                  accums);
+            }
+
+            float* __restrict__ out_ptr =
+                partial_out +
+                ((row_seq_idxs[row_idx] * num_heads + row_head_idxs[row_idx]) *
+                     max_num_partitions +
+                 item.partition_idx) *
+                    HEAD_SIZE +
+                head_part_idx * head_elem_num_per_partition;
+            vec_op::unroll_loop<int, head_elem_num_per_partition>(
+                [&](int head_elem_idx) {
+                  out_ptr[head_elem_idx] = accums[head_elem_idx].reduce_sum();
+                });
+          }
+        }
+      }
+    }
+
+    // Private suffix, merged with the prefix partitions of the sequence.
+    // Sequences without a shared prefix are computed as in v1.
+    cpu_profiler::RegionTimer suffix_timer(omp_get_max_threads());
+#pragma omp parallel for collapse(2) schedule(dynamic, 1)
+    for (int seq_idx = 0; seq_idx < num_seqs; ++seq_idx) {
+      for (int head_idx = 0; head_idx < num_heads; ++head_idx) {
+        const cpu_profiler::FinishScope finish(suffix_timer);
+        const int seq_len = seq_lens[seq_idx];
+        const int shared_block_num = seq_shared_block_nums[seq_idx];
+        const int start_token_idx = shared_block_num * BLOCK_SIZE;
+        const int token_num = seq_len - start_token_idx;
+        const int block_num = (token_num + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        const int last_block_token_num =
+            token_num - (block_num - 1) * BLOCK_SIZE;
+        const int* seq_block_table = block_tables +
+                                     max_num_blocks_per_seq * seq_idx +
+                                     shared_block_num;
+        const int64_t kv_head_idx = head_idx / num_queries_per_kv;
+        const scalar_t* __restrict__ q_vec_ptr =
+            q + seq_idx * q_stride + head_idx * HEAD_SIZE;
+        float* __restrict__ thread_block_logits =
+            cpu_memory::thread_buffer<float>(cpu_memory::Buffer::SCRATCH,
+                                             thread_logits_size);
+
+        // Compute logits
+        for (int block_idx = 0; block_idx < block_num; ++block_idx) {
+          prefetchKVBlock(k_cache + kv_head_idx * kv_head_stride,
+                          seq_block_table, kv_block_stride, block_idx,
+                          block_num, prefetch_distance, HEAD_SIZE * BLOCK_SIZE);
+          const int64_t physical_block_idx = seq_block_table[block_idx];
+          const scalar_t* __restrict__ k_block_cache_ptr =
+              k_cache + physical_block_idx * kv_block_stride +
+              kv_head_idx * kv_head_stride;
+          float* __restrict__ head_block_logits =
+              thread_block_logits + block_idx * BLOCK_SIZE;
+
+          reduceQKBlockKernel<scalar_t, HEAD_SIZE, BLOCK_SIZE, x>::call(
+              q_vec_ptr, k_block_cache_ptr, head_block_logits, scale,
+              block_idx == block_num - 1 ? last_block_token_num : BLOCK_SIZE);
+        }
+
+        // Compute softmax
+        std::pair<float, float> max_and_sum;
+        if (alibi_slopes) {
+          max_and_sum = reduceSoftmaxAlibi(
+              thread_block_logits, token_num, block_num * BLOCK_SIZE,
+              alibi_slopes[head_idx], start_token_idx, seq_len);
+        } else {
+          max_and_sum = reduceSoftmax(thread_block_logits, token_num,
+                                      block_num * BLOCK_SIZE);
+        }
+
+        const int prefix_partition_num =
+            (start_token_idx + PARTITION_SIZE - 1) / PARTITION_SIZE;
+        const auto seq_head_offset =
+            (seq_idx * num_heads + head_idx) * max_num_partitions;
+        if (shared_block_num != 0) {
+          max_logits[seq_head_offset + prefix_partition_num] =
+              max_and_sum.first;
+          exp_sums[seq_head_offset + prefix_partition_num] =
+              max_and_sum.second;
+        }
+
+        // Compute value
+        constexpr int head_elem_num_per_partition = 16;
+        constexpr int head_partition_num =
+            HEAD_SIZE / head_elem_num_per_partition;
+        for (int head_part_idx = 0; head_part_idx < head_partition_num;
+             ++head_part_idx) {
+          vec_op::FP32Vec16 accums[head_elem_num_per_partition];
+          const scalar_t* __restrict__ v_head_cache_ptr =
+              v_cache + kv_head_idx * kv_head_stride +
+              BLOCK_SIZE * head_part_idx * head_elem_num_per_partition;
+          for (int block_idx = 0; block_idx < block_num; ++block_idx) {
+            prefetchKVBlock(v_head_cache_ptr, seq_block_table,
+                            kv_block_stride, block_idx, block_num,
+                            prefetch_distance,
+                            BLOCK_SIZE * head_elem_num_per_partition);
+            const int64_t physical_block_idx = seq_block_table[block_idx];
+            const float* __restrict__ prob_vec_ptr =
+                thread_block_logits + block_idx * BLOCK_SIZE;
+            const scalar_t* __restrict__ v_block_cache_ptr =
+                v_head_cache_ptr + physical_block_idx * kv_block_stride;
+            reduceValueBlock<scalar_t, HEAD_SIZE, BLOCK_SIZE,
+                             head_elem_num_per_partition>(
+                prob_vec_ptr, v_block_cache_ptr, accums);
+          }
+
+          if (shared_block_num == 0) {
+            scalar_t* __restrict__ out_ptr =
+                out + seq_idx * num_heads * HEAD_SIZE + head_idx * HEAD_SIZE +
+                head_part_idx * head_elem_num_per_partition;
+            vec_op::unroll_loop<int, head_elem_num_per_partition>(
+                [&](int head_elem_idx) {
+                  float value = accums[head_elem_idx].reduce_sum();
+                  vec_op::storeFP32(value, out_ptr + head_elem_idx);
+                });
+          } else {
+            float* __restrict__ out_ptr =
+                partial_out +
+                (seq_head_offset + prefix_partition_num) * HEAD_SIZE +
+                head_part_idx * head_elem_num_per_partition;
+            vec_op::unroll_loop<int, head_elem_num_per_partition>(
+                [&](int head_elem_idx) {
+                  out_ptr[head_elem_idx] = accums[head_elem_idx].reduce_sum();
+                });
+          }
+        }
+
+        if (shared_block_num == 0) continue;
+
+        // Merge prefix partitions and suffix with the log-sum-exp rescaling
+        // of paged attention v2.
+        reducePartitonSoftmax(max_logits + seq_head_offset,
+                              exp_sums + seq_head_offset,
+                              prefix_partition_num + 1);
+
+        using v_load_vec_type =
+            typename KernelVecType<scalar_t>::v_load_vec_type;
+        constexpr int head_elem_num_per_group = 16;
+        static_assert(HEAD_SIZE % head_elem_num_per_group == 0);
+        const float* __restrict__ rescale_factors =
+            exp_sums + seq_head_offset;
+        const float* __restrict__ seq_head_partial_out =
+            partial_out + seq_head_offset * HEAD_SIZE;
+        scalar_t* __restrict__ seq_head_output =
+            out + seq_idx * num_heads * HEAD_SIZE + head_idx * HEAD_SIZE;
+        for (int group_idx = 0; group_idx < HEAD_SIZE;
+             group_idx += head_elem_num_per_group) {
+          vec_op::FP32Vec16 acc;
+          for (int i = 0; i <= prefix_partition_num; ++i) {
+            vec_op::FP32Vec16 rescale_factor(rescale_factors[i]);
+            vec_op::FP32Vec16 value(seq_head_partial_out + i * HEAD_SIZE +
+                                    group_idx);
+            acc = acc + value * rescale_factor;
+          }
+          v_load_vec_type cast_acc(acc);
+          cast_acc.save(seq_head_output + group_idx);
+        }
+      }
+    }
+  }
+};
+
+#define LAUNCH_CASCADE_ATTENTION_KERNEL(T, HEAD_SIZE, BLOCK_SIZE)            \
+  paged_attention_cascade_impl<T, HEAD_SIZE, BLOCK_SIZE, PARTITION_SIZE,     \
+                               ROW_TILE_SIZE>::call(                         \
+      out_ptr, query_ptr, key_cache_ptr, value_cache_ptr, num_kv_heads,      \
+      scale, block_tables_ptr, seq_lens_ptr, max_num_blocks_per_seq,         \
+      alibi_slopes_ptr, group_ids_ptr, min_shared_blocks, q_stride,          \
+      kv_block_stride, kv_head_stride, num_seqs, num_heads);
+
+template <typename T, int BLOCK_SIZE, int PARTITION_SIZE = 512,
+          int ROW_TILE_SIZE = 32>
+void paged_attention_cascade_impl_launcher(
+    torch::Tensor& out, torch::Tensor& query, torch::Tensor& key_cache,
+    torch::Tensor& value_cache, int num_kv_heads, float scale,
+    torch::Tensor& block_tables, torch::Tensor& seq_lens,
+    const c10::optional<torch::Tensor>& alibi_slopes,
+    const c10::optional<torch::Tensor>& prefix_group_ids,
+    int min_shared_blocks) {
+  int num_seqs = query.size(0);
+  int num_heads = query.size(1);
+  int head_size = query.size(2);
+  int max_num_blocks_per_seq = block_tables.size(1);
+  int q_stride = query.stride(0);
+  int kv_block_stride = key_cache.stride(0);
+  int kv_head_stride = key_cache.stride(1);
+
+  // NOTE: alibi_slopes and prefix_group_ids are optional.
+  const float* alibi_slopes_ptr =
+      alibi_slopes
+          ? reinterpret_cast<const float*>(alibi_slopes.value().data_ptr())
+          : nullptr;
+  const int* group_ids_ptr =
+      prefix_group_ids ? prefix_group_ids.value().data_ptr<int>() : nullptr;
+
+  T* out_ptr = reinterpret_cast<T*>(out.data_ptr());
+  T* query_ptr = reinterpret_cast<T*>(query.data_ptr());
+  T* key_cache_ptr = reinterpret_cast<T*>(key_cache.data_ptr());
+  T* value_cache_ptr = reinterpret_cast<T*>(value_cache.data_ptr());
+  int* block_tables_ptr = block_tables.data_ptr<int>();
+  int* seq_lens_ptr = seq_lens.data_ptr<int>();
+
+  switch (head_size) {
+    case 64:
+      LAUNCH_CASCADE_ATTENTION_KERNEL(T, 64, BLOCK_SIZE);
+      break;
+    case 80:
+      LAUNCH_CASCADE_ATTENTION_KERNEL(T, 80, BLOCK_SIZE);
+      break;
+    case 96:
+      LAUNCH_CASCADE_ATTENTION_KERNEL(T, 96, BLOCK_SIZE);
+      break;
+    case 112:
+      LAUNCH_CASCADE_ATTENTION_KERNEL(T, 112, BLOCK_SIZE);
+      break;
+    case 128:
+      LAUNCH_CASCADE_ATTENTION_KERNEL(T, 128, BLOCK_SIZE);
+      break;
+    case 192:
+      LAUNCH_CASCADE_ATTENTION_KERNEL(T, 192, BLOCK_SIZE);
+      break;
+    case 256:
+      LAUNCH_CASCADE_ATTENTION_KERNEL(T, 256, BLOCK_SIZE);
+      break;
+    default:
+      TORCH_CHECK(false, "Unsupported head size: ", head_size);
+      break;
+  }
+}
+
+#define CALL_CASCADE_KERNEL_LAUNCHER(T, BLOCK_SIZE)                          \
+  paged_attention_cascade_impl_launcher<T, BLOCK_SIZE>(                      \
+      out, query, key_cache, value_cache, num_kv_heads, scale, block_tables, \
+      seq_lens, alibi_slopes, prefix_group_ids, min_shared_blocks);
+
+#define CALL_CASCADE_KERNEL_LAUNCHER_BLOCK_SIZE(T) \
+  CALL_KERNEL_LAUNCHER_BLOCK_SIZE(CALL_CASCADE_KERNEL_LAUNCHER, T)
+}  // namespace
+
+void paged_attention_cascade(
+    torch::Tensor& out, torch::Tensor& query, torch::Tensor& key_cache,
+    torch::Tensor& value_cache, int64_t num_kv_heads, double scale,
+    torch::Tensor& block_tables, torch::Tensor& seq_lens, int64_t block_size,
+    int64_t max_seq_len, const c10::optional<torch::Tensor>& alibi_slopes,
+    const std::string& kv_cache_dtype, double k_scale, double v_scale,
+    const c10::optional<torch::Tensor>& prefix_group_ids,
+    int64_t min_shared_blocks) {
+  TORCH_CHECK(k_scale == 1.0f && v_scale == 1.0f);
+  if (prefix_group_ids) {
+    TORCH_CHECK(prefix_group_ids->scalar_type() == at::ScalarType::Int &&
+                prefix_group_ids->numel() == query.size(0));
+  }
+  VLLM_DISPATCH_FLOATING_TYPES(
+      query.scalar_type(), "paged_attention_cascade_impl", [&] {
+        CPU_KERNEL_GUARD_IN(paged_attention_cascade_impl)
+        CPU_KERNEL_GUARD_ANNOTATE(
+            paged_attention_cascade_impl, query.size(0),
+            pagedAttentionBytes(query, key_cache, seq_lens))
+        CALL_CASCADE_KERNEL_LAUNCHER_BLOCK_SIZE(scalar_t);
+        CPU_KERNEL_GUARD_OUT(paged_attention_cascade_impl)
+      });
+}
+
+// Paged attention with multiple query tokens per sequence, e.g. to score the
+// draft tokens of speculative decoding. The KV of the query tokens must have
+// been written to the cache, query token i of a sequence attends to the first
+// seq_len - num_query_tokens + i + 1 tokens.
+namespace {
+template <typename scalar_t, int HEAD_SIZE, int BLOCK_SIZE, int ROW_TILE_SIZE>
+struct paged_attention_multi_query_impl {
+  static void call(
+      scalar_t* __restrict__ out,            // [num_seqs, num_query_tokens,
+                                             // num_heads, head_size]
+      const scalar_t* __restrict__ q,        // [num_seqs, num_query_tokens,
+                                             // num_heads, head_size]
+      const scalar_t* __restrict__ k_cache,  // [num_blocks, num_kv_heads,
+                                             // head_size/x, block_size, x]
+      const scalar_t* __restrict__ v_cache,  // [num_blocks, num_kv_heads,
+                                             // head_size, block_size]
+      const int num_kv_heads, const float scale,
+      const int* __restrict__ block_tables,  // [num_seqs,
+                                             // max_num_blocks_per_seq]
+      const int* __restrict__ seq_lens,      // [num_seqs]
+      const int max_num_blocks_per_seq,
+      const float* __restrict__ alibi_slopes,  // [num_heads]
+      const int q_seq_stride, const int q_token_stride,
+      const int kv_block_stride, const int kv_head_stride, const int num_seqs,
+      const int num_query_tokens, const int num_heads,
+      const BlockSparsePattern sparse) {
+    constexpr int x = 16 / sizeof(scalar_t);
+    const int num_queries_per_kv = num_heads / num_kv_heads;
+    const int prefetch_distance = cpu_tuner::prefetch_distance();
+
+    int max_seq_len = max_num_blocks_per_seq * BLOCK_SIZE;
+    int max_seq_len_padded = (max_seq_len + 15) & 0xFFFFFFF0;
+    TORCH_CHECK((max_seq_len_padded * sizeof(float)) % 64 == 0);
+
+
+    // Each work item covers a tile of (query token, query head) rows mapped
+    // to the same KV head, so every K/V block is loaded from memory once for
+    // all query tokens of the sequence.
+    const int row_num_per_kv_head = num_query_tokens * num_queries_per_kv;
+    const int row_tile_num =
+        (row_num_per_kv_head + ROW_TILE_SIZE - 1) / ROW_TILE_SIZE;
+
+    cpu_profiler::RegionTimer region_timer(omp_get_max_threads());
+#pragma omp parallel for collapse(3) schedule(dynamic, 1)
+    for (int seq_idx = 0; seq_idx < num_seqs; ++seq_idx) {
+      for (int kv_head_idx = 0; kv_head_idx < num_kv_heads; ++kv_head_idx) {
+        for (int row_tile_idx = 0; row_tile_idx < row_tile_num;
+             ++row_tile_idx) {
+          const cpu_profiler::FinishScope finish(region_timer);
+          const int seq_len = seq_lens[seq_idx];
+          const int* seq_block_table =
+              block_tables + max_num_blocks_per_seq * seq_idx;
+          const int block_num = (seq_len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+          const int row_start = row_tile_idx * ROW_TILE_SIZE;
+          const int row_num =
+              std::min(ROW_TILE_SIZE, row_num_per_kv_head - row_start);
+          // [ROW_TILE_SIZE, max_seq_len_padded], cache line aligned for each
+          // context token.
+          float* __restrict__ tile_logits = cpu_memory::thread_buffer<float>(
+              cpu_memory::Buffer::SCRATCH, ROW_TILE_SIZE * max_seq_len_padded);
+
+          int row_token_idxs[ROW_TILE_SIZE];
+          int row_head_idxs[ROW_TILE_SIZE];
+          int row_context_lens[ROW_TILE_SIZE];
+          int row_sparse_head_offsets[ROW_TILE_SIZE];
+          for (int row_idx = 0; row_idx < row_num; ++row_idx) {
+            const int row = row_start + row_idx;
+            row_token_idxs[row_idx] = row / num_queries_per_kv;
+            row_head_idxs[row_idx] =
+                kv_head_idx * num_queries_per_kv + row % num_queries_per_kv;
+            // Causal mask among the query tokens
+            row_context_lens[row_idx] =
+                seq_len - num_query_tokens + row_token_idxs[row_idx] + 1;
+            row_sparse_head_offsets[row_idx] = sparse.headOffset(
+                row_head_idxs[row_idx], num_heads, kv_head_idx, num_kv_heads);
+          }
+
+          // Whether a row of the tile attends to the block.
+          auto tile_keeps = [&](const int block_idx) {
+            const int block_start_token_idx = block_idx * BLOCK_SIZE;
+            for (int row_idx = 0; row_idx < row_num; ++row_idx) {
+              if (block_start_token_idx < row_context_lens[row_idx] &&
+                  sparse.keep(block_start_token_idx,
+                              row_context_lens[row_idx] - 1,
+                              row_sparse_head_offsets[row_idx])) {
+                return true;
+              }
+            }
+            return false;
+          };
+
+          // Compute logits. A block skipped by the block-sparse pattern for
+          // all rows of the tile is neither prefetched nor loaded.
+          for (int block_idx = 0; block_idx < block_num; ++block_idx) {
+            if (!sparse.enabled() ||
+                tile_keeps(block_idx + prefetch_distance)) {
+              prefetchKVBlock(k_cache + kv_head_idx * kv_head_stride,
+                              seq_block_table, kv_block_stride, block_idx,
+                              block_num, prefetch_distance,
+                              HEAD_SIZE * BLOCK_SIZE);
+            }
+            const int64_t physical_block_idx = seq_block_table[block_idx];
+            const scalar_t* __restrict__ k_block_cache_ptr =
+                k_cache + physical_block_idx * kv_block_stride +
+                kv_head_idx * kv_head_stride;
+            const int block_start_token_idx = block_idx * BLOCK_SIZE;
+            for (int row_idx = 0; row_idx < row_num; ++row_idx) {
+              const int token_num =
+                  std::min(BLOCK_SIZE,
+                           row_context_lens[row_idx] - block_start_token_idx);
+              if (token_num <= 0) continue;
+              float* __restrict__ row_block_logits =
+                  tile_logits + row_idx * max_seq_len_padded +
+                  block_start_token_idx;
+              if (!sparse.keep(block_start_token_idx,
+                               row_context_lens[row_idx] - 1,
+                               row_sparse_head_offsets[row_idx])) {
+                maskBlockLogits(row_block_logits, token_num);
+                continue;
+              }
+              const scalar_t* __restrict__ q_vec_ptr =
+                  q + seq_idx * q_seq_stride +
+                  row_token_idxs[row_idx] * q_token_stride +
+                  row_head_idxs[row_idx] * HEAD_SIZE;
+              reduceQKBlockKernel<scalar_t, HEAD_SIZE, BLOCK_SIZE, x>::call(
+                  q_vec_ptr, k_block_cache_ptr, row_block_logits, scale,
+                  token_num);
+            }
+          }
+
+          // Compute softmax
+          for (int row_idx = 0; row_idx < row_num; ++row_idx) {
+            const int context_len = row_context_lens[row_idx];
+            const int row_block_num =
+                (context_len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            float* __restrict__ row_logits =
+                tile_logits + row_idx * max_seq_len_padded;
+            if (alibi_slopes) {
+              reduceSoftmaxAlibi(row_logits, context_len,
+                                 row_block_num * BLOCK_SIZE,
+                                 alibi_slopes[row_head_idxs[row_idx]], 0,
+                                 context_len);
+            } else {
+              reduceSoftmax(row_logits, context_len,
+                            row_block_num * BLOCK_SIZE);
+            }
+          }
+
+          // Compute value. The V slice of a head partition stays in cache
+          // while it is reduced for all rows of the tile.
+          constexpr int head_elem_num_per_partition = 16;
+          constexpr int head_partition_num =
+              HEAD_SIZE / head_elem_num_per_partition;
+          for (int head_part_idx = 0; head_part_idx < head_partition_num;
+               ++head_part_idx) {
+            for (int row_idx = 0; row_idx < row_num; ++row_idx) {
+              const int row_block_num =
+                  (row_context_lens[row_idx] + BLOCK_SIZE - 1) / BLOCK_SIZE;
+              const float* __restrict__ row_logits =
+                  tile_logits + row_idx * max_seq_len_padded;
+              vec_op::FP32Vec16 accums[head_elem_num_per_partition];
+              const scalar_t* __restrict__ v_head_cache_ptr =
+                  v_cache + kv_head_idx * kv_head_stride +
+                  BLOCK_SIZE * head_part_idx * head_elem_num_per_partition;
+              for (int block_idx = 0; block_idx < row_block_num; ++block_idx) {
+                if (sparse.keep((block_idx + prefetch_distance) * BLOCK_SIZE,
+                                row_context_lens[row_idx] - 1,
+                                row_sparse_head_offsets[row_idx])) {
+                  prefetchKVBlock(v_head_cache_ptr, seq_block_table,
+                                  kv_block_stride, block_idx, row_block_num,
+                                  prefetch_distance,
+                                  BLOCK_SIZE * head_elem_num_per_partition);
+                }
+                if (!sparse.keep(block_idx * BLOCK_SIZE,
+                                 row_context_lens[row_idx] - 1,
+                                 row_sparse_head_offsets[row_idx])) {
+                  continue;
+                }
+                const int64_t physical_block_idx = seq_block_table[block_idx];
+                const scalar_t* __restrict__ v_block_cache_ptr =
+                    v_head_cache_ptr + physical_block_idx * kv_block_stride;
+                reduceValueBlock<scalar_t, HEAD_SIZE, BLOCK_SIZE,
+                                 head_elem_num_per_partition>(
+                    row_logits + block_idx * BLOCK_SIZE, v_block_cache_ptr,
+                    accums);
+              }
+
+              scalar_t* __restrict__ out_ptr =
+                  out +
+                  ((seq_idx * num_query_tokens + row_token_idxs[row_idx]) *
+                       num_heads +
+                   row_head_idxs[row_idx]) *
+                      HEAD_SIZE +
+                  head_part_idx * head_elem_num_per_partition;
+              vec_op::unroll_loop<int, head_elem_num_per_partition>(
+                  [&](int head_elem_idx) {
+                    float value = accums[head_elem_idx].reduce_sum();
+                    vec_op::storeFP32(value, out_ptr + head_elem_idx);
+                  });
+            }
+          }
+        }
+      }
+    }
+  }
+};
+
+#define LAUNCH_MULTI_QUERY_ATTENTION_KERNEL(T, HEAD_SIZE, BLOCK_SIZE)          \
+  paged_attention_multi_query_impl<T, HEAD_SIZE, BLOCK_SIZE, ROW_TILE_SIZE>::  \
+      call(out_ptr, query_ptr, key_cache_ptr, value_cache_ptr, num_kv_heads,   \
+           scale, block_tables_ptr, seq_lens_ptr, max_num_blocks_per_seq,      \
+           alibi_slopes_ptr, q_seq_stride, q_token_stride, kv_block_stride,    \
+           kv_head_stride, num_seqs, num_query_tokens, num_heads, sparse);
+
+template <typename T, int BLOCK_SIZE, int ROW_TILE_SIZE = 16>
+void paged_attention_multi_query_impl_launcher(
+    torch::Tensor& out, torch::Tensor& query, torch::Tensor& key_cache,
+    torch::Tensor& value_cache, int num_kv_heads, float scale,
+    torch::Tensor& block_tables, torch::Tensor& seq_lens,
+    const c10::optional<torch::Tensor>& alibi_slopes,
+    const BlockSparsePattern& sparse) {
+  int num_seqs = query.size(0);
+  int num_query_tokens = query.size(1);
+  int num_heads = query.size(2);
+  int head_size = query.size(3);
+  int max_num_blocks_per_seq = block_tables.size(1);
+  int q_seq_stride = query.stride(0);
+  int q_token_stride = query.stride(1);
+  int kv_block_stride = key_cache.stride(0);
+  int kv_head_stride = key_cache.stride(1);
+
+  // NOTE: alibi_slopes is optional.
+  const float* alibi_slopes_ptr =
+      alibi_slopes
+          ? reinterpret_cast<const float*>(alibi_slopes.value().data_ptr())
+          : nullptr;
+
+  T* out_ptr = reinterpret_cast<T*>(out.data_ptr());
+  T* query_ptr = reinterpret_cast<T*>(query.data_ptr());
+  T* key_cache_ptr = reinterpret_cast<T*>(key_cache.data_ptr());
+  T* value_cache_ptr = reinterpret_cast<T*>(value_cache.data_ptr());
+  int* block_tables_ptr = block_tables.data_ptr<int>();
+  int* seq_lens_ptr = seq_lens.data_ptr<int>();
+
+  switch (head_size) {
+    case 64:
+      LAUNCH_MULTI_QUERY_ATTENTION_KERNEL(T, 64, BLOCK_SIZE);
+      break;
+    case 80:
+      LAUNCH_MULTI_QUERY_ATTENTION_KERNEL(T, 80, BLOCK_SIZE);
+      break;
+    case 96:
+      LAUNCH_MULTI_QUERY_ATTENTION_KERNEL(T, 96, BLOCK_SIZE);
+      break;
+    case 112:
+      LAUNCH_MULTI_QUERY_ATTENTION_KERNEL(T, 112, BLOCK_SIZE);
+      break;
+    case 128:
+      LAUNCH_MULTI_QUERY_ATTENTION_KERNEL(T, 128, BLOCK_SIZE);
+      break;
+    case 192:
+      LAUNCH_MULTI_QUERY_ATTENTION_KERNEL(T, 192, BLOCK_SIZE);
+      break;
+    case 256:
+      LAUNCH_MULTI_QUERY_ATTENTION_KERNEL(T, 256, BLOCK_SIZE);
+      break;
+    default:
+      TORCH_CHECK(false, "Unsupported head size: ", head_size);
+      break;
+  }
+}
+
+#define CALL_MULTI_QUERY_KERNEL_LAUNCHER(T, BLOCK_SIZE)                      \
+  paged_attention_multi_query_impl_launcher<T, BLOCK_SIZE>(                  \
+      out, query, key_cache, value_cache, num_kv_heads, scale, block_tables, \
+      seq_lens, alibi_slopes, sparse);
+
+#define CALL_MULTI_QUERY_KERNEL_LAUNCHER_BLOCK_SIZE(T) \
+  CALL_KERNEL_LAUNCHER_BLOCK_SIZE(CALL_MULTI_QUERY_KERNEL_LAUNCHER, T)
+}  // namespace
+
+void paged_attention_multi_query(
+    torch::Tensor& out, torch::Tensor& query, torch::Tensor& key_cache,
+    torch::Tensor& value_cache, int64_t num_kv_heads, double scale,
+    torch::Tensor& block_tables, torch::Tensor& seq_lens, int64_t block_size,
+    int64_t max_seq_len, const c10::optional<torch::Tensor>& alibi_slopes,
+    const std::string& kv_cache_dtype, double k_scale, double v_scale,
+    const int64_t tp_rank, const int64_t blocksparse_local_blocks,
+    const int64_t blocksparse_vert_stride, const int64_t blocksparse_block_size,
+    const int64_t blocksparse_head_sliding_step) {
+  TORCH_CHECK(k_scale == 1.0f && v_scale == 1.0f);
+  TORCH_CHECK(query.dim() == 4 && out.is_contiguous());
+  TORCH_CHECK(query.stride(2) == query.size(3) && query.stride(3) == 1);
+  const BlockSparsePattern sparse = makeBlockSparsePattern(
+      block_size, tp_rank, blocksparse_local_blocks, blocksparse_vert_stride,
+      blocksparse_block_size, blocksparse_head_sliding_step);
+  VLLM_DISPATCH_FLOATING_TYPES(
+      query.scalar_type(), "paged_attention_multi_query_impl", [&] {
+        CPU_KERNEL_GUARD_IN(paged_attention_multi_query_impl)
+        CPU_KERNEL_GUARD_ANNOTATE(
+            paged_attention_multi_query_impl, query.size(0),
+            pagedAttentionBytes(query, key_cache, seq_lens))
+        CALL_MULTI_QUERY_KERNEL_LAUNCHER_BLOCK_SIZE(scalar_t);
+        CPU_KERNEL_GUARD_OUT(paged_attention_multi_query_impl)
+      });
+}
@@ -0,0 +1,281 @@
+#ifndef CPU_ATTENTION_KERNELS_HPP
+#define CPU_ATTENTION_KERNELS_HPP
+
+#include "cpu_types.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+// Building blocks of the paged attention decode kernels, shared by
+// attention.cpp and the fused decoder layer of decoder_layer.cpp.
+namespace cpu_attention {
+
+template <typename scalar_t>
+struct KernelVecType {
+  using q_load_vec_type = void;
+  using q_vec_type = void;
+  using k_load_vec_type = void;
+  using k_vec_type = void;
+  using qk_acc_vec_type = void;
+  using v_load_vec_type = void;
+};
+
+template <>
+struct KernelVecType<float> {
+  using q_load_vec_type = vec_op::FP32Vec4;
+  using q_vec_type = vec_op::FP32Vec16;
+  using k_load_vec_type = vec_op::FP32Vec16;
+  using k_vec_type = vec_op::FP32Vec16;
+  using qk_acc_vec_type = vec_op::FP32Vec16;
+  using v_load_vec_type = vec_op::FP32Vec16;
+};
+
+#ifdef __AVX512BF16__
+template <>
+struct KernelVecType<c10::BFloat16> {
+  using q_load_vec_type = vec_op::BF16Vec8;
+  using q_vec_type = vec_op::BF16Vec32;
+  using k_load_vec_type = vec_op::BF16Vec32;
+  using k_vec_type = vec_op::BF16Vec32;
+  using qk_acc_vec_type = vec_op::FP32Vec16;
+  using v_load_vec_type = vec_op::BF16Vec16;
+};
+#else
+template <>
+struct KernelVecType<c10::BFloat16> {
+  using q_load_vec_type = vec_op::BF16Vec8;
+  using q_vec_type = vec_op::FP32Vec16;
+  using k_load_vec_type = vec_op::BF16Vec16;
+  using k_vec_type = vec_op::FP32Vec16;
+  using qk_acc_vec_type = vec_op::FP32Vec16;
+  using v_load_vec_type = vec_op::BF16Vec16;
+};
+#endif
+
+template <>
+struct KernelVecType<c10::Half> {
+  using q_load_vec_type = vec_op::FP16Vec8;
+  using q_vec_type = vec_op::FP32Vec16;
+  using k_load_vec_type = vec_op::FP16Vec16;
+  using k_vec_type = vec_op::FP32Vec16;
+  using qk_acc_vec_type = vec_op::FP32Vec16;
+  using v_load_vec_type = vec_op::FP16Vec16;
+};
+
+template <typename T>
+FORCE_INLINE std::pair<T, T> reduceSoftmax(T* data, const int size,
+                                           const int capacity) {
+  T max = data[0];
+  for (int i = 1; i < size; ++i) {
+    max = max >= data[i] ? max : data[i];
+  }
+
+  T sum = 0;
+  for (int i = 0; i < size; ++i) {
+    data[i] = std::exp(data[i] - max);
+    sum += data[i];
+  }
+
+  int i = 0;
+  for (; i < size; ++i) {
+    data[i] /= sum;
+  }
+
+  for (; i < capacity; ++i) {
+    data[i] = 0;
+  }
+
+  return {max, sum};
+}
+
+template <typename scalar_t, int HEAD_SIZE, int BLOCK_SIZE, int x>
+struct reduceQKBlockKernel {
+  using q_load_vec_type = typename KernelVecType<scalar_t>::q_load_vec_type;
+  using q_vec_type = typename KernelVecType<scalar_t>::q_vec_type;
+  using k_load_vec_type = typename KernelVecType<scalar_t>::k_load_vec_type;
+  using k_vec_type = typename KernelVecType<scalar_t>::k_vec_type;
+  using qk_acc_vec_type = typename KernelVecType<scalar_t>::qk_acc_vec_type;
+
+  constexpr static int TOKEN_PER_GROUP = k_load_vec_type::get_elem_num() / x;
+  // Tokens reduced per pass over the head, one accumulator per token group.
+  // Blocks of more than 16 tokens are reduced tile by tile, so the
+  // accumulators stay in registers for any block size.
+  constexpr static int TILE_TOKEN_NUM = BLOCK_SIZE < 16 ? BLOCK_SIZE : 16;
+  constexpr static int MAX_GROUP_NUM = TILE_TOKEN_NUM / TOKEN_PER_GROUP;
+  constexpr static int UNROLL_GROUP_NUM =
+      MAX_GROUP_NUM >= 4 ? MAX_GROUP_NUM / 4 : 1;
+
+  static_assert(BLOCK_SIZE % TILE_TOKEN_NUM == 0);
+  static_assert(TILE_TOKEN_NUM % TOKEN_PER_GROUP == 0);
+  static_assert(MAX_GROUP_NUM % UNROLL_GROUP_NUM == 0);
+  static_assert(k_load_vec_type::get_elem_num() % x == 0);
+  static_assert(q_load_vec_type::get_elem_num() * sizeof(scalar_t) == 16);
+
+  // head_size is the runtime head size of the generic kernel (HEAD_SIZE 0).
+  FORCE_INLINE static void call(const scalar_t* __restrict__ q,
+                                const scalar_t* __restrict__ k_block,
+                                float* __restrict__ logits, float scale,
+                                const int token_num,
+                                const int head_size = HEAD_SIZE) {
+    for (int tile_start = 0; tile_start < token_num;
+         tile_start += TILE_TOKEN_NUM) {
+      reduceTile(q, k_block + tile_start * x, logits + tile_start, scale,
+                 std::min(TILE_TOKEN_NUM, token_num - tile_start), head_size);
+    }
+  }
+
+  // k_block points to the first token of the tile in the [head_size / x,
+  // BLOCK_SIZE, x] K block.
+  FORCE_INLINE static void reduceTile(const scalar_t* __restrict__ q,
+                                      const scalar_t* __restrict__ k_block,
+                                      float* __restrict__ logits, float scale,
+                                      const int token_num,
+                                      const int head_size) {
+    const int group_num = (token_num + TOKEN_PER_GROUP - 1) / TOKEN_PER_GROUP;
+
+    qk_acc_vec_type group_accums[MAX_GROUP_NUM];
+    if (token_num == TILE_TOKEN_NUM) {
+      for (int q_offset = 0; q_offset < head_size;
+           q_offset += x, k_block += x * BLOCK_SIZE) {
+        q_load_vec_type q_load_group_vec(q + q_offset);
+        q_vec_type q_group_vec(q_load_group_vec);
+
+        vec_op::unroll_loop<int, MAX_GROUP_NUM>(
+            [k_block, &q_group_vec, &group_accums](int token_group_idx) {
+              k_load_vec_type k_load_group_vec(k_block + token_group_idx * x *
+                                                             TOKEN_PER_GROUP);
+              k_vec_type k_group_vec(k_load_group_vec);
+              vec_op::fma(group_accums[token_group_idx], q_group_vec,
+                          k_group_vec);
+              vec_op::prefetch(k_block + x * BLOCK_SIZE +
+                               token_group_idx * x * TOKEN_PER_GROUP);
+            });
+      }
+    } else {
+      for (int q_offset = 0; q_offset < head_size;
+           q_offset += x, k_block += x * BLOCK_SIZE) {
+        q_load_vec_type q_load_group_vec(q + q_offset);
+        q_vec_type q_group_vec(q_load_group_vec);
+        for (int token_group_start = 0; token_group_start < group_num;
+             token_group_start += UNROLL_GROUP_NUM) {
+          vec_op::unroll_loop<int, UNROLL_GROUP_NUM>(
+              [token_group_start, k_block, &q_group_vec,
+               &group_accums](int token_group_idx) {
+                token_group_idx += token_group_start;
+                k_load_vec_type k_load_group_vec(k_block + token_group_idx * x *
+                                                               TOKEN_PER_GROUP);
+                k_vec_type k_group_vec(k_load_group_vec);
+                vec_op::fma(group_accums[token_group_idx], q_group_vec,
+                            k_group_vec);
+                vec_op::prefetch(k_block + x * BLOCK_SIZE +
+                                 token_group_idx * x * TOKEN_PER_GROUP);
+              });
+        }
+      }
+    }
+
+    for (int token_group_idx = 0; token_group_idx < group_num;
+         ++token_group_idx) {
+      vec_op::unroll_loop<int, TOKEN_PER_GROUP>(
+          [&group_accums, logits, scale, token_group_idx](int token_idx) {
+            float dot_v =
+                group_accums[token_group_idx]
+                    .template reduce_sub_sum<qk_acc_vec_type::get_elem_num() /
+                                             TOKEN_PER_GROUP>(token_idx);
+            logits[token_group_idx * TOKEN_PER_GROUP + token_idx] =
+                dot_v * scale;
+          });
+    }
+  }
+};
+
+// Returns the first context token inside the sliding window of a sequence, or
+// 0 without sliding window. A block at the start of the window which the block
+// manager has already recycled for a later position (the cyclic block tables
+// of the v1 block manager) is treated as out of the window.
+// the logical block `distance` blocks after block_idx, where head_cache is
+// the K or V slice of the KV head in the first physical block. The paged
+// blocks are scattered in memory, so the hardware prefetchers do not follow
+// the block table.
+template <typename scalar_t>
+FORCE_INLINE void prefetchKVBlock(const scalar_t* head_cache,
+                                  const int* block_table,
+                                  const int64_t block_stride,
+                                  const int block_idx, const int block_num,
+                                  const int distance, const int elem_num) {
+  const int ahead_block_idx = block_idx + distance;
+  if (distance > 0 && ahead_block_idx < block_num) {
+    vec_op::prefetch_range(
+        head_cache + block_table[ahead_block_idx] * block_stride,
+        elem_num * sizeof(scalar_t));
+  }
+}
+
+// Accumulates the probabilities times the [HEAD_PARTITION_SIZE, BLOCK_SIZE]
+// rows of a V block into one vector per head element, whose lanes are summed
+// by the caller. Rows of several vectors are accumulated vector by vector,
+// rows of half a vector two head elements per load.
+template <typename scalar_t, int HEAD_SIZE, int BLOCK_SIZE,
+          int HEAD_PARTITION_SIZE, typename acc_t>
+FORCE_INLINE void reduceValueBlock(const float* prob, const scalar_t* v_block,
+                                   acc_t&& acc) {
+  using v_load_vec_type = typename KernelVecType<scalar_t>::v_load_vec_type;
+  constexpr int ELEM_NUM = v_load_vec_type::get_elem_num();
+  static_assert(ELEM_NUM == vec_op::FP32Vec16::get_elem_num());
+
+  if constexpr (BLOCK_SIZE % ELEM_NUM == 0) {
+    for (int vec_idx = 0; vec_idx < BLOCK_SIZE / ELEM_NUM; ++vec_idx) {
+      vec_op::FP32Vec16 prob_vec(prob + vec_idx * ELEM_NUM);
+      vec_op::unroll_loop<int, HEAD_PARTITION_SIZE>([&](int head_elem_idx) {
+        v_load_vec_type v_vec(v_block + BLOCK_SIZE * head_elem_idx +
+                              vec_idx * ELEM_NUM);
+        vec_op::FP32Vec16 fp32_v_vec(v_vec);
+        acc[head_elem_idx] = acc[head_elem_idx] + prob_vec * fp32_v_vec;
+      });
+    }
+  } else {
+    static_assert(2 * BLOCK_SIZE == ELEM_NUM && HEAD_PARTITION_SIZE % 2 == 0);
+    // The probabilities in the low and in the high half, zeros elsewhere.
+    float prob_halves[2][ELEM_NUM] __attribute__((aligned(64))) = {};
+    std::copy(prob, prob + BLOCK_SIZE, prob_halves[0]);
+    std::copy(prob, prob + BLOCK_SIZE, prob_halves[1] + BLOCK_SIZE);
+    vec_op::FP32Vec16 low_prob_vec(prob_halves[0]);
+    vec_op::FP32Vec16 high_prob_vec(prob_halves[1]);
+
+    vec_op::unroll_loop<int, HEAD_PARTITION_SIZE / 2>([&](int pair_idx) {
+      const int head_elem_idx = 2 * pair_idx;
+      v_load_vec_type v_vec(v_block + BLOCK_SIZE * head_elem_idx);
+      vec_op::FP32Vec16 fp32_v_vec(v_vec);
+      acc[head_elem_idx] = acc[head_elem_idx] + low_prob_vec * fp32_v_vec;
+      acc[head_elem_idx + 1] =
+          acc[head_elem_idx + 1] + high_prob_vec * fp32_v_vec;
+    });
+  }
+}
+}  // namespace cpu_attention
+
+// Instantiates LAUNCHER(T, BLOCK_SIZE) for the supported KV cache block sizes.
+#define CALL_KERNEL_LAUNCHER_BLOCK_SIZE(LAUNCHER, T)              \
+  switch (block_size) {                                           \
+    case 8:                                                       \
+      LAUNCHER(T, 8);                                             \
+      break;                                                      \
+    case 16:                                                      \
+      LAUNCHER(T, 16);                                            \
+      break;                                                      \
+    case 32:                                                      \
+      LAUNCHER(T, 32);                                            \
+      break;                                                      \
+    case 64:                                                      \
+      LAUNCHER(T, 64);                                            \
+      break;                                                      \
+    case 128:                                                     \
+      LAUNCHER(T, 128);                                           \
+      break;                                                      \
+    default:                                                      \
+      TORCH_CHECK(false, "Unsupported block size: ", block_size); \
+      break;                                                      \
+  }
+
+#endif
@@ -0,0 +1,686 @@
+// Standalone microbenchmarks of the CPU kernels in csrc/cpu, built by the
+// cpu_kernel_bench target of cmake/cpu_extension.cmake:
+//
+//   cmake --build build --target cpu_kernel_bench
+//   ./build/cpu_kernel_bench --threads 1,16,32 --dtypes float,bfloat16
+//       --block-sizes 16,128 --output bench.json
+//
+// Every kernel is swept over shapes, thread counts and dtypes. The achieved
+// GB/s and GFLOP/s are reported together with the STREAM triad bandwidth and
+// the vec_op FMA peak measured at the same thread count, and written as JSON
+// which benchmarks/kernels/compare_cpu_kernel_bench.py diffs between builds.
+//
+// Each result also reports the time the OpenMP threads waited at the closing
+// barriers of the kernels that run through cpu_threads::parallel_for().
+// --subteams 2 or 3 runs those kernels on thread subteams grouped by the L2 or
+// L3 cache, which needs bound threads, e.g. OMP_PLACES=threads
+// OMP_PROC_BIND=close. Comparing a report with and without subteams shows the
+// barrier time they save.
+
+#include <omp.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <ATen/Parallel.h>
+
+#include "cache.h"
+#include "ops.h"
+#include "cpu/cpu_types.hpp"
+
+// Defined in csrc/cpu/thread_subteams.cpp.
+std::vector<int64_t> set_cpu_thread_subteams(int64_t cache_level);
+
+#ifdef VLLM_CPU_BENCH_QUANT
+// Defined in csrc/cpu/quant.cpp, registered as cutlass_scaled_mm.
+void int8_scaled_mm(torch::Tensor& c, const torch::Tensor& a,
+                    const torch::Tensor& b, const torch::Tensor& a_scales,
+                    const torch::Tensor& b_scales,
+                    const c10::optional<torch::Tensor>& bias);
+#endif
+
+namespace {
+
+#if defined(VLLM_CPU_SCALAR_VEC_OP)
+constexpr const char* ISA = "scalar";
+#elif defined(__AVX512F__)
+constexpr const char* ISA = "avx512";
+#elif defined(__AVX2__)
+constexpr const char* ISA = "avx2";
+#elif defined(__s390x__)
+constexpr const char* ISA = "vxe";
+#elif defined(__powerpc64__)
+constexpr const char* ISA = "vsx";
+#else
+constexpr const char* ISA = "unknown";
+#endif
+
+struct Options {
+  std::vector<int> threads;
+  std::vector<std::string> dtypes = {"float", "bfloat16"};
+  // KV cache block sizes of the attention and cache kernels.
+  std::vector<int64_t> block_sizes = {16};
+  int warmup = 3;
+  int iters = 20;
+  std::string filter;
+  std::string output;
+  // Cache level of the thread subteams, 0 for the whole team.
+  int64_t subteams = 0;
+};
+
+struct Roofline {
+  int threads;
+  double stream_gbps;
+  double peak_gflops;
+};
+
+// A benchmarked kernel call. bytes and flops are the nominal memory traffic
+// and floating point operations of one call, flops is 0 for data movement.
+struct Case {
+  std::string kernel;
+  std::string shape;
+  double bytes;
+  double flops;
+  std::function<void()> run;
+};
+
+struct Result {
+  std::string kernel;
+  std::string dtype;
+  std::string shape;
+  int threads;
+  double time_us;
+  double min_time_us;
+  double gbps;
+  double gflops;
+  double bw_fraction;
+  double compute_fraction;
+  // Barrier wait of one call, summed over the threads.
+  double barrier_us;
+};
+
+std::vector<std::string> split(const std::string& list) {
+  std::vector<std::string> items;
+  std::stringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty()) items.push_back(item);
+  }
+  return items;
+}
+
+void usage(const char* prog) {
+  std::cerr
+      << "usage: " << prog
+      << " [--threads N,...] [--dtypes float,bfloat16] [--warmup N]"
+         " [--block-sizes N,...] [--iters N] [--filter SUBSTR]"
+         " [--subteams 0|2|3]"
+         " [--output FILE]\n";
+  std::exit(1);
+}
+
+Options parse_args(int argc, char** argv) {
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--help" || arg == "-h" || i + 1 == argc) usage(argv[0]);
+    const std::string value = argv[++i];
+    if (arg == "--threads") {
+      for (const std::string& n : split(value)) {
+        opts.threads.push_back(std::stoi(n));
+      }
+    } else if (arg == "--dtypes") {
+      opts.dtypes = split(value);
+    } else if (arg == "--block-sizes") {
+      opts.block_sizes.clear();
+      for (const std::string& n : split(value)) {
+        opts.block_sizes.push_back(std::stoll(n));
+      }
+    } else if (arg == "--warmup") {
+      opts.warmup = std::stoi(value);
+    } else if (arg == "--iters") {
+      opts.iters = std::stoi(value);
+    } else if (arg == "--filter") {
+      opts.filter = value;
+    } else if (arg == "--subteams") {
+      opts.subteams = std::stoll(value);
+    } else if (arg == "--output") {
+      opts.output = value;
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (opts.threads.empty()) {
+    const int max_threads = omp_get_max_threads();
+    opts.threads = {1};
+    if (max_threads > 1) opts.threads.push_back(max_threads);
+  }
+  TORCH_CHECK(opts.iters > 0 && opts.warmup >= 0,
+              "--iters must be positive and --warmup non-negative");
+  for (const std::string& dtype : opts.dtypes) {
+    TORCH_CHECK(dtype == "float" || dtype == "bfloat16",
+                "Unsupported dtype: ", dtype);
+  }
+  return opts;
+}
+
+void set_threads(const int threads) {
+  omp_set_num_threads(threads);
+  at::set_num_threads(threads);
+}
+
+double seconds_since(const std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// STREAM triad a = b + s * c over arrays much larger than the LLC, counting
+// 3 arrays of traffic per pass as STREAM does. Best of several passes.
+double measure_stream_gbps() {
+  constexpr int64_t ELEM_NUM = int64_t(1) << 25;
+  constexpr int PASS_NUM = 5;
+  std::vector<float> a(ELEM_NUM), b(ELEM_NUM), c(ELEM_NUM);
+  float* __restrict__ a_ptr = a.data();
+  const float* __restrict__ b_ptr = b.data();
+  const float* __restrict__ c_ptr = c.data();
+  const float s = 3.0f;
+  // First touch from the threads doing the passes.
+#pragma omp parallel for schedule(static)
+  for (int64_t i = 0; i < ELEM_NUM; ++i) {
+    a[i] = 0.0f;
+    b[i] = 1.0f;
+    c[i] = 2.0f;
+  }
+
+  double best = 0.0;
+  for (int pass = 0; pass < PASS_NUM; ++pass) {
+    const auto start = std::chrono::steady_clock::now();
+#pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < ELEM_NUM; ++i) {
+      a_ptr[i] = b_ptr[i] + s * c_ptr[i];
+    }
+    const double elapsed = seconds_since(start);
+    best = std::max(best, 3.0 * ELEM_NUM * sizeof(float) / elapsed / 1e9);
+  }
+  return best;
+}
+
+// Multiply-add throughput of vec_op::FP32Vec16 with enough independent
+// accumulators per thread to hide the FMA latency.
+double measure_peak_gflops() {
+  constexpr int ACC_NUM = 8;
+  constexpr int64_t ITER_NUM = 1 << 22;
+  constexpr int PASS_NUM = 3;
+  double best = 0.0;
+  for (int pass = 0; pass < PASS_NUM; ++pass) {
+    int team_size = 1;
+    volatile float sink = 0.0f;
+    const auto start = std::chrono::steady_clock::now();
+#pragma omp parallel
+    {
+#pragma omp single
+      team_size = omp_get_num_threads();
+      vec_op::FP32Vec16 mul(0.999999f);
+      vec_op::FP32Vec16 add(1e-6f);
+      vec_op::FP32Vec16 acc[ACC_NUM] = {
+          vec_op::FP32Vec16(1.0f), vec_op::FP32Vec16(1.0f),
+          vec_op::FP32Vec16(1.0f), vec_op::FP32Vec16(1.0f),
+          vec_op::FP32Vec16(1.0f), vec_op::FP32Vec16(1.0f),
+          vec_op::FP32Vec16(1.0f), vec_op::FP32Vec16(1.0f)};
+      for (int64_t i = 0; i < ITER_NUM; ++i) {
+        vec_op::unroll_loop<int, ACC_NUM>(
+            [&](int j) { acc[j] = acc[j] * mul + add; });
+      }
+      float sum = 0.0f;
+      for (int j = 0; j < ACC_NUM; ++j) sum += acc[j].reduce_sum();
+#pragma omp critical
+      sink = sink + sum;
+    }
+    const double elapsed = seconds_since(start);
+    const double flops = 2.0 * team_size * ITER_NUM * ACC_NUM *
+                         vec_op::FP32Vec16::VEC_ELEM_NUM;
+    best = std::max(best, flops / elapsed / 1e9);
+  }
+  return best;
+}
+
+torch::ScalarType to_scalar_type(const std::string& dtype) {
+  return dtype == "float" ? torch::kFloat : torch::kBFloat16;
+}
+
+std::string shape_str(std::initializer_list<std::pair<const char*, int64_t>>
+                          dims) {
+  std::string shape;
+  for (const auto& [name, value] : dims) {
+    if (!shape.empty()) shape += ",";
+    shape += std::string(name) + "=" + std::to_string(value);
+  }
+  return shape;
+}
+
+// Mirrors the CPU KV cache layout of vllm.utils.create_kv_caches_with_random:
+// key [num_blocks, num_kv_heads, head_size / x, block_size, x] with x = 16
+// bytes worth of elements, value [num_blocks, num_kv_heads, head_size,
+// block_size].
+void make_kv_cache(const int64_t num_blocks, const int64_t num_kv_heads,
+                   const int64_t head_size, const int64_t block_size,
+                   const torch::ScalarType dtype, torch::Tensor& key_cache,
+                   torch::Tensor& value_cache) {
+  const int64_t x = 16 / c10::elementSize(dtype);
+  key_cache = torch::randn(
+      {num_blocks, num_kv_heads, head_size / x, block_size, x}, dtype);
+  value_cache =
+      torch::randn({num_blocks, num_kv_heads, head_size, block_size}, dtype);
+}
+
+constexpr int64_t NUM_HEADS = 32;
+constexpr int64_t NUM_KV_HEADS = 8;
+constexpr int64_t HEAD_SIZE = 128;
+constexpr int64_t PARTITION_SIZE = 512;
+constexpr int64_t HIDDEN_SIZE = 4096;
+constexpr int64_t INTERMEDIATE_SIZE = 11008;
+
+void add_attention_cases(std::vector<Case>& cases,
+                         const torch::ScalarType dtype,
+                         const int64_t block_size) {
+  const double elem_size = c10::elementSize(dtype);
+  // (num_seqs, seq_len)
+  const std::pair<int64_t, int64_t> shapes[] = {
+      {1, 1024}, {16, 1024}, {64, 512}, {16, 4096}};
+  for (const auto& seq_shape : shapes) {
+    const int64_t num_seqs = seq_shape.first;
+    const int64_t seq_len = seq_shape.second;
+    const int64_t blocks_per_seq = (seq_len + block_size - 1) / block_size;
+    const int64_t num_blocks = num_seqs * blocks_per_seq;
+    torch::Tensor key_cache, value_cache;
+    make_kv_cache(num_blocks, NUM_KV_HEADS, HEAD_SIZE, block_size, dtype,
+                  key_cache, value_cache);
+    // Scattered blocks, as after some time of serving.
+    torch::Tensor block_tables =
+        torch::randperm(num_blocks, torch::kInt)
+            .reshape({num_seqs, blocks_per_seq});
+    torch::Tensor seq_lens = torch::full({num_seqs}, seq_len, torch::kInt);
+    torch::Tensor query =
+        torch::randn({num_seqs, NUM_HEADS, HEAD_SIZE}, dtype);
+    torch::Tensor out = torch::empty_like(query);
+    const int64_t max_partitions =
+        (seq_len + PARTITION_SIZE - 1) / PARTITION_SIZE;
+    torch::Tensor exp_sums =
+        torch::empty({num_seqs, NUM_HEADS, max_partitions}, torch::kFloat);
+    torch::Tensor max_logits = torch::empty_like(exp_sums);
+    torch::Tensor tmp_out = torch::empty(
+        {num_seqs, NUM_HEADS, max_partitions, HEAD_SIZE}, dtype);
+    const double scale = 1.0 / std::sqrt(HEAD_SIZE);
+
+    const double bytes =
+        elem_size * (2.0 * num_seqs * seq_len * NUM_KV_HEADS * HEAD_SIZE +
+                     2.0 * query.numel());
+    // QK^T and softmax(QK^T)V, 2 FLOPs per multiply-add each.
+    const double flops = 4.0 * num_seqs * NUM_HEADS * seq_len * HEAD_SIZE;
+    const std::string shape =
+        shape_str({{"num_seqs", num_seqs},
+                   {"seq_len", seq_len},
+                   {"num_heads", NUM_HEADS},
+                   {"num_kv_heads", NUM_KV_HEADS},
+                   {"head_size", HEAD_SIZE},
+                   {"block_size", block_size}});
+
+    cases.push_back({"paged_attention_v1", shape, bytes, flops, [=]() mutable {
+                       paged_attention_v1(
+                           out, query, key_cache, value_cache, NUM_KV_HEADS,
+                           scale, block_tables, seq_lens, block_size,
+                           seq_len, c10::nullopt, "auto", 1.0, 1.0, 0, 0, 0,
+                           64, 0, 0);
+                     }});
+    cases.push_back({"paged_attention_v2", shape, bytes, flops, [=]() mutable {
+                       paged_attention_v2(
+                           out, exp_sums, max_logits, tmp_out, query,
+                           key_cache, value_cache, NUM_KV_HEADS, scale,
+                           block_tables, seq_lens, block_size, seq_len,
+                           c10::nullopt, "auto", 1.0, 1.0, 0, 0, 0, 64, 0,
+                           0);
+                     }});
+  }
+}
+
+void add_cache_cases(std::vector<Case>& cases, const torch::ScalarType dtype,
+                     const int64_t block_size) {
+  const double elem_size = c10::elementSize(dtype);
+  const double block_bytes =
+      elem_size * NUM_KV_HEADS * HEAD_SIZE * block_size;
+  for (const int64_t num_tokens : {16, 256, 2048}) {
+    const int64_t num_blocks = 2 * num_tokens / block_size + 1;
+    torch::Tensor key_cache, value_cache;
+    make_kv_cache(num_blocks, NUM_KV_HEADS, HEAD_SIZE, block_size, dtype,
+                  key_cache, value_cache);
+    torch::Tensor key = torch::randn({num_tokens, NUM_KV_HEADS, HEAD_SIZE},
+                                     dtype);
+    torch::Tensor value = torch::randn_like(key);
+    torch::Tensor slot_mapping =
+        torch::randperm(num_blocks * block_size, torch::kLong)
+            .slice(0, 0, num_tokens);
+    // Read key and value, write them to the caches.
+    const double bytes = 4.0 * elem_size * key.numel();
+    cases.push_back({"reshape_and_cache",
+                     shape_str({{"num_tokens", num_tokens},
+                                {"num_kv_heads", NUM_KV_HEADS},
+                                {"head_size", HEAD_SIZE},
+                                {"block_size", block_size}}),
+                     bytes, 0.0, [=]() mutable {
+                       reshape_and_cache(key, value, key_cache, value_cache,
+                                         slot_mapping, "auto", 1.0, 1.0);
+                     }});
+  }
+
+  for (const int64_t num_pairs : {16, 256}) {
+    const int64_t num_blocks = 2 * num_pairs;
+    torch::Tensor key_cache, value_cache;
+    make_kv_cache(num_blocks, NUM_KV_HEADS, HEAD_SIZE, block_size, dtype,
+                  key_cache, value_cache);
+    // Copy the first half of the blocks to the second half.
+    torch::Tensor src = torch::arange(num_pairs, torch::kLong);
+    torch::Tensor block_mapping =
+        torch::stack({src, src + num_pairs}, 1).contiguous();
+    const std::vector<torch::Tensor> key_caches = {key_cache};
+    const std::vector<torch::Tensor> value_caches = {value_cache};
+    cases.push_back({"copy_blocks",
+                     shape_str({{"num_pairs", num_pairs},
+                                {"num_kv_heads", NUM_KV_HEADS},
+                                {"head_size", HEAD_SIZE},
+                                {"block_size", block_size}}),
+                     4.0 * num_pairs * block_bytes, 0.0, [=]() {
+                       copy_blocks(key_caches, value_caches, block_mapping);
+                     }});
+  }
+}
+
+void add_norm_cases(std::vector<Case>& cases, const torch::ScalarType dtype) {
+  const double elem_size = c10::elementSize(dtype);
+  for (const int64_t num_tokens : {1, 16, 256, 2048}) {
+    torch::Tensor input = torch::randn({num_tokens, HIDDEN_SIZE}, dtype);
+    torch::Tensor residual = torch::randn_like(input);
+    torch::Tensor weight = torch::randn({HIDDEN_SIZE}, dtype);
+    torch::Tensor out = torch::empty_like(input);
+    const double elems = input.numel();
+    const std::string shape = shape_str(
+        {{"num_tokens", num_tokens}, {"hidden_size", HIDDEN_SIZE}});
+    cases.push_back({"rms_norm", shape, elem_size * (2.0 * elems + HIDDEN_SIZE),
+                     4.0 * elems, [=]() mutable {
+                       rms_norm(out, input, weight, 1e-6);
+                     }});
+    // The residual add is written back, input and residual are read and
+    // written in place.
+    cases.push_back({"fused_add_rms_norm", shape,
+                     elem_size * (4.0 * elems + HIDDEN_SIZE), 5.0 * elems,
+                     [=]() mutable {
+                       fused_add_rms_norm(input, residual, weight, 1e-6);
+                     }});
+  }
+}
+
+void add_activation_cases(std::vector<Case>& cases,
+                          const torch::ScalarType dtype) {
+  using Activation = void (*)(torch::Tensor&, torch::Tensor&);
+  // Nominal FLOPs per output element, transcendentals count as one.
+  const std::tuple<const char*, Activation, bool, double> activations[] = {
+      {"silu_and_mul", &silu_and_mul, true, 5.0},
+      {"gelu_and_mul", &gelu_and_mul, true, 6.0},
+      {"gelu_tanh_and_mul", &gelu_tanh_and_mul, true, 10.0},
+      {"gelu_new", &gelu_new, false, 9.0},
+      {"gelu_fast", &gelu_fast, false, 9.0},
+      {"gelu_quick", &gelu_quick, false, 5.0}};
+  const double elem_size = c10::elementSize(dtype);
+  for (const int64_t num_tokens : {1, 16, 256}) {
+    for (const auto& [name, fn, gated, flops_per_elem] : activations) {
+      const int64_t input_size =
+          gated ? 2 * INTERMEDIATE_SIZE : INTERMEDIATE_SIZE;
+      torch::Tensor input = torch::randn({num_tokens, input_size}, dtype);
+      torch::Tensor out =
+          torch::empty({num_tokens, INTERMEDIATE_SIZE}, dtype);
+      const double out_elems = out.numel();
+      cases.push_back(
+          {name,
+           shape_str({{"num_tokens", num_tokens}, {"d", INTERMEDIATE_SIZE}}),
+           elem_size * (input.numel() + out_elems),
+           flops_per_elem * out_elems,
+           [=, fn = fn]() mutable { fn(out, input); }});
+    }
+  }
+}
+
+void add_rotary_cases(std::vector<Case>& cases,
+                      const torch::ScalarType dtype) {
+  constexpr int64_t MAX_POSITION = 8192;
+  const double elem_size = c10::elementSize(dtype);
+  torch::Tensor cos_sin_cache = torch::randn({MAX_POSITION, HEAD_SIZE}, dtype);
+  for (const int64_t num_tokens : {1, 16, 256, 2048}) {
+    for (const bool is_neox : {true, false}) {
+      torch::Tensor positions =
+          torch::randint(MAX_POSITION, {num_tokens}, torch::kLong);
+      torch::Tensor query =
+          torch::randn({num_tokens, NUM_HEADS * HEAD_SIZE}, dtype);
+      torch::Tensor key =
+          torch::randn({num_tokens, NUM_KV_HEADS * HEAD_SIZE}, dtype);
+      const double elems = query.numel() + key.numel();
+      // 2 multiplies and 1 add per rotated element.
+      cases.push_back(
+          {is_neox ? "rotary_embedding_neox" : "rotary_embedding_gptj",
+           shape_str({{"num_tokens", num_tokens},
+                      {"num_heads", NUM_HEADS},
+                      {"num_kv_heads", NUM_KV_HEADS},
+                      {"head_size", HEAD_SIZE}}),
+           elem_size * (2.0 * elems + num_tokens * HEAD_SIZE), 3.0 * elems,
+           [=]() mutable {
+             rotary_embedding(positions, query, key, HEAD_SIZE, cos_sin_cache,
+                              is_neox);
+           }});
+    }
+  }
+}
+
+#ifdef VLLM_CPU_BENCH_QUANT
+void add_quant_cases(std::vector<Case>& cases, const torch::ScalarType dtype) {
+  const double elem_size = c10::elementSize(dtype);
+  for (const int64_t num_tokens : {1, 16, 256, 2048}) {
+    torch::Tensor input = torch::randn({num_tokens, HIDDEN_SIZE}, dtype);
+    torch::Tensor out = torch::empty({num_tokens, HIDDEN_SIZE}, torch::kInt8);
+    torch::Tensor scale = torch::full({1}, 0.05, torch::kFloat);
+    torch::Tensor scales = torch::empty({num_tokens, 1}, torch::kFloat);
+    const double elems = input.numel();
+    const std::string shape = shape_str(
+        {{"num_tokens", num_tokens}, {"hidden_size", HIDDEN_SIZE}});
+    cases.push_back({"static_scaled_int8_quant", shape,
+                     (elem_size + 1.0) * elems, 2.0 * elems, [=]() mutable {
+                       static_scaled_int8_quant(out, input, scale,
+                                                c10::nullopt);
+                     }});
+    // The input is read twice, for the absmax and for the quantization.
+    cases.push_back({"dynamic_scaled_int8_quant", shape,
+                     (2.0 * elem_size + 1.0) * elems, 3.0 * elems,
+                     [=]() mutable {
+                       dynamic_scaled_int8_quant(out, input, scales,
+                                                 c10::nullopt);
+                     }});
+  }
+
+  for (const int64_t m : {1, 16, 256}) {
+    torch::Tensor a = torch::randint(-127, 128, {m, HIDDEN_SIZE}, torch::kInt8);
+    // Column-major [K, N].
+    torch::Tensor b =
+        torch::randint(-127, 128, {HIDDEN_SIZE, HIDDEN_SIZE}, torch::kInt8)
+            .t();
+    torch::Tensor a_scales = torch::rand({m, 1}, torch::kFloat);
+    torch::Tensor b_scales = torch::rand({HIDDEN_SIZE, 1}, torch::kFloat);
+    torch::Tensor c = torch::empty({m, HIDDEN_SIZE}, dtype);
+    cases.push_back({"int8_scaled_mm",
+                     shape_str({{"m", m}, {"n", HIDDEN_SIZE},
+                                {"k", HIDDEN_SIZE}}),
+                     1.0 * (a.numel() + b.numel()) + elem_size * c.numel(),
+                     2.0 * m * HIDDEN_SIZE * HIDDEN_SIZE, [=]() mutable {
+                       int8_scaled_mm(c, a, b, a_scales, b_scales,
+                                      c10::nullopt);
+                     }});
+  }
+}
+#endif
+
+// Dense layers run through torch on the CPU backend, benchmarked for the
+// roofline comparison with the custom kernels.
+void add_gemm_cases(std::vector<Case>& cases, const torch::ScalarType dtype) {
+  const double elem_size = c10::elementSize(dtype);
+  const std::pair<int64_t, int64_t> weights[] = {
+      {HIDDEN_SIZE, HIDDEN_SIZE}, {2 * INTERMEDIATE_SIZE, HIDDEN_SIZE}};
+  for (const int64_t m : {1, 16, 256}) {
+    for (const auto& [n, k] : weights) {
+      torch::Tensor input = torch::randn({m, k}, dtype);
+      torch::Tensor weight = torch::randn({n, k}, dtype);
+      torch::Tensor out = torch::empty({m, n}, dtype);
+      cases.push_back(
+          {"linear", shape_str({{"m", m}, {"n", n}, {"k", k}}),
+           elem_size * (input.numel() + weight.numel() + out.numel()),
+           2.0 * m * n * k,
+           [=]() mutable { torch::mm_out(out, input, weight.t()); }});
+    }
+  }
+}
+
+std::vector<Case> make_cases(const torch::ScalarType dtype,
+                             const std::vector<int64_t>& block_sizes) {
+  std::vector<Case> cases;
+  for (const int64_t block_size : block_sizes) {
+    add_attention_cases(cases, dtype, block_size);
+    add_cache_cases(cases, dtype, block_size);
+  }
+  add_norm_cases(cases, dtype);
+  add_activation_cases(cases, dtype);
+  add_rotary_cases(cases, dtype);
+#ifdef VLLM_CPU_BENCH_QUANT
+  add_quant_cases(cases, dtype);
+#endif
+  add_gemm_cases(cases, dtype);
+  return cases;
+}
+
+Result run_case(const Case& bench, const std::string& dtype,
+                const Roofline& roofline, const Options& opts) {
+  for (int i = 0; i < opts.warmup; ++i) bench.run();
+  std::vector<double> times_us(opts.iters);
+  for (int i = 0; i < opts.iters; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    bench.run();
+    times_us[i] = seconds_since(start) * 1e6;
+  }
+  std::sort(times_us.begin(), times_us.end());
+
+  Result result;
+  result.kernel = bench.kernel;
+  result.dtype = dtype;
+  result.shape = bench.shape;
+  result.threads = roofline.threads;
+  result.time_us = times_us[times_us.size() / 2];
+  result.min_time_us = times_us.front();
+  result.gbps = bench.bytes / result.time_us / 1e3;
+  result.gflops = bench.flops / result.time_us / 1e3;
+  result.bw_fraction = result.gbps / roofline.stream_gbps;
+  result.compute_fraction = result.gflops / roofline.peak_gflops;
+
+  // Separate passes, the barrier timing adds clock reads to the kernels.
+  cpu_profiler::profiling_level.store(1);
+  const int64_t barrier_start_ns = cpu_profiler::barrier_wait_ns.load();
+  for (int i = 0; i < opts.iters; ++i) bench.run();
+  result.barrier_us =
+      (cpu_profiler::barrier_wait_ns.load() - barrier_start_ns) / 1e3 /
+      opts.iters;
+  cpu_profiler::profiling_level.store(0);
+  return result;
+}
+
+void write_json(std::ostream& os, const std::vector<Roofline>& rooflines,
+                const std::vector<Result>& results, const int64_t subteams) {
+  char hostname[256] = {0};
+  gethostname(hostname, sizeof(hostname) - 1);
+  os << std::setprecision(6);
+  os << "{\n  \"machine\": {\n";
+  os << "    \"hostname\": \"" << hostname << "\",\n";
+  os << "    \"isa\": \"" << ISA << "\",\n";
+  os << "    \"max_threads\": " << omp_get_max_threads() << ",\n";
+  os << "    \"subteams\": " << subteams << ",\n";
+  os << "    \"roofline\": [";
+  for (size_t i = 0; i < rooflines.size(); ++i) {
+    const Roofline& r = rooflines[i];
+    os << (i ? ",\n" : "\n") << "      {\"threads\": " << r.threads
+       << ", \"stream_gbps\": " << r.stream_gbps
+       << ", \"peak_gflops\": " << r.peak_gflops << "}";
+  }
+  os << "\n    ]\n  },\n  \"results\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    os << (i ? ",\n" : "\n") << "    {\"kernel\": \"" << r.kernel
+       << "\", \"dtype\": \"" << r.dtype << "\", \"threads\": " << r.threads
+       << ", \"shape\": \"" << r.shape << "\", \"time_us\": " << r.time_us
+       << ", \"min_time_us\": " << r.min_time_us << ", \"gbps\": " << r.gbps
+       << ", \"gflops\": " << r.gflops
+       << ", \"bw_fraction\": " << r.bw_fraction
+       << ", \"compute_fraction\": " << r.compute_fraction
+       << ", \"barrier_us\": " << r.barrier_us << "}";
+  }
+  os << "\n  ]\n}\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const Options opts = parse_args(argc, argv);
+  torch::NoGradGuard no_grad;
+  torch::manual_seed(0);
+
+  std::vector<Roofline> rooflines;
+  std::vector<Result> results;
+  for (const int threads : opts.threads) {
+    set_threads(threads);
+    if (opts.subteams > 0) set_cpu_thread_subteams(opts.subteams);
+    const Roofline roofline{threads, measure_stream_gbps(),
+                            measure_peak_gflops()};
+    rooflines.push_back(roofline);
+    std::cerr << "threads=" << threads << " stream=" << roofline.stream_gbps
+              << " GB/s peak=" << roofline.peak_gflops << " GFLOP/s\n";
+
+    for (const std::string& dtype : opts.dtypes) {
+      for (const Case& bench :
+           make_cases(to_scalar_type(dtype), opts.block_sizes)) {
+        if (!opts.filter.empty() &&
+            bench.kernel.find(opts.filter) == std::string::npos) {
+          continue;
+        }
+        const Result result = run_case(bench, dtype, roofline, opts);
+        std::cerr << std::left << std::setw(28) << result.kernel
+                  << std::setw(10) << dtype << std::setw(64) << result.shape
+                  << std::right << std::setw(12) << result.time_us << " us "
+                  << std::setw(10) << result.gbps << " GB/s " << std::setw(10)
+                  << result.gflops << " GFLOP/s " << std::setw(10)
+                  << result.barrier_us << " us in barriers\n";
+        results.push_back(result);
+      }
+    }
+  }
+
+  if (opts.output.empty()) {
+    write_json(std::cout, rooflines, results, opts.subteams);
+  } else {
+    std::ofstream file(opts.output);
+    TORCH_CHECK(file.good(), "Cannot open ", opts.output);
+    write_json(file, rooflines, results, opts.subteams);
+  }
+  return 0;
+}
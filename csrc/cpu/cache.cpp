@@ -2,6 +2,8 @@
 #include <vector>
 
 #include "cpu_types.hpp"
+#include "kernel_tuner.hpp"
+#include "thread_subteams.hpp"
 
 namespace {
 template <typename scalar_t>
@@ -12,19 +14,39 @@ void copy_blocks_cpu_impl(std::vector<torch::Tensor> const& key_caches,
                           const int layer_num) {
   const size_t pair_num = mapping_pairs.size(0);
   const size_t block_bytes = sizeof(scalar_t) * element_num_per_block;
+  const int64_t* pairs = mapping_pairs.data_ptr<int64_t>();
+  const size_t prefetch_distance = cpu_tuner::prefetch_distance();
+  cpu_profiler::RegionTimer region_timer(omp_get_max_threads());
 #pragma omp parallel for collapse(2)
   for (int layer = 0; layer < layer_num; ++layer) {
     for (size_t pair = 0; pair < pair_num; ++pair) {
-      int64_t source_offset =
-          element_num_per_block * mapping_pairs[pair][0].item<int64_t>();
-      int64_t target_offset =
-          element_num_per_block * mapping_pairs[pair][1].item<int64_t>();
+      const cpu_profiler::FinishScope finish(region_timer);
       scalar_t* key_cache_ptr = key_caches[layer].data_ptr<scalar_t>();
+      scalar_t* value_cache_ptr = value_caches[layer].data_ptr<scalar_t>();
+      // The blocks of a pair are scattered in the cache, prefetch the ones
+      // copied `prefetch_distance` pairs later.
+      if (prefetch_distance > 0 && pair + prefetch_distance < pair_num) {
+        const size_t ahead = pair + prefetch_distance;
+        const int64_t ahead_source_offset =
+            element_num_per_block * pairs[2 * ahead];
+        const int64_t ahead_target_offset =
+            element_num_per_block * pairs[2 * ahead + 1];
+        vec_op::prefetch_range(key_cache_ptr + ahead_source_offset,
+                               block_bytes);
+        vec_op::prefetch_range(value_cache_ptr + ahead_source_offset,
+                               block_bytes);
+        vec_op::prefetch_write_range(key_cache_ptr + ahead_target_offset,
+                                     block_bytes);
+        vec_op::prefetch_write_range(value_cache_ptr + ahead_target_offset,
+                                     block_bytes);
+      }
+
+      int64_t source_offset = element_num_per_block * pairs[2 * pair];
+      int64_t target_offset = element_num_per_block * pairs[2 * pair + 1];
       scalar_t* source_ptr = key_cache_ptr + source_offset;
       scalar_t* target_ptr = key_cache_ptr + target_offset;
       std::memcpy(target_ptr, source_ptr, block_bytes);
 
-      scalar_t* value_cache_ptr = value_caches[layer].data_ptr<scalar_t>();
       source_ptr = value_cache_ptr + source_offset;
       target_ptr = value_cache_ptr + target_offset;
       std::memcpy(target_ptr, source_ptr, block_bytes);
@@ -40,45 +62,65 @@ void reshape_and_cache_cpu_impl(
     const int key_stride, const int value_stride, const int num_heads,
     const int head_size, const int block_size, const int x) {
   const int block_elem_num = num_heads * head_size * block_size;
+  const int head_elem_num = head_size * block_size;
+  const int prefetch_distance = cpu_tuner::prefetch_distance();
 
-#pragma omp parallel for collapse(2)
-  for (int token_idx = 0; token_idx < num_tokens; ++token_idx) {
-    for (int head_idx = 0; head_idx < num_heads; ++head_idx) {
-      const int64_t slot_idx = slot_mapping[token_idx];
-      if (slot_idx >= 0) {
-        int src_key_head_idx = token_idx * key_stride + head_idx * head_size;
-        int src_value_head_idx =
-            token_idx * value_stride + head_idx * head_size;
-        const scalar_t* src_key_head_ptr = key + src_key_head_idx;
-        const scalar_t* src_value_head_ptr = value + src_value_head_idx;
-        const int64_t block_index = slot_idx / block_size;
-        const int64_t block_offset = slot_idx % block_size;
-        scalar_t* target_key_head_ptr = key_cache +
-                                        block_elem_num * block_index +
-                                        head_idx * block_size * head_size;
-        scalar_t* target_value_head_ptr = value_cache +
+  cpu_threads::parallel_for(
+      static_cast<int64_t>(num_tokens) * num_heads, num_heads,
+      omp_get_max_threads(), false, [&](const int64_t item) {
+        const int token_idx = item / num_heads;
+        const int head_idx = item % num_heads;
+        const int64_t slot_idx = slot_mapping[token_idx];
+        // A token is scattered over the whole [head_size, block_size] slice of
+        // its head, pull in the slice of the token `prefetch_distance` tokens
+        // later when it lies in another block (decode batches).
+        const int ahead_token_idx = token_idx + prefetch_distance;
+        if (prefetch_distance > 0 && ahead_token_idx < num_tokens) {
+          const int64_t ahead_slot_idx = slot_mapping[ahead_token_idx];
+          if (ahead_slot_idx >= 0 &&
+              ahead_slot_idx / block_size != slot_idx / block_size) {
+            const int64_t ahead_offset =
+                block_elem_num * (ahead_slot_idx / block_size) +
+                head_idx * head_elem_num;
+            vec_op::prefetch_write_range(key_cache + ahead_offset,
+                                         head_elem_num * sizeof(scalar_t));
+            vec_op::prefetch_write_range(value_cache + ahead_offset,
+                                         head_elem_num * sizeof(scalar_t));
+          }
+        }
+        if (slot_idx >= 0) {
+          int src_key_head_idx = token_idx * key_stride + head_idx * head_size;
+          int src_value_head_idx =
+              token_idx * value_stride + head_idx * head_size;
+          const scalar_t* src_key_head_ptr = key + src_key_head_idx;
+          const scalar_t* src_value_head_ptr = value + src_value_head_idx;
+          const int64_t block_index = slot_idx / block_size;
+          const int64_t block_offset = slot_idx % block_size;
+          scalar_t* target_key_head_ptr = key_cache +
                                           block_elem_num * block_index +
                                           head_idx * block_size * head_size;
+          scalar_t* target_value_head_ptr = value_cache +
+                                            block_elem_num * block_index +
+                                            head_idx * block_size * head_size;
 
-        for (int src_key_idx = 0; src_key_idx < head_size; src_key_idx += x) {
-          const int64_t target_offset =
-              src_key_idx * block_size + block_offset * x;
-          for (int i = 0; i < x; ++i) {
-            target_key_head_ptr[target_offset + i] =
-                src_key_head_ptr[src_key_idx + i];
+          for (int src_key_idx = 0; src_key_idx < head_size; src_key_idx += x) {
+            const int64_t target_offset =
+                src_key_idx * block_size + block_offset * x;
+            for (int i = 0; i < x; ++i) {
+              target_key_head_ptr[target_offset + i] =
+                  src_key_head_ptr[src_key_idx + i];
+            }
           }
-        }
 
-        for (int src_value_idx = 0; src_value_idx < head_size;
-             ++src_value_idx) {
-          const int64_t target_offset =
-              src_value_idx * block_size + block_offset;
-          target_value_head_ptr[target_offset] =
-              src_value_head_ptr[src_value_idx];
+          for (int src_value_idx = 0; src_value_idx < head_size;
+               ++src_value_idx) {
+            const int64_t target_offset =
+                src_value_idx * block_size + block_offset;
+            target_value_head_ptr[target_offset] =
+                src_value_head_ptr[src_value_idx];
+          }
         }
-      }
-    }
-  }
+      });
 }
 };  // namespace
 
@@ -94,6 +136,9 @@ void copy_blocks(std::vector<torch::Tensor> const& key_caches,
     return;
   }
 
+  TORCH_CHECK(block_mapping.scalar_type() == at::ScalarType::Long &&
+                  block_mapping.is_contiguous(),
+              "block_mapping must be a contiguous int64 tensor");
   const int element_num_per_block = key_caches[0][0].numel();
   VLLM_DISPATCH_FLOATING_TYPES(
       key_caches[0].scalar_type(), "copy_blocks_cpu_impl", [&] {
@@ -123,6 +168,8 @@ void reshape_and_cache(torch::Tensor& key, torch::Tensor& value,
   VLLM_DISPATCH_FLOATING_TYPES(
       key.scalar_type(), "reshape_and_cache_cpu_impl", [&] {
         CPU_KERNEL_GUARD_IN(reshape_and_cache_cpu_impl)
+        CPU_KERNEL_GUARD_ANNOTATE(reshape_and_cache_cpu_impl, num_tokens,
+                                  2 * (key.nbytes() + value.nbytes()))
         reshape_and_cache_cpu_impl<scalar_t>(
             key.data_ptr<scalar_t>(), value.data_ptr<scalar_t>(),
             key_cache.data_ptr<scalar_t>(), value_cache.data_ptr<scalar_t>(),
@@ -0,0 +1,274 @@
+#include <numa.h>
+#include <c10/core/CPUAllocator.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "cpu_types.hpp"
+#include "numa_memory.hpp"
+
+// Size-class caching allocator of the CPU tensors, installed as the CPU
+// allocator of the worker process by enable_cpu_caching_allocator(). Freed
+// blocks stay in the free lists of their NUMA node and are handed out again
+// for the same size class, so a steady decode loop, which allocates the same
+// activation and scratch sizes every step, maps no memory and takes no page
+// faults. Blocks are mapped by cpu_memory::map_region() on the node of the
+// allocating thread and pre-faulted there. Blocks above MAX_CLASS_BYTES and
+// blocks freed while MAX_CACHED_BYTES are cached are unmapped right away, so
+// the cache stays bounded.
+namespace cpu_memory {
+
+namespace {
+// Smaller blocks come from malloc, whose arenas serve them without syscalls.
+constexpr size_t MIN_CACHED_BYTES = 64 << 10;
+// Up to this size blocks are rounded to 4 size classes per power of two, at
+// most 25% internal fragmentation. Larger ones (weights, prefill
+// activations) are rounded to LARGE_GRANULE only and never cached, each
+// distinct size would add a class.
+constexpr size_t MAX_CLASS_BYTES = 64 << 20;
+constexpr size_t LARGE_GRANULE = 2 << 20;
+// From this size on the size classes are multiples of 2 MiB, and transparent
+// huge pages back the blocks without rounding them up further.
+constexpr size_t HUGE_PAGE_MIN_BYTES = 8 << 20;
+// Free blocks beyond this are unmapped instead of cached.
+constexpr int64_t MAX_CACHED_BYTES = int64_t(2) << 30;
+
+size_t size_class(const size_t bytes) {
+  if (bytes > MAX_CLASS_BYTES) {
+    return (bytes + LARGE_GRANULE - 1) / LARGE_GRANULE * LARGE_GRANULE;
+  }
+  // A quarter of the largest power of two below bytes.
+  const size_t step = (size_t(1) << (63 - __builtin_clzll(bytes - 1))) / 4;
+  return (bytes + step - 1) / step * step;
+}
+
+void update_peak(std::atomic<int64_t>& peak, const int64_t value) {
+  int64_t current = peak.load(std::memory_order_relaxed);
+  while (value > current &&
+         !peak.compare_exchange_weak(current, value,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+void free_small(void* ptr) { std::free(ptr); }
+
+struct Block {
+  Region region;
+  // Size class, the key of the free list.
+  size_t bytes;
+  // Bytes of the current allocation.
+  size_t requested;
+  int pool;
+};
+
+struct Pool {
+  std::mutex mutex;
+  std::unordered_map<size_t, std::vector<Block*>> free_blocks;
+};
+
+// Bytes count blocks of at least MIN_CACHED_BYTES only.
+struct Stats {
+  // Requested bytes of the live blocks.
+  std::atomic<int64_t> allocated_bytes{0};
+  std::atomic<int64_t> peak_allocated_bytes{0};
+  // Mapped bytes of all blocks.
+  std::atomic<int64_t> reserved_bytes{0};
+  std::atomic<int64_t> peak_reserved_bytes{0};
+  // Mapped bytes of the free blocks.
+  std::atomic<int64_t> cached_bytes{0};
+  std::atomic<int64_t> allocs{0};
+  std::atomic<int64_t> cache_hits{0};
+  std::atomic<int64_t> maps{0};
+  std::atomic<int64_t> unmaps{0};
+};
+
+class CachingAllocator final : public c10::Allocator {
+ public:
+  CachingAllocator()
+      : numa_supported_(numa_available() != -1),
+        pools_(numa_supported_ ? numa_max_node() + 1 : 1) {
+    for (auto& pool : pools_) pool = std::make_unique<Pool>();
+  }
+
+  c10::DataPtr allocate(size_t n) override {
+    stats_.allocs.fetch_add(1, std::memory_order_relaxed);
+    if (n < MIN_CACHED_BYTES) {
+      void* data = nullptr;
+      if (n > 0) {
+        TORCH_CHECK(posix_memalign(&data, 64, n) == 0,
+                    "Failed to allocate ", n, " bytes");
+      }
+      return {data, data, &free_small, c10::Device(c10::DeviceType::CPU)};
+    }
+    Block* block = take(n);
+    return {block->region.addr, block, &release,
+            c10::Device(c10::DeviceType::CPU)};
+  }
+
+  void copy_data(void* dest, const void* src,
+                 std::size_t count) const override {
+    default_copy_data(dest, src, count);
+  }
+
+  // Unmaps the free blocks of all nodes.
+  void empty_cache() {
+    std::vector<Block*> blocks;
+    for (auto& pool : pools_) {
+      std::lock_guard<std::mutex> guard(pool->mutex);
+      for (auto& [bytes, free_list] : pool->free_blocks) {
+        blocks.insert(blocks.end(), free_list.begin(), free_list.end());
+      }
+      pool->free_blocks.clear();
+    }
+    for (Block* block : blocks) {
+      stats_.cached_bytes.fetch_sub(block->region.bytes,
+                                    std::memory_order_relaxed);
+      unmap(block);
+    }
+  }
+
+  const Stats& stats() const { return stats_; }
+
+  void reset_peak_stats() {
+    stats_.peak_allocated_bytes.store(stats_.allocated_bytes.load());
+    stats_.peak_reserved_bytes.store(stats_.reserved_bytes.load());
+  }
+
+ private:
+  static void release(void* ctx);
+
+  int pool_index() const {
+    if (!numa_supported_) return 0;
+    const int node = current_numa_node();
+    return node >= 0 && node < static_cast<int>(pools_.size()) ? node : 0;
+  }
+
+  Block* take(const size_t n) {
+    const size_t bytes = size_class(n);
+    const int pool_idx = pool_index();
+    Pool& pool = *pools_[pool_idx];
+    Block* block = nullptr;
+    {
+      std::lock_guard<std::mutex> guard(pool.mutex);
+      auto iter = pool.free_blocks.find(bytes);
+      if (iter != pool.free_blocks.end() && !iter->second.empty()) {
+        block = iter->second.back();
+        iter->second.pop_back();
+      }
+    }
+
+    if (block != nullptr) {
+      stats_.cache_hits.fetch_add(1, std::memory_order_relaxed);
+      stats_.cached_bytes.fetch_sub(block->region.bytes,
+                                    std::memory_order_relaxed);
+    } else {
+      const int node = numa_supported_ ? pool_idx : -1;
+      const HugePages huge_pages = bytes >= HUGE_PAGE_MIN_BYTES
+                                       ? HugePages::TRANSPARENT
+                                       : HugePages::NONE;
+      Region region;
+      try {
+        region = map_region(bytes, node, huge_pages);
+      } catch (const std::exception&) {
+        // The free blocks of other size classes or nodes may hold the
+        // memory, return them to the system and map once more.
+        empty_cache();
+        region = map_region(bytes, node, huge_pages);
+      }
+      block = new Block{region, bytes, 0, pool_idx};
+      stats_.maps.fetch_add(1, std::memory_order_relaxed);
+      update_peak(stats_.peak_reserved_bytes,
+                  stats_.reserved_bytes.fetch_add(region.bytes) +
+                      region.bytes);
+    }
+
+    block->requested = n;
+    update_peak(stats_.peak_allocated_bytes,
+                stats_.allocated_bytes.fetch_add(n) + n);
+    return block;
+  }
+
+  void put(Block* block) {
+    stats_.allocated_bytes.fetch_sub(block->requested,
+                                     std::memory_order_relaxed);
+    const int64_t mapped = block->region.bytes;
+    bool cached = block->bytes <= MAX_CLASS_BYTES;
+    if (cached && stats_.cached_bytes.fetch_add(mapped) + mapped >
+                      MAX_CACHED_BYTES) {
+      stats_.cached_bytes.fetch_sub(mapped, std::memory_order_relaxed);
+      cached = false;
+    }
+    if (!cached) {
+      unmap(block);
+      return;
+    }
+    Pool& pool = *pools_[block->pool];
+    std::lock_guard<std::mutex> guard(pool.mutex);
+    pool.free_blocks[block->bytes].push_back(block);
+  }
+
+  void unmap(Block* block) {
+    const int64_t mapped = block->region.bytes;
+    unmap_region(block->region);
+    stats_.reserved_bytes.fetch_sub(mapped, std::memory_order_relaxed);
+    stats_.unmaps.fetch_add(1, std::memory_order_relaxed);
+    delete block;
+  }
+
+  const bool numa_supported_;
+  std::vector<std::unique_ptr<Pool>> pools_;
+  Stats stats_;
+};
+
+// Never destroyed, tensors may be freed during the exit of the process.
+CachingAllocator& caching_allocator() {
+  static CachingAllocator* allocator = new CachingAllocator();
+  return *allocator;
+}
+
+void CachingAllocator::release(void* ctx) {
+  caching_allocator().put(static_cast<Block*>(ctx));
+}
+}  // namespace
+
+}  // namespace cpu_memory
+
+// Installs the caching allocator as the CPU allocator of the process. Tensors
+// allocated before keep the deleter of their allocator.
+void enable_cpu_caching_allocator() {
+  c10::SetCPUAllocator(&cpu_memory::caching_allocator(), /*priority=*/1);
+}
+
+void empty_cpu_allocator_cache() {
+  cpu_memory::caching_allocator().empty_cache();
+}
+
+// [allocated_bytes, peak_allocated_bytes, reserved_bytes,
+// peak_reserved_bytes, cached_bytes, internal_fragmentation_bytes, allocs,
+// cache_hits, maps, unmaps] of the caching allocator, see
+// cpu_memory::Stats. With reset_peak, the peaks restart from the current
+// values afterwards.
+std::vector<int64_t> get_cpu_allocator_stats(bool reset_peak) {
+  auto& allocator = cpu_memory::caching_allocator();
+  const auto& stats = allocator.stats();
+  const int64_t allocated = stats.allocated_bytes.load();
+  const int64_t reserved = stats.reserved_bytes.load();
+  const int64_t cached = stats.cached_bytes.load();
+  std::vector<int64_t> result = {allocated,
+                                 stats.peak_allocated_bytes.load(),
+                                 reserved,
+                                 stats.peak_reserved_bytes.load(),
+                                 cached,
+                                 reserved - cached - allocated,
+                                 stats.allocs.load(),
+                                 stats.cache_hits.load(),
+                                 stats.maps.load(),
+                                 stats.unmaps.load()};
+  if (reset_peak) allocator.reset_peak_stats();
+  return result;
+}
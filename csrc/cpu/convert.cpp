@@ -0,0 +1,404 @@
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include "cpu_types.hpp"
+
+namespace {
+// Elements converted by one OpenMP iteration. The static schedule hands
+// every thread the same contiguous range of the output on each call, so an
+// output freshly allocated by the caller is first touched, and therefore
+// placed, on the NUMA node of the thread that will convert it again when
+// the threads are bound by init_cpu_threads_env.
+constexpr int64_t CONVERT_CHUNK = 16 * 1024;
+
+void bf16_to_fp32_impl(float* __restrict__ out,
+                       const c10::BFloat16* __restrict__ input,
+                       const int64_t numel) {
+  constexpr int VEC_ELEM_NUM = 16;
+  const int64_t chunk_num = (numel + CONVERT_CHUNK - 1) / CONVERT_CHUNK;
+
+  cpu_profiler::RegionTimer region_timer(omp_get_max_threads());
+#pragma omp parallel for schedule(static)
+  for (int64_t chunk = 0; chunk < chunk_num; ++chunk) {
+    const cpu_profiler::FinishScope finish(region_timer);
+    const int64_t start = chunk * CONVERT_CHUNK;
+    const int64_t end = std::min(start + CONVERT_CHUNK, numel);
+    int64_t i = start;
+    for (; i + VEC_ELEM_NUM <= end; i += VEC_ELEM_NUM) {
+      vec_op::FP32Vec16(vec_op::BF16Vec16(input + i)).save(out + i);
+    }
+    for (; i < end; ++i) {
+      out[i] = static_cast<float>(input[i]);
+    }
+  }
+}
+
+// Round to nearest even by the integer arithmetic of the scalar and VXE
+// backends, NaNs become the quiet NaN as in c10::BFloat16. The BF16Vec16
+// conversion is not used: x86 truncates without AVX512-BF16 and flushes
+// denormals with it. The loop over the words is vectorized by the compiler
+// on every backend.
+FORCE_INLINE uint16_t round_bf16(const uint32_t bits) {
+  const uint32_t rounded = (bits + 0x7FFF + ((bits >> 16) & 1)) >> 16;
+  return (bits & 0x7FFFFFFF) > 0x7F800000 ? 0x7FC0 : rounded;
+}
+
+void fp32_to_bf16_impl(c10::BFloat16* __restrict__ out,
+                       const float* __restrict__ input, const int64_t numel) {
+  const int64_t chunk_num = (numel + CONVERT_CHUNK - 1) / CONVERT_CHUNK;
+
+  cpu_profiler::RegionTimer region_timer(omp_get_max_threads());
+#pragma omp parallel for schedule(static)
+  for (int64_t chunk = 0; chunk < chunk_num; ++chunk) {
+    const cpu_profiler::FinishScope finish(region_timer);
+    const int64_t start = chunk * CONVERT_CHUNK;
+    const int64_t end = std::min(start + CONVERT_CHUNK, numel);
+#pragma omp simd
+    for (int64_t i = start; i < end; ++i) {
+      uint32_t bits;
+      std::memcpy(&bits, input + i, sizeof(bits));
+      const uint16_t result = round_bf16(bits);
+      std::memcpy(out + i, &result, sizeof(result));
+    }
+  }
+}
+
+// Chunks of CONVERT_CHUNK FP32 elements, so that a weight loaded as FP32
+// and converted later is touched by the same thread both times.
+void copy_impl(char* __restrict__ out, const char* __restrict__ input,
+               const int64_t nbytes) {
+  constexpr int64_t CHUNK_BYTES = CONVERT_CHUNK * sizeof(float);
+  const int64_t chunk_num = (nbytes + CHUNK_BYTES - 1) / CHUNK_BYTES;
+
+  cpu_profiler::RegionTimer region_timer(omp_get_max_threads());
+#pragma omp parallel for schedule(static)
+  for (int64_t chunk = 0; chunk < chunk_num; ++chunk) {
+    const cpu_profiler::FinishScope finish(region_timer);
+    const int64_t start = chunk * CHUNK_BYTES;
+    std::memcpy(out + start, input + start,
+                std::min(CHUNK_BYTES, nbytes - start));
+  }
+}
+
+// Encodings of the little-endian tensors of a checkpoint, the src_format of
+// convert_le_weight().
+enum class LEFormat : int {
+  BF16 = 0,
+  FP16 = 1,
+  FP32 = 2,
+  INT8 = 3,
+  // Two's complement nibbles, the low nibble of each byte first.
+  INT4 = 4,
+};
+
+int64_t le_bytes(const LEFormat format, const int64_t numel) {
+  switch (format) {
+    case LEFormat::BF16:
+    case LEFormat::FP16:
+      return 2 * numel;
+    case LEFormat::FP32:
+      return 4 * numel;
+    case LEFormat::INT8:
+      return numel;
+    case LEFormat::INT4:
+      return (numel + 1) / 2;
+  }
+  return 0;
+}
+
+uint32_t le_word(const uint8_t* bytes, const int word_bytes) {
+  uint32_t word = 0;
+  for (int b = word_bytes - 1; b >= 0; --b) word = word << 8 | bytes[b];
+  return word;
+}
+
+float fp32_from_bits(const uint32_t bits) {
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Element idx of a little-endian tensor, assembled byte by byte whatever the
+// host byte order. The reference the verification checks the vectorized
+// conversion against.
+float le_element(const uint8_t* input, const LEFormat format,
+                 const int64_t idx) {
+  switch (format) {
+    case LEFormat::BF16:
+      return fp32_from_bits(le_word(input + 2 * idx, 2) << 16);
+    case LEFormat::FP16:
+      return static_cast<float>(
+          c10::Half(le_word(input + 2 * idx, 2), c10::Half::from_bits()));
+    case LEFormat::FP32:
+      return fp32_from_bits(le_word(input + 4 * idx, 4));
+    case LEFormat::INT8:
+      return static_cast<int8_t>(input[idx]);
+    case LEFormat::INT4: {
+      const int nibble = (input[idx / 2] >> (idx % 2 * 4)) & 0xF;
+      return (nibble ^ 8) - 8;
+    }
+  }
+  return 0.0f;
+}
+
+template <typename scalar_t>
+FORCE_INLINE void store_fp32_vec(const vec_op::FP32Vec16& v,
+                                 scalar_t* __restrict__ out) {
+  if constexpr (std::is_same_v<scalar_t, float>) {
+    v.save(out);
+  } else {
+    vec_op::BF16Vec16(v).save(out);
+  }
+}
+
+// Converts the 16 elements from idx on. Floating point words are brought
+// into host byte order by vec_op::load_le_words(), a permute per vector on
+// s390x, and converted in registers.
+template <typename scalar_t, LEFormat FORMAT>
+FORCE_INLINE void le_convert_vec(scalar_t* __restrict__ out,
+                                 const uint8_t* __restrict__ input,
+                                 const int64_t idx) {
+  constexpr int VEC_ELEM_NUM = 16;
+  if constexpr (FORMAT == LEFormat::BF16) {
+    if constexpr (std::is_same_v<scalar_t, c10::BFloat16>) {
+      vec_op::load_le_words<2>(out, input + 2 * idx, VEC_ELEM_NUM);
+    } else {
+      alignas(64) c10::BFloat16 words[VEC_ELEM_NUM];
+      vec_op::load_le_words<2>(words, input + 2 * idx, VEC_ELEM_NUM);
+      vec_op::FP32Vec16(vec_op::BF16Vec16(words)).save(out);
+    }
+  } else if constexpr (FORMAT == LEFormat::FP16) {
+    alignas(64) c10::Half words[VEC_ELEM_NUM];
+    vec_op::load_le_words<2>(words, input + 2 * idx, VEC_ELEM_NUM);
+    store_fp32_vec(vec_op::FP32Vec16(vec_op::FP16Vec16(words)), out);
+  } else if constexpr (FORMAT == LEFormat::FP32) {
+    if constexpr (std::is_same_v<scalar_t, float>) {
+      vec_op::load_le_words<4>(out, input + 4 * idx, VEC_ELEM_NUM);
+    } else {
+      alignas(64) float words[VEC_ELEM_NUM];
+      vec_op::load_le_words<4>(words, input + 4 * idx, VEC_ELEM_NUM);
+      store_fp32_vec(vec_op::FP32Vec16(words), out);
+    }
+  } else {
+    alignas(64) float values[VEC_ELEM_NUM];
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) {
+      values[i] = le_element(input, FORMAT, idx + i);
+    }
+    store_fp32_vec(vec_op::FP32Vec16(values), out);
+  }
+}
+
+template <typename scalar_t, LEFormat FORMAT>
+void le_convert_impl(scalar_t* __restrict__ out,
+                     const uint8_t* __restrict__ input, const int64_t numel) {
+  constexpr int VEC_ELEM_NUM = 16;
+  const int64_t chunk_num = (numel + CONVERT_CHUNK - 1) / CONVERT_CHUNK;
+
+  cpu_profiler::RegionTimer region_timer(omp_get_max_threads());
+#pragma omp parallel for schedule(static)
+  for (int64_t chunk = 0; chunk < chunk_num; ++chunk) {
+    const cpu_profiler::FinishScope finish(region_timer);
+    const int64_t start = chunk * CONVERT_CHUNK;
+    const int64_t end = std::min(start + CONVERT_CHUNK, numel);
+    int64_t i = start;
+    for (; i + VEC_ELEM_NUM <= end; i += VEC_ELEM_NUM) {
+      le_convert_vec<scalar_t, FORMAT>(out + i, input, i);
+    }
+    for (; i < end; ++i) {
+      if constexpr (FORMAT == LEFormat::BF16 &&
+                    std::is_same_v<scalar_t, c10::BFloat16>) {
+        vec_op::load_le_words<2>(out + i, input + 2 * i, 1);
+      } else {
+        vec_op::storeFP32(le_element(input, FORMAT, i), out + i);
+      }
+    }
+  }
+}
+
+// Whether value is the element rounded to BF16 by one of the backends:
+// rounded to nearest even, any NaN matching any NaN, truncated (x86 without
+// AVX512-BF16, which turns NaNs with a low payload into infinities) or
+// flushed to zero when denormal (AVX512-BF16).
+bool is_bf16_rounding(const float value, const float element) {
+  uint32_t value_bits, bits;
+  std::memcpy(&value_bits, &value, sizeof(value_bits));
+  std::memcpy(&bits, &element, sizeof(bits));
+  if (value_bits == (bits & 0xFFFF0000)) return true;
+  if (std::isnan(element)) return std::isnan(value);
+  return value == static_cast<float>(c10::BFloat16(element)) ||
+         (value == 0.0f && std::fabs(element) < FLT_MIN);
+}
+
+// Number of elements of out that differ from the reference. Conversions
+// which are exact (all but FP32 and FP16 to BF16) must round-trip: encoding
+// the element back gives the input bytes, NaN payloads included except for
+// FP16. Rounding conversions must give one of the BF16 roundings of the
+// element.
+template <typename scalar_t>
+int64_t le_verify(const scalar_t* __restrict__ out,
+                  const uint8_t* __restrict__ input, const LEFormat format,
+                  const int64_t numel) {
+  constexpr bool OUT_BF16 = std::is_same_v<scalar_t, c10::BFloat16>;
+  int64_t mismatches = 0;
+#pragma omp parallel for schedule(static) reduction(+ : mismatches)
+  for (int64_t i = 0; i < numel; ++i) {
+    const float value = static_cast<float>(out[i]);
+    uint32_t out_bits;
+    std::memcpy(&out_bits, &value, sizeof(out_bits));
+    bool ok;
+    switch (format) {
+      case LEFormat::BF16:
+        ok = (out_bits >> 16) == le_word(input + 2 * i, 2);
+        break;
+      case LEFormat::FP16:
+        if (OUT_BF16) {
+          ok = is_bf16_rounding(value, le_element(input, format, i));
+        } else {
+          ok = std::isnan(value)
+                   ? std::isnan(le_element(input, format, i))
+                   : c10::Half(value).x == le_word(input + 2 * i, 2);
+        }
+        break;
+      case LEFormat::FP32:
+        if (OUT_BF16) {
+          ok = is_bf16_rounding(value, le_element(input, format, i));
+        } else {
+          ok = out_bits == le_word(input + 4 * i, 4);
+        }
+        break;
+      default: {
+        // Small integers are exact in both BF16 and FP32.
+        const float expected = le_element(input, format, i);
+        ok = value == expected;
+        break;
+      }
+    }
+    mismatches += !ok;
+  }
+  return mismatches;
+}
+
+void check_convert_args(const torch::Tensor& out, const torch::Tensor& input,
+                        const at::ScalarType out_type,
+                        const at::ScalarType input_type) {
+  TORCH_CHECK(out.scalar_type() == out_type, "out must be ", out_type,
+              ", got ", out.scalar_type());
+  TORCH_CHECK(input.scalar_type() == input_type, "input must be ", input_type,
+              ", got ", input.scalar_type());
+  TORCH_CHECK(out.is_contiguous() && input.is_contiguous(),
+              "out and input must be contiguous");
+  TORCH_CHECK(out.numel() == input.numel(), "out has ", out.numel(),
+              " elements, input has ", input.numel());
+}
+}  // namespace
+
+// Round-to-nearest-even conversions of contiguous tensors of any shape,
+// used to load BF16 checkpoints into FP32 models (and back) and to cast
+// the KV cache.
+void convert_bf16_to_fp32(torch::Tensor& out, const torch::Tensor& input) {
+  check_convert_args(out, input, at::ScalarType::Float,
+                     at::ScalarType::BFloat16);
+  const int64_t numel = input.numel();
+
+  CPU_KERNEL_GUARD_IN(bf16_to_fp32_impl)
+  CPU_KERNEL_GUARD_ANNOTATE(bf16_to_fp32_impl, numel,
+                            input.nbytes() + out.nbytes())
+  bf16_to_fp32_impl(out.data_ptr<float>(), input.data_ptr<c10::BFloat16>(),
+                    numel);
+  CPU_KERNEL_GUARD_OUT(bf16_to_fp32_impl)
+}
+
+void convert_fp32_to_bf16(torch::Tensor& out, const torch::Tensor& input) {
+  check_convert_args(out, input, at::ScalarType::BFloat16,
+                     at::ScalarType::Float);
+  const int64_t numel = input.numel();
+
+  CPU_KERNEL_GUARD_IN(fp32_to_bf16_impl)
+  CPU_KERNEL_GUARD_ANNOTATE(fp32_to_bf16_impl, numel,
+                            input.nbytes() + out.nbytes())
+  fp32_to_bf16_impl(out.data_ptr<c10::BFloat16>(), input.data_ptr<float>(),
+                    numel);
+  CPU_KERNEL_GUARD_OUT(fp32_to_bf16_impl)
+}
+
+// Copies a contiguous tensor into a contiguous one of the same type and
+// number of elements. Used to load weights from a mapped checkpoint, the
+// threads fault in their chunks of the file in parallel.
+void copy_contiguous(torch::Tensor& out, const torch::Tensor& input) {
+  check_convert_args(out, input, input.scalar_type(), out.scalar_type());
+  const int64_t nbytes = input.nbytes();
+
+  CPU_KERNEL_GUARD_IN(copy_impl)
+  CPU_KERNEL_GUARD_ANNOTATE(copy_impl, input.numel(), 2 * nbytes)
+  copy_impl(static_cast<char*>(out.data_ptr()),
+            static_cast<const char*>(input.data_ptr()), nbytes);
+  CPU_KERNEL_GUARD_OUT(copy_impl)
+}
+
+// Converts the little-endian tensor in the bytes of input, e.g. a view of a
+// mapped checkpoint, to a contiguous FP32 or BF16 tensor in host byte order.
+// src_format is a LEFormat. With verify, the result is checked against the
+// reference conversion and the number of mismatching elements returned.
+int64_t convert_le_weight(torch::Tensor& out, const torch::Tensor& input,
+                          int64_t src_format, bool verify) {
+  TORCH_CHECK(src_format >= 0 && src_format <= 4,
+              "src_format must be 0 (bf16), 1 (fp16), 2 (fp32), 3 (int8) or "
+              "4 (int4), got ",
+              src_format);
+  TORCH_CHECK(out.scalar_type() == at::ScalarType::Float ||
+                  out.scalar_type() == at::ScalarType::BFloat16,
+              "out must be float or bfloat16, got ", out.scalar_type());
+  TORCH_CHECK(input.scalar_type() == at::ScalarType::Byte,
+              "input must be the uint8 bytes of the tensor, got ",
+              input.scalar_type());
+  TORCH_CHECK(out.is_contiguous() && input.is_contiguous(),
+              "out and input must be contiguous");
+  const LEFormat format = static_cast<LEFormat>(src_format);
+  const int64_t numel = out.numel();
+  TORCH_CHECK(input.numel() == le_bytes(format, numel), "input has ",
+              input.numel(), " bytes, ", numel, " elements take ",
+              le_bytes(format, numel));
+  const uint8_t* input_ptr = input.data_ptr<uint8_t>();
+
+#define LAUNCH_LE_CONVERT(T, FORMAT) \
+  le_convert_impl<T, LEFormat::FORMAT>(out.data_ptr<T>(), input_ptr, numel);
+
+#define LAUNCH_LE_CONVERT_FORMAT(T) \
+  switch (format) {                 \
+    case LEFormat::BF16:            \
+      LAUNCH_LE_CONVERT(T, BF16)    \
+      break;                        \
+    case LEFormat::FP16:            \
+      LAUNCH_LE_CONVERT(T, FP16)    \
+      break;                        \
+    case LEFormat::FP32:            \
+      LAUNCH_LE_CONVERT(T, FP32)    \
+      break;                        \
+    case LEFormat::INT8:            \
+      LAUNCH_LE_CONVERT(T, INT8)    \
+      break;                        \
+    case LEFormat::INT4:            \
+      LAUNCH_LE_CONVERT(T, INT4)    \
+      break;                        \
+  }
+
+  CPU_KERNEL_GUARD_IN(le_convert_impl)
+  CPU_KERNEL_GUARD_ANNOTATE(le_convert_impl, numel,
+                            input.nbytes() + out.nbytes())
+  if (out.scalar_type() == at::ScalarType::Float) {
+    LAUNCH_LE_CONVERT_FORMAT(float)
+  } else {
+    LAUNCH_LE_CONVERT_FORMAT(c10::BFloat16)
+  }
+  CPU_KERNEL_GUARD_OUT(le_convert_impl)
+
+#undef LAUNCH_LE_CONVERT_FORMAT
+#undef LAUNCH_LE_CONVERT
+
+  if (!verify) return 0;
+  if (out.scalar_type() == at::ScalarType::Float) {
+    return le_verify(out.data_ptr<float>(), input_ptr, format, numel);
+  }
+  return le_verify(out.data_ptr<c10::BFloat16>(), input_ptr, format, numel);
+}
@@ -2,7 +2,10 @@
 #ifndef CPU_TYPES_HPP
 #define CPU_TYPES_HPP
 
-#if defined(__x86_64__)
+#if defined(VLLM_CPU_SCALAR_VEC_OP)
+  //portable scalar implementation
+  #include "cpu_types_scalar.hpp"
+#elif defined(__x86_64__)
   //x86 implementation
   #include "cpu_types_x86.hpp"
 #elif defined(__POWER9_VECTOR__)
@@ -12,7 +15,28 @@
   //s390 implementation
   #include "cpu_types_vxe.hpp"
 #else
-  #warning "unsupported vLLM cpu implementation"
+  #warning "unsupported vLLM cpu implementation, using the scalar vec_op"
+  #define VLLM_CPU_SCALAR_VEC_OP
+  #include "cpu_types_scalar.hpp"
 #endif
 
+namespace vec_op {
+
+// Prefetches every cache line of [addr, addr + bytes) of the backend.
+inline void prefetch_range(const void *addr, const int64_t bytes) {
+  const char *ptr = static_cast<const char *>(addr);
+  for (int64_t offset = 0; offset < bytes; offset += CACHE_LINE_SIZE) {
+    prefetch(ptr + offset);
+  }
+}
+
+inline void prefetch_write_range(const void *addr, const int64_t bytes) {
+  const char *ptr = static_cast<const char *>(addr);
+  for (int64_t offset = 0; offset < bytes; offset += CACHE_LINE_SIZE) {
+    prefetch_write(ptr + offset);
+  }
+}
+
+}; // namespace vec_op
+
 #endif
@@ -0,0 +1,64 @@
+
+#ifndef CPU_TYPES_FP16_HPP
+#define CPU_TYPES_FP16_HPP
+
+#include <cstdint>
+
+// Branch-free FP16 <-> FP32 conversions of 4 lanes in GCC generic vectors,
+// for the backends without half precision conversion instructions (VXE,
+// VSX and x86 without F16C). They compile to plain vector integer and FP32
+// instructions on any target and give the same results as c10::Half:
+// round to nearest even, denormals kept, NaNs become the quiet NaN 0x7E00
+// with the sign of the input.
+namespace vec_op {
+namespace fp16 {
+
+typedef uint32_t u32x4_t __attribute__((vector_size(16)));
+typedef int32_t i32x4_t __attribute__((vector_size(16)));
+typedef float f32x4_t __attribute__((vector_size(16)));
+
+inline u32x4_t splat(uint32_t v) { return u32x4_t{v, v, v, v}; }
+
+// Lanes of a where the comparison mask is set, of b elsewhere.
+inline u32x4_t select(i32x4_t mask, u32x4_t a, u32x4_t b) {
+  const u32x4_t m = (u32x4_t)mask;
+  return (a & m) | (b & ~m);
+}
+
+// FP16 bit patterns in the high halfword of each lane to FP32.
+inline f32x4_t fp16_to_fp32(u32x4_t w) {
+  const u32x4_t sign = w & 0x80000000u;
+  const u32x4_t two_w = w + w;
+  // Normal numbers, infinities and NaNs: rebias the exponent by scaling.
+  const f32x4_t normalized =
+      (f32x4_t)((two_w >> 4) + (0xE0u << 23)) * 0x1.0p-112f;
+  // Denormals: place the mantissa in [0.5, 1) and subtract 0.5.
+  const f32x4_t denormalized =
+      (f32x4_t)((two_w >> 17) | (126u << 23)) - 0.5f;
+  const i32x4_t is_denormal = two_w < splat(1u << 27);
+  return (f32x4_t)(sign | select(is_denormal, (u32x4_t)denormalized,
+                                 (u32x4_t)normalized));
+}
+
+// FP32 to FP16 bit patterns in the low halfword of each lane.
+inline u32x4_t fp32_to_fp16(f32x4_t f) {
+  const u32x4_t w = (u32x4_t)f;
+  const u32x4_t shl1_w = w + w;
+  const u32x4_t sign = w & 0x80000000u;
+  // Overflows to infinity, then lets the FP32 adder round the mantissa to
+  // the FP16 precision of the exponent of the input.
+  const f32x4_t abs_f = (f32x4_t)(w & 0x7FFFFFFFu);
+  f32x4_t base = (abs_f * 0x1.0p+112f) * 0x1.0p-110f;
+  u32x4_t bias = shl1_w & 0xFF000000u;
+  bias = select(bias < splat(0x71000000u), splat(0x71000000u), bias);
+  base = (f32x4_t)((bias >> 1) + 0x07800000u) + base;
+  const u32x4_t bits = (u32x4_t)base;
+  const u32x4_t nonsign = ((bits >> 13) & 0x00007C00u) + (bits & 0x00000FFFu);
+  return (sign >> 16) |
+         select(shl1_w > splat(0xFF000000u), splat(0x7E00u), nonsign);
+}
+
+}; // namespace fp16
+}; // namespace vec_op
+
+#endif
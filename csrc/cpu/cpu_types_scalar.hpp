@@ -0,0 +1,497 @@
+
+#ifndef CPU_TYPES_SCALAR_HPP
+#define CPU_TYPES_SCALAR_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <torch/all.h>
+
+#include "kernel_profiler.hpp"
+
+// Portable scalar implementation of the vec_op interface in vec_op::scalar.
+// It is the reference csrc/cpu/tests/vec_op_conformance.cpp checks the SIMD
+// backends against, and the vec_op backend itself if VLLM_CPU_SCALAR_VEC_OP
+// is defined, so that kernels can be developed and tested on any host.
+//
+// Conversions from FP32 to BF16 round to nearest even and turn NaNs into the
+// quiet NaN 0x7FC0, like c10::BFloat16. Conversions to FP16 round to nearest
+// even, keep denormals and turn NaNs into the quiet NaN 0x7E00 with the sign
+// of the input, like c10::Half. BF16 and FP16 values are kept as native
+// uint16_t bit patterns, which holds for either byte order.
+namespace vec_op {
+namespace scalar {
+
+namespace {
+template <typename T, T... indexes, typename F>
+constexpr void unroll_loop_item(std::integer_sequence<T, indexes...>, F &&f) {
+  (f(std::integral_constant<T, indexes>{}), ...);
+}
+}; // namespace
+
+template <typename T, T count, typename F,
+          typename = std::enable_if_t<std::is_invocable_v<F, T>>>
+constexpr void unroll_loop(F &&f) {
+  unroll_loop_item(std::make_integer_sequence<T, count>{}, std::forward<F>(f));
+}
+
+template <typename T> struct Vec {
+  constexpr static int get_elem_num() { return T::VEC_ELEM_NUM; }
+};
+
+inline float bf16_to_fp32(uint16_t v) {
+  const uint32_t bits = static_cast<uint32_t>(v) << 16;
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+inline uint16_t fp32_to_bf16(float v) {
+  uint32_t bits;
+  std::memcpy(&bits, &v, sizeof(bits));
+  if ((bits & 0x7FFFFFFF) > 0x7F800000) return 0x7FC0;
+  const uint32_t rounding_bias = 0x7FFF + ((bits >> 16) & 1);
+  return static_cast<uint16_t>((bits + rounding_bias) >> 16);
+}
+
+inline float fp32_from_bits(uint32_t bits) {
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+inline uint32_t fp32_to_bits(float v) {
+  uint32_t bits;
+  std::memcpy(&bits, &v, sizeof(bits));
+  return bits;
+}
+
+inline float fp16_to_fp32(uint16_t v) {
+  const uint32_t w = static_cast<uint32_t>(v) << 16;
+  const uint32_t sign = w & 0x80000000;
+  const uint32_t two_w = w + w;
+  const float normalized =
+      fp32_from_bits((two_w >> 4) + (0xE0u << 23)) * 0x1.0p-112f;
+  const float denormalized =
+      fp32_from_bits((two_w >> 17) | (126u << 23)) - 0.5f;
+  return fp32_from_bits(sign | (two_w < (1u << 27)
+                                    ? fp32_to_bits(denormalized)
+                                    : fp32_to_bits(normalized)));
+}
+
+inline uint16_t fp32_to_fp16(float v) {
+  const uint32_t w = fp32_to_bits(v);
+  const uint32_t shl1_w = w + w;
+  const uint32_t sign = w & 0x80000000;
+  float base = (std::fabs(v) * 0x1.0p+112f) * 0x1.0p-110f;
+  uint32_t bias = shl1_w & 0xFF000000;
+  if (bias < 0x71000000) bias = 0x71000000;
+  base = fp32_from_bits((bias >> 1) + 0x07800000) + base;
+  const uint32_t bits = fp32_to_bits(base);
+  const uint32_t nonsign = ((bits >> 13) & 0x00007C00) + (bits & 0x00000FFF);
+  return static_cast<uint16_t>((sign >> 16) |
+                               (shl1_w > 0xFF000000 ? 0x7E00 : nonsign));
+}
+
+struct FP32Vec8;
+struct FP32Vec16;
+
+struct FP16Vec8 : public Vec<FP16Vec8> {
+  constexpr static int VEC_ELEM_NUM = 8;
+
+  uint16_t reg[VEC_ELEM_NUM];
+
+  explicit FP16Vec8(const void *ptr) { std::memcpy(reg, ptr, sizeof(reg)); }
+
+  explicit FP16Vec8(const FP32Vec8 &);
+
+  void save(void *ptr) const { std::memcpy(ptr, reg, sizeof(reg)); }
+};
+
+struct FP16Vec16 : public Vec<FP16Vec16> {
+  constexpr static int VEC_ELEM_NUM = 16;
+
+  uint16_t reg[VEC_ELEM_NUM];
+
+  explicit FP16Vec16(const void *ptr) { std::memcpy(reg, ptr, sizeof(reg)); }
+
+  explicit FP16Vec16(const FP32Vec16 &);
+
+  void save(void *ptr) const { std::memcpy(ptr, reg, sizeof(reg)); }
+
+  void save(void *ptr, const int elem_num) const {
+    std::memcpy(ptr, reg, elem_num * sizeof(uint16_t));
+  }
+};
+
+struct BF16Vec8 : public Vec<BF16Vec8> {
+  constexpr static int VEC_ELEM_NUM = 8;
+
+  uint16_t reg[VEC_ELEM_NUM];
+
+  explicit BF16Vec8(const void *ptr) { std::memcpy(reg, ptr, sizeof(reg)); }
+
+  explicit BF16Vec8(const FP32Vec8 &);
+
+  void save(void *ptr) const { std::memcpy(ptr, reg, sizeof(reg)); }
+};
+
+struct BF16Vec16 : public Vec<BF16Vec16> {
+  constexpr static int VEC_ELEM_NUM = 16;
+
+  uint16_t reg[VEC_ELEM_NUM];
+
+  explicit BF16Vec16(const void *ptr) { std::memcpy(reg, ptr, sizeof(reg)); }
+
+  explicit BF16Vec16(const FP32Vec16 &);
+
+  void save(void *ptr) const { std::memcpy(ptr, reg, sizeof(reg)); }
+
+  void save(void *ptr, const int elem_num) const {
+    std::memcpy(ptr, reg, elem_num * sizeof(uint16_t));
+  }
+};
+
+struct BF16Vec32 : public Vec<BF16Vec32> {
+  constexpr static int VEC_ELEM_NUM = 32;
+
+  uint16_t reg[VEC_ELEM_NUM];
+
+  explicit BF16Vec32(const void *ptr) { std::memcpy(reg, ptr, sizeof(reg)); }
+
+  explicit BF16Vec32(const BF16Vec8 &vec8_data) {
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) {
+      reg[i] = vec8_data.reg[i % BF16Vec8::VEC_ELEM_NUM];
+    }
+  }
+
+  void save(void *ptr) const { std::memcpy(ptr, reg, sizeof(reg)); }
+};
+
+struct FP32Vec4 : public Vec<FP32Vec4> {
+  constexpr static int VEC_ELEM_NUM = 4;
+
+  float reg[VEC_ELEM_NUM];
+
+  explicit FP32Vec4(float v) {
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) reg[i] = v;
+  }
+
+  explicit FP32Vec4() : FP32Vec4(0.0f) {}
+
+  explicit FP32Vec4(const float *ptr) { std::memcpy(reg, ptr, sizeof(reg)); }
+
+  explicit FP32Vec4(const FP32Vec4 &data) {
+    std::memcpy(reg, data.reg, sizeof(reg));
+  }
+};
+
+struct FP32Vec8 : public Vec<FP32Vec8> {
+  constexpr static int VEC_ELEM_NUM = 8;
+
+  float reg[VEC_ELEM_NUM];
+
+  explicit FP32Vec8(float v) {
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) reg[i] = v;
+  }
+
+  explicit FP32Vec8() : FP32Vec8(0.0f) {}
+
+  explicit FP32Vec8(const float *ptr) { std::memcpy(reg, ptr, sizeof(reg)); }
+
+  explicit FP32Vec8(const FP32Vec8 &data) {
+    std::memcpy(reg, data.reg, sizeof(reg));
+  }
+
+  explicit FP32Vec8(const FP16Vec8 &v) {
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) reg[i] = fp16_to_fp32(v.reg[i]);
+  }
+
+  explicit FP32Vec8(const BF16Vec8 &v) {
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) reg[i] = bf16_to_fp32(v.reg[i]);
+  }
+
+  float reduce_sum() const {
+    float result = 0;
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) result += reg[i];
+    return result;
+  }
+
+  template <typename F> FP32Vec8 map(F &&f) const {
+    float result[VEC_ELEM_NUM];
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) result[i] = f(reg[i]);
+    return FP32Vec8(result);
+  }
+
+  template <typename F> FP32Vec8 zip(const FP32Vec8 &b, F &&f) const {
+    float result[VEC_ELEM_NUM];
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) result[i] = f(reg[i], b.reg[i]);
+    return FP32Vec8(result);
+  }
+
+  FP32Vec8 exp() const {
+    return map([](float x) { return std::exp(x); });
+  }
+
+  FP32Vec8 tanh() const {
+    return map([](float x) { return std::tanh(x); });
+  }
+
+  FP32Vec8 er() const {
+    return map([](float x) { return std::erf(x); });
+  }
+
+  FP32Vec8 operator*(const FP32Vec8 &b) const {
+    return zip(b, [](float x, float y) { return x * y; });
+  }
+
+  FP32Vec8 operator+(const FP32Vec8 &b) const {
+    return zip(b, [](float x, float y) { return x + y; });
+  }
+
+  FP32Vec8 operator-(const FP32Vec8 &b) const {
+    return zip(b, [](float x, float y) { return x - y; });
+  }
+
+  FP32Vec8 operator/(const FP32Vec8 &b) const {
+    return zip(b, [](float x, float y) { return x / y; });
+  }
+
+  void save(float *ptr) const { std::memcpy(ptr, reg, sizeof(reg)); }
+};
+
+struct FP32Vec16 : public Vec<FP32Vec16> {
+  constexpr static int VEC_ELEM_NUM = 16;
+
+  float reg[VEC_ELEM_NUM];
+
+  explicit FP32Vec16(float v) {
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) reg[i] = v;
+  }
+
+  explicit FP32Vec16() : FP32Vec16(0.0f) {}
+
+  explicit FP32Vec16(const float *ptr) { std::memcpy(reg, ptr, sizeof(reg)); }
+
+  explicit FP32Vec16(const FP32Vec16 &data) {
+    std::memcpy(reg, data.reg, sizeof(reg));
+  }
+
+  explicit FP32Vec16(const FP32Vec4 &data) {
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) {
+      reg[i] = data.reg[i % FP32Vec4::VEC_ELEM_NUM];
+    }
+  }
+
+  explicit FP32Vec16(const FP32Vec8 &data) {
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) {
+      reg[i] = data.reg[i % FP32Vec8::VEC_ELEM_NUM];
+    }
+  }
+
+  explicit FP32Vec16(const FP16Vec16 &v) {
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) reg[i] = fp16_to_fp32(v.reg[i]);
+  }
+
+  explicit FP32Vec16(const FP16Vec8 &v) : FP32Vec16(FP32Vec8(v)) {}
+
+  explicit FP32Vec16(const BF16Vec16 &v) {
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) reg[i] = bf16_to_fp32(v.reg[i]);
+  }
+
+  explicit FP32Vec16(const BF16Vec8 &v) : FP32Vec16(FP32Vec8(v)) {}
+
+  template <typename F> FP32Vec16 zip(const FP32Vec16 &b, F &&f) const {
+    float result[VEC_ELEM_NUM];
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) result[i] = f(reg[i], b.reg[i]);
+    return FP32Vec16(result);
+  }
+
+  FP32Vec16 operator*(const FP32Vec16 &b) const {
+    return zip(b, [](float x, float y) { return x * y; });
+  }
+
+  FP32Vec16 operator+(const FP32Vec16 &b) const {
+    return zip(b, [](float x, float y) { return x + y; });
+  }
+
+  FP32Vec16 operator-(const FP32Vec16 &b) const {
+    return zip(b, [](float x, float y) { return x - y; });
+  }
+
+  FP32Vec16 operator/(const FP32Vec16 &b) const {
+    return zip(b, [](float x, float y) { return x / y; });
+  }
+
+  // min/max return the second operand if either is NaN, as SSE/AVX do.
+  FP32Vec16 clamp(const FP32Vec16 &min, const FP32Vec16 &max) const {
+    return max.zip(min.max(*this), [](float x, float y) {
+      return x < y ? x : y;
+    });
+  }
+
+  FP32Vec16 max(const FP32Vec16 &b) const {
+    return zip(b, [](float x, float y) { return x > y ? x : y; });
+  }
+
+  FP32Vec16 max(const FP32Vec16 &b, const int elem_num) const {
+    float result[VEC_ELEM_NUM];
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) {
+      result[i] = i >= elem_num || reg[i] > b.reg[i] ? reg[i] : b.reg[i];
+    }
+    return FP32Vec16(result);
+  }
+
+  FP32Vec16 abs() const {
+    float result[VEC_ELEM_NUM];
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) result[i] = std::fabs(reg[i]);
+    return FP32Vec16(result);
+  }
+
+  float reduce_sum() const {
+    float result = 0;
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) result += reg[i];
+    return result;
+  }
+
+  float reduce_max() const {
+    float result = reg[0];
+    for (int i = 1; i < VEC_ELEM_NUM; ++i) {
+      result = result > reg[i] ? result : reg[i];
+    }
+    return result;
+  }
+
+  template <int group_size> float reduce_sub_sum(int idx) {
+    static_assert(VEC_ELEM_NUM % group_size == 0);
+    float result = 0;
+    const int start = idx * group_size;
+    for (int i = 0; i < group_size; ++i) result += reg[start + i];
+    return result;
+  }
+
+  void save(float *ptr) const { std::memcpy(ptr, reg, sizeof(reg)); }
+
+  void save(float *ptr, const int elem_num) const {
+    std::memcpy(ptr, reg, elem_num * sizeof(float));
+  }
+};
+
+struct INT8Vec16 : public Vec<INT8Vec16> {
+  constexpr static int VEC_ELEM_NUM = 16;
+
+  int8_t reg[VEC_ELEM_NUM];
+
+  // Rounds to nearest even and keeps the low byte, as AVX512 does.
+  explicit INT8Vec16(const FP32Vec16 &vec) {
+    for (int i = 0; i < VEC_ELEM_NUM; ++i) {
+      reg[i] = static_cast<int8_t>(
+          static_cast<int32_t>(std::nearbyint(vec.reg[i])));
+    }
+  }
+
+  void save(int8_t *ptr) const { std::memcpy(ptr, reg, sizeof(reg)); }
+
+  void save(int8_t *ptr, const int elem_num) const {
+    std::memcpy(ptr, reg, elem_num);
+  }
+};
+
+template <typename T> struct VecType { using vec_type = void; };
+
+template <typename T> using vec_t = typename VecType<T>::vec_type;
+
+template <> struct VecType<float> { using vec_type = FP32Vec8; };
+
+template <> struct VecType<c10::Half> { using vec_type = FP16Vec8; };
+
+template <> struct VecType<c10::BFloat16> { using vec_type = BF16Vec8; };
+
+template <typename T> void storeFP32(float v, T *ptr) { *ptr = v; }
+
+template <> inline void storeFP32<c10::Half>(float v, c10::Half *ptr) {
+  const uint16_t bits = fp32_to_fp16(v);
+  std::memcpy(ptr, &bits, sizeof(bits));
+}
+
+template <> inline void storeFP32<c10::BFloat16>(float v, c10::BFloat16 *ptr) {
+  const uint16_t bits = fp32_to_bf16(v);
+  std::memcpy(ptr, &bits, sizeof(bits));
+}
+
+inline void fma(FP32Vec16 &acc, FP32Vec16 &a, FP32Vec16 &b) {
+  acc = acc + a * b;
+}
+
+inline FP16Vec8::FP16Vec8(const FP32Vec8 &v) {
+  for (int i = 0; i < VEC_ELEM_NUM; ++i) reg[i] = fp32_to_fp16(v.reg[i]);
+}
+
+inline FP16Vec16::FP16Vec16(const FP32Vec16 &v) {
+  for (int i = 0; i < VEC_ELEM_NUM; ++i) reg[i] = fp32_to_fp16(v.reg[i]);
+}
+
+inline BF16Vec8::BF16Vec8(const FP32Vec8 &v) {
+  for (int i = 0; i < VEC_ELEM_NUM; ++i) reg[i] = fp32_to_bf16(v.reg[i]);
+}
+
+inline BF16Vec16::BF16Vec16(const FP32Vec16 &v) {
+  for (int i = 0; i < VEC_ELEM_NUM; ++i) reg[i] = fp32_to_bf16(v.reg[i]);
+}
+
+// Bytes of a cache line, the granule of prefetch().
+constexpr int CACHE_LINE_SIZE = 64;
+
+inline void prefetch(const void *addr) { __builtin_prefetch(addr, 0, 2); }
+
+inline void prefetch_write(const void *addr) {
+  __builtin_prefetch(addr, 1, 2);
+}
+
+// Copies `count` little-endian words of WORD_BYTES bytes, e.g. the tensors of
+// a checkpoint, in host byte order.
+template <int WORD_BYTES>
+inline void load_le_words(void *dst, const void *src, const int64_t count) {
+  static_assert(WORD_BYTES == 2 || WORD_BYTES == 4);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  std::memcpy(dst, src, count * WORD_BYTES);
+#else
+  const unsigned char *in = static_cast<const unsigned char *>(src);
+  unsigned char *out = static_cast<unsigned char *>(dst);
+  for (int64_t i = 0; i < count * WORD_BYTES; i += WORD_BYTES) {
+    for (int b = 0; b < WORD_BYTES; ++b) {
+      out[i + b] = in[i + WORD_BYTES - 1 - b];
+    }
+  }
+#endif
+}
+
+}; // namespace scalar
+
+#ifdef VLLM_CPU_SCALAR_VEC_OP
+#define VLLM_DISPATCH_CASE_FLOATING_TYPES(...)                                 \
+  AT_DISPATCH_CASE(at::ScalarType::Float, __VA_ARGS__)                         \
+  AT_DISPATCH_CASE(at::ScalarType::BFloat16, __VA_ARGS__)                      \
+  AT_DISPATCH_CASE(at::ScalarType::Half, __VA_ARGS__)
+
+#define VLLM_DISPATCH_FLOATING_TYPES(TYPE, NAME, ...)                          \
+  AT_DISPATCH_SWITCH(TYPE, NAME, VLLM_DISPATCH_CASE_FLOATING_TYPES(__VA_ARGS__))
+
+#ifndef CPU_OP_GUARD
+#define CPU_KERNEL_GUARD_IN(NAME) CPU_KERNEL_PROFILE_IN(NAME)
+#define CPU_KERNEL_GUARD_OUT(NAME) CPU_KERNEL_PROFILE_OUT(NAME)
+#else
+#define CPU_KERNEL_GUARD_IN(NAME)                                              \
+  CPU_KERNEL_PROFILE_IN(NAME)                                                  \
+  RECORD_FUNCTION(#NAME, c10::ArrayRef<c10::IValue>({}));
+#define CPU_KERNEL_GUARD_OUT(NAME) CPU_KERNEL_PROFILE_OUT(NAME)
+#endif
+
+#define FORCE_INLINE __attribute__((always_inline)) inline
+
+using namespace scalar;
+#endif
+
+}; // namespace vec_op
+
+#endif
@@ -6,23 +6,29 @@
 #include <cmath>
 #include <torch/torch.h>
 
+#include "cpu_types_fp16.hpp"
+#include "kernel_profiler.hpp"
+
 namespace vec_op {
 
-// FIXME: FP16 is not fully supported in Torch-CPU
 #define VLLM_DISPATCH_CASE_FLOATING_TYPES(...)                                 \
   AT_DISPATCH_CASE(at::ScalarType::Float, __VA_ARGS__)                         \
-  AT_DISPATCH_CASE(at::ScalarType::BFloat16, __VA_ARGS__)
+  AT_DISPATCH_CASE(at::ScalarType::BFloat16, __VA_ARGS__)                      \
+  AT_DISPATCH_CASE(at::ScalarType::Half, __VA_ARGS__)
 
 #define VLLM_DISPATCH_FLOATING_TYPES(TYPE, NAME, ...)                          \
   AT_DISPATCH_SWITCH(TYPE, NAME, VLLM_DISPATCH_CASE_FLOATING_TYPES(__VA_ARGS__))
 
 #ifndef CPU_OP_GUARD
-#define CPU_KERNEL_GUARD_IN(NAME)
-#define CPU_KERNEL_GUARD_OUT(NAME)
+#define CPU_KERNEL_GUARD_IN(NAME) CPU_KERNEL_PROFILE_IN(NAME)
+#define CPU_KERNEL_GUARD_OUT(NAME) CPU_KERNEL_PROFILE_OUT(NAME)
 #else
 #define CPU_KERNEL_GUARD_IN(NAME)                                              \
+  CPU_KERNEL_PROFILE_IN(NAME)                                                  \
   std::cout << #NAME << " invoked." << std::endl;
-#define CPU_KERNEL_GUARD_OUT(NAME) std::cout << #NAME << " exit." << std::endl;
+#define CPU_KERNEL_GUARD_OUT(NAME)                                             \
+  CPU_KERNEL_PROFILE_OUT(NAME)                                                 \
+  std::cout << #NAME << " exit." << std::endl;
 #endif
 
 #define FORCE_INLINE __attribute__((always_inline)) inline
@@ -96,8 +102,51 @@ struct BF16Vec16 : public Vec<BF16Vec16> {
   }
 };
 
+struct FP16Vec8 : public Vec<FP16Vec8> {
+  constexpr static int VEC_ELEM_NUM = 8;
+
+  __vector signed short reg;
+
+  explicit FP16Vec8(const void *ptr)
+      : reg(vec_xl(0, (const signed short *)ptr)) {}
+
+  explicit FP16Vec8(const FP32Vec8 &);
+
+  void save(void *ptr) const { vec_xst(reg, 0, (signed short *)ptr); }
+};
+
+struct FP16Vec16 : public Vec<FP16Vec16> {
+  constexpr static int VEC_ELEM_NUM = 16;
+
+  ss16x8x2_t reg;
+
+  explicit FP16Vec16(const void *ptr) {
+    reg.val[0] = vec_xl(0, (const signed short *)ptr);
+    reg.val[1] = vec_xl(16, (const signed short *)ptr);
+  }
+
+  explicit FP16Vec16(const FP32Vec16 &);
+
+  void save(void *ptr) const {
+    vec_xst(reg.val[0], 0, (signed short *)ptr);
+    vec_xst(reg.val[1], 16, (signed short *)ptr);
+  }
+};
+
 const static __vector signed short zero = vec_splats((signed short)0);
 
+namespace {
+// FP16 bits in the high halfword of each word to FP32.
+FORCE_INLINE __vector float fp16_to_fp32(__vector signed short w) {
+  return (__vector float)fp16::fp16_to_fp32((fp16::u32x4_t)w);
+}
+
+// FP32 to FP16 bits in the low halfword of each word.
+FORCE_INLINE __vector unsigned int fp32_to_fp16(__vector float v) {
+  return (__vector unsigned int)fp16::fp32_to_fp16((fp16::f32x4_t)v);
+}
+}; // namespace
+
 struct BF16Vec32 : public Vec<BF16Vec32> {
   constexpr static int VEC_ELEM_NUM = 32;
 
@@ -168,6 +217,11 @@ struct FP32Vec8 : public Vec<FP32Vec8> {
     reg.val[1] = data.reg.val[1];
   }
 
+  explicit FP32Vec8(const FP16Vec8 &v) {
+    reg.val[0] = fp16_to_fp32(vec_mergeh(zero, v.reg));
+    reg.val[1] = fp16_to_fp32(vec_mergel(zero, v.reg));
+  }
+
   explicit FP32Vec8(const BF16Vec8 &v) {
     reg.val[0] = (__vector float)vec_mergeh(zero, v.reg);
     reg.val[1] = (__vector float)vec_mergel(zero, v.reg);
@@ -305,6 +359,15 @@ struct FP32Vec16 : public Vec<FP32Vec16> {
     reg.val[3] = data.reg.val[1];
   }
 
+  explicit FP32Vec16(const FP16Vec16 &v) {
+    reg.val[0] = fp16_to_fp32(vec_mergeh(zero, v.reg.val[0]));
+    reg.val[1] = fp16_to_fp32(vec_mergel(zero, v.reg.val[0]));
+    reg.val[2] = fp16_to_fp32(vec_mergeh(zero, v.reg.val[1]));
+    reg.val[3] = fp16_to_fp32(vec_mergel(zero, v.reg.val[1]));
+  }
+
+  explicit FP32Vec16(const FP16Vec8 &v) : FP32Vec16(FP32Vec8(v)) {}
+
   explicit FP32Vec16(const BF16Vec16 &v) {
     reg.val[0] = (__vector float)vec_mergeh(zero, v.reg.val[0]);
     reg.val[1] = (__vector float)vec_mergel(zero, v.reg.val[0]);
@@ -382,6 +445,8 @@ template <typename T> using vec_t = typename VecType<T>::vec_type;
 
 template <> struct VecType<float> { using vec_type = FP32Vec8; };
 
+template <> struct VecType<c10::Half> { using vec_type = FP16Vec8; };
+
 template <> struct VecType<c10::BFloat16> { using vec_type = BF16Vec8; };
 
 template <typename T> void storeFP32(float v, T *ptr) { *ptr = v; }
@@ -408,6 +473,18 @@ const static __vector unsigned int sh16 = { 16, 16, 16, 16 };
 const static __vector unsigned int one  = { 1, 1, 1, 1 };
 #endif
 
+inline FP16Vec8::FP16Vec8(const FP32Vec8 &v) {
+  reg = (__vector signed short)vec_pack(fp32_to_fp16(v.reg.val[0]),
+                                        fp32_to_fp16(v.reg.val[1]));
+}
+
+inline FP16Vec16::FP16Vec16(const FP32Vec16 &v) {
+  reg.val[0] = (__vector signed short)vec_pack(fp32_to_fp16(v.reg.val[0]),
+                                               fp32_to_fp16(v.reg.val[1]));
+  reg.val[1] = (__vector signed short)vec_pack(fp32_to_fp16(v.reg.val[2]),
+                                               fp32_to_fp16(v.reg.val[3]));
+}
+
 inline BF16Vec8::BF16Vec8(const FP32Vec8 &v) {
 #ifdef _ARCH_PWR10
   __vector signed short ret[2];
@@ -482,10 +559,21 @@ inline BF16Vec16::BF16Vec16(const FP32Vec16 &v) {
 #endif
 }
 
-inline void prefetch(const void *addr) {
-  //__asm__ __volatile__("dcbt 0, %0" : : "r"(addr) : "memory");
-  //__asm__ __volatile__("nop");
-  void __dcbt(const void* addr);
+// Bytes of a cache line, the granule of prefetch().
+constexpr int CACHE_LINE_SIZE = 128;
+
+// GCC emits dcbt for reads and dcbtst for writes.
+inline void prefetch(const void *addr) { __builtin_prefetch(addr, 0, 2); }
+
+inline void prefetch_write(const void *addr) {
+  __builtin_prefetch(addr, 1, 2);
+}
+
+// Copies `count` little-endian words of WORD_BYTES bytes, e.g. the tensors of
+// a checkpoint, in host byte order. POWER9 runs little-endian.
+template <int WORD_BYTES>
+inline void load_le_words(void *dst, const void *src, const int64_t count) {
+  std::memcpy(dst, src, count * WORD_BYTES);
 }
 
 }; // namespace vec_op
@@ -5,7 +5,9 @@
 #include <vecintrin.h>
 #include <cmath>
 #include <torch/torch.h>
-#include <arpa/inet.h>
+
+#include "cpu_types_fp16.hpp"
+#include "kernel_profiler.hpp"
 
 namespace vec_op {
 
@@ -16,21 +18,24 @@ namespace vec_op {
 #define vec_div(a, b) ((a) / (b))
 #define vec_sr(a, b) ((a) >> (b)) // Vector Shift Right Algebraic
 
-// FIXME: FP16 is not fully supported in Torch-CPU
 #define VLLM_DISPATCH_CASE_FLOATING_TYPES(...)                                 \
   AT_DISPATCH_CASE(at::ScalarType::Float, __VA_ARGS__)                         \
-  AT_DISPATCH_CASE(at::ScalarType::BFloat16, __VA_ARGS__)
+  AT_DISPATCH_CASE(at::ScalarType::BFloat16, __VA_ARGS__)                      \
+  AT_DISPATCH_CASE(at::ScalarType::Half, __VA_ARGS__)
 
 #define VLLM_DISPATCH_FLOATING_TYPES(TYPE, NAME, ...)                          \
   AT_DISPATCH_SWITCH(TYPE, NAME, VLLM_DISPATCH_CASE_FLOATING_TYPES(__VA_ARGS__))
 
 #ifndef CPU_OP_GUARD
-#define CPU_KERNEL_GUARD_IN(NAME)
-#define CPU_KERNEL_GUARD_OUT(NAME)
+#define CPU_KERNEL_GUARD_IN(NAME) CPU_KERNEL_PROFILE_IN(NAME)
+#define CPU_KERNEL_GUARD_OUT(NAME) CPU_KERNEL_PROFILE_OUT(NAME)
 #else
 #define CPU_KERNEL_GUARD_IN(NAME)                                              \
+  CPU_KERNEL_PROFILE_IN(NAME)                                                  \
   std::cout << #NAME << " invoked." << std::endl;
-#define CPU_KERNEL_GUARD_OUT(NAME) std::cout << #NAME << " exit." << std::endl;
+#define CPU_KERNEL_GUARD_OUT(NAME)                                             \
+  CPU_KERNEL_PROFILE_OUT(NAME)                                                 \
+  std::cout << #NAME << " exit." << std::endl;
 #endif
 
 #define FORCE_INLINE __attribute__((always_inline)) inline
@@ -77,26 +82,11 @@ struct BF16Vec8 : public Vec<BF16Vec8> {
   __vector signed short reg;
 
   explicit BF16Vec8(const void *ptr)
-      : reg(*(__vector signed short*)ptr) {}
+      : reg(vec_xl(0, (const signed short *)ptr)) {}
 
   explicit BF16Vec8(const FP32Vec8 &);
-  
-  
-  //void save(void *ptr) const { *reinterpret_cast<__vector signed short *>(ptr) = reg; }
 
-  void save(void *ptr) const {
-     
-      std::cout << "Saving BF16Vec8 to memory" << std::endl;
-      // converting vector to array of type signed shorts for handling data element wise
-      const signed short* data = reinterpret_cast<const signed short*>(&reg);
-      signed short* dest = reinterpret_cast<signed short*>(ptr);
-
-      for (int i=0; i < VEC_ELEM_NUM; ++i){
-	   std::cout << "Saving Element[" << i << "]: " << data[i] << std::endl;
-	   dest[i]=data[i];
-      }
-  
-  }
+  void save(void *ptr) const { vec_xst(reg, 0, (signed short *)ptr); }
 };
 
 struct BF16Vec16 : public Vec<BF16Vec16> {
@@ -119,8 +109,51 @@ struct BF16Vec16 : public Vec<BF16Vec16> {
   }
 };
 
+struct FP16Vec8 : public Vec<FP16Vec8> {
+  constexpr static int VEC_ELEM_NUM = 8;
+
+  __vector signed short reg;
+
+  explicit FP16Vec8(const void *ptr)
+      : reg(vec_xl(0, (const signed short *)ptr)) {}
+
+  explicit FP16Vec8(const FP32Vec8 &);
+
+  void save(void *ptr) const { vec_xst(reg, 0, (signed short *)ptr); }
+};
+
+struct FP16Vec16 : public Vec<FP16Vec16> {
+  constexpr static int VEC_ELEM_NUM = 16;
+
+  ss16x8x2_t reg;
+
+  explicit FP16Vec16(const void *ptr) {
+    reg.val[0] = vec_xl(0, (const signed short *)ptr);
+    reg.val[1] = vec_xl(16, (const signed short *)ptr);
+  }
+
+  explicit FP16Vec16(const FP32Vec16 &);
+
+  void save(void *ptr) const {
+    vec_xst(reg.val[0], 0, (signed short *)ptr);
+    vec_xst(reg.val[1], 16, (signed short *)ptr);
+  }
+};
+
 const static __vector signed short zero = vec_splats((signed short)0);
 
+namespace {
+// FP16 bits in the high halfword of each word to FP32.
+FORCE_INLINE __vector float fp16_to_fp32(__vector signed short w) {
+  return (__vector float)fp16::fp16_to_fp32((fp16::u32x4_t)w);
+}
+
+// FP32 to FP16 bits in the low halfword of each word.
+FORCE_INLINE __vector unsigned int fp32_to_fp16(__vector float v) {
+  return (__vector unsigned int)fp16::fp32_to_fp16((fp16::f32x4_t)v);
+}
+}; // namespace
+
 struct BF16Vec32 : public Vec<BF16Vec32> {
   constexpr static int VEC_ELEM_NUM = 32;
 
@@ -165,7 +198,7 @@ struct FP32Vec8 : public Vec<FP32Vec8> {
   union AliasReg {
     f32x4x2_t reg;
     float values[VEC_ELEM_NUM];
-  } alias;
+  };
 
   f32x4x2_t reg;
 
@@ -191,26 +224,23 @@ struct FP32Vec8 : public Vec<FP32Vec8> {
     reg.val[1] = data.reg.val[1];
   }
 
-  explicit FP32Vec8(const BF16Vec8 &v) {
-    reg.val[0] = (__vector float)vec_mergeh(zero, v.reg);
-    reg.val[1] = (__vector float)vec_mergel(zero, v.reg);
+  explicit FP32Vec8(const FP16Vec8 &v) {
+    reg.val[0] = fp16_to_fp32(vec_mergeh(v.reg, zero));
+    reg.val[1] = fp16_to_fp32(vec_mergel(v.reg, zero));
   }
 
- // float reduce_sum() const {
- //   AliasReg ar;
- //   ar.reg = reg;
- //   float result = 0;
- //   unroll_loop<int, VEC_ELEM_NUM>([&result, &ar](int i) { result += ar.values[i]; });
-
- //   return result;
- // }
- 
+  // Big-endian: the BF16 bits are the high half of the FP32 word.
+  explicit FP32Vec8(const BF16Vec8 &v) {
+    reg.val[0] = (__vector float)vec_mergeh(v.reg, zero);
+    reg.val[1] = (__vector float)vec_mergel(v.reg, zero);
+  }
 
   float reduce_sum() const {
+    AliasReg ar;
+    ar.reg = reg;
     float result = 0;
-    for (int i = 0; i < VEC_ELEM_NUM; ++i) {
-      result += alias.values[i];  // Access each element as float
-    }
+    unroll_loop<int, VEC_ELEM_NUM>([&result, &ar](int i) { result += ar.values[i]; });
+
     return result;
   }
 
@@ -338,11 +368,20 @@ struct FP32Vec16 : public Vec<FP32Vec16> {
     reg.val[3] = data.reg.val[1];
   }
 
+  explicit FP32Vec16(const FP16Vec16 &v) {
+    reg.val[0] = fp16_to_fp32(vec_mergeh(v.reg.val[0], zero));
+    reg.val[1] = fp16_to_fp32(vec_mergel(v.reg.val[0], zero));
+    reg.val[2] = fp16_to_fp32(vec_mergeh(v.reg.val[1], zero));
+    reg.val[3] = fp16_to_fp32(vec_mergel(v.reg.val[1], zero));
+  }
+
+  explicit FP32Vec16(const FP16Vec8 &v) : FP32Vec16(FP32Vec8(v)) {}
+
   explicit FP32Vec16(const BF16Vec16 &v) {
-    reg.val[0] = (__vector float)vec_mergeh(zero, v.reg.val[0]);
-    reg.val[1] = (__vector float)vec_mergel(zero, v.reg.val[0]);
-    reg.val[2] = (__vector float)vec_mergeh(zero, v.reg.val[1]);
-    reg.val[3] = (__vector float)vec_mergel(zero, v.reg.val[1]);
+    reg.val[0] = (__vector float)vec_mergeh(v.reg.val[0], zero);
+    reg.val[1] = (__vector float)vec_mergel(v.reg.val[0], zero);
+    reg.val[2] = (__vector float)vec_mergeh(v.reg.val[1], zero);
+    reg.val[3] = (__vector float)vec_mergel(v.reg.val[1], zero);
   }
 
   explicit FP32Vec16(const BF16Vec8 &v) : FP32Vec16(FP32Vec8(v)) {}
@@ -415,6 +454,8 @@ template <typename T> using vec_t = typename VecType<T>::vec_type;
 
 template <> struct VecType<float> { using vec_type = FP32Vec8; };
 
+template <> struct VecType<c10::Half> { using vec_type = FP16Vec8; };
+
 template <> struct VecType<c10::BFloat16> { using vec_type = BF16Vec8; };
 
 template <typename T> void storeFP32(float v, T *ptr) { *ptr = v; }
@@ -424,150 +465,98 @@ inline void fma(FP32Vec16 &acc, FP32Vec16 &a, FP32Vec16 &b) {
 }
 
 
-namespace c10 {
-    struct BFloat16 {
-        uint16_t value; // Assume BFloat16 is defined as a struct containing a 16-bit value.
-    };
-}
-
+// Rounds to nearest even, NaNs become the quiet NaN 0x7FC0, as c10::BFloat16
+// does.
 template <> inline void storeFP32<c10::BFloat16>(float v, c10::BFloat16 *ptr) {
-//  c10::BFloat16 __attribute__((__may_alias__)) *v_ptr =
-//      reinterpret_cast<c10::BFloat16 *>(&v);
-//  *ptr = *(v_ptr + 1);
-    uint32_t temp;
-    memcpy(&temp, &v, sizeof(float));
-    temp = htonl(temp);
-    temp = temp >> 16;
-    memcpy(ptr, &temp, sizeof(c10::BFloat16));
+  *ptr = c10::BFloat16(v);
 }
 
-#ifndef __VEC_CLASS_FP_NAN
-#define __VEC_CLASS_FP_NAN (1 << 6)
-#endif
-
-const static __vector unsigned char omask = {0, 1, 2, 3, 16, 17, 18, 19, 32, 33, 34, 35, 48, 49, 50, 51};
+// Big-endian: the high halfword of each FP32 word holds the BF16 result.
+const static __vector unsigned char omask = {0,  1,  4,  5,  8,  9,  12, 13,
+                                             16, 17, 20, 21, 24, 25, 28, 29};
 const static __vector unsigned int bias = { 0x00007fff, 0x00007fff, 0x00007fff, 0x00007fff };
-const static __vector unsigned int nan  = { 0x7f800000, 0x7f800000, 0x7f800000, 0x7f800000 };
+const static __vector unsigned int nan  = { 0x7fc00000, 0x7fc00000, 0x7fc00000, 0x7fc00000 };
+const static __vector unsigned int inf  = { 0x7f800000, 0x7f800000, 0x7f800000, 0x7f800000 };
+const static __vector unsigned int abs_mask = { 0x7fffffff, 0x7fffffff, 0x7fffffff, 0x7fffffff };
 const static __vector unsigned int sh16 = { 16, 16, 16, 16 };
 const static __vector unsigned int one  = { 1, 1, 1, 1 };
 
-inline __vector bool int vec_test_data_class(__vector unsigned int a, unsigned int b) {
-    __vector unsigned int r = {0, 0, 0, 0}; // Result vector initialized to all zeros
-
-    // Masks
-    const unsigned int exponent_mask = 0x7F800000; // Exponent mask (for FP32)
-    const unsigned int mantissa_mask = 0x007FFFFF; // Mantissa mask (for FP32)
-
-    // Process each element of the vector manually
-    for (int i = 0; i < 4; i++) {
-        unsigned int value = a[i];
-        unsigned int exponent = (value & exponent_mask);
-        unsigned int mantissa = (value & mantissa_mask);
-
-        // Check for NaN: exponent == exponent_mask and mantissa != 0
-        if ((b & __VEC_CLASS_FP_NAN) && (exponent == exponent_mask && mantissa != 0)) {
-            r[i] = 0xFFFFFFFF; // Set to all ones (true)
-            continue;          // Skip further checks for this element
-        }
-
-        // Check for Infinity: exponent == exponent_mask and mantissa == 0
-        if ((b & __VEC_CLASS_FP_INFINITY) && (exponent == exponent_mask && mantissa == 0)) {
-            r[i] = 0xFFFFFFFF; // Set to all ones (true)
-            continue;          // Skip further checks for this element
-        }
-
-        // Check for Normal numbers: exponent != 0 and exponent != exponent_mask
-        if ((b & FP_NORMAL) && (exponent != 0 && exponent != exponent_mask)) {
-            r[i] = 0xFFFFFFFF; // Set to all ones (true)
-            continue;          // Skip further checks for this element
-        }
-
-        // Check for Subnormal numbers: exponent == 0 and mantissa != 0
-        if ((b & __VEC_CLASS_FP_SUBNORMAL) && (exponent == 0 && mantissa != 0)) {
-            r[i] = 0xFFFFFFFF; // Set to all ones (true)
-            continue;          // Skip further checks for this element
-        }
-
-        // Check for Zero: value == 0
-        if ((b & __VEC_CLASS_FP_ZERO) && value == 0) {
-            r[i] = 0xFFFFFFFF; // Set to all ones (true)
-        }
-    }
-
-    return (__vector bool int)r; // Return the result vector
+namespace {
+// Round to nearest even of the high halfword, NaNs replaced by the quiet NaN.
+FORCE_INLINE __vector unsigned int fp32_round_bf16(__vector float v) {
+  const __vector unsigned int inp = (__vector unsigned int)v;
+  const __vector unsigned int lsb = vec_and(vec_sr(inp, sh16), one);
+  const __vector unsigned int rounded = vec_add(inp, vec_add(lsb, bias));
+  const __vector __bool int is_nan = vec_cmpgt(vec_and(inp, abs_mask), inf);
+  return vec_sel(rounded, nan, is_nan);
 }
+}; // namespace
 
-inline BF16Vec8::BF16Vec8(const FP32Vec8 &v) {
+inline FP16Vec8::FP16Vec8(const FP32Vec8 &v) {
+  reg = (__vector signed short)vec_pack(fp32_to_fp16(v.reg.val[0]),
+                                        fp32_to_fp16(v.reg.val[1]));
+}
 
-  std::cout << "FP32 -> BF16 Conversion Debug:" << std::endl;
-  for (int i = 0; i < 8; i++) {
-      float original_fp32 = reinterpret_cast<const float*>(&v.reg.val[0])[i];
-      std::cout << "FP32[" << i << "]: " << original_fp32 << " -> ";
-      // Mimic conversion to display what happens
-      uint32_t as_int = *reinterpret_cast<uint32_t*>(&original_fp32);
-      uint16_t truncated = (as_int >> 16) & 0xFFFF;
-      std::cout << "BF16[" << i << "]: " << truncated << std::endl;
-  }  
-
-  // Assuming FP32Vec8::reg is a type that allows direct access as __vector unsigned int
-  __vector unsigned int inp0 = (__vector unsigned int)(v.reg.val[0]);
-  __vector unsigned int inp1 = (__vector unsigned int)(v.reg.val[1]);
-
-  // Adding rounding bias for more accurate conversion
-  inp0 = vec_add(inp0, vec_splats(0x00008000u));
-  inp1 = vec_add(inp1, vec_splats(0x00008000u));
-
-  // Shift right by 16 to convert from 32-bit to 16-bit, effectively truncating the lower bits
-  __vector unsigned short bf16_0 = (__vector unsigned short)vec_sr(inp0, vec_splats(16u));
-  __vector unsigned short bf16_1 = (__vector unsigned short)vec_sr(inp1, vec_splats(16u));
-
-  // Use a vector permute to merge the two parts into the register properly
-  // Assuming omask is defined to merge two __vector unsigned short into one __vector signed short correctly
-  reg = (__vector signed short)vec_perm(bf16_0, bf16_1, omask);
+inline FP16Vec16::FP16Vec16(const FP32Vec16 &v) {
+  reg.val[0] = (__vector signed short)vec_pack(fp32_to_fp16(v.reg.val[0]),
+                                               fp32_to_fp16(v.reg.val[1]));
+  reg.val[1] = (__vector signed short)vec_pack(fp32_to_fp16(v.reg.val[2]),
+                                               fp32_to_fp16(v.reg.val[3]));
 }
 
+inline BF16Vec8::BF16Vec8(const FP32Vec8 &v) {
+  reg = (__vector signed short)vec_perm(fp32_round_bf16(v.reg.val[0]),
+                                        fp32_round_bf16(v.reg.val[1]), omask);
+}
 
 inline BF16Vec16::BF16Vec16(const FP32Vec16 &v) {
-  __vector unsigned int inp0 = (__vector unsigned int)(v.reg.val[0]);
-  __vector unsigned int inp1 = (__vector unsigned int)(v.reg.val[1]);
-  __vector unsigned int inp2 = (__vector unsigned int)(v.reg.val[2]);
-  __vector unsigned int inp3 = (__vector unsigned int)(v.reg.val[3]);
-  __vector unsigned int lsb0 = vec_sr(inp0, sh16);
-  __vector unsigned int lsb1 = vec_sr(inp1, sh16);
-  __vector unsigned int lsb2 = vec_sr(inp2, sh16);
-  __vector unsigned int lsb3 = vec_sr(inp3, sh16);
-  lsb0 = vec_and(lsb0, one);
-  lsb1 = vec_and(lsb1, one);
-  lsb2 = vec_and(lsb2, one);
-  lsb3 = vec_and(lsb3, one);
-  __vector unsigned int rnd0 = vec_add(lsb0, bias);
-  __vector unsigned int rnd1 = vec_add(lsb1, bias);
-  __vector unsigned int rnd2 = vec_add(lsb2, bias);
-  __vector unsigned int rnd3 = vec_add(lsb3, bias);
-  inp0 = vec_add(inp0, rnd0);
-  inp1 = vec_add(inp1, rnd1);
-  inp2 = vec_add(inp2, rnd2);
-  inp3 = vec_add(inp3, rnd3);
-  __vector __bool int sel0 = vec_test_data_class(inp0, __VEC_CLASS_FP_NAN);
-  __vector __bool int sel1 = vec_test_data_class(inp1, __VEC_CLASS_FP_NAN);
-  __vector __bool int sel2 = vec_test_data_class(inp2, __VEC_CLASS_FP_NAN);
-  __vector __bool int sel3 = vec_test_data_class(inp3, __VEC_CLASS_FP_NAN);
-  inp0 = vec_sel(inp0, nan, sel0);
-  inp1 = vec_sel(inp1, nan, sel1);
-  inp2 = vec_sel(inp2, nan, sel2);
-  inp3 = vec_sel(inp3, nan, sel3);
-  inp0 = vec_sr(inp0, sh16);
-  inp1 = vec_sr(inp1, sh16);
-  inp2 = vec_sr(inp2, sh16);
-  inp3 = vec_sr(inp3, sh16);
-  reg.val[0] = (__vector signed short)vec_perm(inp0, inp1, omask);
-  reg.val[1] = (__vector signed short)vec_perm(inp2, inp3, omask);
+  reg.val[0] = (__vector signed short)vec_perm(
+      fp32_round_bf16(v.reg.val[0]), fp32_round_bf16(v.reg.val[1]), omask);
+  reg.val[1] = (__vector signed short)vec_perm(
+      fp32_round_bf16(v.reg.val[2]), fp32_round_bf16(v.reg.val[3]), omask);
 }
 
+// Bytes of a cache line, the granule of prefetch().
+constexpr int CACHE_LINE_SIZE = 256;
+
+// PFD (prefetch data) with code 1 fetches the line for reading, code 2 for
+// storing, in exclusive state.
 inline void prefetch(const void *addr) {
-  //__asm__ __volatile__("dcbt 0, %0" : : "r"(addr) : "memory");
-  //__asm__ __volatile__("nop");
-  void __dcbt(const void* addr);
+  __asm__ __volatile__("pfd 1, 0(%0)" : : "a"(addr));
+}
+
+inline void prefetch_write(const void *addr) {
+  __asm__ __volatile__("pfd 2, 0(%0)" : : "a"(addr));
+}
+
+// Reverse the bytes of each halfword (word) of a vector.
+const static __vector unsigned char swap16_mask = {1, 0, 3,  2,  5,  4,  7,  6,
+                                                   9, 8, 11, 10, 13, 12, 15, 14};
+const static __vector unsigned char swap32_mask = {3,  2,  1,  0,  7,  6,
+                                                   5,  4,  11, 10, 9,  8,
+                                                   15, 14, 13, 12};
+
+// Copies `count` little-endian words of WORD_BYTES bytes, e.g. the tensors of
+// a checkpoint, in host byte order: a VPERM per 16 bytes on big-endian
+// s390x.
+template <int WORD_BYTES>
+inline void load_le_words(void *dst, const void *src, const int64_t count) {
+  static_assert(WORD_BYTES == 2 || WORD_BYTES == 4);
+  const __vector unsigned char mask =
+      WORD_BYTES == 2 ? swap16_mask : swap32_mask;
+  const unsigned char *in = static_cast<const unsigned char *>(src);
+  unsigned char *out = static_cast<unsigned char *>(dst);
+  const int64_t bytes = count * WORD_BYTES;
+  int64_t i = 0;
+  for (; i + 16 <= bytes; i += 16) {
+    const __vector unsigned char v = vec_xl(i, in);
+    vec_xst(vec_perm(v, v, mask), i, out);
+  }
+  for (; i < bytes; i += WORD_BYTES) {
+    for (int b = 0; b < WORD_BYTES; ++b) {
+      out[i + b] = in[i + WORD_BYTES - 1 - b];
+    }
+  }
 }
 
 }; // namespace vec_op
@@ -5,27 +5,31 @@
 #include <immintrin.h>
 #include <torch/all.h>
 
+#include "cpu_types_fp16.hpp"
+#include "kernel_profiler.hpp"
+
 #ifndef __AVX2__
 static_assert(false, "AVX2 must be supported for the current implementation.");
 #endif
 
 namespace vec_op {
 
-// FIXME: FP16 is not fully supported in Torch-CPU
 #define VLLM_DISPATCH_CASE_FLOATING_TYPES(...)                                 \
   AT_DISPATCH_CASE(at::ScalarType::Float, __VA_ARGS__)                         \
-  AT_DISPATCH_CASE(at::ScalarType::BFloat16, __VA_ARGS__)
+  AT_DISPATCH_CASE(at::ScalarType::BFloat16, __VA_ARGS__)                      \
+  AT_DISPATCH_CASE(at::ScalarType::Half, __VA_ARGS__)
 
 #define VLLM_DISPATCH_FLOATING_TYPES(TYPE, NAME, ...)                          \
   AT_DISPATCH_SWITCH(TYPE, NAME, VLLM_DISPATCH_CASE_FLOATING_TYPES(__VA_ARGS__))
 
 #ifndef CPU_OP_GUARD
-#define CPU_KERNEL_GUARD_IN(NAME)
-#define CPU_KERNEL_GUARD_OUT(NAME)
+#define CPU_KERNEL_GUARD_IN(NAME) CPU_KERNEL_PROFILE_IN(NAME)
+#define CPU_KERNEL_GUARD_OUT(NAME) CPU_KERNEL_PROFILE_OUT(NAME)
 #else
 #define CPU_KERNEL_GUARD_IN(NAME)                                              \
+  CPU_KERNEL_PROFILE_IN(NAME)                                                  \
   RECORD_FUNCTION(#NAME, c10::ArrayRef<c10::IValue>({}));
-#define CPU_KERNEL_GUARD_OUT(NAME)
+#define CPU_KERNEL_GUARD_OUT(NAME) CPU_KERNEL_PROFILE_OUT(NAME)
 #endif
 
 #define FORCE_INLINE __attribute__((always_inline)) inline
@@ -50,37 +54,46 @@ template <typename T> struct Vec {
 struct FP32Vec8;
 struct FP32Vec16;
 
-#ifdef __AVX512FP16__
+// FP16 values are converted with F16C, or with the generic vector code of
+// cpu_types_fp16.hpp on targets without it.
 struct FP16Vec8 : public Vec<FP16Vec8> {
   constexpr static int VEC_ELEM_NUM = 8;
 
-  __m128h reg;
+  __m128i reg;
 
-  explicit FP16Vec8(_Float16 v) : reg(_mm_set1_ph(v)) {}
+  explicit FP16Vec8(const void *ptr)
+      : reg(_mm_loadu_si128((__m128i const *)ptr)) {}
 
-  explicit FP16Vec8(const void *ptr) : reg(_mm_loadu_ph(ptr)) {}
+  explicit FP16Vec8(const FP32Vec8 &);
 
-  explicit FP16Vec8(__m128h data) : reg(data) {}
+  void save(void *ptr) const { _mm_storeu_si128((__m128i *)ptr, reg); }
+};
 
-  FP16Vec8 operator*(const FP16Vec8 &b) const {
-    return FP16Vec8(_mm_mul_ph(reg, b.reg));
-  }
+struct FP16Vec16 : public Vec<FP16Vec16> {
+  constexpr static int VEC_ELEM_NUM = 16;
 
-  FP16Vec8 operator+(const FP16Vec8 &b) const {
-    return FP16Vec8(_mm_add_ph(reg, b.reg));
-  }
+  __m256i reg;
 
-  FP16Vec8 operator-(const FP16Vec8 &b) const {
-    return FP16Vec8(_mm_sub_ph(reg, b.reg));
-  }
+  explicit FP16Vec16(const void *ptr)
+      : reg(_mm256_loadu_si256((__m256i const *)ptr)) {}
 
-  FP16Vec8 operator/(const FP16Vec8 &b) const {
-    return FP16Vec8(_mm_div_ph(reg, b.reg));
-  }
+  explicit FP16Vec16(const FP32Vec16 &);
 
-  void save(void *ptr) const { _mm_storeu_ph(ptr, reg); }
-};
+  void save(void *ptr) const { _mm256_storeu_si256((__m256i *)ptr, reg); }
+
+  void save(void *ptr, const int elem_num) const {
+#ifdef __AVX512F__
+    constexpr uint32_t M = 0xFFFFFFFF;
+    __mmask16 mask = _cvtu32_mask16(M >> (32 - elem_num));
+    _mm256_mask_storeu_epi16(ptr, mask, reg);
+#else
+    uint16_t values[VEC_ELEM_NUM];
+    _mm256_storeu_si256((__m256i *)values, reg);
+    std::memcpy(ptr, values, elem_num * sizeof(uint16_t));
 #endif
+  }
+};
+
 
 struct BF16Vec8 : public Vec<BF16Vec8> {
   constexpr static int VEC_ELEM_NUM = 8;
@@ -149,10 +162,10 @@ struct BF16Vec32 : public Vec<BF16Vec32> {
                                                   reg_high(high) {}
 
   explicit BF16Vec32(BF16Vec8 &vec8_data)
-      : reg_low((__m256i)_mm256_inserti32x4(
+      : reg_low((__m256i)_mm256_inserti128_si256(
                 _mm256_castsi128_si256((__m128i)vec8_data.reg),
                                        (__m128i)vec8_data.reg, 1)),
-        reg_high((__m256i)_mm256_inserti32x4(
+        reg_high((__m256i)_mm256_inserti128_si256(
                 _mm256_castsi128_si256((__m128i)vec8_data.reg),
                                        (__m128i)vec8_data.reg, 1)) {}
 
@@ -202,9 +215,7 @@ struct FP32Vec8 : public Vec<FP32Vec8> {
 
   explicit FP32Vec8(const FP32Vec8 &data) : reg(data.reg) {}
 
-#ifdef __AVX512FP16__
-  explicit FP32Vec8(__m128h v) : reg(_mm256_cvtph_ps(_mm_castph_si128(v))) {}
-#endif
+  explicit FP32Vec8(const FP16Vec8 &v);
 
   explicit FP32Vec8(const BF16Vec8 &v)
       : reg(_mm256_castsi256_ps(
@@ -297,6 +308,10 @@ struct FP32Vec16 : public Vec<FP32Vec16> {
       : reg((__m512)_mm512_inserti32x8(
             _mm512_castsi256_si512((__m256i)data.reg), (__m256i)data.reg, 1)) {}
 
+  explicit FP32Vec16(const FP16Vec16 &v);
+
+  explicit FP32Vec16(const FP16Vec8 &v) : FP32Vec16(FP32Vec8(v)) {}
+
   explicit FP32Vec16(const BF16Vec16 &v)
       : reg(_mm512_castsi512_ps(
             _mm512_bslli_epi128(_mm512_cvtepu16_epi32(v.reg), 2))) {}
@@ -393,6 +408,10 @@ struct FP32Vec16 : public Vec<FP32Vec16> {
   explicit FP32Vec16(const FP32Vec8 &data)
       : reg_low(data.reg), reg_high(data.reg) {}
 
+  explicit FP32Vec16(const FP16Vec16 &v);
+
+  explicit FP32Vec16(const FP16Vec8 &v) : FP32Vec16(FP32Vec8(v)) {}
+
   explicit FP32Vec16(const BF16Vec16 &v) {
     __m128i low = _mm256_extractf128_si256(v.reg, 0);
     __m128i high = _mm256_extractf128_si256(v.reg, 1);
@@ -497,19 +516,97 @@ template <typename T> using vec_t = typename VecType<T>::vec_type;
 
 template <> struct VecType<float> { using vec_type = FP32Vec8; };
 
-#ifdef __AVX512FP16__
-template <> struct VecType<c10::Half> { using vec_type = FP16Vec16; };
-#endif
+template <> struct VecType<c10::Half> { using vec_type = FP16Vec8; };
 
 template <> struct VecType<c10::BFloat16> { using vec_type = BF16Vec8; };
 
 template <typename T> void storeFP32(float v, T *ptr) { *ptr = v; }
 
-#ifdef __AVX512FP16__
+#ifdef __F16C__
 template <> inline void storeFP32<c10::Half>(float v, c10::Half *ptr) {
-  *reinterpret_cast<_Float16 *>(ptr) = v;
+  *reinterpret_cast<uint16_t *>(ptr) =
+      _cvtss_sh(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
 }
-#endif
+
+inline FP32Vec8::FP32Vec8(const FP16Vec8 &v) : reg(_mm256_cvtph_ps(v.reg)) {}
+
+inline FP16Vec8::FP16Vec8(const FP32Vec8 &v)
+    : reg(_mm256_cvtps_ph(v.reg, _MM_FROUND_TO_NEAREST_INT |
+                                     _MM_FROUND_NO_EXC)) {}
+
+#ifdef __AVX512F__
+inline FP32Vec16::FP32Vec16(const FP16Vec16 &v)
+    : reg(_mm512_cvtph_ps(v.reg)) {}
+
+inline FP16Vec16::FP16Vec16(const FP32Vec16 &v)
+    : reg(_mm512_cvtps_ph(v.reg, _MM_FROUND_TO_NEAREST_INT |
+                                     _MM_FROUND_NO_EXC)) {}
+#else
+inline FP32Vec16::FP32Vec16(const FP16Vec16 &v)
+    : reg_low(_mm256_cvtph_ps(_mm256_extracti128_si256(v.reg, 0))),
+      reg_high(_mm256_cvtph_ps(_mm256_extracti128_si256(v.reg, 1))) {}
+
+inline FP16Vec16::FP16Vec16(const FP32Vec16 &v) {
+  const __m128i low = _mm256_cvtps_ph(
+      v.reg_low, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  const __m128i high = _mm256_cvtps_ph(
+      v.reg_high, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  reg = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+}
+#endif // __AVX512F__
+#else
+namespace {
+// FP16 lanes of a 128-bit register, low (high) half, to FP32.
+FORCE_INLINE __m128 fp16_to_fp32_sse(__m128i v, bool high) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i w = high ? _mm_unpackhi_epi16(zero, v)
+                         : _mm_unpacklo_epi16(zero, v);
+  return (__m128)fp16::fp16_to_fp32((fp16::u32x4_t)w);
+}
+
+FORCE_INLINE __m256 fp16_to_fp32_avx2(__m128i v) {
+  return _mm256_set_m128(fp16_to_fp32_sse(v, true),
+                         fp16_to_fp32_sse(v, false));
+}
+
+FORCE_INLINE __m128i fp32_to_fp16_avx2(__m256 v) {
+  const __m128i low = (__m128i)fp16::fp32_to_fp16(
+      (fp16::f32x4_t)_mm256_castps256_ps128(v));
+  const __m128i high = (__m128i)fp16::fp32_to_fp16(
+      (fp16::f32x4_t)_mm256_extractf128_ps(v, 1));
+  return _mm_packus_epi32(low, high);
+}
+}; // namespace
+
+template <> inline void storeFP32<c10::Half>(float v, c10::Half *ptr) {
+  *ptr = c10::Half(v);
+}
+
+inline FP32Vec8::FP32Vec8(const FP16Vec8 &v) : reg(fp16_to_fp32_avx2(v.reg)) {}
+
+inline FP16Vec8::FP16Vec8(const FP32Vec8 &v) : reg(fp32_to_fp16_avx2(v.reg)) {}
+
+#ifdef __AVX512F__
+inline FP32Vec16::FP32Vec16(const FP16Vec16 &v)
+    : reg(_mm512_insertf32x8(
+          _mm512_castps256_ps512(
+              fp16_to_fp32_avx2(_mm256_extracti128_si256(v.reg, 0))),
+          fp16_to_fp32_avx2(_mm256_extracti128_si256(v.reg, 1)), 1)) {}
+
+inline FP16Vec16::FP16Vec16(const FP32Vec16 &v)
+    : reg(_mm256_set_m128i(
+          fp32_to_fp16_avx2(_mm512_extractf32x8_ps(v.reg, 1)),
+          fp32_to_fp16_avx2(_mm512_castps512_ps256(v.reg)))) {}
+#else
+inline FP32Vec16::FP32Vec16(const FP16Vec16 &v)
+    : reg_low(fp16_to_fp32_avx2(_mm256_extracti128_si256(v.reg, 0))),
+      reg_high(fp16_to_fp32_avx2(_mm256_extracti128_si256(v.reg, 1))) {}
+
+inline FP16Vec16::FP16Vec16(const FP32Vec16 &v)
+    : reg(_mm256_set_m128i(fp32_to_fp16_avx2(v.reg_high),
+                           fp32_to_fp16_avx2(v.reg_low))) {}
+#endif // __AVX512F__
+#endif // __F16C__
 
 inline void fma(FP32Vec16 &acc, FP32Vec16 &a, FP32Vec16 &b) {
   acc = acc + a * b;
@@ -566,8 +663,22 @@ inline BF16Vec16::BF16Vec16(const FP32Vec16 &v) {
 #endif // __AVX512F__
 #endif // __AVX512BF16__
 
+// Bytes of a cache line, the granule of prefetch().
+constexpr int CACHE_LINE_SIZE = 64;
+
 inline void prefetch(const void *addr) { _mm_prefetch(addr, _MM_HINT_T1); }
 
+inline void prefetch_write(const void *addr) {
+  __builtin_prefetch(addr, 1, 2);
+}
+
+// Copies `count` little-endian words of WORD_BYTES bytes, e.g. the tensors of
+// a checkpoint, in host byte order. x86 is little-endian.
+template <int WORD_BYTES>
+inline void load_le_words(void *dst, const void *src, const int64_t count) {
+  std::memcpy(dst, src, count * WORD_BYTES);
+}
+
 }; // namespace vec_op
 
 #endif
@@ -0,0 +1,599 @@
+#include "attention_kernels.hpp"
+#include "cpu_types.hpp"
+#include "kernel_tuner.hpp"
+#include "workspace.hpp"
+
+#include <vector>
+
+namespace {
+
+using namespace cpu_attention;
+
+// Weight rows of the projections per work item.
+constexpr int DEFAULT_COL_BLOCK = 16;
+
+// Tokens whose dot products with a weight row are accumulated per pass over
+// the row.
+constexpr int TOKEN_TILE = 4;
+
+// Decode step of a Llama decoder layer, see llama_decoder_layer().
+template <typename scalar_t>
+struct DecoderLayerArgs {
+  scalar_t* hidden_states;               // [num_tokens, hidden_size]
+  scalar_t* residual;                    // [num_tokens, hidden_size]
+  const int64_t* positions;              // [num_tokens]
+  const scalar_t* input_norm_weight;     // [hidden_size]
+  const scalar_t* qkv_weight;            // [qkv_size, hidden_size]
+  const scalar_t* o_weight;              // [hidden_size, q_size]
+  const scalar_t* post_norm_weight;      // [hidden_size]
+  const scalar_t* gate_up_weight;        // [2 * intermediate_size,
+                                         // hidden_size]
+  const scalar_t* down_weight;           // [hidden_size, intermediate_size]
+  const scalar_t* cos_sin_cache;         // [max_position, rot_dim]
+  scalar_t* key_cache;                   // [num_blocks, num_kv_heads,
+                                         // head_size/x, block_size, x]
+  scalar_t* value_cache;                 // [num_blocks, num_kv_heads,
+                                         // head_size, block_size]
+  const int64_t* slot_mapping;           // [num_tokens]
+  const int* block_tables;               // [num_tokens,
+                                         // max_num_blocks_per_seq]
+  const int* seq_lens;                   // [num_tokens]
+  // Activations between the stages, borrowed from the workspace.
+  scalar_t* normed;                      // [num_tokens, hidden_size]
+  scalar_t* qkv;                         // [num_tokens, qkv_size]
+  scalar_t* attn;                        // [num_tokens, q_size]
+  scalar_t* act;                         // [num_tokens, intermediate_size]
+  int num_tokens;
+  int hidden_size;
+  int intermediate_size;
+  int num_heads;
+  int num_kv_heads;
+  int head_size;
+  int rot_dim;
+  int max_num_blocks_per_seq;
+  int64_t kv_block_stride;
+  int64_t kv_head_stride;
+  float epsilon;
+  float scale;
+  bool add_residual;
+  bool is_neox;
+  int col_block;
+
+  int q_size() const { return num_heads * head_size; }
+  int qkv_size() const { return (num_heads + 2 * num_kv_heads) * head_size; }
+};
+
+// out = RMSNorm(residual) * weight for one token, where residual is first
+// replaced by input or, with add, incremented by it.
+template <typename scalar_t>
+FORCE_INLINE void addRmsNormToken(scalar_t* __restrict__ out,
+                                  scalar_t* __restrict__ residual,
+                                  const scalar_t* __restrict__ input,
+                                  const scalar_t* __restrict__ weight,
+                                  const bool add, const float epsilon,
+                                  const int hidden_size) {
+  using scalar_vec_t = vec_op::vec_t<scalar_t>;
+  constexpr int VEC_ELEM_NUM = scalar_vec_t::get_elem_num();
+
+  vec_op::FP32Vec8 variance(0.0);
+  for (int j = 0; j < hidden_size; j += VEC_ELEM_NUM) {
+    vec_op::FP32Vec8 fp32_x(scalar_vec_t(input + j));
+    if (add) {
+      fp32_x = fp32_x + vec_op::FP32Vec8(scalar_vec_t(residual + j));
+    }
+    variance = variance + fp32_x * fp32_x;
+    scalar_vec_t(fp32_x).save(residual + j);
+  }
+
+  float s_variance =
+      1.0f / sqrtf(variance.reduce_sum() / (float)hidden_size + epsilon);
+  vec_op::FP32Vec8 fp32_s_variance(s_variance);
+
+  for (int j = 0; j < hidden_size; j += VEC_ELEM_NUM) {
+    vec_op::FP32Vec8 fp32_res(scalar_vec_t(residual + j));
+    vec_op::FP32Vec8 fp32_w(scalar_vec_t(weight + j));
+    scalar_vec_t(fp32_res * fp32_s_variance * fp32_w).save(out + j);
+  }
+}
+
+// out[i] = dot(x[i, :], w_row) for the tile_len tokens of a tile.
+template <typename scalar_t>
+FORCE_INLINE void dotTokenTile(float* __restrict__ out,
+                               const scalar_t* __restrict__ x,
+                               const int64_t x_stride,
+                               const scalar_t* __restrict__ w_row,
+                               const int k, const int tile_len) {
+  using scalar_vec_t = vec_op::vec_t<scalar_t>;
+  constexpr int VEC_ELEM_NUM = scalar_vec_t::get_elem_num();
+
+  vec_op::FP32Vec8 accums[TOKEN_TILE];
+  for (int h = 0; h < k; h += VEC_ELEM_NUM) {
+    vec_op::FP32Vec8 w_vec(scalar_vec_t(w_row + h));
+    for (int i = 0; i < tile_len; ++i) {
+      vec_op::FP32Vec8 x_vec(scalar_vec_t(x + i * x_stride + h));
+      accums[i] = accums[i] + x_vec * w_vec;
+    }
+  }
+  for (int i = 0; i < tile_len; ++i) {
+    out[i] = accums[i].reduce_sum();
+  }
+}
+
+// out[t, n] = dot(x[t, :], w[n, :]) for the rows [row_start, row_end) of w.
+// Each weight row is streamed once per tile of tokens.
+template <typename scalar_t>
+FORCE_INLINE void projectRows(scalar_t* __restrict__ out,
+                              const int64_t out_stride,
+                              const scalar_t* __restrict__ x,
+                              const scalar_t* __restrict__ w, const int k,
+                              const int num_tokens, const int row_start,
+                              const int row_end) {
+  for (int n = row_start; n < row_end; ++n) {
+    const scalar_t* __restrict__ w_row = w + static_cast<int64_t>(n) * k;
+    for (int t = 0; t < num_tokens; t += TOKEN_TILE) {
+      const int tile_len = std::min(TOKEN_TILE, num_tokens - t);
+      float dots[TOKEN_TILE];
+      dotTokenTile(dots, x + static_cast<int64_t>(t) * k, k, w_row, k,
+                   tile_len);
+      for (int i = 0; i < tile_len; ++i) {
+        vec_op::storeFP32(dots[i], out + (t + i) * out_stride + n);
+      }
+    }
+  }
+}
+
+// act[t, j] = silu(gate[t, j]) * up[t, j] for the columns [col_start,
+// col_end), computed from the gate and the up rows of the merged weight
+// without writing them out.
+template <typename scalar_t>
+FORCE_INLINE void gateUpSiluColumns(scalar_t* __restrict__ act,
+                                    const scalar_t* __restrict__ x,
+                                    const scalar_t* __restrict__ gate_up,
+                                    const int k, const int intermediate_size,
+                                    const int num_tokens, const int col_start,
+                                    const int col_end) {
+  for (int j = col_start; j < col_end; ++j) {
+    const scalar_t* __restrict__ gate_row =
+        gate_up + static_cast<int64_t>(j) * k;
+    const scalar_t* __restrict__ up_row =
+        gate_row + static_cast<int64_t>(intermediate_size) * k;
+    for (int t = 0; t < num_tokens; t += TOKEN_TILE) {
+      const int tile_len = std::min(TOKEN_TILE, num_tokens - t);
+      float gates[TOKEN_TILE];
+      float ups[TOKEN_TILE];
+      dotTokenTile(gates, x + static_cast<int64_t>(t) * k, k, gate_row, k,
+                   tile_len);
+      dotTokenTile(ups, x + static_cast<int64_t>(t) * k, k, up_row, k,
+                   tile_len);
+      for (int i = 0; i < tile_len; ++i) {
+        const float silu = gates[i] / (1.0f + std::exp(-gates[i]));
+        vec_op::storeFP32(silu * ups[i],
+                          act + (t + i) * intermediate_size + j);
+      }
+    }
+  }
+}
+
+// Rotates the first rot_dim elements of a query or key head in place, in the
+// GPT-NeoX or the GPT-J layout, as rotary_embedding().
+template <typename scalar_t>
+FORCE_INLINE void rotateHead(scalar_t* __restrict__ head,
+                             const scalar_t* __restrict__ cos_sin,
+                             const int rot_dim, const bool is_neox) {
+  using scalar_vec_t = vec_op::vec_t<scalar_t>;
+  constexpr int VEC_ELEM_NUM = scalar_vec_t::get_elem_num();
+  const int embed_dim = rot_dim / 2;
+  const scalar_t* __restrict__ cos_ptr = cos_sin;
+  const scalar_t* __restrict__ sin_ptr = cos_sin + embed_dim;
+
+  if (!is_neox) {
+    for (int j = 0; j < embed_dim; ++j) {
+      const float cos = cos_ptr[j];
+      const float sin = sin_ptr[j];
+      const float x = head[2 * j];
+      const float y = head[2 * j + 1];
+      head[2 * j] = x * cos - y * sin;
+      head[2 * j + 1] = y * cos + x * sin;
+    }
+    return;
+  }
+
+  int j = 0;
+  for (; j + VEC_ELEM_NUM <= embed_dim; j += VEC_ELEM_NUM) {
+    vec_op::FP32Vec8 fp32_cos(scalar_vec_t(cos_ptr + j));
+    vec_op::FP32Vec8 fp32_sin(scalar_vec_t(sin_ptr + j));
+    vec_op::FP32Vec8 fp32_x(scalar_vec_t(head + j));
+    vec_op::FP32Vec8 fp32_y(scalar_vec_t(head + embed_dim + j));
+    scalar_vec_t(fp32_x * fp32_cos - fp32_y * fp32_sin).save(head + j);
+    scalar_vec_t(fp32_y * fp32_cos + fp32_x * fp32_sin)
+        .save(head + embed_dim + j);
+  }
+  for (; j < embed_dim; ++j) {
+    const float cos = cos_ptr[j];
+    const float sin = sin_ptr[j];
+    const float x = head[j];
+    const float y = head[embed_dim + j];
+    head[j] = x * cos - y * sin;
+    head[embed_dim + j] = y * cos + x * sin;
+  }
+}
+
+// Writes the key and the value head of a token to its slot, as
+// reshape_and_cache().
+template <typename scalar_t>
+FORCE_INLINE void cacheKVHead(const DecoderLayerArgs<scalar_t>& args,
+                              const scalar_t* __restrict__ key,
+                              const scalar_t* __restrict__ value,
+                              const int kv_head_idx, const int64_t slot_idx,
+                              const int block_size) {
+  constexpr int x = 16 / sizeof(scalar_t);
+  const int64_t block_offset = slot_idx % block_size;
+  const int64_t head_offset = (slot_idx / block_size) * args.kv_block_stride +
+                              kv_head_idx * args.kv_head_stride;
+  scalar_t* __restrict__ key_head = args.key_cache + head_offset;
+  scalar_t* __restrict__ value_head = args.value_cache + head_offset;
+
+  for (int src_idx = 0; src_idx < args.head_size; src_idx += x) {
+    const int64_t target_offset = src_idx * block_size + block_offset * x;
+    for (int i = 0; i < x; ++i) {
+      key_head[target_offset + i] = key[src_idx + i];
+    }
+  }
+  for (int src_idx = 0; src_idx < args.head_size; ++src_idx) {
+    value_head[src_idx * block_size + block_offset] = value[src_idx];
+  }
+}
+
+// Attention of the query of one decode token and head over its context, as
+// the generic kernel of paged_attention_v1() without alibi, sliding window
+// or block-sparse pattern.
+template <typename scalar_t, int BLOCK_SIZE, int HEAD_PARTITION_SIZE>
+FORCE_INLINE void attendHead(const DecoderLayerArgs<scalar_t>& args,
+                             const int token_idx, const int head_idx,
+                             const int prefetch_distance) {
+  constexpr int x = 16 / sizeof(scalar_t);
+  const int head_size = args.head_size;
+  const int seq_len = args.seq_lens[token_idx];
+  const int block_num = (seq_len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  const int last_block_token_num = seq_len - (block_num - 1) * BLOCK_SIZE;
+  const int* __restrict__ seq_block_table =
+      args.block_tables + args.max_num_blocks_per_seq * token_idx;
+  const int64_t kv_head_idx =
+      head_idx / (args.num_heads / args.num_kv_heads);
+  const scalar_t* __restrict__ q = args.qkv +
+                                   token_idx * args.qkv_size() +
+                                   head_idx * head_size;
+  const scalar_t* __restrict__ k_head_cache =
+      args.key_cache + kv_head_idx * args.kv_head_stride;
+  const scalar_t* __restrict__ v_head_cache =
+      args.value_cache + kv_head_idx * args.kv_head_stride;
+
+  const int max_seq_len_padded =
+      (args.max_num_blocks_per_seq * BLOCK_SIZE + 15) & 0xFFFFFFF0;
+  float* __restrict__ logits = cpu_memory::thread_buffer<float>(
+      cpu_memory::Buffer::SCRATCH, max_seq_len_padded);
+
+  for (int block_idx = 0; block_idx < block_num; ++block_idx) {
+    prefetchKVBlock(k_head_cache, seq_block_table, args.kv_block_stride,
+                    block_idx, block_num, prefetch_distance,
+                    head_size * BLOCK_SIZE);
+    const int block_token_num =
+        block_idx == block_num - 1 ? last_block_token_num : BLOCK_SIZE;
+    reduceQKBlockKernel<scalar_t, 0, BLOCK_SIZE, x>::call(
+        q, k_head_cache + seq_block_table[block_idx] * args.kv_block_stride,
+        logits + block_idx * BLOCK_SIZE, args.scale, block_token_num,
+        head_size);
+  }
+
+  reduceSoftmax(logits, seq_len, block_num * BLOCK_SIZE);
+
+  for (int head_part_idx = 0; head_part_idx < head_size / HEAD_PARTITION_SIZE;
+       ++head_part_idx) {
+    vec_op::FP32Vec16 accums[HEAD_PARTITION_SIZE];
+    const scalar_t* __restrict__ v_part_cache =
+        v_head_cache + BLOCK_SIZE * head_part_idx * HEAD_PARTITION_SIZE;
+    for (int block_idx = 0; block_idx < block_num; ++block_idx) {
+      prefetchKVBlock(v_part_cache, seq_block_table, args.kv_block_stride,
+                      block_idx, block_num, prefetch_distance,
+                      BLOCK_SIZE * HEAD_PARTITION_SIZE);
+      reduceValueBlock<scalar_t, 0, BLOCK_SIZE, HEAD_PARTITION_SIZE>(
+          logits + block_idx * BLOCK_SIZE,
+          v_part_cache + seq_block_table[block_idx] * args.kv_block_stride,
+          accums);
+    }
+
+    scalar_t* __restrict__ out_ptr = args.attn + token_idx * args.q_size() +
+                                     head_idx * head_size +
+                                     head_part_idx * HEAD_PARTITION_SIZE;
+    vec_op::unroll_loop<int, HEAD_PARTITION_SIZE>([&](int head_elem_idx) {
+      vec_op::storeFP32(accums[head_elem_idx].reduce_sum(),
+                        out_ptr + head_elem_idx);
+    });
+  }
+}
+
+// The stages of the layer run in a single parallel region. Each stage is a
+// worksharing loop whose implicit barrier orders it before the next one, and
+// the activations between them stay in the cache-resident workspace instead
+// of round-tripping through torch tensors.
+template <typename scalar_t, int BLOCK_SIZE, int HEAD_PARTITION_SIZE>
+void llama_decoder_layer_impl(const DecoderLayerArgs<scalar_t>& args,
+                              const int thread_num) {
+  const int num_tokens = args.num_tokens;
+  const int hidden_size = args.hidden_size;
+  const int q_size = args.q_size();
+  const int qkv_size = args.qkv_size();
+  const int kv_size = args.num_kv_heads * args.head_size;
+  const int col_block = args.col_block;
+  const int prefetch_distance = cpu_tuner::prefetch_distance();
+
+  const int qkv_items = (qkv_size + col_block - 1) / col_block;
+  const int hidden_items = (hidden_size + col_block - 1) / col_block;
+  const int intermediate_items =
+      (args.intermediate_size + col_block - 1) / col_block;
+
+  // One phase per worksharing loop.
+  cpu_profiler::RegionTimer region_timer(thread_num, 8);
+#pragma omp parallel num_threads(thread_num)
+  {
+    // Input RMSNorm, adding the output of the previous layer to the
+    // residual.
+#pragma omp for schedule(static)
+    for (int t = 0; t < num_tokens; ++t) {
+      const cpu_profiler::FinishScope finish(region_timer, 0);
+      addRmsNormToken(args.normed + t * hidden_size,
+                      args.residual + t * hidden_size,
+                      args.hidden_states + t * hidden_size,
+                      args.input_norm_weight, args.add_residual,
+                      args.epsilon, hidden_size);
+    }
+
+    // QKV projection.
+#pragma omp for schedule(static)
+    for (int item = 0; item < qkv_items; ++item) {
+      const cpu_profiler::FinishScope finish(region_timer, 1);
+      const int row_start = item * col_block;
+      projectRows(args.qkv, qkv_size, args.normed, args.qkv_weight,
+                  hidden_size, num_tokens, row_start,
+                  std::min(qkv_size, row_start + col_block));
+    }
+
+    // Rotary embedding of the query heads, and of the key heads which are
+    // then cached with the value heads.
+#pragma omp for collapse(2) schedule(static)
+    for (int t = 0; t < num_tokens; ++t) {
+      for (int h = 0; h < args.num_heads + args.num_kv_heads; ++h) {
+        const cpu_profiler::FinishScope finish(region_timer, 2);
+        scalar_t* token_qkv = args.qkv + t * qkv_size;
+        const scalar_t* cos_sin =
+            args.cos_sin_cache + args.positions[t] * args.rot_dim;
+        rotateHead(token_qkv + h * args.head_size, cos_sin, args.rot_dim,
+                   args.is_neox);
+        const int kv_head_idx = h - args.num_heads;
+        const int64_t slot_idx = args.slot_mapping[t];
+        if (kv_head_idx >= 0 && slot_idx >= 0) {
+          cacheKVHead(args, token_qkv + h * args.head_size,
+                      token_qkv + q_size + kv_size +
+                          kv_head_idx * args.head_size,
+                      kv_head_idx, slot_idx, BLOCK_SIZE);
+        }
+      }
+    }
+
+    // Paged attention, contexts differ in length.
+#pragma omp for collapse(2) schedule(dynamic, 1)
+    for (int t = 0; t < num_tokens; ++t) {
+      for (int h = 0; h < args.num_heads; ++h) {
+        const cpu_profiler::FinishScope finish(region_timer, 3);
+        attendHead<scalar_t, BLOCK_SIZE, HEAD_PARTITION_SIZE>(
+            args, t, h, prefetch_distance);
+      }
+    }
+
+    // Output projection into hidden_states.
+#pragma omp for schedule(static)
+    for (int item = 0; item < hidden_items; ++item) {
+      const cpu_profiler::FinishScope finish(region_timer, 4);
+      const int row_start = item * col_block;
+      projectRows(args.hidden_states, hidden_size, args.attn, args.o_weight,
+                  q_size, num_tokens, row_start,
+                  std::min(hidden_size, row_start + col_block));
+    }
+
+    // Post-attention RMSNorm, adding the attention to the residual.
+#pragma omp for schedule(static)
+    for (int t = 0; t < num_tokens; ++t) {
+      const cpu_profiler::FinishScope finish(region_timer, 5);
+      addRmsNormToken(args.normed + t * hidden_size,
+                      args.residual + t * hidden_size,
+                      args.hidden_states + t * hidden_size,
+                      args.post_norm_weight, true, args.epsilon,
+                      hidden_size);
+    }
+
+    // Gate and up projections with SiLU and mul.
+#pragma omp for schedule(static)
+    for (int item = 0; item < intermediate_items; ++item) {
+      const cpu_profiler::FinishScope finish(region_timer, 6);
+      const int col_start = item * col_block;
+      const int col_end =
+          std::min(args.intermediate_size, col_start + col_block);
+      gateUpSiluColumns(args.act, args.normed, args.gate_up_weight,
+                        hidden_size, args.intermediate_size, num_tokens,
+                        col_start, col_end);
+    }
+
+    // Down projection into hidden_states.
+#pragma omp for schedule(static)
+    for (int item = 0; item < hidden_items; ++item) {
+      const cpu_profiler::FinishScope finish(region_timer, 7);
+      const int row_start = item * col_block;
+      projectRows(args.hidden_states, hidden_size, args.act,
+                  args.down_weight, args.intermediate_size, num_tokens,
+                  row_start, std::min(hidden_size, row_start + col_block));
+    }
+  }
+}
+
+// Bytes of the weights, the KV of the contexts and the hidden states and
+// residual read and written by a layer, reported to the kernel profiler.
+int64_t decoderLayerBytes(const torch::Tensor& hidden_states,
+                          const std::vector<torch::Tensor>& weights,
+                          const torch::Tensor& key_cache,
+                          const torch::Tensor& seq_lens) {
+  const int64_t kv_bytes_per_token = 2 * key_cache.stride(0) /
+                                     key_cache.size(3) *
+                                     key_cache.element_size();
+  int64_t bytes = 4 * hidden_states.nbytes() +
+                  seq_lens.sum().item<int64_t>() * kv_bytes_per_token;
+  for (const torch::Tensor& weight : weights) {
+    bytes += weight.nbytes();
+  }
+  return bytes;
+}
+
+#define LAUNCH_DECODER_LAYER_IMPL(T, BLOCK_SIZE, HEAD_PART_SIZE) \
+  llama_decoder_layer_impl<T, BLOCK_SIZE, HEAD_PART_SIZE>(args,   \
+                                                          config.threads());
+
+// Value heads which are not a multiple of 16 elements are reduced 8 head
+// elements at a time.
+#define CALL_DECODER_LAYER_LAUNCHER(T, BLOCK_SIZE)     \
+  if (head_size % 16 != 0) {                           \
+    LAUNCH_DECODER_LAYER_IMPL(T, BLOCK_SIZE, 8)        \
+  } else {                                             \
+    LAUNCH_DECODER_LAYER_IMPL(T, BLOCK_SIZE, 16)       \
+  }
+}  // namespace
+
+// One decode step of a Llama decoder layer with unquantized weights and a
+// single tensor parallel rank, in place of rms_norm (fused_add_rms_norm with
+// add_residual), the QKV projection, rotary_embedding, reshape_and_cache,
+// paged_attention_v1, the output projection, fused_add_rms_norm, the gate
+// and up projections, silu_and_mul and the down projection. Every token is
+// the next token of its own sequence. hidden_states is replaced by the
+// output of the MLP and residual by the residual after the attention, as
+// returned by LlamaDecoderLayer. weights are the input norm, QKV, output,
+// post-attention norm, gate_up and down weights.
+void llama_decoder_layer(torch::Tensor& hidden_states,
+                         torch::Tensor& residual, bool add_residual,
+                         torch::Tensor& positions,
+                         const std::vector<torch::Tensor>& weights,
+                         double epsilon, torch::Tensor& cos_sin_cache,
+                         bool is_neox, torch::Tensor& key_cache,
+                         torch::Tensor& value_cache,
+                         torch::Tensor& slot_mapping,
+                         torch::Tensor& block_tables, torch::Tensor& seq_lens,
+                         int64_t num_heads, double scale) {
+  TORCH_CHECK(weights.size() == 6,
+              "Expected the input norm, QKV, output, post-attention norm, "
+              "gate_up and down weights");
+  const torch::Tensor& input_norm_weight = weights[0];
+  const torch::Tensor& qkv_weight = weights[1];
+  const torch::Tensor& o_weight = weights[2];
+  const torch::Tensor& post_norm_weight = weights[3];
+  const torch::Tensor& gate_up_weight = weights[4];
+  const torch::Tensor& down_weight = weights[5];
+
+  const int num_tokens = hidden_states.size(0);
+  const int hidden_size = hidden_states.size(1);
+  const int num_kv_heads = value_cache.size(1);
+  const int head_size = value_cache.size(2);
+  const int block_size = value_cache.size(3);
+  const int intermediate_size = down_weight.size(1);
+  const int rot_dim = cos_sin_cache.size(1);
+  const int q_size = num_heads * head_size;
+  const int qkv_size = q_size + 2 * num_kv_heads * head_size;
+
+  TORCH_CHECK(hidden_states.dim() == 2 && hidden_states.is_contiguous() &&
+              residual.is_contiguous() &&
+              residual.sizes() == hidden_states.sizes());
+  for (const torch::Tensor& tensor :
+       {residual, cos_sin_cache, key_cache, value_cache}) {
+    TORCH_CHECK(tensor.scalar_type() == hidden_states.scalar_type());
+  }
+  for (const torch::Tensor& weight : weights) {
+    TORCH_CHECK(weight.scalar_type() == hidden_states.scalar_type() &&
+                    weight.is_contiguous(),
+                "Decoder layer weights must be contiguous and of the "
+                "activation type");
+  }
+  TORCH_CHECK(input_norm_weight.numel() == hidden_size &&
+              post_norm_weight.numel() == hidden_size);
+  TORCH_CHECK(qkv_weight.size(0) == qkv_size &&
+              qkv_weight.size(1) == hidden_size);
+  TORCH_CHECK(o_weight.size(0) == hidden_size && o_weight.size(1) == q_size);
+  TORCH_CHECK(gate_up_weight.size(0) == 2 * intermediate_size &&
+              gate_up_weight.size(1) == hidden_size);
+  TORCH_CHECK(down_weight.size(0) == hidden_size);
+  TORCH_CHECK(num_heads % num_kv_heads == 0);
+  TORCH_CHECK(hidden_size % 8 == 0 && intermediate_size % 8 == 0 &&
+                  head_size % 8 == 0,
+              "The hidden, intermediate and head sizes must be multiples "
+              "of 8");
+  TORCH_CHECK(rot_dim % 2 == 0 && rot_dim <= head_size);
+  TORCH_CHECK(key_cache.is_contiguous() && value_cache.is_contiguous());
+  TORCH_CHECK(seq_lens.size(0) == num_tokens &&
+                  block_tables.size(0) == num_tokens &&
+                  slot_mapping.numel() == num_tokens &&
+                  positions.numel() == num_tokens,
+              "The fused decoder layer takes one decode token per sequence");
+
+  const cpu_tuner::KernelConfig config = cpu_tuner::lookup(
+      "llama_decoder_layer",
+      {hidden_states.element_size(), cpu_tuner::shape_bucket(num_tokens),
+       hidden_size, intermediate_size});
+
+  VLLM_DISPATCH_FLOATING_TYPES(
+      hidden_states.scalar_type(), "llama_decoder_layer_impl", [&] {
+        DecoderLayerArgs<scalar_t> args;
+        args.hidden_states = hidden_states.data_ptr<scalar_t>();
+        args.residual = residual.data_ptr<scalar_t>();
+        args.positions = positions.data_ptr<int64_t>();
+        args.input_norm_weight = input_norm_weight.data_ptr<scalar_t>();
+        args.qkv_weight = qkv_weight.data_ptr<scalar_t>();
+        args.o_weight = o_weight.data_ptr<scalar_t>();
+        args.post_norm_weight = post_norm_weight.data_ptr<scalar_t>();
+        args.gate_up_weight = gate_up_weight.data_ptr<scalar_t>();
+        args.down_weight = down_weight.data_ptr<scalar_t>();
+        args.cos_sin_cache = cos_sin_cache.data_ptr<scalar_t>();
+        args.key_cache = key_cache.data_ptr<scalar_t>();
+        args.value_cache = value_cache.data_ptr<scalar_t>();
+        args.slot_mapping = slot_mapping.data_ptr<int64_t>();
+        args.block_tables = block_tables.data_ptr<int>();
+        args.seq_lens = seq_lens.data_ptr<int>();
+        args.num_tokens = num_tokens;
+        args.hidden_size = hidden_size;
+        args.intermediate_size = intermediate_size;
+        args.num_heads = num_heads;
+        args.num_kv_heads = num_kv_heads;
+        args.head_size = head_size;
+        args.rot_dim = rot_dim;
+        args.max_num_blocks_per_seq = block_tables.size(1);
+        args.kv_block_stride = key_cache.stride(0);
+        args.kv_head_stride = key_cache.stride(1);
+        args.epsilon = epsilon;
+        args.scale = scale;
+        args.add_residual = add_residual;
+        args.is_neox = is_neox;
+        args.col_block = config.block > 0 ? config.block : DEFAULT_COL_BLOCK;
+
+        // One arena for the activations of all stages, cache-sized for
+        // decode batches.
+        const int64_t token_elems =
+            hidden_size + qkv_size + q_size + intermediate_size;
+        scalar_t* activations = cpu_memory::thread_buffer<scalar_t>(
+            cpu_memory::Buffer::LAYER_ACTIVATIONS, num_tokens * token_elems);
+        args.normed = activations;
+        args.qkv = args.normed + num_tokens * hidden_size;
+        args.attn = args.qkv + num_tokens * qkv_size;
+        args.act = args.attn + num_tokens * q_size;
+
+        CPU_KERNEL_GUARD_IN(llama_decoder_layer_impl)
+        CPU_KERNEL_GUARD_ANNOTATE(
+            llama_decoder_layer_impl, num_tokens,
+            decoderLayerBytes(hidden_states, weights, key_cache, seq_lens))
+        CALL_KERNEL_LAUNCHER_BLOCK_SIZE(CALL_DECODER_LAYER_LAUNCHER, scalar_t)
+        CPU_KERNEL_GUARD_OUT(llama_decoder_layer_impl)
+      });
+}
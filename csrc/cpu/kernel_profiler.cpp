@@ -0,0 +1,279 @@
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+
+#include "cpu_types.hpp"
+
+namespace cpu_profiler {
+
+std::atomic<int> profiling_level{0};
+std::atomic<int64_t> barrier_wait_ns{0};
+std::atomic<int64_t> imbalance_ns{0};
+
+namespace {
+// Distinct (kernel, shape bucket) pairs recorded by one thread, further pairs
+// are dropped.
+constexpr int MAX_ENTRY_NUM = 1024;
+
+int64_t shape_bucket(const int64_t shape) {
+  int64_t bucket = shape > 0 ? 1 : 0;
+  while (bucket < shape) bucket <<= 1;
+  return bucket;
+}
+
+void atomic_max(std::atomic<int64_t>& target, const int64_t value) {
+  int64_t current = target.load(std::memory_order_relaxed);
+  while (current < value &&
+         !target.compare_exchange_weak(current, value,
+                                       std::memory_order_relaxed)) {
+  }
+}
+
+struct StatsEntry {
+  const char* name;
+  int64_t bucket;
+  std::atomic<int64_t> calls{0};
+  std::atomic<int64_t> total_ns{0};
+  std::atomic<int64_t> max_ns{0};
+  std::atomic<int64_t> bytes{0};
+  std::atomic<int64_t> imbalance_total_ns{0};
+  std::atomic<int64_t> imbalance_max_ns{0};
+  std::atomic<int64_t> barrier_total_ns{0};
+  std::atomic<int64_t> hw_counters[HW_COUNTER_NUM] = {};
+};
+
+struct EntryKey {
+  const char* name;
+  int64_t bucket;
+  bool operator==(const EntryKey& other) const {
+    return name == other.name && bucket == other.bucket;
+  }
+};
+
+struct EntryKeyHash {
+  size_t operator()(const EntryKey& key) const {
+    return std::hash<const void*>()(key.name) ^
+           std::hash<int64_t>()(key.bucket) * 31;
+  }
+};
+
+// Entries are only appended by the owning thread and published through
+// `size`, so the collector can read them while the owner keeps recording.
+struct ThreadTable {
+  StatsEntry entries[MAX_ENTRY_NUM];
+  std::atomic<int> size{0};
+  // Only accessed by the owning thread.
+  std::unordered_map<EntryKey, int, EntryKeyHash> index;
+};
+
+struct HwCounterEvent {
+  uint32_t type;
+  uint64_t config;
+};
+
+constexpr HwCounterEvent HW_COUNTER_EVENTS[HW_COUNTER_NUM] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+};
+
+// perf_event_open counter group of one thread. Events the CPU does not
+// support are left out of the group and read as 0.
+struct ThreadCounterGroup {
+  bool opened = false;
+  int leader_fd = -1;
+  int member_num = 0;
+  // Position of each event in the group read, -1 if not available.
+  int slots[HW_COUNTER_NUM];
+};
+
+thread_local ThreadCounterGroup counter_group;
+
+void read_thread_counters(HwCounters& counters) {
+  counters.fill(0);
+  if (counter_group.leader_fd < 0) return;
+  // PERF_FORMAT_GROUP layout: {nr, values[nr]}
+  uint64_t values[1 + HW_COUNTER_NUM];
+  const ssize_t read_bytes =
+      read(counter_group.leader_fd, values, sizeof(values));
+  if (read_bytes < static_cast<ssize_t>(sizeof(uint64_t))) return;
+  for (int i = 0; i < HW_COUNTER_NUM; ++i) {
+    const int slot = counter_group.slots[i];
+    if (slot >= 0 && slot < static_cast<int>(values[0])) {
+      counters[i] = values[1 + slot];
+    }
+  }
+}
+
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<ThreadTable>> registry;
+
+ThreadTable& local_table() {
+  // Tables outlive their threads, the registry keeps them for collection.
+  thread_local ThreadTable* table = nullptr;
+  if (table == nullptr) {
+    std::lock_guard<std::mutex> guard(registry_mutex);
+    registry.emplace_back(std::make_unique<ThreadTable>());
+    table = registry.back().get();
+  }
+  return *table;
+}
+}  // namespace
+
+void record(const char* name, int64_t shape, int64_t wall_ns, int64_t bytes,
+            int64_t imbalance_ns, int64_t barrier_ns,
+            const HwCounters& counters) {
+  ThreadTable& table = local_table();
+  const EntryKey key{name, shape_bucket(shape)};
+  auto iter = table.index.find(key);
+  int entry_idx;
+  if (iter != table.index.end()) {
+    entry_idx = iter->second;
+  } else {
+    entry_idx = table.size.load(std::memory_order_relaxed);
+    if (entry_idx == MAX_ENTRY_NUM) return;
+    table.entries[entry_idx].name = key.name;
+    table.entries[entry_idx].bucket = key.bucket;
+    table.index.emplace(key, entry_idx);
+    table.size.store(entry_idx + 1, std::memory_order_release);
+  }
+
+  StatsEntry& entry = table.entries[entry_idx];
+  entry.calls.fetch_add(1, std::memory_order_relaxed);
+  entry.total_ns.fetch_add(wall_ns, std::memory_order_relaxed);
+  atomic_max(entry.max_ns, wall_ns);
+  entry.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  entry.imbalance_total_ns.fetch_add(imbalance_ns, std::memory_order_relaxed);
+  atomic_max(entry.imbalance_max_ns, imbalance_ns);
+  entry.barrier_total_ns.fetch_add(barrier_ns, std::memory_order_relaxed);
+  for (int i = 0; i < HW_COUNTER_NUM; ++i) {
+    entry.hw_counters[i].fetch_add(counters[i], std::memory_order_relaxed);
+  }
+}
+
+void open_thread_counters() {
+  if (counter_group.opened) return;
+  counter_group.opened = true;
+  for (int i = 0; i < HW_COUNTER_NUM; ++i) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = HW_COUNTER_EVENTS[i].type;
+    attr.config = HW_COUNTER_EVENTS[i].config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // Counts the calling thread on any CPU.
+    const int fd = syscall(__NR_perf_event_open, &attr, 0, -1,
+                           counter_group.leader_fd, 0);
+    if (fd < 0) {
+      counter_group.slots[i] = -1;
+      continue;
+    }
+    if (counter_group.leader_fd < 0) counter_group.leader_fd = fd;
+    counter_group.slots[i] = counter_group.member_num++;
+  }
+  if (counter_group.leader_fd < 0) {
+    TORCH_WARN_ONCE(
+        "perf_event_open failed, CPU kernel hardware counters are not "
+        "available. Check /proc/sys/kernel/perf_event_paranoid.");
+  }
+}
+
+void snapshot_threads(std::vector<HwCounters>& samples) {
+  samples.resize(omp_get_max_threads());
+#pragma omp parallel
+  {
+    open_thread_counters();
+    read_thread_counters(samples[omp_get_thread_num()]);
+  }
+}
+
+void summarize_threads(const std::vector<HwCounters>& samples,
+                       HwCounters& counters) {
+  std::vector<HwCounters> counter_deltas(samples.size(), HwCounters{});
+#pragma omp parallel
+  {
+    const int thread_idx = omp_get_thread_num();
+    if (thread_idx < static_cast<int>(samples.size())) {
+      HwCounters now;
+      read_thread_counters(now);
+      for (int i = 0; i < HW_COUNTER_NUM; ++i) {
+        counter_deltas[thread_idx][i] = now[i] - samples[thread_idx][i];
+      }
+    }
+  }
+  for (const HwCounters& deltas : counter_deltas) {
+    for (int i = 0; i < HW_COUNTER_NUM; ++i) {
+      counters[i] += deltas[i];
+    }
+  }
+}
+
+}  // namespace cpu_profiler
+
+void set_cpu_kernel_profiling(int64_t level) {
+  TORCH_CHECK(level >= 0 && level <= cpu_profiler::HW_COUNTER_LEVEL,
+              "CPU kernel profiling level must be in [0, ",
+              cpu_profiler::HW_COUNTER_LEVEL, "], got ", level);
+  cpu_profiler::profiling_level.store(level, std::memory_order_relaxed);
+}
+
+// Returns the kernel names and an int64 tensor with one row per (kernel, shape
+// bucket): [shape_bucket, calls, total_ns, max_ns, bytes, imbalance_total_ns,
+// imbalance_max_ns, cycles, instructions, l1d_misses, llc_misses,
+// stall_cycles, barrier_total_ns], and resets the stats.
+std::tuple<std::vector<std::string>, torch::Tensor> collect_cpu_kernel_stats() {
+  using namespace cpu_profiler;
+  constexpr int COLUMN_NUM = 8 + HW_COUNTER_NUM;
+  std::map<std::pair<std::string, int64_t>, std::vector<int64_t>> merged;
+  {
+    std::lock_guard<std::mutex> guard(registry_mutex);
+    for (auto& table : registry) {
+      const int size = table->size.load(std::memory_order_acquire);
+      for (int i = 0; i < size; ++i) {
+        StatsEntry& entry = table->entries[i];
+        const int64_t calls = entry.calls.exchange(0);
+        if (calls == 0) continue;
+        auto& row = merged[{entry.name, entry.bucket}];
+        row.resize(COLUMN_NUM, 0);
+        row[0] = entry.bucket;
+        row[1] += calls;
+        row[2] += entry.total_ns.exchange(0);
+        row[3] = std::max(row[3], entry.max_ns.exchange(0));
+        row[4] += entry.bytes.exchange(0);
+        row[5] += entry.imbalance_total_ns.exchange(0);
+        row[6] = std::max(row[6], entry.imbalance_max_ns.exchange(0));
+        for (int c = 0; c < HW_COUNTER_NUM; ++c) {
+          row[7 + c] += entry.hw_counters[c].exchange(0);
+        }
+        row[7 + HW_COUNTER_NUM] += entry.barrier_total_ns.exchange(0);
+      }
+    }
+  }
+
+  std::vector<std::string> names;
+  names.reserve(merged.size());
+  torch::Tensor stats = torch::empty(
+      {static_cast<int64_t>(merged.size()), COLUMN_NUM}, torch::kInt64);
+  int64_t* stats_ptr = stats.data_ptr<int64_t>();
+  for (auto& [key, row] : merged) {
+    names.push_back(key.first);
+    std::copy(row.begin(), row.end(), stats_ptr);
+    stats_ptr += COLUMN_NUM;
+  }
+  return {names, stats};
+}
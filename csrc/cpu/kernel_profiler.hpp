@@ -0,0 +1,208 @@
+#ifndef CPU_KERNEL_PROFILER_HPP
+#define CPU_KERNEL_PROFILER_HPP
+
+#include <omp.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Runtime kernel profiling behind CPU_KERNEL_GUARD_IN/OUT. Each calling
+// thread records into its own table without locks, the tables are aggregated
+// and reset by collect_cpu_kernel_stats() in kernel_profiler.cpp.
+namespace cpu_profiler {
+
+// 0: disabled, 1: call count, wall time and bytes, 2: additionally the
+// imbalance between the OpenMP threads of the team, from the wall-clock time
+// each thread finishes its work in the parallel regions timed by
+// RegionTimer, 3: additionally the hardware counters of the OpenMP threads,
+// which costs two extra parallel regions per kernel call.
+extern std::atomic<int> profiling_level;
+
+// Wall time the OpenMP threads waited at the closing barriers of the loops of
+// cpu_threads::parallel_for(), summed over the threads. Only counted while
+// profiling.
+extern std::atomic<int64_t> barrier_wait_ns;
+
+// Time between the first and the last thread of the team to finish, summed
+// over the parallel regions timed by RegionTimer. Only counted from
+// THREAD_SAMPLE_LEVEL on.
+extern std::atomic<int64_t> imbalance_ns;
+
+constexpr int THREAD_SAMPLE_LEVEL = 2;
+constexpr int HW_COUNTER_LEVEL = 3;
+
+// Cycles, instructions, L1D read misses, LLC misses and backend (memory
+// bound) stall cycles, read through perf_event_open counter groups.
+constexpr int HW_COUNTER_NUM = 5;
+using HwCounters = std::array<int64_t, HW_COUNTER_NUM>;
+
+void record(const char* name, int64_t shape, int64_t wall_ns, int64_t bytes,
+            int64_t imbalance_ns, int64_t barrier_ns,
+            const HwCounters& counters);
+
+// Opens the counter group of the calling thread if not open yet.
+void open_thread_counters();
+
+// Samples the hardware counters of every OpenMP thread of the team.
+void snapshot_threads(std::vector<HwCounters>& samples);
+
+// Adds the counter deltas of all threads since the snapshot to counters.
+void summarize_threads(const std::vector<HwCounters>& samples,
+                       HwCounters& counters);
+
+inline int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Wall-clock finish times of the threads of one parallel region of
+// thread_num threads, recorded from THREAD_SAMPLE_LEVEL on. Thread CPU time
+// would count the spinning at the closing barrier as busy. Regions of several
+// worksharing loops, which the threads leave together, time each loop as a
+// phase. Destroyed after the region, the timer adds the time between the
+// first and the last thread to finish each phase to imbalance_ns. Threads
+// without work in a phase finish when it starts.
+class RegionTimer {
+ public:
+  explicit RegionTimer(const int thread_num, const int phase_num = 1)
+      : thread_num_(thread_num), phase_num_(phase_num) {
+    if (profiling_level.load(std::memory_order_relaxed) <
+        THREAD_SAMPLE_LEVEL) {
+      return;
+    }
+    start_ns_ = now_ns();
+    finish_ns_.resize(thread_num * phase_num);
+  }
+
+  ~RegionTimer() {
+    if (!timed()) return;
+    const int team_size =
+        std::min(team_size_.load(std::memory_order_relaxed), thread_num_);
+    int64_t phase_start_ns = start_ns_;
+    int64_t total_ns = 0;
+    for (int phase = 0; phase < phase_num_; ++phase) {
+      const FinishTime* finish_ns = &finish_ns_[phase * thread_num_];
+      int64_t first = std::numeric_limits<int64_t>::max();
+      int64_t last = phase_start_ns;
+      for (int i = 0; i < team_size; ++i) {
+        const int64_t ns =
+            finish_ns[i].ns < 0 ? phase_start_ns : finish_ns[i].ns;
+        first = std::min(first, ns);
+        last = std::max(last, ns);
+      }
+      if (team_size > 0) total_ns += last - first;
+      phase_start_ns = last;
+    }
+    imbalance_ns.fetch_add(total_ns, std::memory_order_relaxed);
+  }
+
+  bool timed() const { return !finish_ns_.empty(); }
+
+  // Called by the threads of the region when they finish a part of the work
+  // of phase, the last call of each thread counts.
+  void finish(const int phase = 0) {
+    const int thread_idx = omp_get_thread_num();
+    if (thread_idx >= thread_num_) return;
+    team_size_.store(omp_get_num_threads(), std::memory_order_relaxed);
+    finish_ns_[phase * thread_num_ + thread_idx].ns = now_ns();
+  }
+
+ private:
+  // One cache line per thread.
+  struct alignas(64) FinishTime {
+    int64_t ns = -1;
+  };
+
+  const int thread_num_;
+  const int phase_num_;
+  int64_t start_ns_ = 0;
+  std::atomic<int> team_size_{0};
+  std::vector<FinishTime> finish_ns_;
+};
+
+// Finishes the calling thread in phase of timer when it leaves the enclosing
+// scope, e.g. the body of a `parallel for` loop.
+class FinishScope {
+ public:
+  explicit FinishScope(RegionTimer& timer, const int phase = 0)
+      : timer_(timer), phase_(phase) {}
+  ~FinishScope() {
+    if (timer_.timed()) timer_.finish(phase_);
+  }
+
+ private:
+  RegionTimer& timer_;
+  const int phase_;
+};
+
+class KernelScope {
+ public:
+  explicit KernelScope(const char* name)
+      : name_(name), level_(profiling_level.load(std::memory_order_relaxed)) {
+    if (level_ == 0) return;
+    if (level_ >= HW_COUNTER_LEVEL) snapshot_threads(thread_samples_);
+    barrier_start_ns_ = barrier_wait_ns.load(std::memory_order_relaxed);
+    imbalance_start_ns_ = imbalance_ns.load(std::memory_order_relaxed);
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  ~KernelScope() { stop(); }
+
+  bool enabled() const { return level_ != 0; }
+
+  // Shape is bucketed to the next power of two, e.g. the number of tokens.
+  void annotate(const int64_t shape, const int64_t bytes) {
+    shape_ = shape;
+    bytes_ = bytes;
+  }
+
+  void stop() {
+    if (level_ == 0) return;
+    const int64_t wall_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_)
+            .count();
+    HwCounters counters{};
+    if (level_ >= HW_COUNTER_LEVEL) {
+      summarize_threads(thread_samples_, counters);
+    }
+    const int64_t barrier_ns =
+        barrier_wait_ns.load(std::memory_order_relaxed) - barrier_start_ns_;
+    const int64_t region_imbalance_ns =
+        imbalance_ns.load(std::memory_order_relaxed) - imbalance_start_ns_;
+    record(name_, shape_, wall_ns, bytes_, region_imbalance_ns, barrier_ns,
+           counters);
+    level_ = 0;
+  }
+
+ private:
+  const char* name_;
+  int level_;
+  int64_t shape_ = 0;
+  int64_t bytes_ = 0;
+  int64_t barrier_start_ns_ = 0;
+  int64_t imbalance_start_ns_ = 0;
+  std::chrono::steady_clock::time_point start_;
+  std::vector<HwCounters> thread_samples_;
+};
+
+}  // namespace cpu_profiler
+
+#define CPU_KERNEL_PROFILE_IN(NAME) \
+  cpu_profiler::KernelScope NAME##_profile_scope(#NAME);
+#define CPU_KERNEL_PROFILE_OUT(NAME) NAME##_profile_scope.stop();
+
+// Attaches the shape and the bytes touched to the kernel call opened by
+// CPU_KERNEL_GUARD_IN(NAME), the arguments are only evaluated when profiling.
+#define CPU_KERNEL_GUARD_ANNOTATE(NAME, SHAPE, BYTES) \
+  if (NAME##_profile_scope.enabled()) {               \
+    NAME##_profile_scope.annotate(SHAPE, BYTES);      \
+  }
+
+#endif
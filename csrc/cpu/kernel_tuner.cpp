@@ -0,0 +1,83 @@
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+
+#include "cpu_types.hpp"
+#include "kernel_tuner.hpp"
+
+namespace cpu_tuner {
+
+namespace {
+using ConfigKey = std::pair<std::string, std::vector<int64_t>>;
+
+std::shared_mutex table_mutex;
+std::map<ConfigKey, KernelConfig> config_table;
+// Lets the kernels skip the lookup while nothing is installed.
+std::atomic<bool> has_configs{false};
+
+std::atomic<int> block_prefetch_distance{VLLM_CPU_PREFETCH_DISTANCE};
+}  // namespace
+
+int64_t shape_bucket(const int64_t size) {
+  int64_t bucket = size > 0 ? 1 : 0;
+  while (bucket < size) bucket <<= 1;
+  return bucket;
+}
+
+KernelConfig lookup(const char* kernel,
+                    const std::vector<int64_t>& shape_key) {
+  if (!has_configs.load(std::memory_order_acquire)) return {};
+  std::shared_lock<std::shared_mutex> guard(table_mutex);
+  auto iter = config_table.find({kernel, shape_key});
+  return iter == config_table.end() ? KernelConfig{} : iter->second;
+}
+
+int prefetch_distance() {
+  return block_prefetch_distance.load(std::memory_order_relaxed);
+}
+
+}  // namespace cpu_tuner
+
+// config: [thread_num, head_unroll, block, schedule], see
+// cpu_tuner::KernelConfig.
+void set_cpu_kernel_config(const std::string& kernel,
+                           const std::vector<int64_t>& shape_key,
+                           const std::vector<int64_t>& config) {
+  using namespace cpu_tuner;
+  TORCH_CHECK(config.size() == 4,
+              "Kernel config must be [thread_num, head_unroll, block, "
+              "schedule], got ",
+              config.size(), " values");
+  KernelConfig kernel_config;
+  kernel_config.thread_num = config[0];
+  kernel_config.head_unroll = config[1];
+  kernel_config.block = config[2];
+  kernel_config.schedule = static_cast<Schedule>(config[3]);
+  TORCH_CHECK(kernel_config.thread_num >= 0 && kernel_config.block >= 0,
+              "thread_num and block must be non-negative");
+  TORCH_CHECK(kernel_config.head_unroll == 8 || kernel_config.head_unroll == 16,
+              "Unsupported head_unroll: ", kernel_config.head_unroll);
+  TORCH_CHECK(config[3] >= 0 && config[3] <= 2, "Unsupported schedule: ",
+              config[3]);
+
+  std::unique_lock<std::shared_mutex> guard(table_mutex);
+  config_table[{kernel, shape_key}] = kernel_config;
+  has_configs.store(true, std::memory_order_release);
+}
+
+void clear_cpu_kernel_configs() {
+  using namespace cpu_tuner;
+  std::unique_lock<std::shared_mutex> guard(table_mutex);
+  config_table.clear();
+  has_configs.store(false, std::memory_order_release);
+}
+
+void set_cpu_prefetch_distance(int64_t distance) {
+  TORCH_CHECK(distance >= 0 && distance <= 64,
+              "Prefetch distance must be in [0, 64], got ", distance);
+  cpu_tuner::block_prefetch_distance.store(distance,
+                                           std::memory_order_relaxed);
+}
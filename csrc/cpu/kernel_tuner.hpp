@@ -0,0 +1,65 @@
+#ifndef CPU_KERNEL_TUNER_HPP
+#define CPU_KERNEL_TUNER_HPP
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Default of cpu_tuner::prefetch_distance().
+#ifndef VLLM_CPU_PREFETCH_DISTANCE
+#define VLLM_CPU_PREFETCH_DISTANCE 1
+#endif
+
+// Tuned launch configurations of the CPU kernels. vllm/worker/cpu_tuner.py
+// benchmarks the candidates for the shapes of the served model, persists the
+// winners in its on-disk cache and installs them through
+// set_cpu_kernel_config(). The kernels look up the configuration of each call
+// by shape and fall back to their defaults for untuned shapes.
+namespace cpu_tuner {
+
+enum class Schedule : int { DEFAULT = 0, STATIC = 1, DYNAMIC = 2 };
+
+struct KernelConfig {
+  // OpenMP threads of the main parallel region, 0 for all threads.
+  int thread_num = 0;
+  // Head elements accumulated per pass over the value blocks (attention).
+  int head_unroll = 16;
+  // Weight rows or columns per work item (LoRA), 0 for the kernel default.
+  int block = 0;
+  Schedule schedule = Schedule::DEFAULT;
+
+  int threads() const {
+    const int max_threads = omp_get_max_threads();
+    return thread_num > 0 ? std::min(thread_num, max_threads) : max_threads;
+  }
+
+  // Sets the schedule of the `schedule(runtime)` loops of the kernel.
+  void applySchedule(const Schedule kernel_default) const {
+    const Schedule kind =
+        schedule == Schedule::DEFAULT ? kernel_default : schedule;
+    omp_set_schedule(
+        kind == Schedule::DYNAMIC ? omp_sched_dynamic : omp_sched_static, 1);
+  }
+};
+
+// Same power of two bucketing as vllm/worker/cpu_tuner.py.
+int64_t shape_bucket(int64_t size);
+
+// shape_key holds exact sizes and shape_bucket() values, as chosen by the
+// kernel.
+KernelConfig lookup(const char* kernel, const std::vector<int64_t>& shape_key);
+
+// How far ahead the paged attention and cache kernels prefetch, 0 disables
+// the prefetch. Each kernel counts it in its own unit of work: the paged
+// attention kernels in blocks of the block table of a sequence,
+// copy_blocks in (source, target) block pairs and reshape_and_cache in
+// tokens, of which each decode step writes one per sequence and block.
+// Blocks skipped by a block-sparse pattern are not prefetched. Starts at
+// VLLM_CPU_PREFETCH_DISTANCE and is changed by set_cpu_prefetch_distance().
+int prefetch_distance();
+
+}  // namespace cpu_tuner
+
+#endif
@@ -0,0 +1,326 @@
+#include <vector>
+
+#include "cpu_types.hpp"
+#include "kernel_tuner.hpp"
+
+namespace {
+// A run of token rows that share one adapter. For SGMV the runs come from
+// the caller (consecutive tokens of a prefill sequence), for BGMV they are
+// built by grouping the per-token adapter indices.
+struct LoRASegment {
+  int64_t lora_idx;
+  int64_t start;
+  int64_t len;
+};
+
+// Counting sort of the token rows by adapter index, so that each adapter's
+// weights are streamed once per call instead of once per token. Tokens with
+// index -1 (no LoRA) are dropped.
+void group_tokens_by_lora(const int64_t* __restrict__ lora_indices,
+                          const int num_tokens, const int num_loras,
+                          std::vector<int64_t>& token_ids,
+                          std::vector<LoRASegment>& segments) {
+  std::vector<int64_t> offsets(num_loras + 1, 0);
+  for (int i = 0; i < num_tokens; ++i) {
+    const int64_t lora_idx = lora_indices[i];
+    if (lora_idx >= 0) {
+      TORCH_CHECK(lora_idx < num_loras, "Invalid LoRA index: ", lora_idx);
+      ++offsets[lora_idx + 1];
+    }
+  }
+  for (int i = 0; i < num_loras; ++i) {
+    if (offsets[i + 1] > 0) {
+      segments.push_back({i, offsets[i], offsets[i + 1]});
+    }
+    offsets[i + 1] += offsets[i];
+  }
+
+  token_ids.resize(offsets[num_loras]);
+  for (int i = 0; i < num_tokens; ++i) {
+    const int64_t lora_idx = lora_indices[i];
+    if (lora_idx >= 0) {
+      token_ids[offsets[lora_idx]++] = i;
+    }
+  }
+}
+
+// y[t, r] = scale * dot(x[t, :], w[lora(t), r, :])
+template <typename scalar_t>
+void lora_shrink_impl(
+    float* __restrict__ out,                    // [num_tokens, rank]
+    const scalar_t* __restrict__ input,         // [num_tokens, hidden_size]
+    const scalar_t* __restrict__ lora_weights,  // [num_loras, rank,
+                                                // hidden_size]
+    const std::vector<LoRASegment>& segments,
+    const int64_t* __restrict__ token_ids,  // nullptr for contiguous segments
+    const int rank, const int hidden_size, const int64_t input_stride,
+    const int64_t out_stride, const float scale, const int row_block,
+    const int thread_num) {
+  using scalar_vec_t = vec_op::vec_t<scalar_t>;
+  constexpr int VEC_ELEM_NUM = scalar_vec_t::get_elem_num();
+  constexpr int TOKEN_TILE = 4;
+  TORCH_CHECK(hidden_size % VEC_ELEM_NUM == 0);
+
+  const int row_block_num = (rank + row_block - 1) / row_block;
+  const int work_item_num = segments.size() * row_block_num;
+
+  cpu_profiler::RegionTimer region_timer(thread_num);
+#pragma omp parallel for schedule(runtime) num_threads(thread_num)
+  for (int item = 0; item < work_item_num; ++item) {
+    const cpu_profiler::FinishScope finish(region_timer);
+    const LoRASegment& segment = segments[item / row_block_num];
+    const int row_start = (item % row_block_num) * row_block;
+    const int row_end = std::min(rank, row_start + row_block);
+    const scalar_t* __restrict__ lora_ptr =
+        lora_weights + segment.lora_idx * rank * hidden_size;
+
+    for (int64_t tile_start = 0; tile_start < segment.len;
+         tile_start += TOKEN_TILE) {
+      const int tile_len =
+          std::min<int64_t>(TOKEN_TILE, segment.len - tile_start);
+      int64_t rows[TOKEN_TILE];
+      for (int i = 0; i < tile_len; ++i) {
+        const int64_t pos = segment.start + tile_start + i;
+        rows[i] = token_ids ? token_ids[pos] : pos;
+      }
+
+      for (int r = row_start; r < row_end; ++r) {
+        const scalar_t* __restrict__ w_row = lora_ptr + r * hidden_size;
+        vec_op::FP32Vec8 accums[TOKEN_TILE];
+        for (int h = 0; h < hidden_size; h += VEC_ELEM_NUM) {
+          vec_op::FP32Vec8 w_vec(scalar_vec_t(w_row + h));
+          for (int i = 0; i < tile_len; ++i) {
+            vec_op::FP32Vec8 x_vec(
+                scalar_vec_t(input + rows[i] * input_stride + h));
+            accums[i] = accums[i] + x_vec * w_vec;
+          }
+        }
+        for (int i = 0; i < tile_len; ++i) {
+          out[rows[i] * out_stride + r] = accums[i].reduce_sum() * scale;
+        }
+      }
+    }
+  }
+}
+
+// y[t, slice_offset + n] (+)= dot(x[t, :], w[lora(t), n, :])
+template <typename scalar_t>
+void lora_expand_impl(
+    scalar_t* __restrict__ out,                 // [num_tokens, out_dim]
+    const float* __restrict__ input,            // [num_tokens, rank]
+    const scalar_t* __restrict__ lora_weights,  // [num_loras, slice_size,
+                                                // rank]
+    const std::vector<LoRASegment>& segments,
+    const int64_t* __restrict__ token_ids,  // nullptr for contiguous segments
+    const int rank, const int slice_offset, const int slice_size,
+    const int64_t input_stride, const int64_t out_stride,
+    const bool add_inputs, const int col_block, const int thread_num) {
+  using scalar_vec_t = vec_op::vec_t<scalar_t>;
+  constexpr int VEC_ELEM_NUM = scalar_vec_t::get_elem_num();
+  constexpr int TOKEN_TILE = 4;
+  TORCH_CHECK(rank % VEC_ELEM_NUM == 0);
+
+  const int col_block_num = (slice_size + col_block - 1) / col_block;
+  const int work_item_num = segments.size() * col_block_num;
+
+  cpu_profiler::RegionTimer region_timer(thread_num);
+#pragma omp parallel for schedule(runtime) num_threads(thread_num)
+  for (int item = 0; item < work_item_num; ++item) {
+    const cpu_profiler::FinishScope finish(region_timer);
+    const LoRASegment& segment = segments[item / col_block_num];
+    const int col_start = (item % col_block_num) * col_block;
+    const int col_end = std::min(slice_size, col_start + col_block);
+    const scalar_t* __restrict__ lora_ptr =
+        lora_weights + segment.lora_idx * slice_size * rank;
+
+    for (int64_t tile_start = 0; tile_start < segment.len;
+         tile_start += TOKEN_TILE) {
+      const int tile_len =
+          std::min<int64_t>(TOKEN_TILE, segment.len - tile_start);
+      int64_t rows[TOKEN_TILE];
+      for (int i = 0; i < tile_len; ++i) {
+        const int64_t pos = segment.start + tile_start + i;
+        rows[i] = token_ids ? token_ids[pos] : pos;
+      }
+
+      for (int n = col_start; n < col_end; ++n) {
+        const scalar_t* __restrict__ w_row = lora_ptr + n * rank;
+        vec_op::FP32Vec8 accums[TOKEN_TILE];
+        for (int j = 0; j < rank; j += VEC_ELEM_NUM) {
+          vec_op::FP32Vec8 w_vec(scalar_vec_t(w_row + j));
+          for (int i = 0; i < tile_len; ++i) {
+            vec_op::FP32Vec8 x_vec(input + rows[i] * input_stride + j);
+            accums[i] = accums[i] + x_vec * w_vec;
+          }
+        }
+        for (int i = 0; i < tile_len; ++i) {
+          scalar_t* __restrict__ out_ptr =
+              out + rows[i] * out_stride + slice_offset + n;
+          float value = accums[i].reduce_sum();
+          if (add_inputs) {
+            value += static_cast<float>(*out_ptr);
+          }
+          vec_op::storeFP32(value, out_ptr);
+        }
+      }
+    }
+  }
+}
+
+// Weight rows (shrink) or columns (expand) per work item unless tuned.
+constexpr int DEFAULT_ROW_BLOCK = 4;
+constexpr int DEFAULT_COL_BLOCK = 64;
+
+// Tuned configuration of a LoRA call, keyed by the element size, the token
+// bucket and the weight shape.
+cpu_tuner::KernelConfig lookup_lora_config(const char* kernel,
+                                           const torch::Tensor& weights,
+                                           const int64_t num_tokens) {
+  return cpu_tuner::lookup(
+      kernel, {weights.element_size(), cpu_tuner::shape_bucket(num_tokens),
+               weights.size(1), weights.size(2)});
+}
+
+torch::Tensor squeeze_lora_weights(const torch::Tensor& lora_weights) {
+  if (lora_weights.dim() == 4) {
+    // shape: [num_loras, 1, N, K]
+    TORCH_CHECK(lora_weights.size(1) == 1);
+    return lora_weights.squeeze(1);
+  }
+  TORCH_CHECK(lora_weights.dim() == 3);
+  return lora_weights;
+}
+
+std::vector<LoRASegment> make_sgmv_segments(
+    const torch::Tensor& seq_start_locs, const torch::Tensor& seq_lens,
+    const torch::Tensor& lora_indices, const int num_loras) {
+  const int batches = lora_indices.size(0);
+  TORCH_CHECK(seq_start_locs.size(0) == batches &&
+              seq_lens.size(0) == batches);
+  const int64_t* start_ptr = seq_start_locs.data_ptr<int64_t>();
+  const int64_t* len_ptr = seq_lens.data_ptr<int64_t>();
+  const int64_t* lora_ptr = lora_indices.data_ptr<int64_t>();
+
+  std::vector<LoRASegment> segments;
+  segments.reserve(batches);
+  for (int i = 0; i < batches; ++i) {
+    if (lora_ptr[i] < 0) continue;
+    TORCH_CHECK(lora_ptr[i] < num_loras, "Invalid LoRA index: ", lora_ptr[i]);
+    segments.push_back({lora_ptr[i], start_ptr[i], len_ptr[i]});
+  }
+  return segments;
+}
+
+void lora_shrink_launcher(torch::Tensor& out, const torch::Tensor& input,
+                          const torch::Tensor& lora_a_weights,
+                          const std::vector<LoRASegment>& segments,
+                          const int64_t* token_ids, double scale) {
+  torch::Tensor weights = squeeze_lora_weights(lora_a_weights);
+  TORCH_CHECK(input.scalar_type() == weights.scalar_type());
+  TORCH_CHECK(out.scalar_type() == at::ScalarType::Float);
+  TORCH_CHECK(weights.is_contiguous() && input.stride(-1) == 1 &&
+              out.stride(-1) == 1);
+  TORCH_CHECK(input.size(1) == weights.size(2));
+
+  const int rank = weights.size(1);
+  const int hidden_size = weights.size(2);
+  const cpu_tuner::KernelConfig config =
+      lookup_lora_config("lora_shrink", weights, input.size(0));
+  config.applySchedule(cpu_tuner::Schedule::DYNAMIC);
+  const int row_block = config.block > 0 ? config.block : DEFAULT_ROW_BLOCK;
+
+  VLLM_DISPATCH_FLOATING_TYPES(input.scalar_type(), "lora_shrink_impl", [&] {
+    CPU_KERNEL_GUARD_IN(lora_shrink_impl)
+    CPU_KERNEL_GUARD_ANNOTATE(lora_shrink_impl, input.size(0),
+                              input.nbytes() + out.nbytes() + weights.nbytes())
+    lora_shrink_impl<scalar_t>(out.data_ptr<float>(),
+                               input.data_ptr<scalar_t>(),
+                               weights.data_ptr<scalar_t>(), segments,
+                               token_ids, rank, hidden_size, input.stride(0),
+                               out.stride(0), scale, row_block,
+                               config.threads());
+    CPU_KERNEL_GUARD_OUT(lora_shrink_impl)
+  });
+}
+
+void lora_expand_launcher(torch::Tensor& out, const torch::Tensor& input,
+                          const torch::Tensor& lora_b_weights,
+                          const std::vector<LoRASegment>& segments,
+                          const int64_t* token_ids, int64_t slice_offset,
+                          int64_t slice_size, bool add_inputs) {
+  torch::Tensor weights = squeeze_lora_weights(lora_b_weights);
+  TORCH_CHECK(out.scalar_type() == weights.scalar_type());
+  TORCH_CHECK(input.scalar_type() == at::ScalarType::Float);
+  TORCH_CHECK(weights.is_contiguous() && input.stride(-1) == 1 &&
+              out.stride(-1) == 1);
+  TORCH_CHECK(input.size(1) == weights.size(2));
+  TORCH_CHECK(slice_size == weights.size(1));
+  TORCH_CHECK(slice_offset + slice_size <= out.size(1));
+
+  const int rank = weights.size(2);
+  const cpu_tuner::KernelConfig config =
+      lookup_lora_config("lora_expand", weights, input.size(0));
+  config.applySchedule(cpu_tuner::Schedule::DYNAMIC);
+  const int col_block = config.block > 0 ? config.block : DEFAULT_COL_BLOCK;
+
+  VLLM_DISPATCH_FLOATING_TYPES(out.scalar_type(), "lora_expand_impl", [&] {
+    CPU_KERNEL_GUARD_IN(lora_expand_impl)
+    CPU_KERNEL_GUARD_ANNOTATE(lora_expand_impl, input.size(0),
+                              input.nbytes() + out.nbytes() + weights.nbytes())
+    lora_expand_impl<scalar_t>(out.data_ptr<scalar_t>(),
+                               input.data_ptr<float>(),
+                               weights.data_ptr<scalar_t>(), segments,
+                               token_ids, rank, slice_offset, slice_size,
+                               input.stride(0), out.stride(0), add_inputs,
+                               col_block, config.threads());
+    CPU_KERNEL_GUARD_OUT(lora_expand_impl)
+  });
+}
+}  // namespace
+
+// Decode path: every token carries its own adapter index.
+void bgmv_shrink(torch::Tensor& out, const torch::Tensor& input,
+                 const torch::Tensor& lora_a_weights,
+                 const torch::Tensor& lora_indices, double scale) {
+  std::vector<int64_t> token_ids;
+  std::vector<LoRASegment> segments;
+  group_tokens_by_lora(lora_indices.data_ptr<int64_t>(), input.size(0),
+                       lora_a_weights.size(0), token_ids, segments);
+  lora_shrink_launcher(out, input, lora_a_weights, segments, token_ids.data(),
+                       scale);
+}
+
+void bgmv_expand_slice(torch::Tensor& out, const torch::Tensor& input,
+                       const torch::Tensor& lora_b_weights,
+                       const torch::Tensor& lora_indices, int64_t slice_offset,
+                       int64_t slice_size, bool add_inputs) {
+  std::vector<int64_t> token_ids;
+  std::vector<LoRASegment> segments;
+  group_tokens_by_lora(lora_indices.data_ptr<int64_t>(), input.size(0),
+                       lora_b_weights.size(0), token_ids, segments);
+  lora_expand_launcher(out, input, lora_b_weights, segments, token_ids.data(),
+                       slice_offset, slice_size, add_inputs);
+}
+
+// Prefill path: tokens are already grouped into runs sharing one adapter.
+void sgmv_shrink(torch::Tensor& out, const torch::Tensor& input,
+                 const torch::Tensor& lora_a_weights,
+                 const torch::Tensor& seq_start_locs,
+                 const torch::Tensor& seq_lens,
+                 const torch::Tensor& lora_indices, double scale) {
+  std::vector<LoRASegment> segments = make_sgmv_segments(
+      seq_start_locs, seq_lens, lora_indices, lora_a_weights.size(0));
+  lora_shrink_launcher(out, input, lora_a_weights, segments, nullptr, scale);
+}
+
+void sgmv_expand_slice(torch::Tensor& out, const torch::Tensor& input,
+                       const torch::Tensor& lora_b_weights,
+                       const torch::Tensor& seq_start_locs,
+                       const torch::Tensor& seq_lens,
+                       const torch::Tensor& lora_indices, int64_t slice_offset,
+                       int64_t slice_size, bool add_inputs) {
+  std::vector<LoRASegment> segments = make_sgmv_segments(
+      seq_start_locs, seq_lens, lora_indices, lora_b_weights.size(0));
+  lora_expand_launcher(out, input, lora_b_weights, segments, nullptr,
+                       slice_offset, slice_size, add_inputs);
+}
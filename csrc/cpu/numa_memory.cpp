@@ -0,0 +1,268 @@
+#include <fcntl.h>
+#include <numa.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "cpu_types.hpp"
+#include "numa_memory.hpp"
+
+namespace cpu_memory {
+
+namespace {
+constexpr size_t PARALLEL_PREFAULT_BYTES = 16 << 20;
+
+size_t round_up(const size_t bytes, const size_t alignment) {
+  return (bytes + alignment - 1) / alignment * alignment;
+}
+
+// The integer after `key` on the first line of a /proc or /sys file which
+// starts with it, 0 if there is none.
+int64_t read_value(const std::string& path, const std::string& key) {
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.compare(0, key.size(), key) == 0) {
+      try {
+        return std::stoll(line.substr(key.size()));
+      } catch (const std::exception&) {
+        return 0;
+      }
+    }
+  }
+  return 0;
+}
+
+size_t base_page_size() { return sysconf(_SC_PAGESIZE); }
+
+// Page size of the default hugetlbfs pool, 0 without hugetlbfs.
+size_t hugetlb_page_size() {
+  return read_value("/proc/meminfo", "Hugepagesize:") * 1024;
+}
+
+// 0 without transparent huge pages.
+size_t thp_page_size() {
+  return read_value("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "");
+}
+
+// Free pages of the default hugetlbfs pool on a node, or on all nodes for a
+// negative node.
+int64_t free_hugetlb_pages(const int numa_node, const size_t page_size) {
+  const std::string pool =
+      "hugepages/hugepages-" + std::to_string(page_size / 1024) + "kB";
+  const std::string path =
+      numa_node >= 0 ? "/sys/devices/system/node/node" +
+                           std::to_string(numa_node) + "/" + pool
+                     : "/sys/kernel/mm/" + pool;
+  return read_value(path + "/free_hugepages", "");
+}
+
+// Anonymous mapping of `bytes` aligned to `alignment`, nullptr on failure.
+void* map_aligned(const size_t bytes, const size_t alignment) {
+  const size_t padded = bytes + alignment - base_page_size();
+  void* addr = mmap(nullptr, padded, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED) return nullptr;
+  char* const start = static_cast<char*>(addr);
+  char* const aligned = reinterpret_cast<char*>(
+      round_up(reinterpret_cast<uintptr_t>(start), alignment));
+  if (aligned > start) munmap(start, aligned - start);
+  char* const end = start + padded;
+  if (end > aligned + bytes) munmap(aligned + bytes, end - aligned - bytes);
+  return aligned;
+}
+
+// KernelPageSize and AnonHugePages of the mapping holding addr, in bytes.
+std::pair<int64_t, int64_t> smaps_page_sizes(const void* addr) {
+  const unsigned long target = reinterpret_cast<uintptr_t>(addr);
+  std::ifstream smaps("/proc/self/smaps");
+  std::string line;
+  bool in_mapping = false;
+  int64_t kernel_page_size = 0;
+  int64_t anon_huge_bytes = 0;
+  while (std::getline(smaps, line)) {
+    unsigned long start, end;
+    if (std::sscanf(line.c_str(), "%lx-%lx ", &start, &end) == 2) {
+      if (in_mapping) break;
+      in_mapping = start <= target && target < end;
+    } else if (in_mapping) {
+      if (line.compare(0, 15, "KernelPageSize:") == 0) {
+        kernel_page_size = std::stoll(line.substr(15)) * 1024;
+      } else if (line.compare(0, 14, "AnonHugePages:") == 0) {
+        anon_huge_bytes = std::stoll(line.substr(14)) * 1024;
+      }
+    }
+  }
+  return {kernel_page_size, anon_huge_bytes};
+}
+}  // namespace
+
+int current_numa_node() {
+  // numa_available() is a syscall, current_numa_node() is on the allocation
+  // path of the caching allocator.
+  static const bool numa_supported = numa_available() != -1;
+  if (!numa_supported) return -1;
+  const int cpu = sched_getcpu();
+  return cpu < 0 ? -1 : numa_node_of_cpu(cpu);
+}
+
+Region map_region(const size_t bytes, int numa_node,
+                  const HugePages huge_pages, const bool team_prefault) {
+  TORCH_CHECK(bytes > 0, "Cannot map an empty region");
+  if (numa_node < 0) numa_node = current_numa_node();
+
+  Region region;
+  size_t page_size = base_page_size();
+  if (huge_pages == HugePages::HUGETLB && hugetlb_page_size() > 0) {
+    // The pool is reserved at mmap time but not per node, so a node without
+    // enough free pages would fail on the faults below instead.
+    const size_t hugetlb_size = hugetlb_page_size();
+    const size_t rounded = round_up(bytes, hugetlb_size);
+    if (free_hugetlb_pages(numa_node, hugetlb_size) * hugetlb_size >=
+        static_cast<int64_t>(rounded)) {
+      void* addr = mmap(nullptr, rounded, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (addr != MAP_FAILED) {
+        region = {addr, rounded, true};
+        page_size = hugetlb_size;
+      }
+    }
+  }
+  if (region.addr == nullptr) {
+    // Aligned to the transparent huge page size, so that the kernel can back
+    // the whole region with huge pages.
+    const size_t alignment = huge_pages == HugePages::NONE
+                                 ? base_page_size()
+                                 : std::max(thp_page_size(), base_page_size());
+    region.bytes = round_up(bytes, alignment);
+    region.addr = map_aligned(region.bytes, alignment);
+    TORCH_CHECK(region.addr != nullptr, "mmap of ", region.bytes,
+                " bytes failed. errno: ", errno);
+    if (huge_pages != HugePages::NONE) {
+      // Best effort, without transparent huge pages this is a no-op.
+      madvise(region.addr, region.bytes, MADV_HUGEPAGE);
+    }
+  }
+
+  if (numa_node >= 0) {
+    numa_tonode_memory(region.addr, region.bytes, numa_node);
+  }
+
+  // Every OpenMP thread faults in the same share of the pages, small regions
+  // and those without team_prefault are faulted in by the calling thread.
+  volatile char* const base = static_cast<char*>(region.addr);
+  const int64_t page_num = region.bytes / page_size;
+#pragma omp parallel for schedule(static) \
+    if (team_prefault && region.bytes >= PARALLEL_PREFAULT_BYTES)
+  for (int64_t page_idx = 0; page_idx < page_num; ++page_idx) {
+    base[page_idx * page_size] = 0;
+  }
+  return region;
+}
+
+Region map_file(const std::string& path, const bool read_ahead) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  TORCH_CHECK(fd >= 0, "Failed to open ", path, ": ", std::strerror(errno));
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    TORCH_CHECK(false, "Cannot map ", path, ", it is empty or unreadable");
+  }
+  void* addr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fd, 0);
+  const int mmap_errno = errno;
+  // The mapping keeps its own reference to the file.
+  close(fd);
+  TORCH_CHECK(addr != MAP_FAILED, "mmap of ", path,
+              " failed: ", std::strerror(mmap_errno));
+  if (read_ahead) {
+    // Best effort, the loaders copy the tensors of a shard in file order.
+    madvise(addr, st.st_size, MADV_WILLNEED);
+  }
+  return {addr, static_cast<size_t>(st.st_size), false};
+}
+
+void unmap_region(const Region& region) {
+  if (region.addr != nullptr) munmap(region.addr, region.bytes);
+}
+
+Placement query_placement(const Region& region) {
+  Placement placement;
+  const auto [kernel_page_size, anon_huge_bytes] =
+      smaps_page_sizes(region.addr);
+  if (kernel_page_size > static_cast<int64_t>(base_page_size())) {
+    // hugetlbfs
+    placement.page_size = kernel_page_size;
+    placement.huge_page_bytes = region.bytes;
+  } else {
+    placement.huge_page_bytes =
+        std::min<int64_t>(anon_huge_bytes, region.bytes);
+    placement.page_size =
+        2 * placement.huge_page_bytes >= static_cast<int64_t>(region.bytes) &&
+                placement.huge_page_bytes > 0
+            ? thp_page_size()
+            : base_page_size();
+  }
+
+  if (numa_available() != -1) {
+    void* page = region.addr;
+    int status = -1;
+    if (numa_move_pages(0, 1, &page, nullptr, &status, 0) == 0 &&
+        status >= 0) {
+      placement.numa_node = status;
+    }
+  }
+  return placement;
+}
+
+}  // namespace cpu_memory
+
+// Returns a uint8 tensor of num_bytes, see cpu_memory::map_region().
+// huge_pages is a cpu_memory::HugePages, numa_node -1 for the node of the
+// calling thread. The memory is unmapped when the tensor is freed.
+torch::Tensor allocate_cpu_kv_cache(int64_t num_bytes, int64_t huge_pages,
+                                    int64_t numa_node) {
+  using namespace cpu_memory;
+  TORCH_CHECK(num_bytes > 0, "num_bytes must be positive, got ", num_bytes);
+  TORCH_CHECK(huge_pages >= 0 && huge_pages <= 2,
+              "huge_pages must be 0 (none), 1 (transparent) or 2 (hugetlb), "
+              "got ",
+              huge_pages);
+  const Region region =
+      map_region(num_bytes, numa_node, static_cast<HugePages>(huge_pages));
+  return torch::from_blob(
+      region.addr, {num_bytes}, [region](void*) { unmap_region(region); },
+      torch::TensorOptions().dtype(torch::kUInt8).device(torch::kCPU));
+}
+
+// Returns a uint8 tensor viewing the whole file at path, see
+// cpu_memory::map_file(). The file is unmapped when the tensor and all views
+// of it are freed.
+torch::Tensor map_cpu_weights_file(const std::string& path, bool read_ahead) {
+  using namespace cpu_memory;
+  const Region region = map_file(path, read_ahead);
+  return torch::from_blob(
+      region.addr, {static_cast<int64_t>(region.bytes)},
+      [region](void*) { unmap_region(region); },
+      torch::TensorOptions().dtype(torch::kUInt8).device(torch::kCPU));
+}
+
+// [page_size, huge_page_bytes, numa_node] of the memory of a CPU tensor, see
+// cpu_memory::Placement.
+std::vector<int64_t> get_cpu_memory_placement(const torch::Tensor& tensor) {
+  using namespace cpu_memory;
+  TORCH_CHECK(tensor.device().is_cpu(), "tensor must be on the CPU");
+  Region region;
+  region.addr = tensor.data_ptr();
+  region.bytes = tensor.nbytes();
+  const Placement placement = query_placement(region);
+  return {placement.page_size, placement.huge_page_bytes,
+          placement.numa_node};
+}
@@ -0,0 +1,65 @@
+#ifndef CPU_NUMA_MEMORY_HPP
+#define CPU_NUMA_MEMORY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Huge-page backed, NUMA-local memory regions mapped directly from the
+// kernel instead of through the process allocator. The KV cache lives in
+// them: paged attention jumps between scattered blocks, which thrashes the
+// TLB with base pages, and lazy first touch would place each block on the
+// node of whichever thread wrote it first.
+namespace cpu_memory {
+
+enum class HugePages : int {
+  // Base pages only.
+  NONE = 0,
+  // Transparent huge pages, requested with MADV_HUGEPAGE.
+  TRANSPARENT = 1,
+  // Pages of the default hugetlbfs pool (MAP_HUGETLB). Falls back to
+  // transparent huge pages when the pool of the node cannot back the region.
+  HUGETLB = 2,
+};
+
+// Page size and node placement that a region actually got.
+struct Placement {
+  // The hugetlbfs page size, the transparent huge page size when huge pages
+  // back most of the region, the base page size otherwise.
+  int64_t page_size = 0;
+  // Bytes of the region backed by huge pages.
+  int64_t huge_page_bytes = 0;
+  // NUMA node of the first page of the region, -1 if unknown.
+  int numa_node = -1;
+};
+
+struct Region {
+  void* addr = nullptr;
+  // Mapped bytes, rounded up to whole pages.
+  size_t bytes = 0;
+  bool hugetlb = false;
+};
+
+// NUMA node of the CPU the calling thread runs on, -1 without NUMA support.
+// init_cpu_threads_env() binds the calling thread with OpenMP thread 0.
+int current_numa_node();
+
+// Maps at least `bytes` of zeroed memory bound to `numa_node` (-1 for
+// current_numa_node()) and faults every page in, from the OpenMP threads for
+// large regions unless !team_prefault, so that the kernels take no page
+// faults on it later.
+Region map_region(size_t bytes, int numa_node, HugePages huge_pages,
+                  bool team_prefault = true);
+
+// Maps a whole file copy-on-write, with the kernel reading all of it ahead
+// if read_ahead. The page cache backs the region, so tensors viewing it take
+// no anonymous memory until they are written to.
+Region map_file(const std::string& path, bool read_ahead);
+
+void unmap_region(const Region& region);
+
+Placement query_placement(const Region& region);
+
+}  // namespace cpu_memory
+
+#endif
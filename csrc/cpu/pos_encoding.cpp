@@ -1,5 +1,6 @@
 
 #include "cpu_types.hpp"
+#include "thread_subteams.hpp"
 
 namespace {
 template <typename scalar_t>
@@ -73,24 +74,26 @@ void rotary_embedding_impl(
     }
   };
 
-#pragma omp parallel for
-  for (int token_idx = 0; token_idx < num_tokens; ++token_idx) {
-    int64_t pos = positions[token_idx];
-    const scalar_t* cache_ptr = cos_sin_cache + pos * rot_dim;
-
-    for (int i = 0; i < num_heads; ++i) {
-      const int head_idx = i;
-      const int64_t token_head =
-          token_idx * query_stride + head_idx * head_size;
-      compute_loop(token_head, cache_ptr, query);
-    }
+  cpu_threads::parallel_for(
+      num_tokens, 1, omp_get_max_threads(), false,
+      [&](const int64_t token_idx) {
+        int64_t pos = positions[token_idx];
+        const scalar_t* cache_ptr = cos_sin_cache + pos * rot_dim;
+
+        for (int i = 0; i < num_heads; ++i) {
+          const int head_idx = i;
+          const int64_t token_head =
+              token_idx * query_stride + head_idx * head_size;
+          compute_loop(token_head, cache_ptr, query);
+        }
 
-    for (int i = 0; i < num_kv_heads; ++i) {
-      const int head_idx = i;
-      const int64_t token_head = token_idx * key_stride + head_idx * head_size;
-      compute_loop(token_head, cache_ptr, key);
-    }
-  }
+        for (int i = 0; i < num_kv_heads; ++i) {
+          const int head_idx = i;
+          const int64_t token_head =
+              token_idx * key_stride + head_idx * head_size;
+          compute_loop(token_head, cache_ptr, key);
+        }
+      });
 }
 
 template <typename scalar_t>
@@ -110,60 +113,63 @@ void rotary_embedding_gptj_impl(
     const int num_tokens) {
   const int embed_dim = rot_dim / 2;
 
-#pragma omp parallel for collapse(2)
-  for (int token_idx = 0; token_idx < num_tokens; ++token_idx) {
-    for (int i = 0; i < num_heads; ++i) {
-      int64_t pos = positions[token_idx];
-      const scalar_t* cache_ptr = cos_sin_cache + pos * rot_dim;
-      const scalar_t* cos_cache_ptr = cache_ptr;
-      const scalar_t* sin_cache_ptr = cache_ptr + embed_dim;
-      const int head_idx = i;
-      const int64_t token_head =
-          token_idx * query_stride + head_idx * head_size;
-      scalar_t* head_query = token_head + query;
-      for (int j = 0; j < embed_dim; j += 1) {
-        const int rot_offset = j;
-        const int x_index = 2 * rot_offset;
-        const int y_index = 2 * rot_offset + 1;
-
-        const float cos = cos_cache_ptr[rot_offset];
-        const float sin = sin_cache_ptr[rot_offset];
-
-        const float x = head_query[x_index];
-        const float y = head_query[y_index];
-
-        head_query[x_index] = x * cos - y * sin;
-        head_query[y_index] = y * cos + x * sin;
-      }
-    }
-  }
-
-#pragma omp parallel for collapse(2)
-  for (int token_idx = 0; token_idx < num_tokens; ++token_idx) {
-    for (int i = 0; i < num_kv_heads; ++i) {
-      int64_t pos = positions[token_idx];
-      const scalar_t* cache_ptr = cos_sin_cache + pos * rot_dim;
-      const scalar_t* cos_cache_ptr = cache_ptr;
-      const scalar_t* sin_cache_ptr = cache_ptr + embed_dim;
-      const int head_idx = i;
-      const int64_t token_head = token_idx * key_stride + head_idx * head_size;
-      scalar_t* head_key = key + token_head;
-      for (int j = 0; j < embed_dim; j += 1) {
-        const int rot_offset = j;
-        const int x_index = 2 * rot_offset;
-        const int y_index = 2 * rot_offset + 1;
-
-        const float cos = cos_cache_ptr[rot_offset];
-        const float sin = sin_cache_ptr[rot_offset];
-
-        const float x = head_key[x_index];
-        const float y = head_key[y_index];
-
-        head_key[x_index] = x * cos - y * sin;
-        head_key[y_index] = y * cos + x * sin;
-      }
-    }
-  }
+  cpu_threads::parallel_for(
+      static_cast<int64_t>(num_tokens) * num_heads, num_heads,
+      omp_get_max_threads(), false, [&](const int64_t item) {
+        const int token_idx = item / num_heads;
+        const int i = item % num_heads;
+        int64_t pos = positions[token_idx];
+        const scalar_t* cache_ptr = cos_sin_cache + pos * rot_dim;
+        const scalar_t* cos_cache_ptr = cache_ptr;
+        const scalar_t* sin_cache_ptr = cache_ptr + embed_dim;
+        const int head_idx = i;
+        const int64_t token_head =
+            token_idx * query_stride + head_idx * head_size;
+        scalar_t* head_query = token_head + query;
+        for (int j = 0; j < embed_dim; j += 1) {
+          const int rot_offset = j;
+          const int x_index = 2 * rot_offset;
+          const int y_index = 2 * rot_offset + 1;
+
+          const float cos = cos_cache_ptr[rot_offset];
+          const float sin = sin_cache_ptr[rot_offset];
+
+          const float x = head_query[x_index];
+          const float y = head_query[y_index];
+
+          head_query[x_index] = x * cos - y * sin;
+          head_query[y_index] = y * cos + x * sin;
+        }
+      });
+
+  cpu_threads::parallel_for(
+      static_cast<int64_t>(num_tokens) * num_kv_heads, num_kv_heads,
+      omp_get_max_threads(), false, [&](const int64_t item) {
+        const int token_idx = item / num_kv_heads;
+        const int i = item % num_kv_heads;
+        int64_t pos = positions[token_idx];
+        const scalar_t* cache_ptr = cos_sin_cache + pos * rot_dim;
+        const scalar_t* cos_cache_ptr = cache_ptr;
+        const scalar_t* sin_cache_ptr = cache_ptr + embed_dim;
+        const int head_idx = i;
+        const int64_t token_head =
+            token_idx * key_stride + head_idx * head_size;
+        scalar_t* head_key = key + token_head;
+        for (int j = 0; j < embed_dim; j += 1) {
+          const int rot_offset = j;
+          const int x_index = 2 * rot_offset;
+          const int y_index = 2 * rot_offset + 1;
+
+          const float cos = cos_cache_ptr[rot_offset];
+          const float sin = sin_cache_ptr[rot_offset];
+
+          const float x = head_key[x_index];
+          const float y = head_key[y_index];
+
+          head_key[x_index] = x * cos - y * sin;
+          head_key[y_index] = y * cos + x * sin;
+        }
+      });
 }
 };  // namespace
 
@@ -180,6 +186,8 @@ void rotary_embedding(torch::Tensor& positions, torch::Tensor& query,
   VLLM_DISPATCH_FLOATING_TYPES(
       query.scalar_type(), "rotary_embedding_impl", [&] {
         CPU_KERNEL_GUARD_IN(rotary_embedding_impl)
+        CPU_KERNEL_GUARD_ANNOTATE(rotary_embedding_impl, num_tokens,
+                                  2 * (query.nbytes() + key.nbytes()))
         if (is_neox) {
           rotary_embedding_impl(
               positions.data_ptr<int64_t>(), query.data_ptr<scalar_t>(),
@@ -20,6 +20,12 @@ struct KernelVecType<c10::BFloat16> {
   using cvt_vec_type = vec_op::FP32Vec16;
 };
 
+template <>
+struct KernelVecType<c10::Half> {
+  using load_vec_type = vec_op::FP16Vec16;
+  using cvt_vec_type = vec_op::FP32Vec16;
+};
+
 #ifdef __AVX512F__
 template <typename scalar_t>
 void static_scaled_int8_quant_impl(const scalar_t* input, int8_t* output,
@@ -37,8 +43,10 @@ void static_scaled_int8_quant_impl(const scalar_t* input, int8_t* output,
   const cvt_vec_t i8_min_vec(i8_min);
   const cvt_vec_t i8_max_vec(i8_max);
 
+  cpu_profiler::RegionTimer region_timer(omp_get_max_threads());
   #pragma omp parallel for
   for (int i = 0; i < num_tokens; ++i) {
+    const cpu_profiler::FinishScope finish(region_timer);
     int j = 0;
     for (; j < hidden_size - vec_elem_num; j += vec_elem_num) {
       load_vec_t elems(input + i * hidden_size + j);
@@ -69,8 +77,10 @@ void dynamic_scaled_int8_quant_impl(const scalar_t* input, int8_t* output,
   using cvt_vec_t = typename KernelVecType<scalar_t>::cvt_vec_type;
   constexpr int vec_elem_num = load_vec_t::VEC_ELEM_NUM;
 
+  cpu_profiler::RegionTimer region_timer(omp_get_max_threads());
   #pragma omp parallel for
   for (int i = 0; i < num_tokens; ++i) {
+    const cpu_profiler::FinishScope finish(region_timer);
     cvt_vec_t max_abs(0.0);
     {
       int j = 0;
@@ -127,8 +137,10 @@ void dynamic_output_scale_impl(const float* input, scalar_t* output,
   using cvt_vec_t = typename KernelVecType<scalar_t>::cvt_vec_type;
   constexpr int vec_elem_num = load_vec_t::VEC_ELEM_NUM;
 
+  cpu_profiler::RegionTimer region_timer(omp_get_max_threads());
   #pragma omp parallel for
   for (int i = 0; i < num_tokens; ++i) {
+    const cpu_profiler::FinishScope finish(region_timer);
     int j = 0;
     cvt_vec_t token_scale_vec(scale[i]);
     for (; j < hidden_size - vec_elem_num; j += vec_elem_num) {
@@ -0,0 +1,549 @@
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "cpu_types.hpp"
+
+// Broadcast of the per-step model inputs from the driver worker to the other
+// tensor parallel ranks on the same host, through a ring of message slots in
+// a POSIX shared memory segment. The driver copies the pickled metadata and
+// the tensors of a step into the next slot, and the readers get views of the
+// slot, without serialization, sockets or copies. Waiting sides spin for a
+// while, the next step is usually microseconds away, and then sleep on a
+// futex of the segment. Sleepers wake up every LIVENESS_CHECK_NS to check
+// that the processes they wait for still run, and raise once they are gone.
+//
+// The segment is a control region, read-write for every rank, followed by
+// the slots, mapped read-only by the readers so that an in-place write to a
+// received tensor faults instead of corrupting the inputs of the other
+// ranks.
+namespace cpu_shm {
+
+namespace {
+constexpr uint64_t RING_MAGIC = 0x76636d6272696e67;  // "vcmbring"
+
+// The cache line of s390x, a multiple of the others.
+constexpr size_t LINE_BYTES = 256;
+
+// Start of the tensors in a slot.
+constexpr size_t TENSOR_ALIGNMENT = 64;
+
+constexpr int64_t LIVENESS_CHECK_NS = 1000000000;
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+                  sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "futex words must be plain 32-bit integers");
+
+struct RingLayout {
+  uint64_t magic;
+  int64_t num_readers;
+  int64_t num_slots;
+  int64_t slot_bytes;
+};
+
+struct alignas(LINE_BYTES) RingHeader {
+  RingLayout layout;
+  // Futex word of the readers, the low bits of the last published sequence
+  // number.
+  std::atomic<uint32_t> published;
+  std::atomic<uint32_t> reader_sleepers;
+  // Liveness word of the writer, its process id.
+  std::atomic<int32_t> writer_pid;
+  // Futex word of the writer, bumped by every release of a message.
+  alignas(LINE_BYTES) std::atomic<uint32_t> released;
+  std::atomic<uint32_t> writer_sleepers;
+};
+
+// The control region holds the RingHeader, a SlotControl per slot and the
+// liveness word of each reader, its process id once it opened the ring.
+struct alignas(LINE_BYTES) SlotControl {
+  // Sequence number of the message in the slot, starting at 1, 0 for none.
+  std::atomic<uint64_t> seq;
+  // Readers done with the message.
+  std::atomic<uint32_t> readers_done;
+};
+
+// Start of a slot. header_bytes of pickled metadata follow the table of
+// the tensors.
+struct MessageHeader {
+  uint64_t header_bytes;
+  uint64_t num_tensors;
+};
+
+struct TensorEntry {
+  uint64_t offset;
+  uint64_t bytes;
+};
+
+size_t round_up(const size_t bytes, const size_t alignment) {
+  return (bytes + alignment - 1) / alignment * alignment;
+}
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void cpu_relax() {
+#if defined(__x86_64__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#elif defined(__powerpc64__)
+  // Lowers the SMT priority of the spinning thread.
+  asm volatile("or 27,27,27" ::: "memory");
+#else
+  // s390x has no spin hint.
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+// Shared, not FUTEX_PRIVATE_FLAG, the other side is another process.
+// Returns false if the wait timed out.
+bool futex_wait(std::atomic<uint32_t>& word, const uint32_t expected,
+                const int64_t timeout_ns) {
+  const timespec timeout{static_cast<time_t>(timeout_ns / 1000000000),
+                         static_cast<long>(timeout_ns % 1000000000)};
+  return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT,
+                 expected, &timeout, nullptr, 0) == 0 ||
+         errno != ETIMEDOUT;
+}
+
+void futex_wake(std::atomic<uint32_t>& word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX,
+          nullptr, nullptr, 0);
+}
+
+// Whether the process pid runs, also for 0, a reader which has not opened
+// the ring yet. An exited child is a zombie until its parent reaps it, which
+// the parent may not do while it waits here.
+bool process_alive(const int32_t pid) {
+  if (pid == 0) return true;
+  if (kill(pid, 0) != 0 && errno == ESRCH) return false;
+  std::ifstream stat_file("/proc/" + std::to_string(pid) + "/stat");
+  std::string stat;
+  if (!std::getline(stat_file, stat)) return true;
+  // The state follows the parenthesized command name.
+  const size_t name_end = stat.rfind(')');
+  if (name_end == std::string::npos || name_end + 2 >= stat.size()) {
+    return true;
+  }
+  const char state = stat[name_end + 2];
+  return state != 'Z' && state != 'X';
+}
+
+// See get_cpu_shm_ring_stats().
+struct RingStats {
+  int64_t messages = 0;
+  int64_t bytes = 0;
+  int64_t waits = 0;
+  int64_t sleeps = 0;
+  int64_t wait_total_ns = 0;
+  int64_t wait_max_ns = 0;
+};
+
+class ShmRing {
+ public:
+  // The writer, creating the segment.
+  ShmRing(const std::string& name, const int64_t num_readers,
+          const int64_t num_slots, const int64_t slot_bytes,
+          const int64_t spin_ns)
+      : name_(name), reader_(-1), spin_ns_(spin_ns) {
+    TORCH_CHECK(num_readers > 0, "num_readers must be positive");
+    // A reader releases a message when it receives the next one, so a
+    // single slot would never be released.
+    TORCH_CHECK(num_slots >= 2, "num_slots must be at least 2");
+    TORCH_CHECK(slot_bytes > 0, "slot_bytes must be positive");
+    const int fd =
+        shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    TORCH_CHECK(fd >= 0, "Failed to create the shared memory segment ", name,
+                ": ", std::strerror(errno));
+    init_layout(num_readers, num_slots,
+                round_up(slot_bytes, sysconf(_SC_PAGESIZE)));
+    if (ftruncate(fd, control_bytes_ + data_bytes_) != 0) {
+      const int ftruncate_errno = errno;
+      close(fd);
+      shm_unlink(name.c_str());
+      TORCH_CHECK(false, "Failed to size the shared memory segment ", name,
+                  ": ", std::strerror(ftruncate_errno));
+    }
+    map(fd, PROT_READ | PROT_WRITE);
+
+    header_ = new (control_) RingHeader();
+    for (int64_t slot = 0; slot < num_slots; ++slot) {
+      new (&slot_control(slot)) SlotControl();
+    }
+    for (int64_t idx = 0; idx < num_readers; ++idx) {
+      new (&reader_pid(idx)) std::atomic<int32_t>(0);
+    }
+    header_->writer_pid.store(getpid(), std::memory_order_relaxed);
+    header_->layout = {RING_MAGIC, num_readers, num_slots,
+                       static_cast<int64_t>(slot_bytes_)};
+  }
+
+  // A reader, opening the segment of the writer.
+  ShmRing(const std::string& name, const int64_t reader,
+          const int64_t spin_ns)
+      : name_(name), reader_(reader), spin_ns_(spin_ns) {
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+    TORCH_CHECK(fd >= 0, "Failed to open the shared memory segment ", name,
+                ": ", std::strerror(errno));
+    // The writer initialized the segment before sharing its name.
+    RingLayout layout;
+    const ssize_t read_bytes = pread(fd, &layout, sizeof(RingLayout), 0);
+    if (read_bytes != static_cast<ssize_t>(sizeof(RingLayout)) ||
+        layout.magic != RING_MAGIC || reader < 0 ||
+        reader >= layout.num_readers) {
+      close(fd);
+      TORCH_CHECK(false, name, " is not a shared memory ring with reader ",
+                  reader);
+    }
+    init_layout(layout.num_readers, layout.num_slots, layout.slot_bytes);
+    map(fd, PROT_READ);
+    header_ = reinterpret_cast<RingHeader*>(control_);
+    reader_pid(reader).store(getpid(), std::memory_order_seq_cst);
+  }
+
+  ~ShmRing() {
+    munmap(control_, control_bytes_);
+    munmap(data_, data_bytes_);
+  }
+
+  bool is_writer() const { return reader_ < 0; }
+
+  // Copies a message into the next slot and publishes it. Returns false,
+  // sending nothing, if it does not fit into a slot.
+  bool send(const torch::Tensor& header,
+            const std::vector<torch::Tensor>& tensors) {
+    TORCH_CHECK(is_writer(), "Only the writer of ", name_, " sends");
+    TORCH_CHECK(header.is_contiguous() && header.scalar_type() == torch::kUInt8,
+                "header must be a contiguous uint8 tensor");
+    const size_t table_bytes =
+        sizeof(MessageHeader) + tensors.size() * sizeof(TensorEntry);
+    std::vector<TensorEntry> entries(tensors.size());
+    size_t offset = table_bytes + header.numel();
+    for (size_t idx = 0; idx < tensors.size(); ++idx) {
+      const torch::Tensor& tensor = tensors[idx];
+      TORCH_CHECK(tensor.device().is_cpu() && tensor.is_contiguous(),
+                  "tensors must be contiguous CPU tensors");
+      offset = round_up(offset, TENSOR_ALIGNMENT);
+      entries[idx] = {offset, static_cast<uint64_t>(tensor.nbytes())};
+      offset += tensor.nbytes();
+    }
+    if (offset > slot_bytes_) return false;
+
+    const uint64_t seq = ++sequence_;
+    const int64_t slot = (seq - 1) % header_->layout.num_slots;
+    SlotControl& control = slot_control(slot);
+    // The message sent num_slots before this one must be released.
+    wait_until(
+        [&] {
+          return control.seq.load(std::memory_order_acquire) == 0 ||
+                 control.readers_done.load(std::memory_order_acquire) ==
+                     header_->layout.num_readers;
+        },
+        header_->released, header_->writer_sleepers);
+
+    char* const data = slot_data(slot);
+    const MessageHeader message{static_cast<uint64_t>(header.numel()),
+                                tensors.size()};
+    std::memcpy(data, &message, sizeof(MessageHeader));
+    if (!entries.empty()) {
+      std::memcpy(data + sizeof(MessageHeader), entries.data(),
+                  entries.size() * sizeof(TensorEntry));
+    }
+    std::memcpy(data + table_bytes, header.data_ptr(), header.numel());
+    for (size_t idx = 0; idx < tensors.size(); ++idx) {
+      if (entries[idx].bytes == 0) continue;
+      std::memcpy(data + entries[idx].offset, tensors[idx].data_ptr(),
+                  entries[idx].bytes);
+    }
+
+    control.readers_done.store(0, std::memory_order_relaxed);
+    control.seq.store(seq, std::memory_order_release);
+    header_->published.store(static_cast<uint32_t>(seq),
+                             std::memory_order_seq_cst);
+    wake(header_->published, header_->reader_sleepers);
+    ++stats_.messages;
+    stats_.bytes += offset;
+    return true;
+  }
+
+  // Releases the message received last and returns views of the header and
+  // the tensors of the next one, valid until the next receive.
+  std::tuple<torch::Tensor, std::vector<torch::Tensor>> recv() {
+    TORCH_CHECK(!is_writer(), "The writer of ", name_, " cannot receive");
+    release_received();
+
+    const uint64_t seq = ++sequence_;
+    const int64_t slot = (seq - 1) % header_->layout.num_slots;
+    SlotControl& control = slot_control(slot);
+    wait_until(
+        [&] { return control.seq.load(std::memory_order_acquire) == seq; },
+        header_->published, header_->reader_sleepers);
+    holding_ = true;
+
+    char* const data = slot_data(slot);
+    MessageHeader message;
+    std::memcpy(&message, data, sizeof(MessageHeader));
+    const size_t table_bytes =
+        sizeof(MessageHeader) + message.num_tensors * sizeof(TensorEntry);
+    const auto options =
+        torch::TensorOptions().dtype(torch::kUInt8).device(torch::kCPU);
+    torch::Tensor header = torch::from_blob(
+        data + table_bytes, {static_cast<int64_t>(message.header_bytes)},
+        options);
+    std::vector<torch::Tensor> tensors;
+    tensors.reserve(message.num_tensors);
+    size_t end = table_bytes + message.header_bytes;
+    for (uint64_t idx = 0; idx < message.num_tensors; ++idx) {
+      TensorEntry entry;
+      std::memcpy(&entry,
+                  data + sizeof(MessageHeader) + idx * sizeof(TensorEntry),
+                  sizeof(TensorEntry));
+      tensors.push_back(torch::from_blob(
+          data + entry.offset, {static_cast<int64_t>(entry.bytes)}, options));
+      end = std::max<size_t>(end, entry.offset + entry.bytes);
+    }
+    ++stats_.messages;
+    stats_.bytes += end;
+    return {header, tensors};
+  }
+
+  // [messages, bytes, waits, sleeps, wait_total_ns, wait_max_ns]
+  std::vector<int64_t> stats(const bool reset) {
+    const std::vector<int64_t> result = {
+        stats_.messages, stats_.bytes,         stats_.waits,
+        stats_.sleeps,   stats_.wait_total_ns, stats_.wait_max_ns};
+    if (reset) stats_ = RingStats();
+    return result;
+  }
+
+  void unlink() {
+    TORCH_CHECK(is_writer(), "Only the writer of ", name_, " unlinks it");
+    shm_unlink(name_.c_str());
+  }
+
+  // Lets the writer reuse the slot of the message received last, the
+  // views of it must not be used afterwards.
+  void release_received() {
+    if (!holding_) return;
+    holding_ = false;
+    const int64_t slot = (sequence_ - 1) % header_->layout.num_slots;
+    slot_control(slot).readers_done.fetch_add(1, std::memory_order_seq_cst);
+    // An increment, a plain store of the readers racing here could leave
+    // the word at the value the writer sleeps on.
+    header_->released.fetch_add(1, std::memory_order_seq_cst);
+    wake(header_->released, header_->writer_sleepers);
+  }
+
+ private:
+  void init_layout(const int64_t num_readers, const int64_t num_slots,
+                   const size_t slot_bytes) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    num_slots_ = num_slots;
+    slot_bytes_ = slot_bytes;
+    control_bytes_ =
+        round_up(sizeof(RingHeader) + num_slots * sizeof(SlotControl) +
+                     num_readers * sizeof(std::atomic<int32_t>),
+                 page_size);
+    data_bytes_ = num_slots * slot_bytes;
+  }
+
+  // Maps the control region read-write and the slots with data_prot, both
+  // pre-faulted.
+  void map(const int fd, const int data_prot) {
+    void* control = mmap(nullptr, control_bytes_, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, 0);
+    const int control_errno = errno;
+    void* data = mmap(nullptr, data_bytes_, data_prot,
+                      MAP_SHARED | MAP_POPULATE, fd, control_bytes_);
+    const int data_errno = errno;
+    // The mappings keep their own reference to the segment.
+    close(fd);
+    if (control == MAP_FAILED || data == MAP_FAILED) {
+      if (is_writer()) shm_unlink(name_.c_str());
+      if (control != MAP_FAILED) munmap(control, control_bytes_);
+      if (data != MAP_FAILED) munmap(data, data_bytes_);
+      TORCH_CHECK(false, "mmap of the shared memory segment ", name_,
+                  " failed: ",
+                  std::strerror(control == MAP_FAILED ? control_errno
+                                                      : data_errno));
+    }
+    control_ = static_cast<char*>(control);
+    data_ = static_cast<char*>(data);
+  }
+
+  SlotControl& slot_control(const int64_t slot) {
+    return reinterpret_cast<SlotControl*>(control_ + sizeof(RingHeader))[slot];
+  }
+
+  std::atomic<int32_t>& reader_pid(const int64_t reader) {
+    char* const pids = control_ + sizeof(RingHeader) +
+                       num_slots_ * sizeof(SlotControl);
+    return reinterpret_cast<std::atomic<int32_t>*>(pids)[reader];
+  }
+
+  char* slot_data(const int64_t slot) { return data_ + slot * slot_bytes_; }
+
+  // Raises if the writer, for a reader, or any reader, for the writer, has
+  // exited.
+  void check_peers() {
+    if (!is_writer()) {
+      TORCH_CHECK(process_alive(header_->writer_pid.load()), "The writer of ",
+                  name_, " exited while reader ", reader_, " waits for it");
+      return;
+    }
+    for (int64_t idx = 0; idx < header_->layout.num_readers; ++idx) {
+      TORCH_CHECK(process_alive(reader_pid(idx).load()), "Reader ", idx,
+                  " of ", name_, " exited while the writer waits for it");
+    }
+  }
+
+  // Wakes the other side after changing its futex word, if it sleeps. The
+  // sleepers count is sequentially consistent with the change, so either
+  // the sleeper is seen here or its futex_wait() sees the changed word and
+  // returns at once.
+  static void wake(std::atomic<uint32_t>& word,
+                   std::atomic<uint32_t>& sleepers) {
+    if (sleepers.load(std::memory_order_seq_cst) > 0) futex_wake(word);
+  }
+
+  // Spins for spin_ns_ until ready(), then sleeps on word until the other
+  // side changes it, checking every LIVENESS_CHECK_NS that the other side
+  // still runs.
+  template <typename Ready>
+  void wait_until(const Ready& ready, std::atomic<uint32_t>& word,
+                  std::atomic<uint32_t>& sleepers) {
+    if (ready()) return;
+    const int64_t start = now_ns();
+    int64_t iters = 0;
+    while (!ready()) {
+      // The clock is read every 64 polls.
+      if ((++iters & 63) != 0 || now_ns() - start < spin_ns_) {
+        cpu_relax();
+        continue;
+      }
+      const uint32_t observed = word.load(std::memory_order_seq_cst);
+      sleepers.fetch_add(1, std::memory_order_seq_cst);
+      bool woken = true;
+      if (!ready()) {
+        ++stats_.sleeps;
+        woken = futex_wait(word, observed, LIVENESS_CHECK_NS);
+      }
+      sleepers.fetch_sub(1, std::memory_order_seq_cst);
+      if (!woken && !ready()) check_peers();
+    }
+    const int64_t wait_ns = now_ns() - start;
+    ++stats_.waits;
+    stats_.wait_total_ns += wait_ns;
+    stats_.wait_max_ns = std::max(stats_.wait_max_ns, wait_ns);
+  }
+
+  const std::string name_;
+  // -1 for the writer.
+  const int64_t reader_;
+  const int64_t spin_ns_;
+  RingHeader* header_ = nullptr;
+  char* control_ = nullptr;
+  char* data_ = nullptr;
+  size_t control_bytes_ = 0;
+  size_t data_bytes_ = 0;
+  int64_t num_slots_ = 0;
+  size_t slot_bytes_ = 0;
+  // Sequence number of the message sent or received last.
+  uint64_t sequence_ = 0;
+  // Whether a reader still uses the message received last.
+  bool holding_ = false;
+  RingStats stats_;
+};
+
+std::mutex rings_mutex;
+std::unordered_map<int64_t, std::unique_ptr<ShmRing>> rings;
+int64_t next_ring_id = 0;
+
+int64_t add_ring(std::unique_ptr<ShmRing> ring) {
+  std::lock_guard<std::mutex> guard(rings_mutex);
+  rings[next_ring_id] = std::move(ring);
+  return next_ring_id++;
+}
+
+ShmRing& ring_of(const int64_t ring) {
+  std::lock_guard<std::mutex> guard(rings_mutex);
+  auto iter = rings.find(ring);
+  TORCH_CHECK(iter != rings.end(), "Unknown shared memory ring ", ring);
+  return *iter->second;
+}
+}  // namespace
+
+}  // namespace cpu_shm
+
+// Creates the segment of a ring of num_slots slots of slot_bytes, written
+// by the calling process and read by num_readers others, and returns its
+// handle. Waiting sides spin for spin_us before sleeping.
+int64_t create_cpu_shm_ring(const std::string& name, int64_t num_readers,
+                            int64_t num_slots, int64_t slot_bytes,
+                            int64_t spin_us) {
+  using namespace cpu_shm;
+  return add_ring(std::make_unique<ShmRing>(name, num_readers, num_slots,
+                                            slot_bytes, spin_us * 1000));
+}
+
+// Opens the ring created under name as its reader-th reader.
+int64_t open_cpu_shm_ring(const std::string& name, int64_t reader,
+                          int64_t spin_us) {
+  using namespace cpu_shm;
+  return add_ring(std::make_unique<ShmRing>(name, reader, spin_us * 1000));
+}
+
+// Removes the name of the segment once every reader opened it, the mappings
+// stay valid and the memory is freed with the last of them.
+void unlink_cpu_shm_ring(int64_t ring) { cpu_shm::ring_of(ring).unlink(); }
+
+// A reader releases its last message first, so the views it received must
+// not be used afterwards.
+void close_cpu_shm_ring(int64_t ring) {
+  using namespace cpu_shm;
+  std::unique_ptr<ShmRing> closed;
+  std::lock_guard<std::mutex> guard(rings_mutex);
+  auto iter = rings.find(ring);
+  TORCH_CHECK(iter != rings.end(), "Unknown shared memory ring ", ring);
+  closed = std::move(iter->second);
+  rings.erase(iter);
+  if (!closed->is_writer()) closed->release_received();
+}
+
+bool cpu_shm_ring_send(int64_t ring, const torch::Tensor& header,
+                       const std::vector<torch::Tensor>& tensors) {
+  return cpu_shm::ring_of(ring).send(header, tensors);
+}
+
+std::tuple<torch::Tensor, std::vector<torch::Tensor>> cpu_shm_ring_recv(
+    int64_t ring) {
+  return cpu_shm::ring_of(ring).recv();
+}
+
+std::vector<int64_t> get_cpu_shm_ring_stats(int64_t ring, bool reset) {
+  return cpu_shm::ring_of(ring).stats(reset);
+}
@@ -0,0 +1,639 @@
+// Conformance tests of the vec_op backend of the host against the portable
+// scalar implementation in csrc/cpu/cpu_types_scalar.hpp, built by the
+// cpu_vec_op_tests target of cmake/cpu_extension.cmake:
+//
+//   cmake --build build --target cpu_vec_op_tests
+//   ./build/cpu_vec_op_tests
+//
+// Loads, stores, broadcasts, element-wise arithmetic and BF16/FP16
+// conversions must match the reference bit for bit (any NaN matches any
+// NaN), reductions and transcendental functions within the bounds below.
+// The generic FP16 conversions of cpu_types_fp16.hpp are checked on every
+// host, whether the backend uses them or not. Failing lanes are printed and
+// the exit code is 1.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "cpu/cpu_types.hpp"
+#include "cpu/cpu_types_fp16.hpp"
+#include "cpu/cpu_types_scalar.hpp"
+
+namespace {
+
+namespace ref = vec_op::scalar;
+
+// FP32 to BF16 conversions of the backends that truncate instead of rounding
+// to nearest even, by vector conversion and by storeFP32.
+#if defined(VLLM_CPU_SCALAR_VEC_OP)
+constexpr bool BF16_VEC_TRUNCATES = false;
+constexpr bool BF16_STORE_TRUNCATES = false;
+#elif defined(__AVX512BF16__)
+constexpr bool BF16_VEC_TRUNCATES = false;
+constexpr bool BF16_STORE_TRUNCATES = false;
+#elif defined(__x86_64__)
+constexpr bool BF16_VEC_TRUNCATES = true;
+constexpr bool BF16_STORE_TRUNCATES = true;
+#elif defined(__POWER9_VECTOR__)
+constexpr bool BF16_VEC_TRUNCATES = false;
+constexpr bool BF16_STORE_TRUNCATES = true;
+#else
+constexpr bool BF16_VEC_TRUNCATES = false;
+constexpr bool BF16_STORE_TRUNCATES = false;
+#endif
+
+// VCVTNEPS2BF16 treats FP32 denormals as zeros.
+#if defined(__AVX512BF16__) && !defined(VLLM_CPU_SCALAR_VEC_OP)
+constexpr bool BF16_FLUSHES_DENORMALS = true;
+#else
+constexpr bool BF16_FLUSHES_DENORMALS = false;
+#endif
+
+// Extensions of the AVX512 backend used by the int8 kernels.
+#if defined(VLLM_CPU_SCALAR_VEC_OP) || defined(__AVX512F__)
+#define VEC_OP_TEST_QUANT_OPS
+#endif
+
+// Relative error bound of the reductions, which sum in backend order.
+constexpr float REDUCE_EPS = 16 * 1.2e-7f;
+// ULP bound of exp, tanh and erf.
+constexpr int64_t MATH_MAX_ULP = 4;
+
+int checks = 0;
+int failures = 0;
+
+uint32_t fp32_bits(float v) {
+  uint32_t bits;
+  std::memcpy(&bits, &v, sizeof(bits));
+  return bits;
+}
+
+float fp32_from_bits(uint32_t bits) {
+  float v;
+  std::memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+bool bf16_is_nan(uint16_t bits) { return (bits & 0x7FFF) > 0x7F80; }
+
+bool fp16_is_nan(uint16_t bits) { return (bits & 0x7FFF) > 0x7C00; }
+
+void check(bool ok, const char* test, int lane, double input, double got,
+           double expected) {
+  ++checks;
+  if (ok) return;
+  ++failures;
+  std::printf("FAIL %s lane %d: input %a got %a expected %a\n", test, lane,
+              input, got, expected);
+}
+
+bool same_fp32(float got, float expected) {
+  return fp32_bits(got) == fp32_bits(expected) ||
+         (std::isnan(got) && std::isnan(expected));
+}
+
+int64_t ulp_distance(float a, float b) {
+  auto ordered = [](float v) {
+    const int32_t bits = static_cast<int32_t>(fp32_bits(v));
+    return bits < 0 ? static_cast<int64_t>(INT32_MIN) - bits
+                    : static_cast<int64_t>(bits);
+  };
+  return std::llabs(ordered(a) - ordered(b));
+}
+
+// Bit patterns at the edges of the BF16 rounding and of the FP32 classes.
+const std::vector<uint32_t> SPECIAL_BITS = {
+    0x00000000, 0x80000000,  // +-0
+    0x3F800000, 0xBF800000,  // +-1
+    0x3F807FFF, 0x3F808000,  // below and at the tie to the even 0x3F80
+    0x3F808001, 0x3F818000,  // above the tie, tie to the odd 0x3F81
+    0xBF808000, 0xBF818000,  // negative ties
+    0x7F7F7FFF, 0x7F7FFFFF,  // largest finite, rounding to infinity
+    0x00000001, 0x00008000,  // FP32 and BF16 denormals
+    0x00018000, 0x807FFFFF,
+    0x7F800000, 0xFF800000,  // +-inf
+    0x7FC00000, 0xFFC00000,  // quiet NaNs
+    0x7F800001, 0x7F808000,  // signaling NaNs, payload below the BF16 bits
+    0x7FFFFFFF, 0xFFFFFFFF,  // NaNs overflowing when rounded
+};
+
+// SPECIAL_BITS followed by random bit patterns, padded to a multiple of 32.
+std::vector<float> bf16_conversion_inputs(std::mt19937& gen) {
+  std::vector<float> values;
+  for (const uint32_t bits : SPECIAL_BITS) {
+    values.push_back(fp32_from_bits(bits));
+  }
+  std::uniform_int_distribution<uint32_t> dist;
+  while (values.size() < 1024) values.push_back(fp32_from_bits(dist(gen)));
+  return values;
+}
+
+// Bit patterns at the edges of the FP16 rounding, range and denormals.
+const std::vector<uint32_t> FP16_SPECIAL_BITS = {
+    0x3F801000, 0x3F803000,  // ties to the even 1.0 and to the odd 0x3C01
+    0x3F801001, 0xBF803000,  // above the tie, negative tie
+    0x477FE000, 0x477FEFFF,  // largest finite, below the tie to infinity
+    0x477FF000, 0x47800000,  // rounding to infinity, overflow
+    0x38800000, 0x387FC000,  // smallest normal, denormal tie
+    0x33800000, 0x33000000,  // smallest denormal, tie to zero
+    0x33000001, 0xB3000001,  // above the tie to zero
+    0x7FC00000, 0x7F800001,  // quiet and signaling NaN
+    0xFF802000, 0x7F800000,  // NaN with payload in the FP16 bits, inf
+};
+
+// FP16_SPECIAL_BITS, SPECIAL_BITS and random values around the FP16 range,
+// padded to a multiple of 32.
+std::vector<float> fp16_conversion_inputs(std::mt19937& gen) {
+  std::vector<float> values;
+  for (const uint32_t bits : FP16_SPECIAL_BITS) {
+    values.push_back(fp32_from_bits(bits));
+  }
+  for (const uint32_t bits : SPECIAL_BITS) {
+    values.push_back(fp32_from_bits(bits));
+  }
+  std::uniform_int_distribution<uint32_t> dist;
+  // Exponents from 2^-30 to 2^17.
+  std::uniform_int_distribution<uint32_t> exponent(97, 144);
+  while (values.size() < 1024) {
+    values.push_back(fp32_from_bits((dist(gen) & 0x807FFFFF) |
+                                    (exponent(gen) << 23)));
+  }
+  return values;
+}
+
+std::vector<float> normal_inputs(std::mt19937& gen, int n, float stddev) {
+  std::normal_distribution<float> dist(0.0f, stddev);
+  std::vector<float> values(n);
+  for (float& v : values) v = dist(gen);
+  return values;
+}
+
+void check_bf16(const char* test, int lane, float input, uint16_t got,
+                bool truncates) {
+  const uint32_t bits = fp32_bits(input);
+  uint16_t expected = ref::fp32_to_bf16(input);
+  if (BF16_FLUSHES_DENORMALS && (bits & 0x7F800000) == 0) {
+    expected = (bits >> 16) & 0x8000;
+  }
+  bool ok = got == expected;
+  if (std::isnan(input)) {
+    // Truncation turns NaNs with only low payload bits into infinities.
+    ok = bf16_is_nan(got) ||
+         (truncates && (bits & 0x007F0000) == 0);
+  } else if (truncates) {
+    ok = ok || got == static_cast<uint16_t>(bits >> 16);
+  }
+  check(ok, test, lane, input, got, expected);
+}
+
+void check_fp16(const char* test, int lane, float input, uint16_t got) {
+  const uint16_t expected = ref::fp32_to_fp16(input);
+  const bool ok = std::isnan(input) ? fp16_is_nan(got) : got == expected;
+  check(ok, test, lane, input, got, expected);
+}
+
+void test_reference_matches_c10(const std::vector<float>& inputs) {
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    const uint16_t expected = c10::BFloat16(inputs[i]).x;
+    const uint16_t got = ref::fp32_to_bf16(inputs[i]);
+    check(got == expected, "reference fp32_to_bf16", i, inputs[i], got,
+          expected);
+    const float back = ref::bf16_to_fp32(expected);
+    check(same_fp32(back, static_cast<float>(c10::BFloat16(inputs[i]))),
+          "reference bf16_to_fp32", i, expected, back, back);
+  }
+}
+
+void test_fp16_reference_matches_c10(const std::vector<float>& inputs) {
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    const uint16_t expected = c10::Half(inputs[i]).x;
+    const uint16_t got = ref::fp32_to_fp16(inputs[i]);
+    check(got == expected || (fp16_is_nan(got) && fp16_is_nan(expected)),
+          "reference fp32_to_fp16", i, inputs[i], got, expected);
+  }
+  for (uint32_t bits = 0; bits <= 0xFFFF; ++bits) {
+    c10::Half half;
+    half.x = static_cast<uint16_t>(bits);
+    const float expected = static_cast<float>(half);
+    const float got = ref::fp16_to_fp32(half.x);
+    check(same_fp32(got, expected), "reference fp16_to_fp32", bits, bits,
+          got, expected);
+  }
+}
+
+template <typename Vec, typename RefVec, typename Op>
+void check_binary(const char* test, const std::vector<float>& a,
+                  const std::vector<float>& b, Op op) {
+  constexpr int N = Vec::VEC_ELEM_NUM;
+  static_assert(N == RefVec::VEC_ELEM_NUM);
+  for (size_t i = 0; i + N <= a.size(); i += N) {
+    float got[N], expected[N];
+    op(Vec(a.data() + i), Vec(b.data() + i)).save(got);
+    op(RefVec(a.data() + i), RefVec(b.data() + i)).save(expected);
+    for (int j = 0; j < N; ++j) {
+      check(same_fp32(got[j], expected[j]), test, j, a[i + j], got[j],
+            expected[j]);
+    }
+  }
+}
+
+template <typename Vec, typename RefVec>
+void test_fp32_arith(const char* name, const std::vector<float>& a,
+                     const std::vector<float>& b) {
+  const std::string prefix(name);
+  check_binary<Vec, RefVec>((prefix + " +").c_str(), a, b,
+                            [](const auto& x, const auto& y) { return x + y; });
+  check_binary<Vec, RefVec>((prefix + " -").c_str(), a, b,
+                            [](const auto& x, const auto& y) { return x - y; });
+  check_binary<Vec, RefVec>((prefix + " *").c_str(), a, b,
+                            [](const auto& x, const auto& y) { return x * y; });
+  check_binary<Vec, RefVec>((prefix + " /").c_str(), a, b,
+                            [](const auto& x, const auto& y) { return x / y; });
+}
+
+template <typename Vec, typename RefVec>
+void test_reduce_sum(const char* test, const std::vector<float>& a) {
+  constexpr int N = Vec::VEC_ELEM_NUM;
+  for (size_t i = 0; i + N <= a.size(); i += N) {
+    float abs_sum = 0;
+    for (int j = 0; j < N; ++j) abs_sum += std::fabs(a[i + j]);
+    const float got = Vec(a.data() + i).reduce_sum();
+    const float expected = RefVec(a.data() + i).reduce_sum();
+    check(std::fabs(got - expected) <= REDUCE_EPS * abs_sum, test, 0, a[i],
+          got, expected);
+  }
+}
+
+template <int group_size>
+void test_reduce_sub_sum(const std::vector<float>& a) {
+  constexpr int N = vec_op::FP32Vec16::VEC_ELEM_NUM;
+  for (size_t i = 0; i + N <= a.size(); i += N) {
+    vec_op::FP32Vec16 vec(a.data() + i);
+    ref::FP32Vec16 ref_vec(a.data() + i);
+    for (int idx = 0; idx < N / group_size; ++idx) {
+      float abs_sum = 0;
+      for (int j = 0; j < group_size; ++j) {
+        abs_sum += std::fabs(a[i + idx * group_size + j]);
+      }
+      const float got = vec.reduce_sub_sum<group_size>(idx);
+      const float expected = ref_vec.reduce_sub_sum<group_size>(idx);
+      check(std::fabs(got - expected) <= REDUCE_EPS * abs_sum,
+            "FP32Vec16 reduce_sub_sum", idx, group_size, got, expected);
+    }
+  }
+}
+
+template <typename Op>
+void check_math(const char* test, const std::vector<float>& a, Op op) {
+  constexpr int N = vec_op::FP32Vec8::VEC_ELEM_NUM;
+  for (size_t i = 0; i + N <= a.size(); i += N) {
+    float got[N], expected[N];
+    op(vec_op::FP32Vec8(a.data() + i)).save(got);
+    op(ref::FP32Vec8(a.data() + i)).save(expected);
+    for (int j = 0; j < N; ++j) {
+      check(ulp_distance(got[j], expected[j]) <= MATH_MAX_ULP, test, j,
+            a[i + j], got[j], expected[j]);
+    }
+  }
+}
+
+void test_math(const std::vector<float>& a) {
+  check_math("FP32Vec8 exp", a, [](const auto& x) { return x.exp(); });
+  check_math("FP32Vec8 tanh", a, [](const auto& x) { return x.tanh(); });
+  check_math("FP32Vec8 er", a, [](const auto& x) { return x.er(); });
+}
+
+void test_fp32_broadcast(const std::vector<float>& a) {
+  constexpr int N = vec_op::FP32Vec16::VEC_ELEM_NUM;
+  float got[N], expected[N];
+  vec_op::FP32Vec16(vec_op::FP32Vec4(a.data())).save(got);
+  ref::FP32Vec16(ref::FP32Vec4(a.data())).save(expected);
+  for (int j = 0; j < N; ++j) {
+    check(same_fp32(got[j], expected[j]), "FP32Vec16(FP32Vec4)", j, a[j],
+          got[j], expected[j]);
+  }
+  vec_op::FP32Vec16(vec_op::FP32Vec8(a.data())).save(got);
+  ref::FP32Vec16(ref::FP32Vec8(a.data())).save(expected);
+  for (int j = 0; j < N; ++j) {
+    check(same_fp32(got[j], expected[j]), "FP32Vec16(FP32Vec8)", j, a[j],
+          got[j], expected[j]);
+  }
+  vec_op::FP32Vec16(a[0]).save(got);
+  ref::FP32Vec16(a[0]).save(expected);
+  for (int j = 0; j < N; ++j) {
+    check(same_fp32(got[j], expected[j]), "FP32Vec16(float)", j, a[0],
+          got[j], expected[j]);
+  }
+
+  vec_op::FP32Vec16 acc(a.data()), x(a.data() + N), y(a.data() + 2 * N);
+  ref::FP32Vec16 ref_acc(a.data()), ref_x(a.data() + N),
+      ref_y(a.data() + 2 * N);
+  vec_op::fma(acc, x, y);
+  ref::fma(ref_acc, ref_x, ref_y);
+  acc.save(got);
+  ref_acc.save(expected);
+  for (int j = 0; j < N; ++j) {
+    // Backends may fuse the multiply-add.
+    check(ulp_distance(got[j], expected[j]) <= 1, "fma", j, a[j], got[j],
+          expected[j]);
+  }
+}
+
+// BF16 bit patterns of the FP32 inputs, truncated.
+std::vector<uint16_t> bf16_inputs(const std::vector<float>& a) {
+  std::vector<uint16_t> bits(a.size());
+  for (size_t i = 0; i < a.size(); ++i) bits[i] = fp32_bits(a[i]) >> 16;
+  return bits;
+}
+
+template <typename BF16Vec, typename FP32Vec, typename RefBF16Vec,
+          typename RefFP32Vec>
+void test_bf16_to_fp32(const char* test, const std::vector<uint16_t>& a) {
+  constexpr int N = BF16Vec::VEC_ELEM_NUM;
+  for (size_t i = 0; i + N <= a.size(); i += N) {
+    float got[FP32Vec::VEC_ELEM_NUM], expected[FP32Vec::VEC_ELEM_NUM];
+    FP32Vec(BF16Vec(a.data() + i)).save(got);
+    RefFP32Vec(RefBF16Vec(a.data() + i)).save(expected);
+    for (int j = 0; j < FP32Vec::VEC_ELEM_NUM; ++j) {
+      check(same_fp32(got[j], expected[j]), test, j, a[i + j % N], got[j],
+            expected[j]);
+    }
+  }
+}
+
+template <typename BF16Vec, typename FP32Vec>
+void test_fp32_to_bf16(const char* test, const std::vector<float>& a) {
+  constexpr int N = BF16Vec::VEC_ELEM_NUM;
+  for (size_t i = 0; i + N <= a.size(); i += N) {
+    uint16_t got[N];
+    BF16Vec(FP32Vec(a.data() + i)).save(got);
+    for (int j = 0; j < N; ++j) {
+      check_bf16(test, j, a[i + j], got[j], BF16_VEC_TRUNCATES);
+    }
+  }
+}
+
+template <typename BF16Vec>
+void test_bf16_load_save(const char* test, const std::vector<uint16_t>& a) {
+  constexpr int N = BF16Vec::VEC_ELEM_NUM;
+  for (size_t i = 0; i + N <= a.size(); i += N) {
+    uint16_t got[N];
+    BF16Vec(a.data() + i).save(got);
+    for (int j = 0; j < N; ++j) {
+      check(got[j] == a[i + j], test, j, a[i + j], got[j], a[i + j]);
+    }
+  }
+}
+
+void test_bf16(const std::vector<float>& a) {
+  const std::vector<uint16_t> bits = bf16_inputs(a);
+  test_bf16_load_save<vec_op::BF16Vec8>("BF16Vec8 load/save", bits);
+  test_bf16_load_save<vec_op::BF16Vec16>("BF16Vec16 load/save", bits);
+  test_bf16_load_save<vec_op::BF16Vec32>("BF16Vec32 load/save", bits);
+
+  test_bf16_to_fp32<vec_op::BF16Vec8, vec_op::FP32Vec8, ref::BF16Vec8,
+                    ref::FP32Vec8>("FP32Vec8(BF16Vec8)", bits);
+  test_bf16_to_fp32<vec_op::BF16Vec16, vec_op::FP32Vec16, ref::BF16Vec16,
+                    ref::FP32Vec16>("FP32Vec16(BF16Vec16)", bits);
+  test_bf16_to_fp32<vec_op::BF16Vec8, vec_op::FP32Vec16, ref::BF16Vec8,
+                    ref::FP32Vec16>("FP32Vec16(BF16Vec8)", bits);
+
+  test_fp32_to_bf16<vec_op::BF16Vec8, vec_op::FP32Vec8>("BF16Vec8(FP32Vec8)",
+                                                        a);
+  test_fp32_to_bf16<vec_op::BF16Vec16, vec_op::FP32Vec16>(
+      "BF16Vec16(FP32Vec16)", a);
+
+  for (size_t i = 0; i < a.size(); ++i) {
+    c10::BFloat16 got;
+    vec_op::storeFP32(a[i], &got);
+    check_bf16("storeFP32<BFloat16>", i, a[i], got.x, BF16_STORE_TRUNCATES);
+    float got_fp32;
+    vec_op::storeFP32(a[i], &got_fp32);
+    check(same_fp32(got_fp32, a[i]), "storeFP32<float>", i, a[i], got_fp32,
+          a[i]);
+  }
+
+  // BF16Vec32(BF16Vec8) repeats the 8 elements.
+  vec_op::BF16Vec8 vec8(bits.data());
+  vec_op::BF16Vec32 vec32(vec8);
+  uint16_t got[vec_op::BF16Vec32::VEC_ELEM_NUM];
+  vec32.save(got);
+  for (int j = 0; j < vec_op::BF16Vec32::VEC_ELEM_NUM; ++j) {
+    check(got[j] == bits[j % 8], "BF16Vec32(BF16Vec8)", j, bits[j % 8],
+          got[j], bits[j % 8]);
+  }
+}
+
+// The generic vector conversions, on all FP16 values and on the inputs.
+void test_fp16_generic(const std::vector<float>& a) {
+  namespace fp16 = vec_op::fp16;
+  for (uint32_t bits = 0; bits <= 0xFFFF; bits += 4) {
+    const fp16::u32x4_t w = {bits << 16, (bits + 1) << 16, (bits + 2) << 16,
+                             (bits + 3) << 16};
+    const fp16::f32x4_t got = fp16::fp16_to_fp32(w);
+    for (int j = 0; j < 4; ++j) {
+      const float expected = ref::fp16_to_fp32(bits + j);
+      check(same_fp32(got[j], expected), "generic fp16_to_fp32", j,
+            bits + j, got[j], expected);
+    }
+  }
+  for (size_t i = 0; i + 4 <= a.size(); i += 4) {
+    const fp16::f32x4_t v = {a[i], a[i + 1], a[i + 2], a[i + 3]};
+    const fp16::u32x4_t got = fp16::fp32_to_fp16(v);
+    for (int j = 0; j < 4; ++j) {
+      check(got[j] <= 0xFFFF, "generic fp32_to_fp16 range", j, a[i + j],
+            got[j], 0);
+      check_fp16("generic fp32_to_fp16", j, a[i + j], got[j]);
+    }
+  }
+}
+
+// FP16 bit patterns of the FP32 inputs.
+std::vector<uint16_t> fp16_inputs(const std::vector<float>& a) {
+  std::vector<uint16_t> bits(a.size());
+  for (size_t i = 0; i < a.size(); ++i) bits[i] = ref::fp32_to_fp16(a[i]);
+  return bits;
+}
+
+template <typename FP16Vec, typename FP32Vec>
+void test_fp32_to_fp16(const char* test, const std::vector<float>& a) {
+  constexpr int N = FP16Vec::VEC_ELEM_NUM;
+  for (size_t i = 0; i + N <= a.size(); i += N) {
+    uint16_t got[N];
+    FP16Vec(FP32Vec(a.data() + i)).save(got);
+    for (int j = 0; j < N; ++j) check_fp16(test, j, a[i + j], got[j]);
+  }
+}
+
+void test_fp16(const std::vector<float>& a) {
+  const std::vector<uint16_t> bits = fp16_inputs(a);
+  // Loads, stores and widening are format agnostic.
+  test_bf16_load_save<vec_op::FP16Vec8>("FP16Vec8 load/save", bits);
+  test_bf16_load_save<vec_op::FP16Vec16>("FP16Vec16 load/save", bits);
+
+  test_bf16_to_fp32<vec_op::FP16Vec8, vec_op::FP32Vec8, ref::FP16Vec8,
+                    ref::FP32Vec8>("FP32Vec8(FP16Vec8)", bits);
+  test_bf16_to_fp32<vec_op::FP16Vec16, vec_op::FP32Vec16, ref::FP16Vec16,
+                    ref::FP32Vec16>("FP32Vec16(FP16Vec16)", bits);
+  test_bf16_to_fp32<vec_op::FP16Vec8, vec_op::FP32Vec16, ref::FP16Vec8,
+                    ref::FP32Vec16>("FP32Vec16(FP16Vec8)", bits);
+
+  test_fp32_to_fp16<vec_op::FP16Vec8, vec_op::FP32Vec8>("FP16Vec8(FP32Vec8)",
+                                                        a);
+  test_fp32_to_fp16<vec_op::FP16Vec16, vec_op::FP32Vec16>(
+      "FP16Vec16(FP32Vec16)", a);
+
+  for (size_t i = 0; i < a.size(); ++i) {
+    c10::Half got;
+    vec_op::storeFP32(a[i], &got);
+    check_fp16("storeFP32<Half>", i, a[i], got.x);
+  }
+
+  // Partial stores leave the tail untouched.
+  constexpr int N = vec_op::FP16Vec16::VEC_ELEM_NUM;
+  uint16_t got[N];
+  std::fill(got, got + N, 0xABCD);
+  vec_op::FP16Vec16(bits.data()).save(got, 5);
+  for (int j = 0; j < N; ++j) {
+    const uint16_t expected = j < 5 ? bits[j] : 0xABCD;
+    check(got[j] == expected, "FP16Vec16 save(ptr, 5)", j, bits[j], got[j],
+          expected);
+  }
+}
+
+// Every count up to a few vectors, so that both the vector body and the tail
+// of the backends run. Each word must hold the value its little-endian bytes
+// encode.
+template <int WORD_BYTES, typename word_t>
+void test_load_le_words(const char* test, std::mt19937& gen) {
+  constexpr int MAX_COUNT = 40;
+  std::uniform_int_distribution<int> dist(0, 255);
+  uint8_t input[MAX_COUNT * WORD_BYTES];
+  for (uint8_t& byte : input) byte = dist(gen);
+  for (int count = 0; count <= MAX_COUNT; ++count) {
+    word_t got[MAX_COUNT + 1];
+    word_t expected[MAX_COUNT + 1];
+    got[count] = expected[count] = 0x5A;
+    vec_op::load_le_words<WORD_BYTES>(got, input, count);
+    ref::load_le_words<WORD_BYTES>(expected, input, count);
+    for (int j = 0; j <= count; ++j) {
+      word_t value = 0;
+      for (int b = WORD_BYTES - 1; b >= 0 && j < count; --b) {
+        value = value << 8 | input[j * WORD_BYTES + b];
+      }
+      if (j == count) value = 0x5A;  // must not be written
+      check(got[j] == value && expected[j] == value, test, j, count, got[j],
+            value);
+    }
+  }
+}
+
+#ifdef VEC_OP_TEST_QUANT_OPS
+void test_quant_ops(const std::vector<float>& a, const std::vector<float>& b) {
+  constexpr int N = vec_op::FP32Vec16::VEC_ELEM_NUM;
+  check_binary<vec_op::FP32Vec16, ref::FP32Vec16>(
+      "FP32Vec16 max", a, b,
+      [](const auto& x, const auto& y) { return x.max(y); });
+  check_binary<vec_op::FP32Vec16, ref::FP32Vec16>(
+      "FP32Vec16 max(5)", a, b,
+      [](const auto& x, const auto& y) { return x.max(y, 5); });
+  check_binary<vec_op::FP32Vec16, ref::FP32Vec16>(
+      "FP32Vec16 abs", a, b,
+      [](const auto& x, const auto&) { return x.abs(); });
+  check_binary<vec_op::FP32Vec16, ref::FP32Vec16>(
+      "FP32Vec16 clamp", a, b, [](const auto& x, const auto& y) {
+        using Vec = std::decay_t<decltype(x)>;
+        return x.clamp(Vec(-1.0f), y.abs());
+      });
+
+  for (size_t i = 0; i + N <= a.size(); i += N) {
+    const float got = vec_op::FP32Vec16(a.data() + i).reduce_max();
+    const float expected = ref::FP32Vec16(a.data() + i).reduce_max();
+    check(same_fp32(got, expected), "FP32Vec16 reduce_max", 0, a[i], got,
+          expected);
+
+    // Partial stores leave the tail untouched.
+    float got_partial[N], expected_partial[N];
+    std::fill(got_partial, got_partial + N, -2.0f);
+    std::fill(expected_partial, expected_partial + N, -2.0f);
+    vec_op::FP32Vec16(a.data() + i).save(got_partial, 7);
+    ref::FP32Vec16(a.data() + i).save(expected_partial, 7);
+    int8_t got_int8[N], expected_int8[N];
+    std::fill(got_int8, got_int8 + N, 3);
+    std::fill(expected_int8, expected_int8 + N, 3);
+    // In the int8 range, as the kernels clamp first.
+    const vec_op::FP32Vec16 scaled =
+        vec_op::FP32Vec16(a.data() + i) * vec_op::FP32Vec16(40.0f);
+    const ref::FP32Vec16 ref_scaled =
+        ref::FP32Vec16(a.data() + i) * ref::FP32Vec16(40.0f);
+    vec_op::INT8Vec16(scaled.clamp(vec_op::FP32Vec16(-128.0f),
+                                   vec_op::FP32Vec16(127.0f)))
+        .save(got_int8, 11);
+    ref::INT8Vec16(
+        ref_scaled.clamp(ref::FP32Vec16(-128.0f), ref::FP32Vec16(127.0f)))
+        .save(expected_int8, 11);
+    for (int j = 0; j < N; ++j) {
+      check(same_fp32(got_partial[j], expected_partial[j]),
+            "FP32Vec16 save(ptr, 7)", j, a[i + j], got_partial[j],
+            expected_partial[j]);
+      check(got_int8[j] == expected_int8[j], "INT8Vec16 save(ptr, 11)", j,
+            a[i + j], got_int8[j], expected_int8[j]);
+    }
+  }
+}
+#endif
+
+}  // namespace
+
+int main() {
+  static_assert(vec_op::vec_t<float>::VEC_ELEM_NUM ==
+                ref::vec_t<float>::VEC_ELEM_NUM);
+  static_assert(vec_op::vec_t<c10::BFloat16>::VEC_ELEM_NUM ==
+                ref::vec_t<c10::BFloat16>::VEC_ELEM_NUM);
+  static_assert(vec_op::vec_t<c10::Half>::VEC_ELEM_NUM ==
+                ref::vec_t<c10::Half>::VEC_ELEM_NUM);
+
+  std::mt19937 gen(0);
+  const std::vector<float> conversion_inputs = bf16_conversion_inputs(gen);
+  const std::vector<float> fp16_inputs = fp16_conversion_inputs(gen);
+  const std::vector<float> a = normal_inputs(gen, 1024, 4.0f);
+  const std::vector<float> b = normal_inputs(gen, 1024, 4.0f);
+
+  test_reference_matches_c10(conversion_inputs);
+  test_fp32_arith<vec_op::FP32Vec8, ref::FP32Vec8>("FP32Vec8", a, b);
+  test_fp32_arith<vec_op::FP32Vec16, ref::FP32Vec16>("FP32Vec16", a, b);
+  // Special values, NaN and infinity propagation.
+  test_fp32_arith<vec_op::FP32Vec16, ref::FP32Vec16>(
+      "FP32Vec16 special", conversion_inputs,
+      std::vector<float>(conversion_inputs.rbegin(),
+                         conversion_inputs.rend()));
+  test_reduce_sum<vec_op::FP32Vec8, ref::FP32Vec8>("FP32Vec8 reduce_sum", a);
+  test_reduce_sum<vec_op::FP32Vec16, ref::FP32Vec16>("FP32Vec16 reduce_sum",
+                                                     a);
+  test_reduce_sub_sum<2>(a);
+  test_reduce_sub_sum<4>(a);
+  test_reduce_sub_sum<8>(a);
+  test_math(a);
+  test_fp32_broadcast(a);
+  test_bf16(conversion_inputs);
+  test_bf16(a);
+  test_fp16_reference_matches_c10(fp16_inputs);
+  test_fp16_generic(fp16_inputs);
+  test_fp16(fp16_inputs);
+  test_fp16(a);
+  test_load_le_words<2, uint16_t>("load_le_words<2>", gen);
+  test_load_le_words<4, uint32_t>("load_le_words<4>", gen);
+#ifdef VEC_OP_TEST_QUANT_OPS
+  test_quant_ops(a, b);
+#endif
+
+  std::printf("%d checks, %d failures\n", checks, failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+#include <sched.h>
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "cpu_types.hpp"
+#include "thread_subteams.hpp"
+
+namespace cpu_threads {
+
+namespace {
+// Largest cache index of /sys/devices/system/cpu/cpu*/cache looked at.
+constexpr int MAX_CACHE_INDEX = 16;
+
+struct Topology {
+  // Group of each OpenMP thread, the groups are numbered in the order of
+  // their first thread.
+  std::vector<int> thread_groups;
+  int group_num = 0;
+  // Whether the threads of every group are consecutive, so that the first
+  // groups can be forked without the others.
+  bool contiguous = false;
+  // One past the last thread of each group.
+  std::vector<int> group_ends;
+};
+
+std::shared_mutex topology_mutex;
+Topology topology;
+// Lets planSubteams() skip the lock while subteams are disabled.
+std::atomic<bool> subteams_enabled{false};
+
+// Buffers of the plans of one calling thread.
+struct PlanBuffers {
+  std::vector<int> thread_queues;
+  std::vector<int> group_queues;
+  std::vector<int> queue_threads;
+  std::unique_ptr<GroupQueue[]> queues;
+  int queue_capacity = 0;
+  std::vector<int64_t> order;
+};
+
+thread_local PlanBuffers plan_buffers;
+
+// The shared_cpu_list of the data or unified cache of `level` of a CPU, which
+// names its cache domain.
+std::string sharedCpuList(const int cpu, const int64_t level) {
+  const std::string cache_dir =
+      "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+  for (int index = 0; index < MAX_CACHE_INDEX; ++index) {
+    const std::string index_dir = cache_dir + std::to_string(index) + "/";
+    std::ifstream level_file(index_dir + "level");
+    if (!level_file) break;
+    int64_t index_level = 0;
+    std::string type;
+    level_file >> index_level;
+    std::ifstream(index_dir + "type") >> type;
+    if (index_level != level || type == "Instruction") continue;
+    std::string cpu_list;
+    std::ifstream(index_dir + "shared_cpu_list") >> cpu_list;
+    if (!cpu_list.empty()) return cpu_list;
+  }
+  TORCH_CHECK(false, "No L", level, " cache of CPU ", cpu,
+              " in /sys/devices/system/cpu");
+}
+}  // namespace
+
+SubteamPlan planSubteams(const int64_t item_num, const int64_t items_per_home,
+                         const int thread_num) {
+  if (!subteams_enabled.load(std::memory_order_acquire) || item_num == 0) {
+    return {};
+  }
+  std::shared_lock<std::shared_mutex> guard(topology_mutex);
+  const int thread_limit = std::min<int>(
+      thread_num, static_cast<int>(topology.thread_groups.size()));
+  // Small batches fork the first groups which give each thread an item.
+  int team_size = thread_limit;
+  if (topology.contiguous) {
+    const int needed = std::min<int64_t>(thread_limit, item_num);
+    team_size = std::min(
+        thread_limit,
+        topology.group_ends[topology.thread_groups[needed - 1]]);
+  }
+
+  PlanBuffers& buffers = plan_buffers;
+  buffers.group_queues.assign(topology.group_num, -1);
+  buffers.thread_queues.resize(team_size);
+  buffers.queue_threads.assign(topology.group_num, 0);
+  int queue_num = 0;
+  for (int thread = 0; thread < team_size; ++thread) {
+    int& queue = buffers.group_queues[topology.thread_groups[thread]];
+    if (queue < 0) queue = queue_num++;
+    buffers.thread_queues[thread] = queue;
+    ++buffers.queue_threads[queue];
+  }
+  if (buffers.queue_capacity < queue_num) {
+    buffers.queues.reset(new GroupQueue[queue_num]);
+    buffers.queue_capacity = queue_num;
+  }
+
+  // The sequences are dealt to the queues round robin.
+  buffers.order.resize(item_num);
+  const int64_t home_num = (item_num + items_per_home - 1) / items_per_home;
+  int64_t pos = 0;
+  for (int queue_idx = 0; queue_idx < queue_num; ++queue_idx) {
+    GroupQueue& queue = buffers.queues[queue_idx];
+    const int64_t begin = pos;
+    for (int64_t home = queue_idx; home < home_num; home += queue_num) {
+      const int64_t home_end = std::min(item_num, (home + 1) * items_per_home);
+      for (int64_t item = home * items_per_home; item < home_end; ++item) {
+        buffers.order[pos++] = item;
+      }
+    }
+    queue.next.store(begin, std::memory_order_relaxed);
+    queue.end = pos;
+    // A few chunks per thread of the group, for stealing to even out.
+    queue.chunk = std::max<int64_t>(
+        1, (pos - begin) / (4 * buffers.queue_threads[queue_idx]));
+  }
+
+  SubteamPlan plan;
+  plan.team_size = team_size;
+  plan.queue_num = queue_num;
+  plan.thread_queues = buffers.thread_queues.data();
+  plan.queues = buffers.queues.get();
+  plan.order = buffers.order.data();
+  return plan;
+}
+
+}  // namespace cpu_threads
+
+// Groups the OpenMP threads by the L2 (cache_level 2) or L3 (3) cache of the
+// CPUs they are bound to and enables the subteams, 0 disables them. Returns
+// the group of each OpenMP thread. Call again after changing the number of
+// OpenMP threads.
+std::vector<int64_t> set_cpu_thread_subteams(int64_t cache_level) {
+  using namespace cpu_threads;
+  TORCH_CHECK(cache_level == 0 || cache_level == 2 || cache_level == 3,
+              "Thread subteams group by the L2 or L3 cache, got level ",
+              cache_level);
+  if (cache_level == 0) {
+    subteams_enabled.store(false, std::memory_order_release);
+    return {};
+  }
+
+  const int thread_num = omp_get_max_threads();
+  std::vector<std::vector<int>> thread_cpus(thread_num);
+#pragma omp parallel num_threads(thread_num)
+  {
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &mask)) {
+          thread_cpus[omp_get_thread_num()].push_back(cpu);
+        }
+      }
+    }
+  }
+
+  Topology new_topology;
+  std::map<int, std::string> cpu_domains;
+  std::map<std::string, int> domain_groups;
+  auto domain_of = [&](const int cpu) -> const std::string& {
+    auto iter = cpu_domains.find(cpu);
+    if (iter == cpu_domains.end()) {
+      iter = cpu_domains.emplace(cpu, sharedCpuList(cpu, cache_level)).first;
+    }
+    return iter->second;
+  };
+  for (int thread = 0; thread < thread_num; ++thread) {
+    const std::vector<int>& cpus = thread_cpus[thread];
+    TORCH_CHECK(!cpus.empty(), "Cannot read the CPU affinity of OpenMP thread ",
+                thread);
+    const std::string domain = domain_of(cpus.front());
+    for (const int cpu : cpus) {
+      TORCH_CHECK(domain_of(cpu) == domain, "OpenMP thread ", thread,
+                  " may run outside the L", cache_level, " cache of CPU ",
+                  cpus.front(),
+                  ", bind the threads with init_cpu_threads_env() first");
+    }
+    const int group =
+        domain_groups.emplace(domain, domain_groups.size()).first->second;
+    new_topology.thread_groups.push_back(group);
+  }
+  new_topology.group_num = domain_groups.size();
+  new_topology.contiguous = std::is_sorted(new_topology.thread_groups.begin(),
+                                           new_topology.thread_groups.end());
+  new_topology.group_ends.assign(new_topology.group_num, 0);
+  for (int thread = 0; thread < thread_num; ++thread) {
+    new_topology.group_ends[new_topology.thread_groups[thread]] = thread + 1;
+  }
+
+  std::unique_lock<std::shared_mutex> guard(topology_mutex);
+  topology = std::move(new_topology);
+  subteams_enabled.store(true, std::memory_order_release);
+  return std::vector<int64_t>(topology.thread_groups.begin(),
+                              topology.thread_groups.end());
+}
@@ -0,0 +1,107 @@
+#ifndef CPU_THREAD_SUBTEAMS_HPP
+#define CPU_THREAD_SUBTEAMS_HPP
+
+#include <omp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "kernel_profiler.hpp"
+
+// Subteams of the OpenMP team for the attention and per-token kernels. A
+// `parallel for` over the whole team gives each thread little work on small
+// decode batches, and all threads then meet at the closing barrier. With
+// subteams enabled by set_cpu_thread_subteams(), the OpenMP threads are
+// grouped by the L2 or L3 cache they share. parallel_for() queues the items of
+// each sequence on one group, forks only the groups the batch needs and lets
+// the threads of a group steal items from the other queues once their own one
+// is drained.
+namespace cpu_threads {
+
+// Work queue of one group, items are claimed `chunk` at a time.
+struct alignas(64) GroupQueue {
+  std::atomic<int64_t> next{0};
+  int64_t end = 0;
+  int64_t chunk = 1;
+};
+
+struct SubteamPlan {
+  // OpenMP threads to fork, 0 when subteams are disabled.
+  int team_size = 0;
+  int queue_num = 0;
+  // [team_size] queue of the group of each thread.
+  const int* thread_queues = nullptr;
+  // [queue_num]
+  GroupQueue* queues = nullptr;
+  // The items in queue order, queue q holds positions [next, end).
+  const int64_t* order = nullptr;
+};
+
+// Plans item_num items on at most thread_num threads. Runs of items_per_home
+// consecutive items belong to one sequence (or token) and share a queue. The
+// plan lives in buffers of the calling thread until its next call.
+SubteamPlan planSubteams(int64_t item_num, int64_t items_per_home,
+                         int thread_num);
+
+// Closing barrier of a parallel_for() region, timed while profiling. The
+// arrival is the finish time of the thread in timer.
+inline void timedBarrier(cpu_profiler::RegionTimer& timer) {
+  if (timer.timed()) timer.finish();
+  const auto start = std::chrono::steady_clock::now();
+#pragma omp barrier
+  const int64_t wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+  cpu_profiler::barrier_wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+}
+
+// Calls fn(item) for every item in [0, item_num). Without subteams, this is a
+// `parallel for` over thread_num threads with a static schedule, or the
+// `schedule(runtime)` one of cpu_tuner::KernelConfig::applySchedule().
+template <typename Fn>
+void parallel_for(const int64_t item_num, const int64_t items_per_home,
+                  const int thread_num, const bool runtime_schedule,
+                  const Fn& fn) {
+  const bool timed =
+      cpu_profiler::profiling_level.load(std::memory_order_relaxed) > 0;
+  const SubteamPlan plan = planSubteams(item_num, items_per_home, thread_num);
+  if (plan.team_size == 0) {
+    cpu_profiler::RegionTimer region_timer(thread_num);
+#pragma omp parallel num_threads(thread_num)
+    {
+      if (runtime_schedule) {
+#pragma omp for schedule(runtime) nowait
+        for (int64_t item = 0; item < item_num; ++item) fn(item);
+      } else {
+#pragma omp for schedule(static) nowait
+        for (int64_t item = 0; item < item_num; ++item) fn(item);
+      }
+      if (timed) timedBarrier(region_timer);
+    }
+    return;
+  }
+
+  cpu_profiler::RegionTimer region_timer(plan.team_size);
+#pragma omp parallel num_threads(plan.team_size)
+  {
+    // The own queue first, then the others in turn.
+    const int own_queue = plan.thread_queues[omp_get_thread_num()];
+    for (int i = 0; i < plan.queue_num; ++i) {
+      GroupQueue& queue = plan.queues[(own_queue + i) % plan.queue_num];
+      const int64_t chunk = queue.chunk;
+      int64_t begin;
+      while ((begin = queue.next.fetch_add(
+                  chunk, std::memory_order_relaxed)) < queue.end) {
+        const int64_t end = std::min(begin + chunk, queue.end);
+        for (int64_t pos = begin; pos < end; ++pos) fn(plan.order[pos]);
+      }
+    }
+    if (timed) timedBarrier(region_timer);
+  }
+}
+
+}  // namespace cpu_threads
+
+#endif
@@ -6,11 +6,133 @@
 
 std::string init_cpu_threads_env(const std::string& cpu_ids);
 
+std::string get_cpu_vec_op_isa();
+
+void set_cpu_kernel_profiling(int64_t level);
+
+std::tuple<std::vector<std::string>, torch::Tensor> collect_cpu_kernel_stats();
+
+void set_cpu_kernel_config(const std::string& kernel,
+                           const std::vector<int64_t>& shape_key,
+                           const std::vector<int64_t>& config);
+
+void clear_cpu_kernel_configs();
+
+void set_cpu_prefetch_distance(int64_t distance);
+
+std::vector<int64_t> set_cpu_thread_subteams(int64_t cache_level);
+
+torch::Tensor allocate_cpu_kv_cache(int64_t num_bytes, int64_t huge_pages,
+                                    int64_t numa_node);
+
+std::vector<int64_t> get_cpu_memory_placement(const torch::Tensor& tensor);
+
+torch::Tensor map_cpu_weights_file(const std::string& path, bool read_ahead);
+
+void enable_cpu_caching_allocator();
+
+void empty_cpu_allocator_cache();
+
+std::vector<int64_t> get_cpu_allocator_stats(bool reset_peak);
+
+std::vector<int64_t> get_cpu_workspace_stats();
+
+void register_cpu_streamed_layer(int64_t layer,
+                                 const std::vector<torch::Tensor>& weights);
+
+void prefetch_cpu_streamed_layer(int64_t layer);
+
+int64_t wait_cpu_streamed_layer(int64_t layer);
+
+void release_cpu_streamed_layer(int64_t layer);
+
+torch::Tensor get_cpu_weight_streaming_stats(bool reset);
+
+int64_t create_cpu_shm_ring(const std::string& name, int64_t num_readers,
+                            int64_t num_slots, int64_t slot_bytes,
+                            int64_t spin_us);
+
+int64_t open_cpu_shm_ring(const std::string& name, int64_t reader,
+                          int64_t spin_us);
+
+void unlink_cpu_shm_ring(int64_t ring);
+
+void close_cpu_shm_ring(int64_t ring);
+
+bool cpu_shm_ring_send(int64_t ring, const torch::Tensor& header,
+                       const std::vector<torch::Tensor>& tensors);
+
+std::tuple<torch::Tensor, std::vector<torch::Tensor>> cpu_shm_ring_recv(
+    int64_t ring);
+
+std::vector<int64_t> get_cpu_shm_ring_stats(int64_t ring, bool reset);
+
+void convert_bf16_to_fp32(torch::Tensor& out, const torch::Tensor& input);
+
+void convert_fp32_to_bf16(torch::Tensor& out, const torch::Tensor& input);
+
+void copy_contiguous(torch::Tensor& out, const torch::Tensor& input);
+
+int64_t convert_le_weight(torch::Tensor& out, const torch::Tensor& input,
+                          int64_t src_format, bool verify);
+
+void paged_attention_cascade(
+    torch::Tensor& out, torch::Tensor& query, torch::Tensor& key_cache,
+    torch::Tensor& value_cache, int64_t num_kv_heads, double scale,
+    torch::Tensor& block_tables, torch::Tensor& seq_lens, int64_t block_size,
+    int64_t max_seq_len, const c10::optional<torch::Tensor>& alibi_slopes,
+    const std::string& kv_cache_dtype, double k_scale, double v_scale,
+    const c10::optional<torch::Tensor>& prefix_group_ids,
+    int64_t min_shared_blocks);
+
+void paged_attention_multi_query(
+    torch::Tensor& out, torch::Tensor& query, torch::Tensor& key_cache,
+    torch::Tensor& value_cache, int64_t num_kv_heads, double scale,
+    torch::Tensor& block_tables, torch::Tensor& seq_lens, int64_t block_size,
+    int64_t max_seq_len, const c10::optional<torch::Tensor>& alibi_slopes,
+    const std::string& kv_cache_dtype, double k_scale, double v_scale,
+    const int64_t tp_rank, const int64_t blocksparse_local_blocks,
+    const int64_t blocksparse_vert_stride, const int64_t blocksparse_block_size,
+    const int64_t blocksparse_head_sliding_step);
+
+void llama_decoder_layer(torch::Tensor& hidden_states,
+                         torch::Tensor& residual, bool add_residual,
+                         torch::Tensor& positions,
+                         const std::vector<torch::Tensor>& weights,
+                         double epsilon, torch::Tensor& cos_sin_cache,
+                         bool is_neox, torch::Tensor& key_cache,
+                         torch::Tensor& value_cache,
+                         torch::Tensor& slot_mapping,
+                         torch::Tensor& block_tables, torch::Tensor& seq_lens,
+                         int64_t num_heads, double scale);
+
 void int8_scaled_mm(torch::Tensor& c, const torch::Tensor& a,
                     const torch::Tensor& b, const torch::Tensor& a_scales,
                     const torch::Tensor& b_scales,
                     const c10::optional<torch::Tensor>& bias);
 
+void bgmv_shrink(torch::Tensor& out, const torch::Tensor& input,
+                 const torch::Tensor& lora_a_weights,
+                 const torch::Tensor& lora_indices, double scale);
+
+void bgmv_expand_slice(torch::Tensor& out, const torch::Tensor& input,
+                       const torch::Tensor& lora_b_weights,
+                       const torch::Tensor& lora_indices, int64_t slice_offset,
+                       int64_t slice_size, bool add_inputs);
+
+void sgmv_shrink(torch::Tensor& out, const torch::Tensor& input,
+                 const torch::Tensor& lora_a_weights,
+                 const torch::Tensor& seq_start_locs,
+                 const torch::Tensor& seq_lens,
+                 const torch::Tensor& lora_indices, double scale);
+
+void sgmv_expand_slice(torch::Tensor& out, const torch::Tensor& input,
+                       const torch::Tensor& lora_b_weights,
+                       const torch::Tensor& seq_start_locs,
+                       const torch::Tensor& seq_lens,
+                       const torch::Tensor& lora_indices, int64_t slice_offset,
+                       int64_t slice_size, bool add_inputs);
+
 TORCH_LIBRARY_EXPAND(TORCH_EXTENSION_NAME, ops) {
   // vLLM custom ops
 
@@ -26,10 +148,14 @@ TORCH_LIBRARY_EXPAND(TORCH_EXTENSION_NAME, ops) {
       "    str kv_cache_dtype, float k_scale, float v_scale,"
       "    int tp_rank, int blocksparse_local_blocks,"
       "    int blocksparse_vert_stride, int blocksparse_block_size,"
-      "    int blocksparse_head_sliding_step) -> ()");
+      "    int blocksparse_head_sliding_step,"
+      "    int sliding_window=0) -> ()");
   ops.impl("paged_attention_v1", torch::kCPU, &paged_attention_v1);
 
-  // PagedAttention V2.
+  // PagedAttention V2. exp_sums, max_logits and tmp_out are the reduction
+  // buffers, [num_seqs, num_heads, max_num_partitions(, head_size)]. With no
+  // rows the kernel borrows them from its workspace, exp_sums then only
+  // passes max_num_partitions.
   ops.def(
       "paged_attention_v2("
       "    Tensor! out, Tensor! exp_sums, Tensor! max_logits,"
@@ -40,9 +166,39 @@ TORCH_LIBRARY_EXPAND(TORCH_EXTENSION_NAME, ops) {
       "    str kv_cache_dtype, float k_scale, float v_scale,"
       "    int tp_rank, int blocksparse_local_blocks,"
       "    int blocksparse_vert_stride, int blocksparse_block_size,"
-      "    int blocksparse_head_sliding_step) -> ()");
+      "    int blocksparse_head_sliding_step,"
+      "    int sliding_window=0) -> ()");
   ops.impl("paged_attention_v2", torch::kCPU, &paged_attention_v2);
 
+  // PagedAttention for decoding batches sharing prefix blocks. The shared
+  // blocks are read once per group of sequences, grouped by prefix_group_ids
+  // if given or by their first physical block otherwise.
+  ops.def(
+      "paged_attention_cascade("
+      "    Tensor! out, Tensor query, Tensor key_cache,"
+      "    Tensor value_cache, int num_kv_heads, float scale,"
+      "    Tensor block_tables, Tensor seq_lens, int block_size,"
+      "    int max_seq_len, Tensor? alibi_slopes,"
+      "    str kv_cache_dtype, float k_scale, float v_scale,"
+      "    Tensor? prefix_group_ids, int min_shared_blocks) -> ()");
+  ops.impl("paged_attention_cascade", torch::kCPU, &paged_attention_cascade);
+
+  // PagedAttention for several query tokens per sequence with a causal mask
+  // among them, e.g. to score speculative draft tokens or for block-sparse
+  // prefill.
+  ops.def(
+      "paged_attention_multi_query("
+      "    Tensor! out, Tensor query, Tensor key_cache,"
+      "    Tensor value_cache, int num_kv_heads, float scale,"
+      "    Tensor block_tables, Tensor seq_lens, int block_size,"
+      "    int max_seq_len, Tensor? alibi_slopes,"
+      "    str kv_cache_dtype, float k_scale, float v_scale,"
+      "    int tp_rank=0, int blocksparse_local_blocks=0,"
+      "    int blocksparse_vert_stride=0, int blocksparse_block_size=64,"
+      "    int blocksparse_head_sliding_step=0) -> ()");
+  ops.impl("paged_attention_multi_query", torch::kCPU,
+           &paged_attention_multi_query);
+
   // Activation ops
 
   // Activation function used in SwiGLU.
@@ -69,6 +225,26 @@ TORCH_LIBRARY_EXPAND(TORCH_EXTENSION_NAME, ops) {
   ops.def("gelu_quick(Tensor! out, Tensor input) -> ()");
   ops.impl("gelu_quick", torch::kCPU, &gelu_quick);
 
+  // Conversion ops
+  // Convert a contiguous BF16 tensor to FP32.
+  ops.def("convert_bf16_to_fp32(Tensor! out, Tensor input) -> ()");
+  ops.impl("convert_bf16_to_fp32", torch::kCPU, &convert_bf16_to_fp32);
+
+  // Convert a contiguous FP32 tensor to BF16, rounding to nearest even.
+  ops.def("convert_fp32_to_bf16(Tensor! out, Tensor input) -> ()");
+  ops.impl("convert_fp32_to_bf16", torch::kCPU, &convert_fp32_to_bf16);
+
+  // Copy a contiguous tensor into a contiguous one of the same type.
+  ops.def("copy_contiguous(Tensor! out, Tensor input) -> ()");
+  ops.impl("copy_contiguous", torch::kCPU, &copy_contiguous);
+
+  // Convert the raw bytes of a little-endian checkpoint tensor to a float or
+  // bfloat16 tensor in host byte order, optionally verifying the result.
+  ops.def(
+      "convert_le_weight(Tensor! out, Tensor input, int src_format, "
+      "bool verify) -> int");
+  ops.impl("convert_le_weight", torch::kCPU, &convert_le_weight);
+
   // Layernorm
   // Apply Root Mean Square (RMS) Normalization to the input tensor.
   ops.def(
@@ -90,6 +266,53 @@ TORCH_LIBRARY_EXPAND(TORCH_EXTENSION_NAME, ops) {
       "                 Tensor cos_sin_cache, bool is_neox) -> ()");
   ops.impl("rotary_embedding", torch::kCPU, &rotary_embedding);
 
+  // Fused layers
+  // One decode step of a Llama decoder layer in a single parallel region:
+  // the norms, projections, rotary embedding, KV cache write, paged
+  // attention and SwiGLU MLP. Weights are the input norm, QKV, output,
+  // post-attention norm, gate_up and down weights.
+  ops.def(
+      "llama_decoder_layer(Tensor! hidden_states, Tensor! residual,"
+      "                    bool add_residual, Tensor positions,"
+      "                    Tensor[] weights, float epsilon,"
+      "                    Tensor cos_sin_cache, bool is_neox,"
+      "                    Tensor! key_cache, Tensor! value_cache,"
+      "                    Tensor slot_mapping, Tensor block_tables,"
+      "                    Tensor seq_lens, int num_heads,"
+      "                    float scale) -> ()");
+  ops.impl("llama_decoder_layer", torch::kCPU, &llama_decoder_layer);
+
+  // LoRA
+  // Shrink the input by the LoRA A weights, one adapter index per token.
+  ops.def(
+      "bgmv_shrink(Tensor! out, Tensor input, Tensor lora_a_weights,"
+      "            Tensor lora_indices, float scale) -> ()");
+  ops.impl("bgmv_shrink", torch::kCPU, &bgmv_shrink);
+
+  // Expand by the LoRA B weights into a column slice of the output, one
+  // adapter index per token.
+  ops.def(
+      "bgmv_expand_slice(Tensor! out, Tensor input, Tensor lora_b_weights,"
+      "                  Tensor lora_indices, int slice_offset,"
+      "                  int slice_size, bool add_inputs) -> ()");
+  ops.impl("bgmv_expand_slice", torch::kCPU, &bgmv_expand_slice);
+
+  // Shrink the input by the LoRA A weights, one adapter index per sequence.
+  ops.def(
+      "sgmv_shrink(Tensor! out, Tensor input, Tensor lora_a_weights,"
+      "            Tensor seq_start_locs, Tensor seq_lens,"
+      "            Tensor lora_indices, float scale) -> ()");
+  ops.impl("sgmv_shrink", torch::kCPU, &sgmv_shrink);
+
+  // Expand by the LoRA B weights into a column slice of the output, one
+  // adapter index per sequence.
+  ops.def(
+      "sgmv_expand_slice(Tensor! out, Tensor input, Tensor lora_b_weights,"
+      "                  Tensor seq_start_locs, Tensor seq_lens,"
+      "                  Tensor lora_indices, int slice_offset,"
+      "                  int slice_size, bool add_inputs) -> ()");
+  ops.impl("sgmv_expand_slice", torch::kCPU, &sgmv_expand_slice);
+
   // Quantization
 #ifdef __AVX512F__
   // Compute int8 quantized tensor for given scaling factor.
@@ -140,6 +363,128 @@ TORCH_LIBRARY_EXPAND(CONCAT(TORCH_EXTENSION_NAME, _cache_ops), cache_ops) {
 TORCH_LIBRARY_EXPAND(CONCAT(TORCH_EXTENSION_NAME, _utils), utils) {
   // CPU utils
   utils.def("init_cpu_threads_env(str cpu_ids) -> str", &init_cpu_threads_env);
+
+  // Returns the vector ISA the CPU kernels were built for, e.g. "avx512" or
+  // "vxe".
+  utils.def("get_cpu_vec_op_isa() -> str", &get_cpu_vec_op_isa);
+
+  // Kernel profiling of the CPU_KERNEL_GUARD_IN/OUT scopes. Level 0 disables
+  // it, 1 records call count, wall time and bytes per kernel and shape
+  // bucket, 2 additionally the OpenMP thread imbalance, 3 additionally the
+  // hardware counters of the OpenMP threads.
+  utils.def("set_cpu_kernel_profiling(int level) -> ()",
+            &set_cpu_kernel_profiling);
+
+  // Returns the kernel names and the [shape_bucket, calls, total_ns, max_ns,
+  // bytes, imbalance_total_ns, imbalance_max_ns, cycles, instructions,
+  // l1d_misses, llc_misses, stall_cycles, barrier_total_ns] stats of each
+  // name, and resets them.
+  utils.def("collect_cpu_kernel_stats() -> (str[], Tensor)",
+            &collect_cpu_kernel_stats);
+
+  // Installs a tuned [thread_num, head_unroll, block, schedule] launch
+  // configuration of a kernel for one shape key, see
+  // vllm/worker/cpu_tuner.py.
+  utils.def(
+      "set_cpu_kernel_config(str kernel, int[] shape_key, int[] config) -> ()",
+      &set_cpu_kernel_config);
+
+  // Drops all tuned configurations, the kernels use their defaults.
+  utils.def("clear_cpu_kernel_configs() -> ()", &clear_cpu_kernel_configs);
+
+  // KV cache blocks that the paged attention and cache kernels prefetch
+  // ahead of the block they work on, 0 disables the prefetch.
+  utils.def("set_cpu_prefetch_distance(int distance) -> ()",
+            &set_cpu_prefetch_distance);
+
+  // Groups the bound OpenMP threads by their L2 (cache_level 2) or L3 (3)
+  // cache for the attention and per-token kernels, 0 runs them on the whole
+  // team. Returns the group of each OpenMP thread.
+  utils.def("set_cpu_thread_subteams(int cache_level) -> int[]",
+            &set_cpu_thread_subteams);
+
+  // Maps num_bytes of zeroed, pre-faulted memory for the KV cache on a NUMA
+  // node (-1 for the node of the calling thread), backed by huge pages
+  // (huge_pages 1 for transparent huge pages, 2 for the hugetlbfs pool with
+  // a fallback to transparent ones) or base pages (0).
+  utils.def(
+      "allocate_cpu_kv_cache(int num_bytes, int huge_pages, int numa_node) "
+      "-> Tensor",
+      &allocate_cpu_kv_cache);
+
+  // Returns the [page_size, huge_page_bytes, numa_node] placement of the
+  // memory of a tensor.
+  utils.def("get_cpu_memory_placement(Tensor tensor) -> int[]",
+            &get_cpu_memory_placement);
+
+  // Maps a checkpoint file copy-on-write into a uint8 tensor, whose views
+  // are the weights without reading them into anonymous memory. With
+  // read_ahead, the kernel starts reading the whole file.
+  utils.def("map_cpu_weights_file(str path, bool read_ahead=True) -> Tensor",
+            &map_cpu_weights_file);
+
+  // Installs the size-class caching allocator, with per-NUMA-node pools of
+  // pre-faulted blocks, as the CPU allocator of the process.
+  utils.def("enable_cpu_caching_allocator() -> ()",
+            &enable_cpu_caching_allocator);
+
+  // Unmaps the cached free blocks of the caching allocator.
+  utils.def("empty_cpu_allocator_cache() -> ()", &empty_cpu_allocator_cache);
+
+  // Returns the [allocated_bytes, peak_allocated_bytes, reserved_bytes,
+  // peak_reserved_bytes, cached_bytes, internal_fragmentation_bytes, allocs,
+  // cache_hits, maps, unmaps] stats of the caching allocator, and restarts
+  // the peaks from the current values if reset_peak is set.
+  utils.def("get_cpu_allocator_stats(bool reset_peak) -> int[]",
+            &get_cpu_allocator_stats);
+
+  // Returns the [reserved_bytes, peak_reserved_bytes, grows] stats of the
+  // per-thread scratch buffers of the kernels.
+  utils.def("get_cpu_workspace_stats() -> int[]", &get_cpu_workspace_stats);
+
+  // Layer-ahead streaming of weights mapped from files. Registers the
+  // weights of a layer, reads a layer in the background, blocks until a
+  // layer is resident returning the nanoseconds waited, and pages a layer
+  // out.
+  utils.def("register_cpu_streamed_layer(int layer, Tensor[] weights) -> ()",
+            &register_cpu_streamed_layer);
+  utils.def("prefetch_cpu_streamed_layer(int layer) -> ()",
+            &prefetch_cpu_streamed_layer);
+  utils.def("wait_cpu_streamed_layer(int layer) -> int",
+            &wait_cpu_streamed_layer);
+  utils.def("release_cpu_streamed_layer(int layer) -> ()",
+            &release_cpu_streamed_layer);
+
+  // Returns the [layer, bytes, waits, stalls, stall_total_ns, stall_max_ns,
+  // fetches, fetch_total_ns] stats of each streamed layer, and resets them
+  // with reset.
+  utils.def("get_cpu_weight_streaming_stats(bool reset) -> Tensor",
+            &get_cpu_weight_streaming_stats);
+
+  // Shared memory ring broadcasting the model inputs of a step to the
+  // tensor parallel ranks on the same host. The writer creates it under a
+  // name and unlinks the name once the readers opened it. send() copies the
+  // pickled metadata and the tensors of a message into the next slot and
+  // returns false if they do not fit, recv() returns read-only views of
+  // them, valid until the next recv().
+  utils.def(
+      "create_cpu_shm_ring(str name, int num_readers, int num_slots, "
+      "int slot_bytes, int spin_us) -> int",
+      &create_cpu_shm_ring);
+  utils.def("open_cpu_shm_ring(str name, int reader, int spin_us) -> int",
+            &open_cpu_shm_ring);
+  utils.def("unlink_cpu_shm_ring(int ring) -> ()", &unlink_cpu_shm_ring);
+  utils.def("close_cpu_shm_ring(int ring) -> ()", &close_cpu_shm_ring);
+  utils.def("cpu_shm_ring_send(int ring, Tensor header, Tensor[] tensors) "
+            "-> bool",
+            &cpu_shm_ring_send);
+  utils.def("cpu_shm_ring_recv(int ring) -> (Tensor, Tensor[])",
+            &cpu_shm_ring_recv);
+
+  // Returns the [messages, bytes, waits, sleeps, wait_total_ns, wait_max_ns]
+  // stats of the calling side of a ring, and resets them with reset.
+  utils.def("get_cpu_shm_ring_stats(int ring, bool reset) -> int[]",
+            &get_cpu_shm_ring_stats);
 }
 
 REGISTER_EXTENSION(TORCH_EXTENSION_NAME)
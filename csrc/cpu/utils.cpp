@@ -68,6 +68,12 @@ std::string init_cpu_threads_env(const std::string& cpu_ids) {
                   "sched_setaffinity failed. errno: " + std::to_string(errno));
     }
 
+    // Hardware counters of the kernel profiler follow the threads of the team.
+    if (cpu_profiler::profiling_level.load() >=
+        cpu_profiler::HW_COUNTER_LEVEL) {
+      cpu_profiler::open_thread_counters();
+    }
+
     omp_set_lock(&writelock);
     thread_core_mapping.emplace_back(gettid(), omp_cpu_ids[i]);
     omp_unset_lock(&writelock);
@@ -88,3 +94,23 @@ std::string init_cpu_threads_env(const std::string& cpu_ids) {
 
   return ss.str();
 }
+
+// Vector ISA the vec_op backend of this build targets. The layout of the
+// weights the CPU kernels pack depends on it.
+std::string get_cpu_vec_op_isa() {
+#if defined(VLLM_CPU_SCALAR_VEC_OP)
+  return "scalar";
+#elif defined(__AVX512BF16__)
+  return "avx512_bf16";
+#elif defined(__AVX512F__)
+  return "avx512";
+#elif defined(__x86_64__)
+  return "avx2";
+#elif defined(__POWER10_VECTOR__)
+  return "vsx_power10";
+#elif defined(__POWER9_VECTOR__)
+  return "vsx";
+#else
+  return "vxe";
+#endif
+}
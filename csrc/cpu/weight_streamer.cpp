@@ -0,0 +1,244 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "cpu_types.hpp"
+
+// Linux 5.4, older kernels reject it and keep the pages.
+#ifndef MADV_PAGEOUT
+  #define MADV_PAGEOUT 21
+#endif
+
+// Layer-ahead streaming of file-backed weights, for models larger than the
+// memory of the host. The weights of each decoder layer are views of a
+// mapped file (see map_cpu_weights_file()). A background thread reads the
+// layers ahead of the one computing into the page cache and maps them, and
+// layers computed already are paged out again, so only a few layers are
+// resident at a time. Waiting for a layer that is not resident yet is the
+// I/O stall left, recorded per layer.
+namespace cpu_memory {
+
+namespace {
+enum class LayerState : int { EVICTED = 0, QUEUED = 1, RESIDENT = 2 };
+
+struct Range {
+  char* addr;
+  size_t bytes;
+};
+
+struct StreamedLayer {
+  // Page-aligned ranges of the weights of the layer.
+  std::vector<Range> ranges;
+  // Keep the mapped files alive.
+  std::vector<torch::Tensor> weights;
+  LayerState state = LayerState::EVICTED;
+
+  // See get_cpu_weight_streaming_stats().
+  int64_t bytes = 0;
+  int64_t waits = 0;
+  int64_t stalls = 0;
+  int64_t stall_total_ns = 0;
+  int64_t stall_max_ns = 0;
+  int64_t fetches = 0;
+  int64_t fetch_total_ns = 0;
+};
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+class WeightStreamer {
+ public:
+  void register_layer(const int64_t layer,
+                      const std::vector<torch::Tensor>& weights) {
+    const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    StreamedLayer streamed;
+    for (const torch::Tensor& weight : weights) {
+      TORCH_CHECK(weight.device().is_cpu(), "weights must be on the CPU");
+      if (weight.numel() == 0) continue;
+      const uintptr_t begin = reinterpret_cast<uintptr_t>(weight.data_ptr());
+      const uintptr_t end = begin + weight.numel() * weight.element_size();
+      const uintptr_t aligned = begin / page_size * page_size;
+      const size_t bytes =
+          (end - aligned + page_size - 1) / page_size * page_size;
+      streamed.ranges.push_back({reinterpret_cast<char*>(aligned), bytes});
+      streamed.bytes += bytes;
+      streamed.weights.push_back(weight);
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    layers_[layer] = std::move(streamed);
+  }
+
+  void prefetch(const int64_t layer) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    enqueue(layer_of(layer), layer);
+  }
+
+  // Blocks until the layer is resident, returns the nanoseconds waited.
+  int64_t wait(const int64_t layer) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    StreamedLayer& streamed = layer_of(layer);
+    ++streamed.waits;
+    if (streamed.state == LayerState::RESIDENT) return 0;
+    const int64_t start = now_ns();
+    enqueue(streamed, layer);
+    resident_.wait(lock,
+                   [&] { return streamed.state == LayerState::RESIDENT; });
+    const int64_t stall_ns = now_ns() - start;
+    ++streamed.stalls;
+    streamed.stall_total_ns += stall_ns;
+    streamed.stall_max_ns = std::max(streamed.stall_max_ns, stall_ns);
+    return stall_ns;
+  }
+
+  // Pages the layer out, a hint the kernel may ignore. Clean pages of the
+  // file are dropped, never written anywhere.
+  void release(const int64_t layer) {
+    std::vector<Range> ranges;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      StreamedLayer& streamed = layer_of(layer);
+      // A prefetch of the next step may have queued the layer again.
+      if (streamed.state != LayerState::RESIDENT) return;
+      streamed.state = LayerState::EVICTED;
+      ranges = streamed.ranges;
+    }
+    for (const Range& range : ranges) {
+      madvise(range.addr, range.bytes, MADV_PAGEOUT);
+    }
+  }
+
+  // [layer, bytes, waits, stalls, stall_total_ns, stall_max_ns, fetches,
+  // fetch_total_ns] of each layer, ordered by layer.
+  torch::Tensor stats(const bool reset) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    std::vector<int64_t> layer_ids;
+    for (const auto& [layer, streamed] : layers_) layer_ids.push_back(layer);
+    std::sort(layer_ids.begin(), layer_ids.end());
+    torch::Tensor result =
+        torch::empty({static_cast<int64_t>(layer_ids.size()), 8},
+                     torch::TensorOptions().dtype(torch::kInt64));
+    int64_t* row = result.data_ptr<int64_t>();
+    for (const int64_t layer : layer_ids) {
+      StreamedLayer& streamed = layers_.at(layer);
+      const int64_t values[8] = {layer,
+                                 streamed.bytes,
+                                 streamed.waits,
+                                 streamed.stalls,
+                                 streamed.stall_total_ns,
+                                 streamed.stall_max_ns,
+                                 streamed.fetches,
+                                 streamed.fetch_total_ns};
+      std::copy(values, values + 8, row);
+      row += 8;
+      if (reset) {
+        streamed.waits = streamed.stalls = streamed.fetches = 0;
+        streamed.stall_total_ns = streamed.stall_max_ns = 0;
+        streamed.fetch_total_ns = 0;
+      }
+    }
+    return result;
+  }
+
+ private:
+  StreamedLayer& layer_of(const int64_t layer) {
+    auto iter = layers_.find(layer);
+    TORCH_CHECK(iter != layers_.end(), "Layer ", layer,
+                " is not registered for weight streaming");
+    return iter->second;
+  }
+
+  // Called with mutex_ held.
+  void enqueue(StreamedLayer& streamed, const int64_t layer) {
+    if (streamed.state != LayerState::EVICTED) return;
+    streamed.state = LayerState::QUEUED;
+    queue_.push_back(layer);
+    if (!thread_.joinable()) thread_ = std::thread([this] { run(); });
+    queued_.notify_one();
+  }
+
+  // The fetching thread. Reads a layer ahead with MADV_WILLNEED, which
+  // starts the reads of all its pages at once, then touches every page, so
+  // that the layer is resident and mapped when it is marked RESIDENT and
+  // its kernels take no major faults.
+  void run() {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      queued_.wait(lock, [&] { return !queue_.empty(); });
+      const int64_t layer = queue_.front();
+      queue_.pop_front();
+      const std::vector<Range> ranges = layers_.at(layer).ranges;
+      lock.unlock();
+
+      const int64_t start = now_ns();
+      for (const Range& range : ranges) {
+        madvise(range.addr, range.bytes, MADV_WILLNEED);
+      }
+      for (const Range& range : ranges) {
+        const volatile char* const base = range.addr;
+        for (size_t offset = 0; offset < range.bytes; offset += page_size) {
+          (void)base[offset];
+        }
+      }
+      const int64_t fetch_ns = now_ns() - start;
+
+      lock.lock();
+      StreamedLayer& streamed = layers_.at(layer);
+      streamed.state = LayerState::RESIDENT;
+      ++streamed.fetches;
+      streamed.fetch_total_ns += fetch_ns;
+      resident_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  std::condition_variable resident_;
+  std::deque<int64_t> queue_;
+  std::unordered_map<int64_t, StreamedLayer> layers_;
+  std::thread thread_;
+};
+
+// Never destroyed, the fetching thread runs until the process exits.
+WeightStreamer& weight_streamer() {
+  static WeightStreamer* streamer = new WeightStreamer();
+  return *streamer;
+}
+}  // namespace
+
+}  // namespace cpu_memory
+
+// Registers the weights of a layer, views of a mapped file, for streaming.
+void register_cpu_streamed_layer(int64_t layer,
+                                 const std::vector<torch::Tensor>& weights) {
+  cpu_memory::weight_streamer().register_layer(layer, weights);
+}
+
+// Starts reading a layer in the background, if it is not resident.
+void prefetch_cpu_streamed_layer(int64_t layer) {
+  cpu_memory::weight_streamer().prefetch(layer);
+}
+
+// Blocks until a layer is resident, returns the nanoseconds of I/O stall.
+int64_t wait_cpu_streamed_layer(int64_t layer) {
+  return cpu_memory::weight_streamer().wait(layer);
+}
+
+void release_cpu_streamed_layer(int64_t layer) {
+  cpu_memory::weight_streamer().release(layer);
+}
+
+torch::Tensor get_cpu_weight_streaming_stats(bool reset) {
+  return cpu_memory::weight_streamer().stats(reset);
+}
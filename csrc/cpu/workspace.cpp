@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <atomic>
+
+#include "cpu_types.hpp"
+#include "numa_memory.hpp"
+#include "workspace.hpp"
+
+namespace cpu_memory {
+
+namespace {
+constexpr size_t MIN_BUFFER_BYTES = 64 << 10;
+constexpr size_t HUGE_PAGE_MIN_BYTES = 8 << 20;
+
+// Of the buffers of all threads, see WorkspaceStats.
+std::atomic<int64_t> reserved_bytes{0};
+std::atomic<int64_t> peak_reserved_bytes{0};
+std::atomic<int64_t> grows{0};
+
+struct ThreadWorkspace {
+  Region regions[static_cast<int>(Buffer::NUM_BUFFERS)];
+
+  ~ThreadWorkspace() {
+    for (const Region& region : regions) {
+      if (region.addr == nullptr) continue;
+      unmap_region(region);
+      reserved_bytes.fetch_sub(region.bytes, std::memory_order_relaxed);
+    }
+  }
+
+  // Grows by at least half the size, so a context growing a block per step
+  // remaps the buffer a logarithmic number of times. The buffer is used by
+  // the calling thread only, which maps and faults it in on its own node.
+  void* grow(Region& region, const size_t bytes) {
+    const size_t new_bytes =
+        std::max({bytes, region.bytes + region.bytes / 2, MIN_BUFFER_BYTES});
+    if (region.addr != nullptr) {
+      unmap_region(region);
+      reserved_bytes.fetch_sub(region.bytes, std::memory_order_relaxed);
+    }
+    region = map_region(new_bytes, current_numa_node(),
+                        new_bytes >= HUGE_PAGE_MIN_BYTES
+                            ? HugePages::TRANSPARENT
+                            : HugePages::NONE,
+                        /*team_prefault=*/false);
+    const int64_t reserved =
+        reserved_bytes.fetch_add(region.bytes, std::memory_order_relaxed) +
+        region.bytes;
+    int64_t peak = peak_reserved_bytes.load(std::memory_order_relaxed);
+    while (reserved > peak &&
+           !peak_reserved_bytes.compare_exchange_weak(
+               peak, reserved, std::memory_order_relaxed)) {
+    }
+    grows.fetch_add(1, std::memory_order_relaxed);
+    return region.addr;
+  }
+};
+
+thread_local ThreadWorkspace thread_workspace;
+}  // namespace
+
+void* thread_buffer(const Buffer buffer, const size_t bytes) {
+  Region& region = thread_workspace.regions[static_cast<int>(buffer)];
+  if (region.bytes >= bytes && region.addr != nullptr) return region.addr;
+  return thread_workspace.grow(region, bytes);
+}
+
+WorkspaceStats workspace_stats() {
+  WorkspaceStats stats;
+  stats.reserved_bytes = reserved_bytes.load();
+  stats.peak_reserved_bytes = peak_reserved_bytes.load();
+  stats.grows = grows.load();
+  return stats;
+}
+
+}  // namespace cpu_memory
+
+// [reserved_bytes, peak_reserved_bytes, grows] of the kernel workspace, see
+// cpu_memory::WorkspaceStats.
+std::vector<int64_t> get_cpu_workspace_stats() {
+  const cpu_memory::WorkspaceStats stats = cpu_memory::workspace_stats();
+  return {stats.reserved_bytes, stats.peak_reserved_bytes, stats.grows};
+}
@@ -0,0 +1,54 @@
+#ifndef CPU_WORKSPACE_HPP
+#define CPU_WORKSPACE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Scratch memory of the kernels, owned by the extension instead of being
+// allocated per call. Every thread keeps its own buffers, which only grow,
+// so once a decode step has seen the largest batch and context, the steps
+// and layers after it allocate nothing.
+namespace cpu_memory {
+
+enum class Buffer : int {
+  // Scratch of the work item a thread runs, e.g. its logits.
+  SCRATCH = 0,
+  // Results a kernel launcher borrows for its OpenMP team, reduced after the
+  // parallel region, e.g. the partitions of paged attention v2.
+  EXP_SUMS = 1,
+  MAX_LOGITS = 2,
+  PARTIAL_OUT = 3,
+  // Per-sequence values a kernel launcher computes before its parallel
+  // region, e.g. the first token of the sliding window.
+  SEQ_METADATA = 4,
+  // Activations a fused kernel passes between the stages of its parallel
+  // region, e.g. the QKV of the decoder layer.
+  LAYER_ACTIVATIONS = 5,
+  NUM_BUFFERS = 6,
+};
+
+// Buffer of the calling thread of at least `bytes`, 64-byte aligned. It is
+// mapped by map_region() on the NUMA node the thread runs on when it grows,
+// so the arenas of the OpenMP threads bound by init_cpu_threads_env() are
+// local to them. The contents are undefined, and the pointer is valid until
+// the same thread requests more bytes of the same buffer.
+void* thread_buffer(Buffer buffer, size_t bytes);
+
+template <typename T>
+T* thread_buffer(const Buffer buffer, const size_t count) {
+  return static_cast<T*>(thread_buffer(buffer, count * sizeof(T)));
+}
+
+struct WorkspaceStats {
+  // Mapped bytes of the buffers of all threads.
+  int64_t reserved_bytes = 0;
+  int64_t peak_reserved_bytes = 0;
+  // Buffers mapped or grown, constant in a steady decode loop.
+  int64_t grows = 0;
+};
+
+WorkspaceStats workspace_stats();
+
+}  // namespace cpu_memory
+
+#endif
@@ -0,0 +1,141 @@
+"""Tests for the shared memory broadcast of the model inputs between CPU
+workers.
+
+Run `pytest tests/distributed/test_cpu_shm_broadcast.py`.
+"""
+import multiprocessing
+import os
+
+import pytest
+import torch
+
+from vllm import _custom_ops as ops
+from vllm.utils import get_open_port, is_cpu, update_environment_variables
+
+pytestmark = pytest.mark.skipif(not is_cpu(), reason="CPU backend only")
+
+
+def _header(value) -> torch.Tensor:
+    return torch.frombuffer(bytearray(repr(value).encode()),
+                            dtype=torch.uint8)
+
+
+def test_cpu_shm_ring() -> None:
+    name = f"/vllm_test_ring_{os.getpid()}"
+    writer = ops.create_cpu_shm_ring(name, 1, 2, 1 << 16, 0)
+    reader = ops.open_cpu_shm_ring(name, 0, 0)
+    ops.unlink_cpu_shm_ring(writer)
+    try:
+        for step in range(5):
+            tensors = [
+                torch.arange(step * 7, dtype=torch.int64),
+                torch.full((3, 5), step, dtype=torch.bfloat16),
+                torch.empty(0, dtype=torch.int32),
+            ]
+            assert ops.cpu_shm_ring_send(writer, _header(step), tensors)
+            header, payloads = ops.cpu_shm_ring_recv(reader)
+            assert bytes(header.numpy()) == repr(step).encode()
+            assert len(payloads) == len(tensors)
+            for payload, tensor in zip(payloads, tensors):
+                assert payload.data_ptr() % 64 == 0
+                torch.testing.assert_close(
+                    payload.view(tensor.dtype).view(tensor.shape), tensor)
+
+        # A message larger than a slot is not sent.
+        assert not ops.cpu_shm_ring_send(
+            writer, _header(0), [torch.empty(1 << 16, dtype=torch.uint8)])
+        stats = ops.get_cpu_shm_ring_stats(writer)
+        assert stats["messages"] == 5 and stats["bytes"] > 0
+        assert ops.get_cpu_shm_ring_stats(reader)["messages"] == 5
+    finally:
+        ops.close_cpu_shm_ring(reader)
+        ops.close_cpu_shm_ring(writer)
+
+    with pytest.raises(RuntimeError):
+        ops.open_cpu_shm_ring(name, 0, 0)
+
+
+def _exiting_writer(name: str, created, opened) -> None:
+    writer = ops.create_cpu_shm_ring(name, 1, 2, 1 << 16, 0)
+    created.set()
+    opened.wait()
+    ops.unlink_cpu_shm_ring(writer)
+
+
+def test_cpu_shm_ring_writer_exit() -> None:
+    name = f"/vllm_test_ring_exit_{os.getpid()}"
+    ctx = multiprocessing.get_context("spawn")
+    created, opened = ctx.Event(), ctx.Event()
+    process = ctx.Process(target=_exiting_writer,
+                          args=(name, created, opened))
+    process.start()
+    assert created.wait(timeout=60)
+    reader = ops.open_cpu_shm_ring(name, 0, 0)
+    opened.set()
+    # The writer exits without sending, and is not reaped while the reader
+    # waits for it.
+    try:
+        with pytest.raises(RuntimeError, match="exited"):
+            ops.cpu_shm_ring_recv(reader)
+    finally:
+        ops.close_cpu_shm_ring(reader)
+        process.join()
+
+
+def _tensor_dict(step: int):
+    return {
+        "input_tokens": torch.arange(step * 3 + 1),
+        "block_tables": torch.full((step + 1, 4), step, dtype=torch.int32),
+        "is_prompt": step % 2 == 0,
+        "virtual_engine": 0,
+        # Too large for the slots of the test, sent over gloo.
+        "large": torch.ones(1 << 15) if step == 3 else None,
+    }
+
+
+def _broadcast_worker(env) -> None:
+    update_environment_variables(env)
+    from vllm.distributed import (get_tp_group, init_distributed_environment,
+                                  initialize_model_parallel)
+    from vllm.distributed.device_communicators.cpu_shm_broadcast import (
+        CPUShmBroadcaster)
+    init_distributed_environment(backend="gloo")
+    initialize_model_parallel(int(env["WORLD_SIZE"]), backend="gloo")
+    group = get_tp_group()
+    broadcaster = CPUShmBroadcaster(group, spin_us=10, slot_bytes=1 << 16)
+    for step in range(6):
+        expected = _tensor_dict(step)
+        if group.rank_in_group == 0:
+            broadcaster.broadcast_tensor_dict(expected)
+            continue
+        received = broadcaster.broadcast_tensor_dict()
+        assert received.keys() == expected.keys()
+        for key, value in expected.items():
+            if isinstance(value, torch.Tensor):
+                torch.testing.assert_close(received[key], value)
+            else:
+                assert received[key] == value
+    # The five steps which fit, and the fallback marker of step 3.
+    assert broadcaster.stats()["messages"] == 6
+    broadcaster.close()
+
+
+def test_cpu_shm_broadcaster() -> None:
+    world_size = 3
+    port = get_open_port()
+    ctx = multiprocessing.get_context("spawn")
+    processes = []
+    for rank in range(world_size):
+        env = {
+            "RANK": str(rank),
+            "LOCAL_RANK": str(rank),
+            "WORLD_SIZE": str(world_size),
+            "MASTER_ADDR": "localhost",
+            "MASTER_PORT": str(port),
+        }
+        process = ctx.Process(target=_broadcast_worker, args=(env, ))
+        process.start()
+        processes.append(process)
+    for process in processes:
+        process.join()
+        assert process.exitcode == 0
@@ -0,0 +1,706 @@
+"""Tests for the CPU-only paged attention kernels in csrc/cpu/attention.cpp.
+
+Run `pytest tests/kernels/test_cpu_attention.py`.
+"""
+import random
+from typing import Dict, List, Optional, Tuple
+
+import pytest
+import torch
+
+from vllm import _custom_ops as ops
+from vllm.utils import create_kv_caches_with_random, is_cpu, seed_everything
+
+NUM_BLOCKS = 1024
+BLOCK_SIZE = 16
+PARTITION_SIZE = 512
+DTYPES = [torch.bfloat16, torch.half, torch.float]
+NUM_HEADS = [(8, 8), (16, 4)]
+HEAD_SIZES = [64, 128]
+USE_ALIBI = [False, True]
+SEEDS = [0]
+
+pytestmark = pytest.mark.skipif(not is_cpu(), reason="CPU backend only")
+
+
+def ref_paged_attention(
+    output: torch.Tensor,
+    query: torch.Tensor,
+    key_cache: torch.Tensor,
+    value_cache: torch.Tensor,
+    block_tables: torch.Tensor,
+    seq_lens: torch.Tensor,
+    scale: float,
+    alibi_slopes: Optional[torch.Tensor],
+    sliding_window: int = 0,
+    blocksparse_kwargs: Optional[Dict[str, int]] = None,
+) -> None:
+    num_heads = query.shape[1]
+    num_kv_heads = value_cache.shape[1]
+    head_size = value_cache.shape[2]
+    block_size = value_cache.shape[3]
+    num_queries_per_kv = num_heads // num_kv_heads
+
+    for i, seq_len in enumerate(seq_lens.tolist()):
+        block_table = block_tables[i].tolist()
+        start = max(0, seq_len - sliding_window) if sliding_window > 0 else 0
+        keys_lst: List[torch.Tensor] = []
+        values_lst: List[torch.Tensor] = []
+        for j in range(start, seq_len):
+            block_number = block_table[j // block_size]
+            block_offset = j % block_size
+            k = key_cache[block_number, :, :, block_offset, :]
+            keys_lst.append(k.reshape(num_kv_heads, -1))
+            values_lst.append(value_cache[block_number, :, :, block_offset])
+        keys = torch.stack(keys_lst, dim=0).float()
+        values = torch.stack(values_lst, dim=0).float()
+        keys = torch.repeat_interleave(keys, num_queries_per_kv, dim=1)
+        values = torch.repeat_interleave(values, num_queries_per_kv, dim=1)
+
+        attn_weights = scale * torch.einsum("hd,khd->hk", query[i].float(),
+                                            keys)
+        if alibi_slopes is not None:
+            position_ids = torch.arange(start, seq_len).int()
+            alibi_bias = (position_ids - seq_len + 1).float()
+            attn_weights += alibi_slopes.view(-1, 1) * alibi_bias.view(1, -1)
+        if blocksparse_kwargs is not None:
+            keep = ref_blocksparse_mask(num_heads, num_kv_heads, start,
+                                        seq_len, **blocksparse_kwargs)
+            attn_weights.masked_fill_(~keep, -torch.inf)
+        attn_weights = torch.softmax(attn_weights, dim=-1)
+        out = torch.einsum("hk,khd->hd", attn_weights, values)
+        output[i].copy_(out)
+
+
+def ref_blocksparse_mask(
+    num_heads: int,
+    num_kv_heads: int,
+    start: int,
+    seq_len: int,
+    tp_rank: int,
+    blocksparse_local_blocks: int,
+    blocksparse_vert_stride: int,
+    blocksparse_block_size: int,
+    blocksparse_head_sliding_step: int,
+) -> torch.Tensor:
+    """Keys [start, seq_len) the last token attends to, per head."""
+    head_idxs = torch.arange(num_heads)
+    if blocksparse_head_sliding_step >= 0:
+        offsets = ((tp_rank * num_heads + head_idxs) *
+                   blocksparse_head_sliding_step + 1)
+    else:
+        kv_head_idxs = head_idxs // (num_heads // num_kv_heads)
+        offsets = ((tp_rank * num_kv_heads + kv_head_idxs) *
+                   (-blocksparse_head_sliding_step) + 1)
+    k_blocks = torch.arange(start, seq_len) // blocksparse_block_size
+    q_block = (seq_len - 1) // blocksparse_block_size
+    local = k_blocks > q_block - blocksparse_local_blocks
+    vertical = (k_blocks.view(1, -1) + offsets.view(-1, 1)) % \
+        blocksparse_vert_stride == 0
+    return local.view(1, -1) | vertical
+
+
+@pytest.mark.parametrize("num_groups", [1, 3])
+@pytest.mark.parametrize("seqs_per_group", [1, 5])
+@pytest.mark.parametrize("shared_len", [16, 700])
+@pytest.mark.parametrize("num_heads", NUM_HEADS)
+@pytest.mark.parametrize("head_size", HEAD_SIZES)
+@pytest.mark.parametrize("use_alibi", USE_ALIBI)
+@pytest.mark.parametrize("use_group_ids", [False, True])
+@pytest.mark.parametrize("dtype", DTYPES)
+@pytest.mark.parametrize("seed", SEEDS)
+@torch.inference_mode()
+def test_paged_attention_cascade(
+    num_groups: int,
+    seqs_per_group: int,
+    shared_len: int,
+    num_heads: tuple,
+    head_size: int,
+    use_alibi: bool,
+    use_group_ids: bool,
+    dtype: torch.dtype,
+    seed: int,
+) -> None:
+    seed_everything(seed)
+    num_query_heads, num_kv_heads = num_heads
+    scale = float(1.0 / (head_size**0.5))
+    num_seqs = num_groups * seqs_per_group + 1
+
+    query = torch.empty(num_seqs, num_query_heads, head_size, dtype=dtype)
+    query.uniform_(-scale, scale)
+    alibi_slopes = (torch.randn(num_query_heads, dtype=torch.float)
+                    if use_alibi else None)
+
+    # Every group shares its leading blocks (partial blocks included, which
+    # the kernel must treat as private), the last sequence shares nothing.
+    block_ids = list(range(NUM_BLOCKS))
+    random.shuffle(block_ids)
+    seq_lens: List[int] = []
+    block_tables: List[List[int]] = []
+    group_ids: List[int] = []
+    shared_block_num = (shared_len + BLOCK_SIZE - 1) // BLOCK_SIZE
+    for group_idx in range(num_groups + 1):
+        shared_blocks = [block_ids.pop() for _ in range(shared_block_num)]
+        for _ in range(seqs_per_group if group_idx < num_groups else 1):
+            seq_len = shared_len + random.randint(1, 100)
+            private_block_num = ((seq_len + BLOCK_SIZE - 1) // BLOCK_SIZE -
+                                 shared_block_num)
+            block_table = shared_blocks + [
+                block_ids.pop() for _ in range(private_block_num)
+            ]
+            if shared_len % BLOCK_SIZE:
+                # The partially filled last shared block is per sequence.
+                block_table[shared_block_num - 1] = block_ids.pop()
+            seq_lens.append(seq_len)
+            block_tables.append(block_table)
+            group_ids.append(group_idx if group_idx < num_groups else -1)
+    max_seq_len = max(seq_lens)
+    max_num_blocks_per_seq = (max_seq_len + BLOCK_SIZE - 1) // BLOCK_SIZE
+    block_tables = [
+        table + [0] * (max_num_blocks_per_seq - len(table))
+        for table in block_tables
+    ]
+    block_tables_tensor = torch.tensor(block_tables, dtype=torch.int)
+    seq_lens_tensor = torch.tensor(seq_lens, dtype=torch.int)
+
+    key_caches, value_caches = create_kv_caches_with_random(NUM_BLOCKS,
+                                                            BLOCK_SIZE,
+                                                            1,
+                                                            num_kv_heads,
+                                                            head_size,
+                                                            "auto",
+                                                            dtype,
+                                                            seed,
+                                                            device="cpu")
+    key_cache, value_cache = key_caches[0], value_caches[0]
+
+    output = torch.empty_like(query)
+    ops.paged_attention_cascade(
+        output,
+        query,
+        key_cache,
+        value_cache,
+        num_kv_heads,
+        scale,
+        block_tables_tensor,
+        seq_lens_tensor,
+        BLOCK_SIZE,
+        max_seq_len,
+        alibi_slopes,
+        "auto",
+        1.0,
+        1.0,
+        prefix_group_ids=(torch.tensor(group_ids, dtype=torch.int)
+                          if use_group_ids else None),
+        min_shared_blocks=1,
+    )
+
+    ref_output = torch.empty(num_seqs,
+                             num_query_heads,
+                             head_size,
+                             dtype=torch.float)
+    ref_paged_attention(ref_output, query, key_cache, value_cache,
+                        block_tables_tensor, seq_lens_tensor, scale,
+                        alibi_slopes)
+
+    atol, rtol = (1e-3, 1e-5) if dtype == torch.float else (1e-2, 1e-2)
+    torch.testing.assert_close(output.float(), ref_output, atol=atol, rtol=rtol)
+
+
+@pytest.mark.parametrize("num_seqs", [1, 7])
+@pytest.mark.parametrize("num_query_tokens", [1, 5])
+@pytest.mark.parametrize("num_heads", NUM_HEADS)
+@pytest.mark.parametrize("head_size", HEAD_SIZES)
+@pytest.mark.parametrize("use_alibi", USE_ALIBI)
+@pytest.mark.parametrize("dtype", DTYPES)
+@pytest.mark.parametrize("seed", SEEDS)
+@torch.inference_mode()
+def test_paged_attention_multi_query(
+    num_seqs: int,
+    num_query_tokens: int,
+    num_heads: tuple,
+    head_size: int,
+    use_alibi: bool,
+    dtype: torch.dtype,
+    seed: int,
+) -> None:
+    seed_everything(seed)
+    num_query_heads, num_kv_heads = num_heads
+    scale = float(1.0 / (head_size**0.5))
+
+    query = torch.empty(num_seqs,
+                        num_query_tokens,
+                        num_query_heads,
+                        head_size,
+                        dtype=dtype)
+    query.uniform_(-scale, scale)
+    alibi_slopes = (torch.randn(num_query_heads, dtype=torch.float)
+                    if use_alibi else None)
+
+    # seq_lens include the query tokens, whose KV is already in the cache.
+    seq_lens = [
+        random.randint(num_query_tokens, 1000) for _ in range(num_seqs)
+    ]
+    max_seq_len = max(seq_lens)
+    max_num_blocks_per_seq = (max_seq_len + BLOCK_SIZE - 1) // BLOCK_SIZE
+    block_tables = torch.randint(0,
+                                 NUM_BLOCKS,
+                                 (num_seqs, max_num_blocks_per_seq),
+                                 dtype=torch.int)
+    seq_lens_tensor = torch.tensor(seq_lens, dtype=torch.int)
+
+    key_caches, value_caches = create_kv_caches_with_random(NUM_BLOCKS,
+                                                            BLOCK_SIZE,
+                                                            1,
+                                                            num_kv_heads,
+                                                            head_size,
+                                                            "auto",
+                                                            dtype,
+                                                            seed,
+                                                            device="cpu")
+    key_cache, value_cache = key_caches[0], value_caches[0]
+
+    output = torch.empty_like(query)
+    ops.paged_attention_multi_query(output, query, key_cache, value_cache,
+                                    num_kv_heads, scale, block_tables,
+                                    seq_lens_tensor, BLOCK_SIZE, max_seq_len,
+                                    alibi_slopes, "auto", 1.0, 1.0)
+
+    # Query token i sees the context up to and including itself.
+    ref_output = torch.empty(num_seqs,
+                             num_query_tokens,
+                             num_query_heads,
+                             head_size,
+                             dtype=torch.float)
+    for i in range(num_query_tokens):
+        ref_paged_attention(ref_output[:, i], query[:, i], key_cache,
+                            value_cache, block_tables,
+                            seq_lens_tensor - num_query_tokens + i + 1, scale,
+                            alibi_slopes)
+
+    atol, rtol = (1e-3, 1e-5) if dtype == torch.float else (1e-2, 1e-2)
+    torch.testing.assert_close(output.float(), ref_output, atol=atol, rtol=rtol)
+
+
+@pytest.mark.parametrize("version", ["v1", "v2"])
+@pytest.mark.parametrize("num_seqs", [7])
+@pytest.mark.parametrize("sliding_window", [0, 100, 512, 1000])
+@pytest.mark.parametrize("num_heads", NUM_HEADS)
+@pytest.mark.parametrize("head_size", HEAD_SIZES)
+@pytest.mark.parametrize("use_alibi", USE_ALIBI)
+@pytest.mark.parametrize("dtype", DTYPES)
+@pytest.mark.parametrize("seed", SEEDS)
+@torch.inference_mode()
+def test_paged_attention_sliding_window(
+    version: str,
+    num_seqs: int,
+    sliding_window: int,
+    num_heads: tuple,
+    head_size: int,
+    use_alibi: bool,
+    dtype: torch.dtype,
+    seed: int,
+) -> None:
+    seed_everything(seed)
+    num_query_heads, num_kv_heads = num_heads
+    scale = float(1.0 / (head_size**0.5))
+
+    query = torch.empty(num_seqs, num_query_heads, head_size, dtype=dtype)
+    query.uniform_(-scale, scale)
+    alibi_slopes = (torch.randn(num_query_heads, dtype=torch.float)
+                    if use_alibi else None)
+
+    seq_lens = [random.randint(1, 2000) for _ in range(num_seqs)]
+    max_seq_len = max(seq_lens)
+    max_num_blocks_per_seq = (max_seq_len + BLOCK_SIZE - 1) // BLOCK_SIZE
+    block_tables = torch.stack([
+        torch.randperm(NUM_BLOCKS)[:max_num_blocks_per_seq]
+        for _ in range(num_seqs)
+    ]).int()
+    seq_lens_tensor = torch.tensor(seq_lens, dtype=torch.int)
+
+    key_caches, value_caches = create_kv_caches_with_random(NUM_BLOCKS,
+                                                            BLOCK_SIZE,
+                                                            1,
+                                                            num_kv_heads,
+                                                            head_size,
+                                                            "auto",
+                                                            dtype,
+                                                            seed,
+                                                            device="cpu")
+    key_cache, value_cache = key_caches[0], value_caches[0]
+
+    output = torch.empty_like(query)
+    if version == "v1":
+        ops.paged_attention_v1(output,
+                               query,
+                               key_cache,
+                               value_cache,
+                               num_kv_heads,
+                               scale,
+                               block_tables,
+                               seq_lens_tensor,
+                               BLOCK_SIZE,
+                               max_seq_len,
+                               alibi_slopes,
+                               "auto",
+                               1.0,
+                               1.0,
+                               sliding_window=sliding_window)
+    else:
+        max_num_partitions = ((max_seq_len + PARTITION_SIZE - 1) //
+                              PARTITION_SIZE)
+        tmp_output = torch.empty(num_seqs,
+                                 num_query_heads,
+                                 max_num_partitions,
+                                 head_size,
+                                 dtype=dtype)
+        exp_sums = torch.empty(num_seqs,
+                               num_query_heads,
+                               max_num_partitions,
+                               dtype=torch.float)
+        max_logits = torch.empty_like(exp_sums)
+        ops.paged_attention_v2(output,
+                               exp_sums,
+                               max_logits,
+                               tmp_output,
+                               query,
+                               key_cache,
+                               value_cache,
+                               num_kv_heads,
+                               scale,
+                               block_tables,
+                               seq_lens_tensor,
+                               BLOCK_SIZE,
+                               max_seq_len,
+                               alibi_slopes,
+                               "auto",
+                               1.0,
+                               1.0,
+                               sliding_window=sliding_window)
+
+    ref_output = torch.empty(num_seqs,
+                             num_query_heads,
+                             head_size,
+                             dtype=torch.float)
+    ref_paged_attention(ref_output, query, key_cache, value_cache,
+                        block_tables, seq_lens_tensor, scale, alibi_slopes,
+                        sliding_window)
+
+    atol, rtol = (1e-3, 1e-5) if dtype == torch.float else (1e-2, 1e-2)
+    torch.testing.assert_close(output.float(), ref_output, atol=atol, rtol=rtol)
+
+
+@pytest.mark.parametrize("version", ["v1", "v2", "multi_query"])
+@pytest.mark.parametrize("num_seqs", [7])
+@pytest.mark.parametrize("head_sliding_step", [0, 1, -2])
+@pytest.mark.parametrize("num_heads", NUM_HEADS)
+@pytest.mark.parametrize("head_size", HEAD_SIZES)
+@pytest.mark.parametrize("dtype", DTYPES)
+@pytest.mark.parametrize("seed", SEEDS)
+@torch.inference_mode()
+def test_paged_attention_blocksparse(
+    version: str,
+    num_seqs: int,
+    head_sliding_step: int,
+    num_heads: tuple,
+    head_size: int,
+    dtype: torch.dtype,
+    seed: int,
+) -> None:
+    seed_everything(seed)
+    num_query_heads, num_kv_heads = num_heads
+    scale = float(1.0 / (head_size**0.5))
+    num_query_tokens = 5 if version == "multi_query" else 1
+    blocksparse_kwargs = dict(tp_rank=1,
+                              blocksparse_local_blocks=4,
+                              blocksparse_vert_stride=8,
+                              blocksparse_block_size=64,
+                              blocksparse_head_sliding_step=head_sliding_step)
+
+    query = torch.empty(num_seqs,
+                        num_query_tokens,
+                        num_query_heads,
+                        head_size,
+                        dtype=dtype)
+    query.uniform_(-scale, scale)
+
+    seq_lens = [random.randint(num_query_tokens, 2000) for _ in range(num_seqs)]
+    max_seq_len = max(seq_lens)
+    max_num_blocks_per_seq = (max_seq_len + BLOCK_SIZE - 1) // BLOCK_SIZE
+    block_tables = torch.randint(0,
+                                 NUM_BLOCKS,
+                                 (num_seqs, max_num_blocks_per_seq),
+                                 dtype=torch.int)
+    seq_lens_tensor = torch.tensor(seq_lens, dtype=torch.int)
+
+    key_caches, value_caches = create_kv_caches_with_random(NUM_BLOCKS,
+                                                            BLOCK_SIZE,
+                                                            1,
+                                                            num_kv_heads,
+                                                            head_size,
+                                                            "auto",
+                                                            dtype,
+                                                            seed,
+                                                            device="cpu")
+    key_cache, value_cache = key_caches[0], value_caches[0]
+
+    output = torch.empty_like(query)
+    if version == "v1":
+        ops.paged_attention_v1(output[:, 0], query[:, 0], key_cache,
+                               value_cache, num_kv_heads, scale, block_tables,
+                               seq_lens_tensor, BLOCK_SIZE, max_seq_len, None,
+                               "auto", 1.0, 1.0, **blocksparse_kwargs)
+    elif version == "v2":
+        max_num_partitions = ((max_seq_len + PARTITION_SIZE - 1) //
+                              PARTITION_SIZE)
+        tmp_output = torch.empty(num_seqs,
+                                 num_query_heads,
+                                 max_num_partitions,
+                                 head_size,
+                                 dtype=dtype)
+        exp_sums = torch.empty(num_seqs,
+                               num_query_heads,
+                               max_num_partitions,
+                               dtype=torch.float)
+        max_logits = torch.empty_like(exp_sums)
+        ops.paged_attention_v2(output[:, 0], exp_sums, max_logits, tmp_output,
+                               query[:, 0], key_cache, value_cache,
+                               num_kv_heads, scale, block_tables,
+                               seq_lens_tensor, BLOCK_SIZE, max_seq_len, None,
+                               "auto", 1.0, 1.0, **blocksparse_kwargs)
+    else:
+        ops.paged_attention_multi_query(output, query, key_cache, value_cache,
+                                        num_kv_heads, scale, block_tables,
+                                        seq_lens_tensor, BLOCK_SIZE,
+                                        max_seq_len, None, "auto", 1.0, 1.0,
+                                        **blocksparse_kwargs)
+
+    ref_output = torch.empty(num_seqs,
+                             num_query_tokens,
+                             num_query_heads,
+                             head_size,
+                             dtype=torch.float)
+    for i in range(num_query_tokens):
+        ref_paged_attention(ref_output[:, i],
+                            query[:, i],
+                            key_cache,
+                            value_cache,
+                            block_tables,
+                            seq_lens_tensor - num_query_tokens + i + 1,
+                            scale,
+                            None,
+                            blocksparse_kwargs=blocksparse_kwargs)
+
+    atol, rtol = (1e-3, 1e-5) if dtype == torch.float else (1e-2, 1e-2)
+    torch.testing.assert_close(output.float(), ref_output, atol=atol, rtol=rtol)
+
+
+@pytest.mark.parametrize("prefetch_distance", [0, 3, 64])
+@torch.inference_mode()
+def test_paged_attention_prefetch_distance(prefetch_distance: int) -> None:
+    seed_everything(0)
+    num_seqs, num_heads, head_size = 5, 8, 128
+    scale = float(1.0 / (head_size**0.5))
+    query = torch.empty(num_seqs, num_heads, head_size, dtype=torch.float)
+    query.uniform_(-scale, scale)
+    seq_lens = [random.randint(1, 1000) for _ in range(num_seqs)]
+    max_seq_len = max(seq_lens)
+    max_num_blocks_per_seq = (max_seq_len + BLOCK_SIZE - 1) // BLOCK_SIZE
+    block_tables = torch.stack([
+        torch.randperm(NUM_BLOCKS)[:max_num_blocks_per_seq]
+        for _ in range(num_seqs)
+    ]).int()
+    seq_lens_tensor = torch.tensor(seq_lens, dtype=torch.int)
+    key_caches, value_caches = create_kv_caches_with_random(
+        NUM_BLOCKS, BLOCK_SIZE, 1, num_heads, head_size, "auto", torch.float,
+        0, device="cpu")
+    key_cache, value_cache = key_caches[0], value_caches[0]
+
+    output = torch.empty_like(query)
+    ops.set_cpu_prefetch_distance(prefetch_distance)
+    try:
+        ops.paged_attention_v1(output, query, key_cache, value_cache,
+                               num_heads, scale, block_tables,
+                               seq_lens_tensor, BLOCK_SIZE, max_seq_len, None,
+                               "auto", 1.0, 1.0)
+    finally:
+        ops.set_cpu_prefetch_distance(1)
+
+    ref_output = torch.empty_like(query)
+    ref_paged_attention(ref_output, query, key_cache, value_cache,
+                        block_tables, seq_lens_tensor, scale, None)
+    torch.testing.assert_close(output, ref_output, atol=1e-3, rtol=1e-5)
+
+    with pytest.raises(RuntimeError):
+        ops.set_cpu_prefetch_distance(-1)
+
+
+@pytest.mark.parametrize("version", ["v1", "v2", "multi_query"])
+@pytest.mark.parametrize("block_size", [8, 32, 64, 128])
+@pytest.mark.parametrize("dtype", DTYPES)
+@torch.inference_mode()
+def test_paged_attention_block_size(version: str, block_size: int,
+                                    dtype: torch.dtype) -> None:
+    seed_everything(0)
+    num_seqs, num_query_tokens = 5, 3
+    num_query_heads, num_kv_heads, head_size = 8, 2, 128
+    scale = float(1.0 / (head_size**0.5))
+    num_blocks = 4096 // block_size
+
+    query = torch.empty(num_seqs,
+                        num_query_tokens,
+                        num_query_heads,
+                        head_size,
+                        dtype=dtype)
+    query.uniform_(-scale, scale)
+    # Lengths below, at and across block boundaries.
+    seq_lens = [3, block_size, block_size + 1, 300, 700]
+    max_seq_len = max(seq_lens)
+    max_num_blocks_per_seq = (max_seq_len + block_size - 1) // block_size
+    block_tables = torch.stack([
+        torch.randperm(num_blocks)[:max_num_blocks_per_seq]
+        for _ in range(num_seqs)
+    ]).int()
+    seq_lens_tensor = torch.tensor(seq_lens, dtype=torch.int)
+    key_caches, value_caches = create_kv_caches_with_random(num_blocks,
+                                                            block_size,
+                                                            1,
+                                                            num_kv_heads,
+                                                            head_size,
+                                                            "auto",
+                                                            dtype,
+                                                            0,
+                                                            device="cpu")
+    key_cache, value_cache = key_caches[0], value_caches[0]
+
+    output = torch.empty_like(query)
+    if version == "v1":
+        num_query_tokens = 1
+        ops.paged_attention_v1(output[:, 0], query[:, 0], key_cache,
+                               value_cache, num_kv_heads, scale, block_tables,
+                               seq_lens_tensor, block_size, max_seq_len, None,
+                               "auto", 1.0, 1.0)
+    elif version == "v2":
+        num_query_tokens = 1
+        max_num_partitions = ((max_seq_len + PARTITION_SIZE - 1) //
+                              PARTITION_SIZE)
+        tmp_output = torch.empty(num_seqs,
+                                 num_query_heads,
+                                 max_num_partitions,
+                                 head_size,
+                                 dtype=dtype)
+        exp_sums = torch.empty(num_seqs,
+                               num_query_heads,
+                               max_num_partitions,
+                               dtype=torch.float)
+        max_logits = torch.empty_like(exp_sums)
+        ops.paged_attention_v2(output[:, 0], exp_sums, max_logits, tmp_output,
+                               query[:, 0], key_cache, value_cache,
+                               num_kv_heads, scale, block_tables,
+                               seq_lens_tensor, block_size, max_seq_len, None,
+                               "auto", 1.0, 1.0)
+    else:
+        ops.paged_attention_multi_query(output, query, key_cache, value_cache,
+                                        num_kv_heads, scale, block_tables,
+                                        seq_lens_tensor, block_size,
+                                        max_seq_len, None, "auto", 1.0, 1.0)
+
+    ref_output = torch.empty(num_seqs,
+                             num_query_tokens,
+                             num_query_heads,
+                             head_size,
+                             dtype=torch.float)
+    for i in range(num_query_tokens):
+        ref_paged_attention(ref_output[:, i], query[:, i], key_cache,
+                            value_cache, block_tables,
+                            seq_lens_tensor - num_query_tokens + i + 1, scale,
+                            None)
+
+    atol, rtol = (1e-3, 1e-5) if dtype == torch.float else (1e-2, 1e-2)
+    torch.testing.assert_close(output[:, :num_query_tokens].float(),
+                               ref_output,
+                               atol=atol,
+                               rtol=rtol)
+
+
+# Head sizes without templated kernels, computed by the generic kernel, and
+# query/key head sizes which differ from the value head size.
+@pytest.mark.parametrize("version", ["v1", "v2"])
+@pytest.mark.parametrize("head_sizes", [(32, 32), (48, 48), (120, 120),
+                                        (160, 160), (512, 512), (192, 128),
+                                        (40, 24)])
+@pytest.mark.parametrize("dtype", DTYPES)
+@torch.inference_mode()
+def test_paged_attention_generic_head_size(version: str,
+                                           head_sizes: Tuple[int, int],
+                                           dtype: torch.dtype) -> None:
+    seed_everything(0)
+    qk_head_size, v_head_size = head_sizes
+    num_seqs, num_query_heads, num_kv_heads = 5, 8, 2
+    scale = float(1.0 / (qk_head_size**0.5))
+    x = 16 // torch.tensor([], dtype=dtype).element_size()
+
+    query = torch.empty(num_seqs, num_query_heads, qk_head_size, dtype=dtype)
+    query.uniform_(-scale, scale)
+    seq_lens = [1, BLOCK_SIZE, BLOCK_SIZE + 1, 300, 700]
+    max_seq_len = max(seq_lens)
+    max_num_blocks_per_seq = (max_seq_len + BLOCK_SIZE - 1) // BLOCK_SIZE
+    block_tables = torch.stack([
+        torch.randperm(NUM_BLOCKS)[:max_num_blocks_per_seq]
+        for _ in range(num_seqs)
+    ]).int()
+    seq_lens_tensor = torch.tensor(seq_lens, dtype=torch.int)
+    key_cache = torch.empty(NUM_BLOCKS,
+                            num_kv_heads,
+                            qk_head_size // x,
+                            BLOCK_SIZE,
+                            x,
+                            dtype=dtype).uniform_(-1, 1)
+    value_cache = torch.empty(NUM_BLOCKS,
+                              num_kv_heads,
+                              v_head_size,
+                              BLOCK_SIZE,
+                              dtype=dtype).uniform_(-1, 1)
+
+    output = torch.empty(num_seqs, num_query_heads, v_head_size, dtype=dtype)
+    if version == "v1":
+        ops.paged_attention_v1(output, query, key_cache, value_cache,
+                               num_kv_heads, scale, block_tables,
+                               seq_lens_tensor, BLOCK_SIZE, max_seq_len, None,
+                               "auto", 1.0, 1.0)
+    else:
+        max_num_partitions = ((max_seq_len + PARTITION_SIZE - 1) //
+                              PARTITION_SIZE)
+        tmp_output = torch.empty(num_seqs,
+                                 num_query_heads,
+                                 max_num_partitions,
+                                 v_head_size,
+                                 dtype=dtype)
+        exp_sums = torch.empty(num_seqs,
+                               num_query_heads,
+                               max_num_partitions,
+                               dtype=torch.float)
+        max_logits = torch.empty_like(exp_sums)
+        ops.paged_attention_v2(output, exp_sums, max_logits, tmp_output,
+                               query, key_cache, value_cache, num_kv_heads,
+                               scale, block_tables, seq_lens_tensor,
+                               BLOCK_SIZE, max_seq_len, None, "auto", 1.0,
+                               1.0)
+
+    ref_output = torch.empty(num_seqs,
+                             num_query_heads,
+                             v_head_size,
+                             dtype=torch.float)
+    ref_paged_attention(ref_output, query, key_cache, value_cache,
+                        block_tables, seq_lens_tensor, scale, None)
+    atol, rtol = (1e-3, 1e-5) if dtype == torch.float else (1e-2, 1e-2)
+    torch.testing.assert_close(output.float(), ref_output, atol=atol, rtol=rtol)
+
+    # Head sizes which are not multiples of 8 are rejected.
+    with pytest.raises(RuntimeError):
+        ops.paged_attention_v1(output[..., :4], query[..., :4],
+                               key_cache[:, :, :1, :, :4],
+                               value_cache[:, :, :4], num_kv_heads, scale,
+                               block_tables, seq_lens_tensor, BLOCK_SIZE,
+                               max_seq_len, None, "auto", 1.0, 1.0)
@@ -0,0 +1,119 @@
+"""Tests for the dtype conversion and copy ops of the CPU backend.
+
+Run `pytest tests/kernels/test_cpu_convert.py`.
+"""
+import numpy as np
+import pytest
+import torch
+
+from vllm import _custom_ops as ops
+from vllm.utils import is_cpu, seed_everything
+
+# Sizes below one vector, across a chunk boundary with a tail, and several
+# chunks.
+NUMELS = [7, 16 * 1024 + 13, 100 * 1000]
+
+pytestmark = pytest.mark.skipif(not is_cpu(), reason="CPU backend only")
+
+
+@pytest.mark.parametrize("numel", NUMELS)
+@torch.inference_mode()
+def test_convert_bf16_fp32(numel: int) -> None:
+    seed_everything(0)
+    x = torch.randn(numel, dtype=torch.float) * 1e3
+    # Infinities, signed zeros, a NaN, a denormal and ties to even.
+    specials = torch.tensor([
+        float("inf"), float("-inf"), 0.0, -0.0,
+        float("nan"), 1e-40, 1.0 + 2**-8, 1.0 + 3 * 2**-8
+    ])
+    num_specials = min(numel, len(specials))
+    x[:num_specials] = specials[:num_specials]
+
+    out = torch.empty(numel, dtype=torch.bfloat16)
+    ops.convert_fp32_to_bf16(out, x)
+    # Rounded to nearest even on every backend, bit for bit.
+    assert torch.equal(out.view(torch.int16),
+                       x.to(torch.bfloat16).view(torch.int16))
+
+    back = torch.empty(numel, dtype=torch.float)
+    ops.convert_bf16_to_fp32(back, out)
+    torch.testing.assert_close(back, out.float(), equal_nan=True)
+
+
+@pytest.mark.parametrize("numel", NUMELS)
+@pytest.mark.parametrize("dtype", [torch.float, torch.bfloat16, torch.int8])
+@torch.inference_mode()
+def test_copy_contiguous(numel: int, dtype: torch.dtype) -> None:
+    seed_everything(0)
+    x = torch.randint(-100, 100, (numel, ), dtype=torch.int).to(dtype)
+    out = torch.empty_like(x)
+    ops.copy_contiguous(out, x)
+    assert torch.equal(out, x)
+
+
+def _le_bytes(x: torch.Tensor, src_format: str) -> torch.Tensor:
+    """The little-endian encoding of x as stored in a checkpoint."""
+    if src_format == "int4":
+        nibbles = (x.to(torch.uint8) & 0xF).flatten()
+        if nibbles.numel() % 2:
+            nibbles = torch.cat([nibbles, nibbles.new_zeros(1)])
+        return nibbles[0::2] | (nibbles[1::2] << 4)
+    if src_format == "bf16":
+        array = x.view(torch.int16).numpy().astype("<i2")
+    else:
+        array = x.numpy().astype(x.numpy().dtype.newbyteorder("<"))
+    return torch.frombuffer(bytearray(array.tobytes()), dtype=torch.uint8)
+
+
+@pytest.mark.parametrize("numel", NUMELS)
+@pytest.mark.parametrize("src_format",
+                         ["fp32", "fp16", "bf16", "int8", "int4"])
+@pytest.mark.parametrize("dtype", [torch.float, torch.bfloat16])
+@torch.inference_mode()
+def test_convert_le_weight(numel: int, src_format: str,
+                           dtype: torch.dtype) -> None:
+    seed_everything(0)
+    if src_format in ("int8", "int4"):
+        bound = 128 if src_format == "int8" else 8
+        x = torch.randint(-bound, bound, (numel, ), dtype=torch.int8)
+    else:
+        x = torch.randn(numel, dtype=torch.float) * 1e3
+        x[:4] = torch.tensor([float("inf"), float("-inf"), 0.0, -0.0])
+        if numel > 4:
+            x[4] = float("nan")
+        x = x.to({
+            "fp32": torch.float,
+            "fp16": torch.half,
+            "bf16": torch.bfloat16
+        }[src_format])
+
+    out = torch.empty(numel, dtype=dtype)
+    mismatches = ops.convert_le_weight(out,
+                                       _le_bytes(x, src_format),
+                                       src_format,
+                                       verify=True)
+    assert mismatches == 0
+    # Backends without native BF16 conversion truncate instead of rounding.
+    torch.testing.assert_close(out, x.to(dtype), equal_nan=True)
+
+    with pytest.raises(RuntimeError):
+        ops.convert_le_weight(out, _le_bytes(x[:-2], src_format),
+                              src_format)
+
+
+def test_cpu_convert_fallback() -> None:
+    x = torch.randn(8, 16, dtype=torch.float)
+    out = torch.empty(8, 16, dtype=torch.bfloat16)
+    assert ops.cpu_convert_(out, x)
+    torch.testing.assert_close(out, x.to(torch.bfloat16))
+
+    # Tensors of the same dtype are copied.
+    copy = torch.empty_like(out)
+    assert ops.cpu_convert_(copy, out)
+    assert torch.equal(copy, out)
+
+    # Non-contiguous inputs and other dtype pairs are left to copy_().
+    assert not ops.cpu_convert_(out, x.t().contiguous().t())
+    assert not ops.cpu_convert_(out, x.half())
+    with pytest.raises(RuntimeError):
+        ops.convert_bf16_to_fp32(x, x)
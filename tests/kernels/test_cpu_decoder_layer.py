@@ -0,0 +1,156 @@
+"""Tests for the fused Llama decoder layer in csrc/cpu/decoder_layer.cpp.
+
+Run `pytest tests/kernels/test_cpu_decoder_layer.py`.
+"""
+import random
+from typing import List, Optional, Tuple
+
+import pytest
+import torch
+import torch.nn.functional as F
+
+from vllm import _custom_ops as ops
+from vllm.utils import create_kv_caches_with_random, is_cpu, seed_everything
+
+NUM_BLOCKS = 128
+MAX_POSITION = 1024
+DTYPES = [torch.bfloat16, torch.float]
+
+pytestmark = pytest.mark.skipif(not is_cpu(), reason="CPU backend only")
+
+
+def ref_decoder_layer(
+    hidden_states: torch.Tensor,
+    residual: Optional[torch.Tensor],
+    positions: torch.Tensor,
+    weights: List[torch.Tensor],
+    epsilon: float,
+    cos_sin_cache: torch.Tensor,
+    is_neox: bool,
+    key_cache: torch.Tensor,
+    value_cache: torch.Tensor,
+    slot_mapping: torch.Tensor,
+    block_tables: torch.Tensor,
+    seq_lens: torch.Tensor,
+    num_heads: int,
+    scale: float,
+) -> Tuple[torch.Tensor, torch.Tensor]:
+    """The unfused ops of LlamaDecoderLayer.forward()."""
+    input_norm, qkv_w, o_w, post_norm, gate_up_w, down_w = weights
+    num_kv_heads, head_size, block_size = value_cache.shape[1:]
+    q_size = num_heads * head_size
+    kv_size = num_kv_heads * head_size
+
+    if residual is None:
+        residual = hidden_states
+        hidden_states = torch.empty_like(residual)
+        ops.rms_norm(hidden_states, residual, input_norm, epsilon)
+    else:
+        hidden_states, residual = hidden_states.clone(), residual.clone()
+        ops.fused_add_rms_norm(hidden_states, residual, input_norm, epsilon)
+
+    qkv = F.linear(hidden_states, qkv_w)
+    q, k, v = qkv.split([q_size, kv_size, kv_size], dim=-1)
+    ops.rotary_embedding(positions, q, k, head_size, cos_sin_cache, is_neox)
+    ops.reshape_and_cache(k.view(-1, num_kv_heads, head_size),
+                          v.view(-1, num_kv_heads, head_size), key_cache,
+                          value_cache, slot_mapping, "auto", 1.0, 1.0)
+    attn = torch.empty_like(q).view(-1, num_heads, head_size)
+    ops.paged_attention_v1(attn, q.view(-1, num_heads, head_size), key_cache,
+                           value_cache, num_kv_heads, scale, block_tables,
+                           seq_lens, block_size, int(seq_lens.max()), None,
+                           "auto", 1.0, 1.0)
+    hidden_states = F.linear(attn.view(-1, q_size), o_w)
+
+    ops.fused_add_rms_norm(hidden_states, residual, post_norm, epsilon)
+    gate_up = F.linear(hidden_states, gate_up_w)
+    act = torch.empty_like(gate_up[:, :gate_up.shape[1] // 2])
+    ops.silu_and_mul(act, gate_up)
+    return F.linear(act, down_w), residual
+
+
+@pytest.mark.parametrize("num_tokens", [1, 5, 8])
+@pytest.mark.parametrize("num_heads", [(8, 8), (8, 2)])
+@pytest.mark.parametrize("head_size", [64, 40])
+@pytest.mark.parametrize("block_size", [16, 32])
+@pytest.mark.parametrize("is_neox", [True, False])
+@pytest.mark.parametrize("first_layer", [True, False])
+@pytest.mark.parametrize("dtype", DTYPES)
+@torch.inference_mode()
+def test_llama_decoder_layer(num_tokens: int, num_heads: Tuple[int, int],
+                             head_size: int, block_size: int, is_neox: bool,
+                             first_layer: bool, dtype: torch.dtype) -> None:
+    seed_everything(0)
+    num_query_heads, num_kv_heads = num_heads
+    hidden_size = 256
+    intermediate_size = 344
+    epsilon = 1e-5
+    scale = head_size**-0.5
+    qkv_size = (num_query_heads + 2 * num_kv_heads) * head_size
+
+    def weight(*shape: int) -> torch.Tensor:
+        return (torch.randn(*shape) / shape[-1]**0.5).to(dtype)
+
+    def norm_weight() -> torch.Tensor:
+        return (1.0 + 0.1 * torch.randn(hidden_size)).to(dtype)
+
+    weights = [
+        norm_weight(),
+        weight(qkv_size, hidden_size),
+        weight(hidden_size, num_query_heads * head_size),
+        norm_weight(),
+        weight(2 * intermediate_size, hidden_size),
+        weight(hidden_size, intermediate_size),
+    ]
+    angles = torch.rand(MAX_POSITION, head_size // 2) * 6.28
+    cos_sin_cache = torch.cat([angles.cos(), angles.sin()], dim=-1).to(dtype)
+
+    # One decode token per sequence, appended after its context.
+    max_blocks = NUM_BLOCKS // num_tokens
+    seq_lens = [
+        random.randint(1, max_blocks * block_size) for _ in range(num_tokens)
+    ]
+    blocks = random.sample(range(NUM_BLOCKS), num_tokens * max_blocks)
+    block_tables = torch.tensor(blocks, dtype=torch.int).view(
+        num_tokens, max_blocks)
+    positions = torch.tensor([seq_len - 1 for seq_len in seq_lens])
+    slot_mapping = torch.tensor([
+        block_tables[i, pos // block_size].item() * block_size +
+        pos % block_size for i, pos in enumerate(positions.tolist())
+    ])
+    seq_lens_tensor = torch.tensor(seq_lens, dtype=torch.int)
+
+    key_caches, value_caches = create_kv_caches_with_random(
+        NUM_BLOCKS, block_size, 1, num_kv_heads, head_size, "auto", dtype, 0,
+        "cpu")
+    key_cache, value_cache = key_caches[0], value_caches[0]
+    ref_key_cache, ref_value_cache = key_cache.clone(), value_cache.clone()
+
+    hidden_states = torch.randn(num_tokens, hidden_size, dtype=dtype)
+    residual = (None if first_layer else torch.randn(
+        num_tokens, hidden_size, dtype=dtype))
+    ref_out, ref_residual = ref_decoder_layer(
+        hidden_states, residual, positions, weights, epsilon, cos_sin_cache,
+        is_neox, ref_key_cache, ref_value_cache, slot_mapping, block_tables,
+        seq_lens_tensor, num_query_heads, scale)
+
+    out = hidden_states.clone()
+    out_residual = (torch.empty_like(hidden_states)
+                    if first_layer else residual.clone())
+    ops.llama_decoder_layer(out, out_residual, not first_layer, positions,
+                            weights, epsilon, cos_sin_cache, is_neox,
+                            key_cache, value_cache, slot_mapping,
+                            block_tables, seq_lens_tensor, num_query_heads,
+                            scale)
+
+    atol, rtol = (1e-3, 1e-4) if dtype == torch.float else (5e-2, 5e-2)
+    torch.testing.assert_close(key_cache, ref_key_cache, atol=atol, rtol=rtol)
+    torch.testing.assert_close(value_cache,
+                               ref_value_cache,
+                               atol=atol,
+                               rtol=rtol)
+    torch.testing.assert_close(out_residual,
+                               ref_residual,
+                               atol=atol,
+                               rtol=rtol)
+    torch.testing.assert_close(out, ref_out, atol=atol, rtol=rtol)
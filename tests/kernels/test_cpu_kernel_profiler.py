@@ -0,0 +1,53 @@
+"""Tests for the CPU kernel profiling registry in csrc/cpu/kernel_profiler.cpp.
+
+Run `pytest tests/kernels/test_cpu_kernel_profiler.py`.
+"""
+import pytest
+import torch
+
+from vllm import _custom_ops as ops
+from vllm.utils import is_cpu
+
+pytestmark = pytest.mark.skipif(not is_cpu(), reason="CPU backend only")
+
+
+@pytest.mark.parametrize("level", [1, 2, 3])
+@torch.inference_mode()
+def test_cpu_kernel_profiler(level: int) -> None:
+    hidden_size = 1024
+    weight = torch.ones(hidden_size, dtype=torch.bfloat16)
+    ops.collect_cpu_kernel_stats()
+
+    ops.set_cpu_kernel_profiling(level)
+    try:
+        for num_tokens in [3, 4, 100]:
+            x = torch.randn(num_tokens, hidden_size, dtype=torch.bfloat16)
+            out = torch.empty_like(x)
+            ops.rms_norm(out, x, weight, 1e-6)
+    finally:
+        ops.set_cpu_kernel_profiling(0)
+
+    stats = [
+        s for s in ops.collect_cpu_kernel_stats()
+        if s["kernel"] == "rms_norm_impl"
+    ]
+    # Shapes are bucketed to the next power of two.
+    assert {s["shape_bucket"]: s["calls"] for s in stats} == {4: 2, 128: 1}
+    for s in stats:
+        assert 0 < s["max_ns"] <= s["total_ns"]
+        assert s["bytes"] > 0
+        assert s["barrier_total_ns"] >= 0
+        if level == 1:
+            assert s["imbalance_total_ns"] == 0
+        else:
+            # The spread of the finish times of the threads within the call.
+            assert 0 <= s["imbalance_max_ns"] <= s["max_ns"]
+        if level < 3:
+            assert s["cycles"] == 0 and "ipc" not in s
+        elif s["cycles"] > 0:
+            # Hardware counters depend on perf_event_paranoid.
+            assert s["ipc"] > 0
+
+    # Collecting resets the stats, nothing is recorded while disabled.
+    ops.rms_norm(out, x, weight, 1e-6)
+    assert ops.collect_cpu_kernel_stats() == []
@@ -0,0 +1,124 @@
+"""Tests for the tuned CPU kernel configurations of vllm/worker/cpu_tuner.py.
+
+Run `pytest tests/kernels/test_cpu_kernel_tuner.py`.
+"""
+import dataclasses
+
+import pytest
+import torch
+
+from vllm import _custom_ops as ops
+from vllm.attention.ops.paged_attn import PagedAttention
+from vllm.utils import create_kv_caches_with_random, is_cpu, seed_everything
+from vllm.worker import cpu_tuner
+
+NUM_BLOCKS = 512
+BLOCK_SIZE = 16
+NUM_SEQS = 5
+MAX_SEQ_LEN = 2000
+NUM_HEADS = (16, 4)
+HEAD_SIZE = 128
+
+pytestmark = pytest.mark.skipif(not is_cpu(), reason="CPU backend only")
+
+
+def _decode(query, key_cache, value_cache, block_tables, seq_lens,
+            **kwargs) -> torch.Tensor:
+    return PagedAttention.forward_decode(query, key_cache, value_cache,
+                                         block_tables, seq_lens, MAX_SEQ_LEN,
+                                         "auto", NUM_HEADS[1],
+                                         HEAD_SIZE**-0.5, None, 1.0, 1.0,
+                                         **kwargs)
+
+
+@pytest.mark.parametrize("dtype", [torch.bfloat16, torch.float])
+@torch.inference_mode()
+def test_tuned_paged_attention(dtype: torch.dtype) -> None:
+    seed_everything(0)
+    num_query_heads, num_kv_heads = NUM_HEADS
+    query = torch.randn(NUM_SEQS, num_query_heads, HEAD_SIZE, dtype=dtype)
+    seq_lens = torch.randint(1, MAX_SEQ_LEN, (NUM_SEQS, ), dtype=torch.int)
+    seq_lens[-1] = MAX_SEQ_LEN
+    max_num_blocks_per_seq = (MAX_SEQ_LEN + BLOCK_SIZE - 1) // BLOCK_SIZE
+    block_tables = torch.randint(0,
+                                 NUM_BLOCKS,
+                                 (NUM_SEQS, max_num_blocks_per_seq),
+                                 dtype=torch.int)
+    key_caches, value_caches = create_kv_caches_with_random(NUM_BLOCKS,
+                                                            BLOCK_SIZE,
+                                                            1,
+                                                            num_kv_heads,
+                                                            HEAD_SIZE,
+                                                            "auto",
+                                                            dtype,
+                                                            device="cpu")
+    args = (query, key_caches[0], value_caches[0], block_tables, seq_lens)
+    ref_output = _decode(*args, use_v1=True)
+    atol, rtol = (1e-3, 1e-5) if dtype == torch.float else (1e-2, 1e-2)
+
+    # v2 with a partition size other than the default.
+    for partition_size in (256, 1024):
+        output = _decode(*args, use_v1=False, partition_size=partition_size)
+        torch.testing.assert_close(output, ref_output, atol=atol, rtol=rtol)
+
+    # Installed in-kernel configurations for the shape of this batch.
+    key = cpu_tuner.attention_key(query.element_size(), num_query_heads,
+                                  num_kv_heads, HEAD_SIZE, NUM_SEQS,
+                                  MAX_SEQ_LEN)
+    config = cpu_tuner.KernelConfig(thread_num=2, head_unroll=8, schedule=1)
+    try:
+        for kernel in ("paged_attention_v1", "paged_attention_v2"):
+            ops.set_cpu_kernel_config(kernel, list(key), config.to_list())
+        torch.testing.assert_close(_decode(*args, use_v1=True),
+                                   ref_output,
+                                   atol=atol,
+                                   rtol=rtol)
+        torch.testing.assert_close(_decode(*args,
+                                           use_v1=False,
+                                           partition_size=512),
+                                   ref_output,
+                                   atol=atol,
+                                   rtol=rtol)
+    finally:
+        ops.clear_cpu_kernel_configs()
+
+    with pytest.raises(RuntimeError):
+        ops.set_cpu_kernel_config("paged_attention_v1", list(key),
+                                  [0, 4, 0, 0])
+
+
+def test_tuning_cache(tmp_path, monkeypatch) -> None:
+    path = str(tmp_path / "cpu_tuning.json")
+    monkeypatch.setenv("VLLM_CPU_TUNING_CACHE", path)
+    num_query_heads, num_kv_heads = NUM_HEADS
+    tuned = cpu_tuner.attention_key(2, num_query_heads, num_kv_heads,
+                                    HEAD_SIZE, 4, 1024)
+    kernel = cpu_tuner.KernelConfig(thread_num=1, head_unroll=8, schedule=2)
+    entry = dict(use_v1=False,
+                 partition_size=256,
+                 time_us=1.0,
+                 **dataclasses.asdict(kernel))
+
+    cache = cpu_tuner.TuningCache(path)
+    cache.update("paged_attention", {",".join(map(str, tuned)): entry})
+    cache.update("lora_shrink", {})
+    entries = cpu_tuner.TuningCache(path).load()
+    assert set(entries) == {"paged_attention", "lora_shrink"}
+
+    cpu_tuner.install(entries)
+    try:
+        # Buckets around the tuned one dispatch on its configuration.
+        for num_seqs, max_seq_len in ((4, 1024), (3, 1000), (8, 2048)):
+            query = torch.empty(num_seqs,
+                                num_query_heads,
+                                HEAD_SIZE,
+                                dtype=torch.bfloat16)
+            assert cpu_tuner.decode_kwargs(query, num_kv_heads,
+                                           max_seq_len) == dict(
+                                               use_v1=False,
+                                               partition_size=256)
+        query = torch.empty(4, num_query_heads, HEAD_SIZE, dtype=torch.float)
+        assert cpu_tuner.decode_kwargs(query, num_kv_heads, 1024) == {}
+    finally:
+        cpu_tuner.install({})
+    assert cpu_tuner.decode_kwargs(query, num_kv_heads, 1024) == {}
@@ -0,0 +1,262 @@
+"""Tests for the NUMA-local, huge-page backed memory of the CPU backend.
+
+Run `pytest tests/kernels/test_cpu_memory.py`.
+"""
+import pytest
+import torch
+
+from vllm import _custom_ops as ops
+from vllm.utils import is_cpu
+
+pytestmark = pytest.mark.skipif(not is_cpu(), reason="CPU backend only")
+
+
+@pytest.mark.parametrize("huge_pages", ["none", "thp", "hugetlb"])
+@pytest.mark.parametrize("num_bytes", [1, 3 * (1 << 20) + 17])
+@torch.inference_mode()
+def test_allocate_cpu_kv_cache(huge_pages: str, num_bytes: int) -> None:
+    cache = ops.allocate_cpu_kv_cache(num_bytes, huge_pages)
+    assert cache.dtype == torch.uint8 and cache.numel() == num_bytes
+    assert not cache.any()
+
+    page_size, huge_page_bytes, numa_node = ops.get_cpu_memory_placement(
+        cache)
+    assert page_size > 0 and page_size & (page_size - 1) == 0
+    assert 0 <= huge_page_bytes and numa_node >= -1
+
+    # The memory stays usable through typed views of the cache shape.
+    kv = cache[:num_bytes // 4 * 4].view(torch.float)
+    kv.fill_(1.0)
+    assert kv.sum().item() == kv.numel()
+
+
+def test_allocate_cpu_kv_cache_invalid() -> None:
+    with pytest.raises(RuntimeError):
+        ops.allocate_cpu_kv_cache(0)
+    with pytest.raises(RuntimeError):
+        torch.ops._C_utils.allocate_cpu_kv_cache(1, 3, -1)
+
+
+@torch.inference_mode()
+def test_mmap_safetensors_weights_iterator(tmp_path) -> None:
+    from safetensors.torch import load_file, save_file
+
+    from vllm.model_executor.model_loader.weight_utils import (
+        mmap_safetensors_weights_iterator)
+
+    # Mixed dtypes, with an odd-sized int8 tensor and a scalar.
+    tensors = {
+        "a.weight": torch.randn(33, 17, dtype=torch.bfloat16),
+        "b.bias": torch.randint(-5, 5, (3, ), dtype=torch.int8),
+        "c.weight": torch.randn(5, 7),
+        "d.scale": torch.tensor(0.5),
+    }
+    path = str(tmp_path / "model.safetensors")
+    save_file(tensors, path)
+
+    loaded = dict(mmap_safetensors_weights_iterator([path]))
+    expected = load_file(path)
+    assert loaded.keys() == expected.keys()
+    for name, weight in loaded.items():
+        assert weight.dtype == expected[name].dtype
+        assert torch.equal(weight, expected[name])
+
+    # Views are copied into the parameters like the tensors of safe_open.
+    param = torch.empty(33, 17, dtype=torch.float)
+    assert ops.cpu_convert_(param, loaded["a.weight"])
+    torch.testing.assert_close(param, tensors["a.weight"].float())
+
+
+@torch.inference_mode()
+def test_cpu_weight_cache(tmp_path) -> None:
+    from vllm.model_executor.model_loader import cpu_weight_cache
+
+    def make_model() -> torch.nn.Module:
+        model = torch.nn.Module()
+        model.dense = torch.nn.Parameter(torch.randn(33, 17), False)
+        # Transposed like the weights of the int8 GEMMs.
+        model.transposed = torch.nn.Parameter(
+            torch.randint(-5, 5, (7, 9), dtype=torch.int8).t(), False)
+        model.strided = torch.nn.Parameter(
+            torch.randn(8, 10, dtype=torch.bfloat16)[:, ::2], False)
+        model.scalar = torch.nn.Parameter(torch.tensor(0.5), False)
+        return model
+
+    model = make_model()
+    key = {"version": 1, "model": "test"}
+    path = cpu_weight_cache.cache_path(str(tmp_path), key)
+    cpu_weight_cache.save_weights(model, path, key)
+
+    cached = make_model()
+    assert cpu_weight_cache.load_weights(cached, path, key)
+    for (name, param), expected in zip(cached.named_parameters(),
+                                       model.parameters()):
+        assert torch.equal(param, expected), name
+        assert param.data_ptr() % 64 == 0
+    assert cached.transposed.stride() == model.transposed.stride()
+
+    # Another key or other parameters leave the model untouched.
+    other = make_model()
+    assert not cpu_weight_cache.load_weights(other, path, {"version": 2})
+    other.extra = torch.nn.Parameter(torch.zeros(3), False)
+    assert not cpu_weight_cache.load_weights(other, path, key)
+    assert not torch.equal(other.dense, model.dense)
+
+
+@torch.inference_mode()
+def test_cpu_weight_cache_by_layer(tmp_path) -> None:
+    from vllm.model_executor.model_loader import cpu_weight_cache
+
+    class Model(torch.nn.Module):
+
+        def __init__(self) -> None:
+            super().__init__()
+            self.layers = torch.nn.ModuleList(
+                torch.nn.Linear(64, 64) for _ in range(3))
+            self.norm = torch.nn.LayerNorm(64)
+
+        def load_weights(self, weights) -> None:
+            params = dict(self.named_parameters())
+            for name, weight in weights:
+                params[name].data.copy_(weight)
+
+    checkpoint = {
+        name: torch.randn_like(param)
+        for name, param in Model().named_parameters()
+    }
+    released = []
+
+    def weights():
+        for name, weight in checkpoint.items():
+            # Layer 0 is written and released before layer 1 is loaded.
+            released.append(model.layers[0].weight.stride() == (0, 0))
+            yield name, weight
+
+    model = Model()
+    processed = []
+    key = {"version": 1, "model": "by-layer"}
+    path = cpu_weight_cache.cache_path(str(tmp_path), key)
+    cpu_weight_cache.load_and_save_weights(model, weights(), checkpoint,
+                                           processed.append, path, key)
+
+    assert released == [False, False, True, True, True, True, True, True]
+    assert len(processed) == len(list(model.modules()))
+    for name, param in model.named_parameters():
+        assert torch.equal(param, checkpoint[name]), name
+    cached = Model()
+    assert cpu_weight_cache.load_weights(cached, path, key)
+
+
+@torch.inference_mode()
+def test_cpu_weight_streaming(tmp_path) -> None:
+    from vllm.model_executor.model_loader import cpu_weight_cache
+    from vllm.worker.cpu_weight_streamer import CPUWeightStreamer
+
+    model = torch.nn.Module()
+    model.layers = torch.nn.ModuleList(
+        torch.nn.Linear(256, 256) for _ in range(4))
+    x = torch.randn(8, 256)
+    expected = x
+    for layer in model.layers:
+        expected = layer(expected)
+
+    key = {"version": 1, "model": "streaming"}
+    path = cpu_weight_cache.cache_path(str(tmp_path), key)
+    cpu_weight_cache.save_weights(model, path, key)
+    assert cpu_weight_cache.load_weights(model, path, key, read_ahead=False)
+
+    CPUWeightStreamer(model, ahead=1)
+    ops.get_cpu_weight_streaming_stats(reset=True)
+    for _ in range(2):
+        out = x
+        for layer in model.layers:
+            out = layer(out)
+        torch.testing.assert_close(out, expected)
+
+    stats = ops.get_cpu_weight_streaming_stats()
+    assert [s["layer"] for s in stats] == [0, 1, 2, 3]
+    for s in stats:
+        assert s["waits"] == 2 and s["bytes"] >= 256 * 256 * 4
+        assert 0 <= s["stalls"] <= s["waits"] and s["fetches"] >= 1
+
+
+@torch.inference_mode()
+def test_cpu_caching_allocator() -> None:
+    ops.enable_cpu_caching_allocator()
+    sizes = [(1 << 20) + 3, 3 * (1 << 20), 40 << 20]
+
+    def step() -> None:
+        tensors = [torch.empty(size, dtype=torch.uint8) for size in sizes]
+        for t in tensors:
+            t.fill_(1)
+        assert all(t.sum().item() == t.numel() for t in tensors)
+
+    step()
+    before = ops.get_cpu_allocator_stats(reset_peak=True)
+    step()
+    after = ops.get_cpu_allocator_stats()
+    # A repeated step reuses the cached blocks without mapping memory.
+    assert after["maps"] == before["maps"]
+    assert after["cache_hits"] - before["cache_hits"] >= len(sizes)
+    assert after["peak_allocated_bytes"] >= sum(sizes)
+    assert after["cached_bytes"] <= after["reserved_bytes"]
+    assert 0.0 <= after["fragmentation"] <= 1.0
+
+    # Blocks above the size classes are unmapped when freed.
+    torch.empty(100 << 20, dtype=torch.uint8)
+    large = ops.get_cpu_allocator_stats()
+    assert large["maps"] == after["maps"] + 1
+    assert large["unmaps"] == after["unmaps"] + 1
+    assert large["cached_bytes"] == after["cached_bytes"]
+
+    ops.empty_cpu_allocator_cache()
+    stats = ops.get_cpu_allocator_stats()
+    assert stats["cached_bytes"] == 0
+    assert stats["unmaps"] > large["unmaps"]
+
+
+@torch.inference_mode()
+def test_cpu_workspace_reuse() -> None:
+    from vllm.attention.ops.paged_attn import PagedAttention
+
+    num_seqs, num_heads, num_kv_heads, head_size = 4, 8, 2, 128
+    block_size, num_blocks, max_seq_len = 16, 512, 1500
+    x = 16 // torch.tensor([], dtype=torch.float).element_size()
+    query = torch.randn(num_seqs, num_heads, head_size) * 0.1
+    key_cache = torch.randn(num_blocks, num_kv_heads, head_size // x,
+                            block_size, x)
+    value_cache = torch.randn(num_blocks, num_kv_heads, head_size, block_size)
+    max_num_blocks = (max_seq_len + block_size - 1) // block_size
+    block_tables = torch.randint(0,
+                                 num_blocks, (num_seqs, max_num_blocks),
+                                 dtype=torch.int)
+    seq_lens = torch.tensor([max_seq_len, 700, 33, 1], dtype=torch.int)
+
+    def step(use_v1: bool) -> torch.Tensor:
+        return PagedAttention.forward_decode(query,
+                                             key_cache,
+                                             value_cache,
+                                             block_tables,
+                                             seq_lens,
+                                             max_seq_len,
+                                             "auto",
+                                             num_kv_heads,
+                                             head_size**-0.5,
+                                             None,
+                                             1.0,
+                                             1.0,
+                                             use_v1=use_v1,
+                                             partition_size=256)
+
+    ref = step(use_v1=True)
+    out = step(use_v1=False)
+    torch.testing.assert_close(out, ref, atol=1e-4, rtol=1e-4)
+
+    # Later steps and layers reuse the buffers grown by the first ones.
+    before = ops.get_cpu_workspace_stats()
+    for _ in range(3):
+        step(use_v1=True)
+        step(use_v1=False)
+    after = ops.get_cpu_workspace_stats()
+    assert after["grows"] == before["grows"]
+    assert after["reserved_bytes"] == before["reserved_bytes"] > 0
@@ -0,0 +1,111 @@
+"""Tests for the thread subteams of the CPU kernels in
+csrc/cpu/thread_subteams.cpp.
+
+Run `pytest tests/kernels/test_cpu_thread_subteams.py`.
+"""
+import multiprocessing
+import os
+import random
+
+import pytest
+import torch
+
+from vllm import _custom_ops as ops
+from vllm.utils import create_kv_caches_with_random, is_cpu, seed_everything
+
+pytestmark = pytest.mark.skipif(not is_cpu(), reason="CPU backend only")
+
+NUM_BLOCKS = 64
+BLOCK_SIZE = 16
+NUM_HEADS = 8
+NUM_KV_HEADS = 2
+HEAD_SIZE = 64
+HIDDEN_SIZE = 256
+
+
+@torch.inference_mode()
+def _run_kernels(num_seqs: int):
+    """Outputs of the kernels which run on the subteams, for a decode batch
+    of num_seqs sequences."""
+    seed_everything(0)
+    random.seed(num_seqs)
+    dtype = torch.bfloat16
+    hidden = torch.randn(num_seqs, HIDDEN_SIZE, dtype=dtype)
+    weight = torch.randn(HIDDEN_SIZE, dtype=dtype)
+    normed = torch.empty_like(hidden)
+    ops.rms_norm(normed, hidden, weight, 1e-6)
+    residual = torch.randn_like(hidden)
+    ops.fused_add_rms_norm(hidden, residual, weight, 1e-6)
+    gate_up = torch.randn(num_seqs, 2 * HIDDEN_SIZE, dtype=dtype)
+    act = torch.empty_like(hidden)
+    ops.silu_and_mul(act, gate_up)
+
+    max_blocks = NUM_BLOCKS // num_seqs
+    seq_lens = [
+        random.randint(1, max_blocks * BLOCK_SIZE) for _ in range(num_seqs)
+    ]
+    block_tables = torch.tensor(random.sample(range(NUM_BLOCKS),
+                                              num_seqs * max_blocks),
+                                dtype=torch.int).view(num_seqs, max_blocks)
+    positions = torch.tensor([seq_len - 1 for seq_len in seq_lens])
+    slot_mapping = torch.tensor([
+        block_tables[i, pos // BLOCK_SIZE].item() * BLOCK_SIZE +
+        pos % BLOCK_SIZE for i, pos in enumerate(positions.tolist())
+    ])
+    query = torch.randn(num_seqs, NUM_HEADS * HEAD_SIZE, dtype=dtype)
+    key = torch.randn(num_seqs, NUM_KV_HEADS * HEAD_SIZE, dtype=dtype)
+    value = torch.randn_like(key)
+    cos_sin_cache = torch.randn(NUM_BLOCKS * BLOCK_SIZE,
+                                HEAD_SIZE,
+                                dtype=dtype)
+    ops.rotary_embedding(positions, query, key, HEAD_SIZE, cos_sin_cache,
+                         True)
+    key_caches, value_caches = create_kv_caches_with_random(
+        NUM_BLOCKS, BLOCK_SIZE, 1, NUM_KV_HEADS, HEAD_SIZE, "auto", dtype, 0,
+        "cpu")
+    key_cache, value_cache = key_caches[0], value_caches[0]
+    ops.reshape_and_cache(key.view(-1, NUM_KV_HEADS, HEAD_SIZE),
+                          value.view(-1, NUM_KV_HEADS, HEAD_SIZE), key_cache,
+                          value_cache, slot_mapping, "auto", 1.0, 1.0)
+    out = torch.empty(num_seqs, NUM_HEADS, HEAD_SIZE, dtype=dtype)
+    ops.paged_attention_v1(out, query.view(-1, NUM_HEADS, HEAD_SIZE),
+                           key_cache, value_cache, NUM_KV_HEADS,
+                           HEAD_SIZE**-0.5, block_tables,
+                           torch.tensor(seq_lens, dtype=torch.int),
+                           BLOCK_SIZE, max(seq_lens), None, "auto", 1.0, 1.0)
+    return [normed, hidden, residual, act, query, key, key_cache, out]
+
+
+def _subteams_worker(cpu_ids: str) -> None:
+    torch.ops._C_utils.init_cpu_threads_env(cpu_ids)
+    num_threads = torch.get_num_threads()
+    for subteams in ["l2", "l3"]:
+        groups = ops.set_cpu_thread_subteams(subteams)
+        assert len(groups) == num_threads
+        assert sorted(set(groups)) == list(range(len(set(groups))))
+        for num_seqs in [1, 3, 16]:
+            ops.set_cpu_thread_subteams("none")
+            expected = _run_kernels(num_seqs)
+            ops.set_cpu_thread_subteams(subteams)
+            # Every item is computed as on the whole team.
+            for actual, reference in zip(_run_kernels(num_seqs), expected):
+                assert torch.equal(actual, reference)
+
+    # The barrier wait at the end of the kernels is profiled.
+    ops.collect_cpu_kernel_stats()
+    ops.set_cpu_kernel_profiling(1)
+    _run_kernels(3)
+    ops.set_cpu_kernel_profiling(0)
+    stats = {s["kernel"]: s for s in ops.collect_cpu_kernel_stats()}
+    assert stats["rms_norm_impl"]["barrier_total_ns"] >= 0
+    ops.set_cpu_thread_subteams("none")
+
+
+def test_cpu_thread_subteams() -> None:
+    cpu_ids = ",".join(map(str, sorted(os.sched_getaffinity(0))))
+    # Binding the threads and the memory of the process stays in the child.
+    ctx = multiprocessing.get_context("spawn")
+    process = ctx.Process(target=_subteams_worker, args=(cpu_ids, ))
+    process.start()
+    process.join()
+    assert process.exitcode == 0
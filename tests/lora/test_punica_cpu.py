@@ -0,0 +1,104 @@
+"""
+Tests for the CPU BGMV/SGMV LoRA kernels in csrc/cpu/lora.cpp against the
+torch reference implementation.
+"""
+import pytest
+import torch
+
+from vllm import _custom_ops as ops
+from vllm.utils import is_cpu, seed_everything
+
+from .utils import generate_data, ref_torch_groupgemm
+
+HIDDEN_SIZES = [4096]
+BATCHES = [1, 4, 16]
+NUM_LORA = [1, 8]
+DTYPES = [torch.float32, torch.bfloat16]
+MAX_RANKS = [8, 16, 64]
+SCALES = [0.5]
+SEED = [0]
+
+
+def assert_close(a, b):
+    rtol, atol = {
+        torch.bfloat16: (6e-2, 6e-2),
+        torch.float32: (1e-2, 1e-2),
+    }[a.dtype]
+    torch.testing.assert_close(a, b, rtol=rtol, atol=atol)
+
+
+@pytest.mark.skipif(not is_cpu(), reason="CPU backend only")
+@pytest.mark.parametrize("batches", BATCHES)
+@pytest.mark.parametrize("num_loras", NUM_LORA)
+@pytest.mark.parametrize("rank", MAX_RANKS)
+@pytest.mark.parametrize("hidden_size", HIDDEN_SIZES)
+@pytest.mark.parametrize("scaling", SCALES)
+@pytest.mark.parametrize("dtype", DTYPES)
+@pytest.mark.parametrize("op_type", ["shrink", "expand"])
+@pytest.mark.parametrize("seq_length", [1, 32])
+@pytest.mark.parametrize("seed", SEED)
+@torch.inference_mode()
+def test_punica_cpu(
+    batches: int,
+    num_loras: int,
+    rank: int,
+    hidden_size: int,
+    scaling: float,
+    dtype: torch.dtype,
+    op_type: str,
+    seq_length: int,
+    seed: int,
+):
+    seed_everything(seed)
+    (
+        inputs_tensor,
+        lora_weights,
+        our_out_tensor,
+        ref_out_tensor,
+        b_seq_start_loc,
+        lora_indices_tensor,
+        seq_len_tensor,
+        indices,
+    ) = generate_data(
+        batches,
+        hidden_size,
+        num_loras,
+        rank,
+        seq_length,
+        dtype,
+        op_type,
+        "cpu",
+    )
+    # Decode batches (one token per sequence) go through the BGMV path,
+    # prefill batches through the segmented SGMV path.
+    if op_type == "shrink":
+        if seq_length == 1:
+            ops.bgmv_shrink(inputs_tensor, lora_weights, our_out_tensor,
+                            indices, scaling)
+        else:
+            ops.sgmv_shrink(inputs_tensor, lora_weights, our_out_tensor,
+                            b_seq_start_loc, seq_len_tensor,
+                            lora_indices_tensor, batches, seq_length,
+                            seq_len_tensor.sum().item(), scaling)
+    else:
+        if seq_length == 1:
+            ops.bgmv_expand(inputs_tensor, lora_weights, our_out_tensor,
+                            indices, add_inputs=True)
+        else:
+            ops.sgmv_expand(inputs_tensor, lora_weights, our_out_tensor,
+                            b_seq_start_loc, seq_len_tensor,
+                            lora_indices_tensor, batches, seq_length,
+                            seq_len_tensor.sum().item(), add_inputs=True)
+    ref_torch_groupgemm(
+        ref_out_tensor,
+        inputs_tensor,
+        lora_weights,
+        lora_indices_tensor,
+        seq_len_tensor,
+        batches,
+        scaling if op_type == "shrink" else 1.0,
+        op_type,
+    )
+    if op_type == "shrink":
+        ref_out_tensor = ref_out_tensor.to(torch.float32)
+    assert_close(our_out_tensor, ref_out_tensor)
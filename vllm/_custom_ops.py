@@ -1,6 +1,6 @@
 import contextlib
 import functools
-from typing import List, Optional, Tuple, Union
+from typing import Dict, List, Optional, Tuple, Union
 
 import torch
 
@@ -89,13 +89,14 @@ def paged_attention_v1(
     blocksparse_vert_stride: int = 0,
     blocksparse_block_size: int = 64,
     blocksparse_head_sliding_step: int = 0,
+    sliding_window: int = 0,
 ) -> None:
     torch.ops._C.paged_attention_v1(
         out, query, key_cache, value_cache, num_kv_heads, scale, block_tables,
         seq_lens, block_size, max_seq_len, alibi_slopes, kv_cache_dtype,
         k_scale, v_scale, tp_rank, blocksparse_local_blocks,
         blocksparse_vert_stride, blocksparse_block_size,
-        blocksparse_head_sliding_step)
+        blocksparse_head_sliding_step, sliding_window)
 
 
 def paged_attention_v2(
@@ -121,13 +122,69 @@ def paged_attention_v2(
     blocksparse_vert_stride: int = 0,
     blocksparse_block_size: int = 64,
     blocksparse_head_sliding_step: int = 0,
+    sliding_window: int = 0,
 ) -> None:
     torch.ops._C.paged_attention_v2(
         out, exp_sum, max_logits, tmp_out, query, key_cache, value_cache,
         num_kv_heads, scale, block_tables, seq_lens, block_size, max_seq_len,
         alibi_slopes, kv_cache_dtype, k_scale, v_scale, tp_rank,
         blocksparse_local_blocks, blocksparse_vert_stride,
-        blocksparse_block_size, blocksparse_head_sliding_step)
+        blocksparse_block_size, blocksparse_head_sliding_step, sliding_window)
+
+
+def paged_attention_cascade(
+    out: torch.Tensor,
+    query: torch.Tensor,
+    key_cache: torch.Tensor,
+    value_cache: torch.Tensor,
+    num_kv_heads: int,
+    scale: float,
+    block_tables: torch.Tensor,
+    seq_lens: torch.Tensor,
+    block_size: int,
+    max_seq_len: int,
+    alibi_slopes: Optional[torch.Tensor],
+    kv_cache_dtype: str,
+    k_scale: float,
+    v_scale: float,
+    prefix_group_ids: Optional[torch.Tensor] = None,
+    min_shared_blocks: int = 1,
+) -> None:
+    torch.ops._C.paged_attention_cascade(out, query, key_cache, value_cache,
+                                         num_kv_heads, scale, block_tables,
+                                         seq_lens, block_size, max_seq_len,
+                                         alibi_slopes, kv_cache_dtype,
+                                         k_scale, v_scale, prefix_group_ids,
+                                         min_shared_blocks)
+
+
+def paged_attention_multi_query(
+    out: torch.Tensor,
+    query: torch.Tensor,
+    key_cache: torch.Tensor,
+    value_cache: torch.Tensor,
+    num_kv_heads: int,
+    scale: float,
+    block_tables: torch.Tensor,
+    seq_lens: torch.Tensor,
+    block_size: int,
+    max_seq_len: int,
+    alibi_slopes: Optional[torch.Tensor],
+    kv_cache_dtype: str,
+    k_scale: float,
+    v_scale: float,
+    tp_rank: int = 0,
+    blocksparse_local_blocks: int = 0,
+    blocksparse_vert_stride: int = 0,
+    blocksparse_block_size: int = 64,
+    blocksparse_head_sliding_step: int = 0,
+) -> None:
+    torch.ops._C.paged_attention_multi_query(
+        out, query, key_cache, value_cache, num_kv_heads, scale, block_tables,
+        seq_lens, block_size, max_seq_len, alibi_slopes, kv_cache_dtype,
+        k_scale, v_scale, tp_rank, blocksparse_local_blocks,
+        blocksparse_vert_stride, blocksparse_block_size,
+        blocksparse_head_sliding_step)
 
 
 def paged_attention_rocm(
@@ -190,6 +247,381 @@ def fused_add_rms_norm(input: torch.Tensor, residual: torch.Tensor,
     torch.ops._C.fused_add_rms_norm(input, residual, weight, epsilon)
 
 
+# fused decoder layer (CPU backend)
+def llama_decoder_layer(hidden_states: torch.Tensor, residual: torch.Tensor,
+                        add_residual: bool, positions: torch.Tensor,
+                        weights: List[torch.Tensor], epsilon: float,
+                        cos_sin_cache: torch.Tensor, is_neox: bool,
+                        key_cache: torch.Tensor, value_cache: torch.Tensor,
+                        slot_mapping: torch.Tensor, block_tables: torch.Tensor,
+                        seq_lens: torch.Tensor, num_heads: int,
+                        scale: float) -> None:
+    torch.ops._C.llama_decoder_layer(hidden_states, residual, add_residual,
+                                     positions, weights, epsilon,
+                                     cos_sin_cache, is_neox, key_cache,
+                                     value_cache, slot_mapping, block_tables,
+                                     seq_lens, num_heads, scale)
+
+
+# lora ops (CPU backend), with the same signatures as vllm.lora.ops
+def bgmv_shrink(inputs: torch.Tensor,
+                lora_a_weights: torch.Tensor,
+                output_tensor: torch.Tensor,
+                lora_indices_tensor: torch.Tensor,
+                scaling: float = 1.0) -> None:
+    torch.ops._C.bgmv_shrink(output_tensor, inputs, lora_a_weights,
+                             lora_indices_tensor, scaling)
+
+
+def bgmv_expand(inputs: torch.Tensor,
+                lora_b_weights: torch.Tensor,
+                output_tensor: torch.Tensor,
+                lora_indices_tensor: torch.Tensor,
+                add_inputs: bool = True) -> None:
+    torch.ops._C.bgmv_expand_slice(output_tensor, inputs, lora_b_weights,
+                                   lora_indices_tensor, 0,
+                                   lora_b_weights.size(-2), add_inputs)
+
+
+def bgmv_expand_slice(inputs: torch.Tensor,
+                      lora_b_weights: torch.Tensor,
+                      output_tensor: torch.Tensor,
+                      lora_indices_tensor: torch.Tensor,
+                      slice_offset: int,
+                      slice_size: int,
+                      add_inputs: bool = True) -> None:
+    torch.ops._C.bgmv_expand_slice(output_tensor, inputs, lora_b_weights,
+                                   lora_indices_tensor, slice_offset,
+                                   slice_size, add_inputs)
+
+
+def sgmv_shrink(inputs: torch.Tensor, lora_a_weights: torch.Tensor,
+                output_tensor: torch.Tensor, b_seq_start_loc: torch.Tensor,
+                seq_len_tensor: torch.Tensor,
+                lora_indices_tensor: torch.Tensor, batches: int,
+                max_seq_length: int, token_nums: int,
+                scaling: float) -> None:
+    torch.ops._C.sgmv_shrink(output_tensor, inputs, lora_a_weights,
+                             b_seq_start_loc, seq_len_tensor,
+                             lora_indices_tensor, scaling)
+
+
+def sgmv_expand(inputs: torch.Tensor,
+                lora_b_weights: torch.Tensor,
+                output_tensor: torch.Tensor,
+                b_seq_start_loc: torch.Tensor,
+                seq_len_tensor: torch.Tensor,
+                lora_indices_tensor: torch.Tensor,
+                batches: int,
+                max_seq_length: int,
+                token_nums: int,
+                add_inputs: bool = False) -> None:
+    torch.ops._C.sgmv_expand_slice(output_tensor, inputs, lora_b_weights,
+                                   b_seq_start_loc, seq_len_tensor,
+                                   lora_indices_tensor, 0,
+                                   lora_b_weights.size(-2), add_inputs)
+
+
+def sgmv_expand_slice(inputs: torch.Tensor,
+                      lora_b_weights: torch.Tensor,
+                      output_tensor: torch.Tensor,
+                      b_seq_start_loc: torch.Tensor,
+                      seq_len_tensor: torch.Tensor,
+                      lora_indices_tensor: torch.Tensor,
+                      batches: int,
+                      max_seq_length: int,
+                      token_nums: int,
+                      slice_offset: int,
+                      slice_size: int,
+                      add_inputs: bool = False) -> None:
+    torch.ops._C.sgmv_expand_slice(output_tensor, inputs, lora_b_weights,
+                                   b_seq_start_loc, seq_len_tensor,
+                                   lora_indices_tensor, slice_offset,
+                                   slice_size, add_inputs)
+
+
+# conversion ops (CPU backend)
+def convert_bf16_to_fp32(out: torch.Tensor, input: torch.Tensor) -> None:
+    torch.ops._C.convert_bf16_to_fp32(out, input)
+
+
+def convert_fp32_to_bf16(out: torch.Tensor, input: torch.Tensor) -> None:
+    torch.ops._C.convert_fp32_to_bf16(out, input)
+
+
+def copy_contiguous(out: torch.Tensor, input: torch.Tensor) -> None:
+    torch.ops._C.copy_contiguous(out, input)
+
+
+# src_format of convert_le_weight by the encoding of the source tensor. int4
+# packs two two's complement values per byte, the low nibble first.
+CPU_LE_FORMATS = {"bf16": 0, "fp16": 1, "fp32": 2, "int8": 3, "int4": 4}
+
+
+def convert_le_weight(out: torch.Tensor,
+                      input: torch.Tensor,
+                      src_format: str,
+                      verify: bool = False) -> int:
+    """Converts the uint8 bytes of a little-endian tensor, e.g. a view of a
+    mapped checkpoint, into a contiguous float or bfloat16 tensor in host
+    byte order, byte-swapping on big-endian hosts. With verify, returns the
+    number of elements that differ from the reference conversion, 0
+    otherwise."""
+    return torch.ops._C.convert_le_weight(out, input,
+                                          CPU_LE_FORMATS[src_format], verify)
+
+
+def cpu_convert_(out: torch.Tensor, input: torch.Tensor) -> bool:
+    """Copies a contiguous tensor into a contiguous one of the same type, or
+    a BF16 (FP32) one into an FP32 (BF16) one, with the parallel conversion
+    ops, e.g. to load a BF16 checkpoint into an FP32 model or to cast the KV
+    cache. Returns False, leaving `out` untouched, for any other pair of
+    tensors."""
+    if (out.device.type != "cpu" or input.device.type != "cpu"
+            or out.numel() != input.numel() or not out.is_contiguous()
+            or not input.is_contiguous()):
+        return False
+    if out.dtype == input.dtype:
+        copy_contiguous(out, input)
+        return True
+    if out.dtype == torch.float and input.dtype == torch.bfloat16:
+        convert_bf16_to_fp32(out, input)
+        return True
+    if out.dtype == torch.bfloat16 and input.dtype == torch.float:
+        convert_fp32_to_bf16(out, input)
+        return True
+    return False
+
+
+_CPU_KERNEL_STATS_COLUMNS = ("shape_bucket", "calls", "total_ns", "max_ns",
+                             "bytes", "imbalance_total_ns",
+                             "imbalance_max_ns", "cycles", "instructions",
+                             "l1d_misses", "llc_misses", "stall_cycles",
+                             "barrier_total_ns")
+
+
+def set_cpu_kernel_profiling(level: int) -> None:
+    torch.ops._C_utils.set_cpu_kernel_profiling(level)
+
+
+def collect_cpu_kernel_stats() -> List[Dict[str, Union[str, int, float]]]:
+    """Returns the stats of each (kernel, shape bucket) recorded since the
+    last call and resets them. With hardware counters (profiling level 3)
+    the IPC, L1D/LLC misses per kilo-instruction and the share of stalled
+    cycles are derived as well."""
+    names, stats = torch.ops._C_utils.collect_cpu_kernel_stats()
+    results: List[Dict[str, Union[str, int, float]]] = []
+    for name, row in zip(names, stats.tolist()):
+        values: Dict[str, int] = dict(zip(_CPU_KERNEL_STATS_COLUMNS, row))
+        result: Dict[str, Union[str, int, float]] = dict(kernel=name)
+        result.update(values)
+        cycles, instructions = values["cycles"], values["instructions"]
+        if cycles > 0 and instructions > 0:
+            result["ipc"] = instructions / cycles
+            result["l1d_mpki"] = 1000 * values["l1d_misses"] / instructions
+            result["llc_mpki"] = 1000 * values["llc_misses"] / instructions
+            result["stall_ratio"] = values["stall_cycles"] / cycles
+        results.append(result)
+    return results
+
+
+# kernel tuning (CPU backend)
+def set_cpu_kernel_config(kernel: str, shape_key: List[int],
+                          config: List[int]) -> None:
+    torch.ops._C_utils.set_cpu_kernel_config(kernel, shape_key, config)
+
+
+def clear_cpu_kernel_configs() -> None:
+    torch.ops._C_utils.clear_cpu_kernel_configs()
+
+
+def set_cpu_prefetch_distance(distance: int) -> None:
+    torch.ops._C_utils.set_cpu_prefetch_distance(distance)
+
+
+CPU_THREAD_SUBTEAMS = {"none": 0, "l2": 2, "l3": 3}
+
+
+def set_cpu_thread_subteams(subteams: str) -> List[int]:
+    """Runs the attention and per-token CPU kernels on subteams of the
+    OpenMP threads sharing an L2 ("l2") or L3 ("l3") cache, or on the whole
+    team ("none"). The threads must be bound to their CPUs. Returns the
+    subteam of each OpenMP thread."""
+    return torch.ops._C_utils.set_cpu_thread_subteams(
+        CPU_THREAD_SUBTEAMS[subteams])
+
+
+# KV cache memory (CPU backend)
+CPU_HUGE_PAGES = {"none": 0, "thp": 1, "hugetlb": 2}
+
+
+def allocate_cpu_kv_cache(num_bytes: int,
+                          huge_pages: str = "hugetlb",
+                          numa_node: int = -1) -> torch.Tensor:
+    """Returns a uint8 tensor of num_bytes of zeroed, pre-faulted memory on
+    numa_node (-1 for the node of the calling thread), backed by pages of
+    the hugetlbfs pool ("hugetlb", falling back to transparent huge pages),
+    transparent huge pages ("thp") or base pages ("none")."""
+    return torch.ops._C_utils.allocate_cpu_kv_cache(
+        num_bytes, CPU_HUGE_PAGES[huge_pages], numa_node)
+
+
+def map_cpu_weights_file(path: str, read_ahead: bool = True) -> torch.Tensor:
+    """Maps a checkpoint file copy-on-write into a uint8 tensor. Its views
+    read the weights from the page cache, without copying them into
+    anonymous memory. With read_ahead the kernel starts reading the whole
+    file. The file stays mapped while any view is alive."""
+    return torch.ops._C_utils.map_cpu_weights_file(path, read_ahead)
+
+
+_CPU_WEIGHT_STREAMING_STATS_COLUMNS = ("layer", "bytes", "waits", "stalls",
+                                       "stall_total_ns", "stall_max_ns",
+                                       "fetches", "fetch_total_ns")
+
+
+def register_cpu_streamed_layer(layer: int,
+                                weights: List[torch.Tensor]) -> None:
+    torch.ops._C_utils.register_cpu_streamed_layer(layer, weights)
+
+
+def prefetch_cpu_streamed_layer(layer: int) -> None:
+    torch.ops._C_utils.prefetch_cpu_streamed_layer(layer)
+
+
+def wait_cpu_streamed_layer(layer: int) -> int:
+    return torch.ops._C_utils.wait_cpu_streamed_layer(layer)
+
+
+def release_cpu_streamed_layer(layer: int) -> None:
+    torch.ops._C_utils.release_cpu_streamed_layer(layer)
+
+
+def get_cpu_weight_streaming_stats(
+        reset: bool = False) -> List[Dict[str, Union[int, float]]]:
+    """Returns the I/O stats of each streamed layer: the waits for the layer
+    before computing it, the ones that stalled because it was not resident
+    yet and how long, and the background reads of the layer, with the
+    derived share of waits that stalled and the read bandwidth."""
+    stats = torch.ops._C_utils.get_cpu_weight_streaming_stats(reset)
+    results: List[Dict[str, Union[int, float]]] = []
+    for row in stats.tolist():
+        result: Dict[str, Union[int, float]] = dict(
+            zip(_CPU_WEIGHT_STREAMING_STATS_COLUMNS, row))
+        if result["waits"] > 0:
+            result["stall_ratio"] = result["stalls"] / result["waits"]
+            result["mean_stall_us"] = (result["stall_total_ns"] /
+                                       result["waits"] / 1e3)
+        if result["fetch_total_ns"] > 0:
+            result["fetch_gbps"] = (result["bytes"] * result["fetches"] /
+                                    result["fetch_total_ns"])
+        results.append(result)
+    return results
+
+
+# shared memory broadcast (CPU backend)
+_CPU_SHM_RING_STATS_COLUMNS = ("messages", "bytes", "waits", "sleeps",
+                               "wait_total_ns", "wait_max_ns")
+
+
+def create_cpu_shm_ring(name: str, num_readers: int, num_slots: int,
+                        slot_bytes: int, spin_us: int) -> int:
+    return torch.ops._C_utils.create_cpu_shm_ring(name, num_readers,
+                                                  num_slots, slot_bytes,
+                                                  spin_us)
+
+
+def open_cpu_shm_ring(name: str, reader: int, spin_us: int) -> int:
+    return torch.ops._C_utils.open_cpu_shm_ring(name, reader, spin_us)
+
+
+def unlink_cpu_shm_ring(ring: int) -> None:
+    torch.ops._C_utils.unlink_cpu_shm_ring(ring)
+
+
+def close_cpu_shm_ring(ring: int) -> None:
+    torch.ops._C_utils.close_cpu_shm_ring(ring)
+
+
+def cpu_shm_ring_send(ring: int, header: torch.Tensor,
+                      tensors: List[torch.Tensor]) -> bool:
+    return torch.ops._C_utils.cpu_shm_ring_send(ring, header, tensors)
+
+
+def cpu_shm_ring_recv(ring: int) -> Tuple[torch.Tensor, List[torch.Tensor]]:
+    return torch.ops._C_utils.cpu_shm_ring_recv(ring)
+
+
+def get_cpu_shm_ring_stats(
+        ring: int,
+        reset: bool = False) -> Dict[str, Union[int, float]]:
+    """Returns the messages and bytes the calling side of a ring sent or
+    received, and its waits for the other side with the ones that slept on
+    the futex and the mean wait."""
+    result: Dict[str, Union[int, float]] = dict(
+        zip(_CPU_SHM_RING_STATS_COLUMNS,
+            torch.ops._C_utils.get_cpu_shm_ring_stats(ring, reset)))
+    if result["waits"] > 0:
+        result["mean_wait_us"] = (result["wait_total_ns"] / result["waits"] /
+                                  1e3)
+    return result
+
+
+def get_cpu_vec_op_isa() -> str:
+    """Returns the vector ISA the CPU kernels were built for, e.g. "avx512"
+    or "vxe"."""
+    return torch.ops._C_utils.get_cpu_vec_op_isa()
+
+
+def get_cpu_memory_placement(tensor: torch.Tensor) -> Tuple[int, int, int]:
+    """Returns the page size, the bytes backed by huge pages and the NUMA
+    node (-1 if unknown) of the memory of a CPU tensor."""
+    page_size, huge_page_bytes, numa_node = (
+        torch.ops._C_utils.get_cpu_memory_placement(tensor))
+    return page_size, huge_page_bytes, numa_node
+
+
+# caching allocator (CPU backend)
+_CPU_ALLOCATOR_STATS_COLUMNS = ("allocated_bytes", "peak_allocated_bytes",
+                                "reserved_bytes", "peak_reserved_bytes",
+                                "cached_bytes", "internal_fragmentation_bytes",
+                                "allocs", "cache_hits", "maps", "unmaps")
+
+
+def enable_cpu_caching_allocator() -> None:
+    torch.ops._C_utils.enable_cpu_caching_allocator()
+
+
+def empty_cpu_allocator_cache() -> None:
+    torch.ops._C_utils.empty_cpu_allocator_cache()
+
+
+def get_cpu_allocator_stats(
+        reset_peak: bool = False) -> Dict[str, Union[int, float]]:
+    """Returns the stats of the CPU caching allocator. Byte counts cover the
+    blocks it caches (64 KiB and larger). The fragmentation is the share of
+    the reserved bytes which is cached or lost to size class rounding."""
+    stats: Dict[str, Union[int, float]] = dict(
+        zip(_CPU_ALLOCATOR_STATS_COLUMNS,
+            torch.ops._C_utils.get_cpu_allocator_stats(reset_peak)))
+    reserved = stats["reserved_bytes"]
+    stats["fragmentation"] = (
+        (stats["cached_bytes"] + stats["internal_fragmentation_bytes"]) /
+        reserved if reserved > 0 else 0.0)
+    return stats
+
+
+_CPU_WORKSPACE_STATS_COLUMNS = ("reserved_bytes", "peak_reserved_bytes",
+                                "grows")
+
+
+def get_cpu_workspace_stats() -> Dict[str, int]:
+    """Returns the stats of the per-thread scratch buffers of the CPU
+    kernels. grows stays constant once the buffers fit the largest step."""
+    return dict(
+        zip(_CPU_WORKSPACE_STATS_COLUMNS,
+            torch.ops._C_utils.get_cpu_workspace_stats()))
+
+
 def advance_step_flashattn(num_seqs: int, num_queries: int, block_size: int,
                            input_tokens: torch.Tensor,
                            sampled_token_ids: torch.Tensor,
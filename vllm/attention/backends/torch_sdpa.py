@@ -9,19 +9,50 @@ from torch.serialization import LoadEndianness
 #torch.serialization.set_default_load_endianness('native')
 torch.serialization.set_default_load_endianness(LoadEndianness.LITTLE)
 
+import vllm.envs as envs
+from vllm import _custom_ops as ops
 from vllm.attention.backends.abstract import (AttentionBackend, AttentionImpl,
                                               AttentionMetadata, AttentionType)
 from vllm.attention.backends.utils import CommonAttentionState
 from vllm.attention.ops.paged_attn import PagedAttentionMetadata
+from vllm.distributed import (get_tensor_model_parallel_rank,
+                              get_tensor_model_parallel_world_size)
 from vllm.utils import is_cpu
+from vllm.worker import cpu_tuner
 
 if is_cpu():
     try:
         from vllm.attention.ops.ipex_attn import PagedAttention
+        _use_cascade_attention = False
+        _support_blocksparse = False
+        _support_autotune = False
+        _support_generic_head_size = False
+        _support_fused_decoder_layer = False
     except ImportError:
         from vllm.attention.ops.paged_attn import PagedAttention
+        # The cascade kernel expects the KV cache layout of the native
+        # CPU paged attention.
+        _use_cascade_attention = envs.VLLM_CPU_CASCADE_MIN_SHARED_BLOCKS > 0
+        _support_blocksparse = True
+        # Decoding dispatches on the configurations of vllm.worker.cpu_tuner.
+        _support_autotune = True
+        # Decoding falls back to a generic kernel for head sizes without a
+        # templated kernel, as long as they are multiples of 8.
+        _support_generic_head_size = True
+        # The fused decoder layer of csrc/cpu/decoder_layer.cpp writes and
+        # reads the KV cache layout of the native CPU paged attention.
+        _support_fused_decoder_layer = True
 else:
     from vllm.attention.ops.paged_attn import PagedAttention
+    _use_cascade_attention = False
+    _support_blocksparse = False
+    _support_autotune = False
+    _support_generic_head_size = False
+    _support_fused_decoder_layer = False
+
+# Head sizes with templated kernels in csrc/cpu/attention.cpp. The cascade and
+# the multi-query (block-sparse prefill) kernels exist only for these.
+_TEMPLATED_HEAD_SIZES = [64, 80, 96, 112, 128, 192, 256]
 
 
 class TorchSDPABackend(AttentionBackend):
@@ -119,9 +150,13 @@ class TorchSDPABackendImpl(AttentionImpl[TorchSDPAMetadata]):
         blocksparse_params: Optional[Dict[str, Any]] = None,
         logits_soft_cap: Optional[float] = None,
     ) -> None:
-        if blocksparse_params is not None:
+        if blocksparse_params is not None and not _support_blocksparse:
             raise ValueError(
-                "Torch SPDA does not support block-sparse attention.")
+                "Torch SPDA does not support block-sparse attention with IPEX.")
+        if blocksparse_params is not None and (alibi_slopes is not None
+                                               or sliding_window is not None):
+            raise ValueError("Torch SPDA does not support block-sparse "
+                             "attention with alibi or sliding window.")
         if logits_soft_cap is not None:
             raise ValueError("Torch SPDA does not support logits soft cap.")
         self.num_heads = num_heads
@@ -136,19 +171,40 @@ class TorchSDPABackendImpl(AttentionImpl[TorchSDPAMetadata]):
 
         assert self.num_heads % self.num_kv_heads == 0
         self.num_queries_per_kv = self.num_heads // self.num_kv_heads
+        # Kernel arguments of the local + vertical stride block-sparse
+        # pattern, empty for dense attention.
+        self.blocksparse_kwargs: Dict[str, int] = {}
+        if blocksparse_params is not None:
+            self.blocksparse_kwargs = _make_blocksparse_kwargs(
+                blocksparse_params, num_heads, num_kv_heads)
         self.need_mask = (self.alibi_slopes is not None
-                          or self.sliding_window is not None)
+                          or self.sliding_window is not None
+                          or bool(self.blocksparse_kwargs))
 
         supported_head_sizes = PagedAttention.get_supported_head_sizes()
-        if head_size not in supported_head_sizes:
+        if _support_generic_head_size:
+            if head_size % 8 != 0:
+                raise ValueError(
+                    f"Head size {head_size} is not supported by "
+                    "PagedAttention. Head sizes must be multiples of 8.")
+        elif head_size not in supported_head_sizes:
             raise ValueError(
                 f"Head size {head_size} is not supported by PagedAttention. "
                 f"Supported head sizes are: {supported_head_sizes}.")
+        self.templated_head_size = head_size in _TEMPLATED_HEAD_SIZES
         if kv_cache_dtype != "auto":
             raise NotImplementedError(
                 "Torch SDPA backend does not support FP8 KV cache. "
                 "Please use xFormers backend instead.")
 
+    def supports_fused_decoder_layer(self) -> bool:
+        """Whether ops.llama_decoder_layer() may compute the decode
+        attention of this layer, which it does without ALiBi, sliding window
+        or block-sparse pattern."""
+        return (_support_fused_decoder_layer and self.alibi_slopes is None
+                and self.sliding_window is None
+                and not self.blocksparse_kwargs)
+
     def forward(
         self,
         query: torch.Tensor,
@@ -194,7 +250,15 @@ class TorchSDPABackendImpl(AttentionImpl[TorchSDPAMetadata]):
 
         if attn_metadata.is_prompt:
             assert attn_metadata.seq_lens is not None
-            if (kv_cache is None or attn_metadata.block_tables.numel() == 0):
+            if (self.blocksparse_kwargs and kv_cache is not None
+                    and self.templated_head_size):
+                # Block-sparse prefill reads the prompt KV back from the
+                # cache so that skipped blocks are never loaded.
+                output = self._forward_blocksparse_prefill(
+                    query, key_cache, value_cache, attn_metadata, k_scale,
+                    v_scale)
+            elif (kv_cache is None
+                  or attn_metadata.block_tables.numel() == 0):
                 if self.num_kv_heads != self.num_heads:
                     key = key.repeat_interleave(self.num_queries_per_kv, dim=1)
                     value = value.repeat_interleave(self.num_queries_per_kv,
@@ -209,6 +273,11 @@ class TorchSDPABackendImpl(AttentionImpl[TorchSDPAMetadata]):
                         att_masks = _make_sliding_window_bias(
                             attn_metadata.seq_lens, self.sliding_window,
                             query.dtype)  # type: ignore
+                    elif self.blocksparse_kwargs:
+                        att_masks = _make_blocksparse_bias(
+                            attn_metadata.seq_lens, self.num_heads,
+                            self.num_kv_heads, self.blocksparse_kwargs,
+                            query.dtype)  # type: ignore
                     else:
                         att_masks = [None] * len(attn_metadata.seq_lens)
                     attn_metadata.attn_bias = att_masks
@@ -240,8 +309,35 @@ class TorchSDPABackendImpl(AttentionImpl[TorchSDPAMetadata]):
                 raise RuntimeError(
                     "Torch SDPA backend doesn't support prefix decoding.")
 
+        elif (_use_cascade_attention and self.sliding_window is None
+              and not self.blocksparse_kwargs and self.templated_head_size):
+            # Decoding run, reading KV blocks shared by several sequences
+            # (e.g. a common system prompt) once per batch.
+            output = torch.empty_like(query)
+            ops.paged_attention_cascade(
+                output,
+                query,
+                key_cache,
+                value_cache,
+                self.num_kv_heads,
+                self.scale,
+                attn_metadata.block_tables,
+                attn_metadata.seq_lens_tensor,
+                value_cache.shape[3],
+                attn_metadata.max_decode_seq_len,
+                self.alibi_slopes,
+                self.kv_cache_dtype,
+                k_scale,
+                v_scale,
+                min_shared_blocks=envs.VLLM_CPU_CASCADE_MIN_SHARED_BLOCKS,
+            )
         else:
             # Decoding run.
+            tuned_kwargs: Dict[str, Any] = {}
+            if _support_autotune and not self.blocksparse_kwargs:
+                tuned_kwargs = cpu_tuner.decode_kwargs(
+                    query, self.num_kv_heads,
+                    attn_metadata.max_decode_seq_len)
             output = PagedAttention.forward_decode(
                 query,
                 key_cache,
@@ -255,11 +351,78 @@ class TorchSDPABackendImpl(AttentionImpl[TorchSDPAMetadata]):
                 self.alibi_slopes,
                 k_scale,
                 v_scale,
+                sliding_window=self.sliding_window or 0,
+                **self.blocksparse_kwargs,
+                **tuned_kwargs,
             )
 
         # Reshape the output tensor.
         return output.view(-1, self.num_heads * self.head_size)
 
+    def _forward_blocksparse_prefill(
+        self,
+        query: torch.Tensor,
+        key_cache: torch.Tensor,
+        value_cache: torch.Tensor,
+        attn_metadata: TorchSDPAMetadata,
+        k_scale: float,
+        v_scale: float,
+    ) -> torch.Tensor:
+        assert attn_metadata.seq_lens is not None
+        output = torch.empty_like(query)
+        block_size = value_cache.shape[3]
+        start = 0
+        for seq_len in attn_metadata.seq_lens:
+            end = start + seq_len
+            # The prompt fills its blocks from the first position on, so its
+            # block table follows from the slot of every block_size-th token.
+            block_table = (attn_metadata.slot_mapping[start:end:block_size] //
+                           block_size).to(torch.int32).unsqueeze(0)
+            ops.paged_attention_multi_query(
+                output[None, start:end],
+                query[None, start:end],
+                key_cache,
+                value_cache,
+                self.num_kv_heads,
+                self.scale,
+                block_table,
+                torch.tensor([seq_len], dtype=torch.int32),
+                block_size,
+                seq_len,
+                None,
+                self.kv_cache_dtype,
+                k_scale,
+                v_scale,
+                **self.blocksparse_kwargs,
+            )
+            start = end
+        return output
+
+
+def _make_blocksparse_kwargs(
+    blocksparse_params: Dict[str, Any],
+    num_heads: int,
+    num_kv_heads: int,
+) -> Dict[str, int]:
+    # Follows BlocksparseParams of the blocksparse attention backend, which
+    # cannot be imported here as it depends on triton.
+    tp_size = get_tensor_model_parallel_world_size()
+    vert_stride = blocksparse_params["vert_stride"]
+    if blocksparse_params.get("homo_head", False):
+        head_sliding_step = 0
+    elif blocksparse_params.get("homo_head_group", False):
+        # Negative steps slide the vertical stride along the KV heads.
+        head_sliding_step = -max(1, vert_stride // (tp_size * num_kv_heads))
+    else:
+        head_sliding_step = max(1, vert_stride // (tp_size * num_heads))
+    return dict(
+        tp_rank=get_tensor_model_parallel_rank(),
+        blocksparse_local_blocks=blocksparse_params["local_blocks"],
+        blocksparse_vert_stride=vert_stride,
+        blocksparse_block_size=blocksparse_params["block_size"],
+        blocksparse_head_sliding_step=head_sliding_step,
+    )
+
 
 def _make_alibi_bias(
     alibi_slopes: torch.Tensor,
@@ -307,3 +470,40 @@ def _make_sliding_window_bias(
         attn_biases.append(mask.to(dtype))
 
     return attn_biases
+
+
+def _make_blocksparse_bias(
+    seq_lens: List[int],
+    num_heads: int,
+    num_kv_heads: int,
+    blocksparse_kwargs: Dict[str, int],
+    dtype: torch.dtype,
+) -> List[torch.Tensor]:
+    tp_rank = blocksparse_kwargs["tp_rank"]
+    local_blocks = blocksparse_kwargs["blocksparse_local_blocks"]
+    vert_stride = blocksparse_kwargs["blocksparse_vert_stride"]
+    block_size = blocksparse_kwargs["blocksparse_block_size"]
+    head_sliding_step = blocksparse_kwargs["blocksparse_head_sliding_step"]
+    head_idxs = torch.arange(num_heads)
+    if head_sliding_step >= 0:
+        head_offsets = ((tp_rank * num_heads + head_idxs) * head_sliding_step +
+                        1)
+    else:
+        kv_head_idxs = head_idxs // (num_heads // num_kv_heads)
+        head_offsets = ((tp_rank * num_kv_heads + kv_head_idxs) *
+                        (-head_sliding_step) + 1)
+
+    attn_biases: List[torch.Tensor] = []
+    for seq_len in seq_lens:
+        positions = torch.arange(seq_len)
+        block_idxs = positions // block_size
+        causal = positions[None, :] <= positions[:, None]
+        local = block_idxs[None, :] > block_idxs[:, None] - local_blocks
+        vertical = (block_idxs[None, None, :] +
+                    head_offsets[:, None, None]) % vert_stride == 0
+        mask = (local[None] | vertical) & causal[None]
+        bias = torch.zeros(mask.shape, dtype=dtype)
+        bias.masked_fill_(~mask, -torch.inf)
+        attn_biases.append(bias)
+
+    return attn_biases
@@ -68,9 +68,22 @@ class PagedAttention:
         k_scale: float,
         v_scale: float,
         *args,
+        sliding_window: int = 0,
     ) -> torch.Tensor:
         output = torch.empty_like(query)
         block_size = value_cache.shape[2]
+        if sliding_window > 0:
+            # The IPEX kernel works from the full block tables without a
+            # window, so only pass it the blocks of the last window.
+            window_blocks = sliding_window // block_size
+            num_blocks = (context_lens + block_size - 1) // block_size
+            start_blocks = (num_blocks - window_blocks).clamp(min=0)
+            block_ids = (start_blocks.view(-1, 1) + torch.arange(
+                window_blocks, dtype=start_blocks.dtype)).clamp(
+                    max=block_tables.size(1) - 1)
+            block_tables = block_tables.gather(1, block_ids.long())
+            context_lens = context_lens.clamp(max=sliding_window)
+            max_context_len = min(max_context_len, sliding_window)
         head_mapping = torch.arange(
             0,
             num_kv_heads,
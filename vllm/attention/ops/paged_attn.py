@@ -102,7 +102,13 @@ class PagedAttention:
         blocksparse_vert_stride: int = 0,
         blocksparse_block_size: int = 64,
         blocksparse_head_sliding_step: int = 0,
+        sliding_window: int = 0,
+        use_v1: Optional[bool] = None,
+        partition_size: int = _PARTITION_SIZE,
     ) -> torch.Tensor:
+        # use_v1 and partition_size override the heuristic below with tuned
+        # choices, a partition size other than _PARTITION_SIZE is only
+        # supported by the CPU kernels.
         if blocksparse_vert_stride is not None and blocksparse_vert_stride > 1:
             # use blocksparse paged attention
             block_size = value_cache.size(-1)
@@ -114,8 +120,8 @@ class PagedAttention:
         output = torch.empty_like(query)
         block_size = value_cache.shape[3]
         num_seqs, num_heads, head_size = query.shape
-        max_num_partitions = ((max_seq_len + _PARTITION_SIZE - 1) //
-                              _PARTITION_SIZE)
+        max_num_partitions = ((max_seq_len + partition_size - 1) //
+                              partition_size)
         # NOTE(woosuk): We use a simple heuristic to decide whether to use
         # PagedAttention V1 or V2. If the number of partitions is 1, we use
         # V1 to avoid the overhead of reduction. Also, if the number of
@@ -123,8 +129,9 @@ class PagedAttention:
         # to parallelize.
         # TODO(woosuk): Tune this heuristic.
         # For context len > 8192, use V2 kernel to avoid shared memory shortage.
-        use_v1 = (max_seq_len <= 8192
-                  and (max_num_partitions == 1 or num_seqs * num_heads > 512))
+        if use_v1 is None:
+            use_v1 = (max_seq_len <= 8192 and
+                      (max_num_partitions == 1 or num_seqs * num_heads > 512))
 
         if use_v1:
             # Run PagedAttention V1.
@@ -148,17 +155,22 @@ class PagedAttention:
                 blocksparse_vert_stride,
                 blocksparse_block_size,
                 blocksparse_head_sliding_step,
+                sliding_window,
             )
         else:
             # Run PagedAttention V2.
-            assert _PARTITION_SIZE % block_size == 0
+            assert partition_size % block_size == 0
+            # Given no rows, the CPU kernel borrows its reduction buffers
+            # from its workspace, exp_sums only passes the number of
+            # partitions.
+            buffer_rows = 0 if output.device.type == "cpu" else num_seqs
             tmp_output = torch.empty(
-                size=(num_seqs, num_heads, max_num_partitions, head_size),
+                size=(buffer_rows, num_heads, max_num_partitions, head_size),
                 dtype=output.dtype,
                 device=output.device,
             )
             exp_sums = torch.empty(
-                size=(num_seqs, num_heads, max_num_partitions),
+                size=(buffer_rows, num_heads, max_num_partitions),
                 dtype=torch.float32,
                 device=output.device,
             )
@@ -186,6 +198,7 @@ class PagedAttention:
                 blocksparse_vert_stride,
                 blocksparse_block_size,
                 blocksparse_head_sliding_step,
+                sliding_window,
             )
         return output
 
@@ -99,7 +99,8 @@ def get_attn_backend(
 ) -> Type[AttentionBackend]:
     """Selects which attention backend to use and lazily imports it."""
 
-    if is_blocksparse:
+    # The CPU backend runs block-sparse attention in its native kernels.
+    if is_blocksparse and not is_cpu():
         logger.info("Using BlocksparseFlashAttention backend.")
         from vllm.attention.backends.blocksparse_attn import (
             BlocksparseFlashAttentionBackend)
@@ -0,0 +1,127 @@
+"""Shared memory broadcast of the model inputs between CPU workers.
+
+The driver worker broadcasts the inputs of every step to the other tensor
+parallel ranks. Over gloo that pickles the whole dict, broadcasts it and
+then broadcasts every tensor through the sockets. CPUShmBroadcaster sends
+all of it through a native ring of message slots in shared memory instead,
+see csrc/cpu/shm_broadcast.cpp: the driver copies the pickled metadata and
+the tensors into the next slot, and the other ranks use the tensors in
+place. A rank waiting for the next step spins for
+VLLM_CPU_SHM_BROADCAST_SPIN_US and then sleeps on a futex.
+
+The received tensors are read-only and only valid until the next receive,
+which holds for the inputs of a step.
+"""
+import os
+import pickle
+import uuid
+from typing import Any, Dict, Optional, Union
+
+import torch
+import torch.distributed as dist
+
+from vllm import _custom_ops as ops
+from vllm.distributed.parallel_state import (GroupCoordinator,
+                                             TensorMetadata,
+                                             _split_tensor_dict,
+                                             in_the_same_node_as)
+from vllm.logger import init_logger
+
+logger = init_logger(__name__)
+
+# The driver runs at most _NUM_SLOTS - 1 steps ahead of the other ranks.
+_NUM_SLOTS = 4
+
+# Larger messages, e.g. of very large prefills, fall back to gloo.
+_SLOT_BYTES = 1 << 22
+
+# Sent instead of the metadata of a message which did not fit into a slot.
+_FALLBACK = pickle.dumps(None)
+
+
+def _as_uint8(data: bytes) -> torch.Tensor:
+    return torch.frombuffer(bytearray(data), dtype=torch.uint8)
+
+
+class CPUShmBroadcaster:
+    """Broadcasts tensor dicts from the first rank of a group to the others,
+    which must all be on its host."""
+
+    def __init__(self,
+                 group: GroupCoordinator,
+                 spin_us: int,
+                 num_slots: int = _NUM_SLOTS,
+                 slot_bytes: int = _SLOT_BYTES) -> None:
+        self.group = group
+        self.is_writer = group.rank_in_group == 0
+        name = [None]
+        if self.is_writer:
+            name[0] = f"/vllm_cpu_bcast_{os.getpid()}_{uuid.uuid4().hex[:8]}"
+            self.ring = ops.create_cpu_shm_ring(name[0],
+                                                group.world_size - 1,
+                                                num_slots, slot_bytes,
+                                                spin_us)
+        dist.broadcast_object_list(name,
+                                   src=group.first_rank,
+                                   group=group.cpu_group)
+        if not self.is_writer:
+            self.ring = ops.open_cpu_shm_ring(name[0],
+                                              group.rank_in_group - 1,
+                                              spin_us)
+        # The segment is freed with the last mapping of it, even if a rank
+        # dies.
+        dist.barrier(group=group.cpu_group)
+        if self.is_writer:
+            ops.unlink_cpu_shm_ring(self.ring)
+
+    @staticmethod
+    def create(group: GroupCoordinator,
+               spin_us: int) -> Optional["CPUShmBroadcaster"]:
+        """A broadcaster of group, or None if not all of its ranks are on
+        the host of its first rank. Collective over group."""
+        if group.world_size == 1:
+            return None
+        if not all(in_the_same_node_as(group.cpu_group, source_rank=0)):
+            logger.info("Not all ranks of the %s group are on one host, "
+                        "broadcasting the model inputs over gloo",
+                        group.unique_name)
+            return None
+        return CPUShmBroadcaster(group, spin_us)
+
+    def broadcast_tensor_dict(
+        self,
+        tensor_dict: Optional[Dict[str, Union[torch.Tensor, Any]]] = None
+    ) -> Optional[Dict[str, Union[torch.Tensor, Any]]]:
+        """GroupCoordinator.broadcast_tensor_dict() from the first rank."""
+        if self.is_writer:
+            assert tensor_dict is not None
+            metadata_list, tensor_list = _split_tensor_dict(tensor_dict)
+            header = _as_uint8(
+                pickle.dumps(metadata_list, protocol=pickle.HIGHEST_PROTOCOL))
+            tensors = [tensor.contiguous() for tensor in tensor_list]
+            if not ops.cpu_shm_ring_send(self.ring, header, tensors):
+                ops.cpu_shm_ring_send(self.ring, _as_uint8(_FALLBACK), [])
+                self.group.broadcast_tensor_dict(tensor_dict, src=0)
+            return tensor_dict
+
+        header, payloads = ops.cpu_shm_ring_recv(self.ring)
+        metadata_list = pickle.loads(header.numpy())
+        if metadata_list is None:
+            return self.group.broadcast_tensor_dict(src=0)
+        result: Dict[str, Union[torch.Tensor, Any]] = {}
+        payload_iter = iter(payloads)
+        for key, value in metadata_list:
+            if isinstance(value, TensorMetadata):
+                result[key] = next(payload_iter).view(value.dtype).view(
+                    value.size)
+            else:
+                result[key] = value
+        return result
+
+    def stats(self, reset: bool = False) -> Dict[str, Union[int, float]]:
+        """Messages sent or received by this rank and its waits for the
+        other side, see ops.get_cpu_shm_ring_stats()."""
+        return ops.get_cpu_shm_ring_stats(self.ring, reset)
+
+    def close(self) -> None:
+        ops.close_cpu_shm_ring(self.ring)
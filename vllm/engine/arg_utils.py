@@ -355,10 +355,11 @@ class EngineArgs:
         parser.add_argument('--block-size',
                             type=int,
                             default=EngineArgs.block_size,
-                            choices=[8, 16, 32],
+                            choices=[8, 16, 32, 64, 128],
                             help='Token block size for contiguous chunks of '
                             'tokens. This is ignored on neuron devices and '
-                            'set to max-model-len')
+                            'set to max-model-len. 64 and 128 are only '
+                            'supported by the CPU backend.')
 
         parser.add_argument('--enable-prefix-caching',
                             action='store_true',
@@ -871,6 +872,11 @@ class EngineArgs:
             f", but got {self.cpu_offload_gb}")
 
         device_config = DeviceConfig(device=self.device)
+        # Only the CPU attention kernels are instantiated for larger blocks.
+        if self.block_size > 32 and device_config.device_type != "cpu":
+            raise ValueError(
+                f"Block size {self.block_size} is only supported by the CPU "
+                f"backend, {device_config.device_type} supports up to 32.")
         model_config = self.create_model_config()
 
         if model_config.is_multimodal_model:
@@ -35,6 +35,23 @@ if TYPE_CHECKING:
     VLLM_PP_LAYER_PARTITION: Optional[str] = None
     VLLM_CPU_KVCACHE_SPACE: int = 0
     VLLM_CPU_OMP_THREADS_BIND: str = ""
+    VLLM_CPU_CASCADE_MIN_SHARED_BLOCKS: int = 0
+    VLLM_CPU_KERNEL_PROFILE: int = 0
+    VLLM_CPU_AUTOTUNE: int = 0
+    VLLM_CPU_TUNING_CACHE: str = os.path.join(VLLM_CACHE_ROOT,
+                                              "cpu_tuning.json")
+    VLLM_CPU_PREFETCH_DISTANCE: Optional[int] = None
+    VLLM_CPU_THREAD_SUBTEAMS: str = "none"
+    VLLM_CPU_KVCACHE_HUGE_PAGES: str = "hugetlb"
+    VLLM_CPU_CACHING_ALLOCATOR: bool = True
+    VLLM_CPU_MMAP_WEIGHTS: bool = True
+    VLLM_CPU_VERIFY_WEIGHT_CONVERSION: bool = False
+    VLLM_CPU_WEIGHT_CACHE_DIR: Optional[str] = None
+    VLLM_CPU_WEIGHT_STREAMING: bool = False
+    VLLM_CPU_WEIGHT_STREAMING_AHEAD: int = 1
+    VLLM_CPU_SHM_BROADCAST: bool = True
+    VLLM_CPU_SHM_BROADCAST_SPIN_US: int = 50
+    VLLM_CPU_FUSED_DECODER_LAYER_MAX_TOKENS: int = 0
     VLLM_OPENVINO_KVCACHE_SPACE: int = 0
     VLLM_OPENVINO_CPU_KV_CACHE_PRECISION: Optional[str] = None
     VLLM_OPENVINO_ENABLE_QUANTIZED_WEIGHTS: bool = False
@@ -301,6 +318,110 @@ environment_variables: Dict[str, Callable[[], Any]] = {
     "VLLM_CPU_OMP_THREADS_BIND":
     lambda: os.getenv("VLLM_CPU_OMP_THREADS_BIND", "all"),
 
+    # (CPU backend only) If set to a positive value, decoding uses cascade
+    # attention for sequences sharing at least this many leading KV blocks,
+    # reading the shared blocks once per batch. 0 disables it.
+    "VLLM_CPU_CASCADE_MIN_SHARED_BLOCKS":
+    lambda: int(os.getenv("VLLM_CPU_CASCADE_MIN_SHARED_BLOCKS", "0")),
+
+    # (CPU backend only) Kernel profiling level of the CPU ops. 0 disables it,
+    # 1 records call count, wall time and bytes per kernel and shape bucket,
+    # 2 additionally the imbalance between the OpenMP threads, the spread of
+    # their finish times, 3 additionally their hardware counters (cycles,
+    # instructions, cache misses, stalls) through perf_event_open.
+    "VLLM_CPU_KERNEL_PROFILE":
+    lambda: int(os.getenv("VLLM_CPU_KERNEL_PROFILE", "0")),
+
+    # (CPU backend only) If set, the CPU worker benchmarks the kernel launch
+    # configurations of the model shapes missing from VLLM_CPU_TUNING_CACHE at
+    # startup. The cached configurations are used either way.
+    "VLLM_CPU_AUTOTUNE":
+    lambda: int(os.getenv("VLLM_CPU_AUTOTUNE", "0")),
+
+    # (CPU backend only) Path of the CPU kernel tuning cache.
+    "VLLM_CPU_TUNING_CACHE":
+    lambda: os.path.expanduser(
+        os.getenv(
+            "VLLM_CPU_TUNING_CACHE",
+            os.path.join(get_default_cache_root(), "vllm", "cpu_tuning.json"),
+        )),
+
+    # (CPU backend only) How far ahead the paged attention and cache kernels
+    # prefetch KV cache blocks, 0 disables the prefetch. Paged attention
+    # counts it in blocks of a sequence, copy_blocks in block pairs and
+    # reshape_and_cache in tokens, one per sequence when decoding. Defaults
+    # to the distance the kernels were built with.
+    "VLLM_CPU_PREFETCH_DISTANCE":
+    lambda: int(os.getenv("VLLM_CPU_PREFETCH_DISTANCE", "0"))
+    if "VLLM_CPU_PREFETCH_DISTANCE" in os.environ else None,
+
+    # (CPU backend only) Runs the attention and per-token kernels on
+    # subteams of the OpenMP threads sharing an L2 ("l2") or L3 ("l3")
+    # cache, with the sequences of a batch spread over the subteams. "none"
+    # runs them on the whole team. Needs VLLM_CPU_OMP_THREADS_BIND.
+    "VLLM_CPU_THREAD_SUBTEAMS":
+    lambda: os.getenv("VLLM_CPU_THREAD_SUBTEAMS", "none").lower(),
+
+    # (CPU backend only) Pages backing the KV cache: "hugetlb" for the
+    # hugetlbfs pool of the NUMA node, falling back to transparent huge pages
+    # when it is too small, "thp" for transparent huge pages, "none" for base
+    # pages.
+    "VLLM_CPU_KVCACHE_HUGE_PAGES":
+    lambda: os.getenv("VLLM_CPU_KVCACHE_HUGE_PAGES", "hugetlb").lower(),
+
+    # (CPU backend only) If set, the CPU worker installs a caching allocator
+    # with per-NUMA-node pools of pre-faulted blocks as the CPU allocator, so
+    # that steady decoding neither maps memory nor takes page faults.
+    "VLLM_CPU_CACHING_ALLOCATOR":
+    lambda: bool(int(os.getenv("VLLM_CPU_CACHING_ALLOCATOR", "1"))),
+
+    # (CPU backend only) If set, safetensors checkpoints are mapped and the
+    # weights copied from the page cache straight into the parameters,
+    # instead of being read into intermediate tensors first.
+    "VLLM_CPU_MMAP_WEIGHTS":
+    lambda: bool(int(os.getenv("VLLM_CPU_MMAP_WEIGHTS", "1"))),
+
+    # (CPU backend only) If set, the weights byte-swapped from the
+    # little-endian checkpoint on big-endian hosts are checked against a
+    # scalar reference conversion, and loading fails on any mismatch.
+    "VLLM_CPU_VERIFY_WEIGHT_CONVERSION":
+    lambda: bool(int(os.getenv("VLLM_CPU_VERIFY_WEIGHT_CONVERSION", "0"))),
+
+    # (CPU backend only) Directory of the cache of the model weights after
+    # loading and packing. If set, the first start of a model writes the
+    # processed weights of each worker there, and later starts map them
+    # instead of loading the checkpoint.
+    "VLLM_CPU_WEIGHT_CACHE_DIR":
+    lambda: (os.path.expanduser(os.environ["VLLM_CPU_WEIGHT_CACHE_DIR"])
+             if "VLLM_CPU_WEIGHT_CACHE_DIR" in os.environ else None),
+
+    # (CPU backend only) If set, the weights of the decoder layers stay in
+    # the file of VLLM_CPU_WEIGHT_CACHE_DIR and are read layer by layer while
+    # the model runs, for models larger than the memory of the host.
+    "VLLM_CPU_WEIGHT_STREAMING":
+    lambda: bool(int(os.getenv("VLLM_CPU_WEIGHT_STREAMING", "0"))),
+
+    # (CPU backend only) Decoder layers read ahead of the computing one with
+    # VLLM_CPU_WEIGHT_STREAMING.
+    "VLLM_CPU_WEIGHT_STREAMING_AHEAD":
+    lambda: int(os.getenv("VLLM_CPU_WEIGHT_STREAMING_AHEAD", "1")),
+
+    # (CPU backend only) If set, the driver worker broadcasts the model
+    # inputs of each step to the tensor parallel ranks on the same host
+    # through a shared memory ring instead of gloo.
+    "VLLM_CPU_SHM_BROADCAST":
+    lambda: bool(int(os.getenv("VLLM_CPU_SHM_BROADCAST", "1"))),
+
+    # (CPU backend only) Microseconds the ranks of VLLM_CPU_SHM_BROADCAST
+    # spin for the next message before sleeping on a futex.
+    "VLLM_CPU_SHM_BROADCAST_SPIN_US":
+    lambda: int(os.getenv("VLLM_CPU_SHM_BROADCAST_SPIN_US", "50")),
+
+    # (CPU backend only) Decode batches of up to this many tokens run each
+    # layer of Llama models as one native op, 0 disables it.
+    "VLLM_CPU_FUSED_DECODER_LAYER_MAX_TOKENS":
+    lambda: int(os.getenv("VLLM_CPU_FUSED_DECODER_LAYER_MAX_TOKENS", "0")),
+
     # OpenVINO key-value cache space
     # default is 4GB
     "VLLM_OPENVINO_KVCACHE_SPACE":
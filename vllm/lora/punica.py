@@ -10,8 +10,12 @@ from typing import TYPE_CHECKING, Callable, List, Optional, Tuple, Union
 import torch
 
 from vllm.triton_utils import HAS_TRITON
+from vllm.utils import is_cpu
 
-if HAS_TRITON:
+if is_cpu():
+    from vllm._custom_ops import (bgmv_expand, bgmv_expand_slice, bgmv_shrink,
+                                  sgmv_expand, sgmv_expand_slice, sgmv_shrink)
+elif HAS_TRITON:
     from vllm.lora.ops.bgmv_expand import bgmv_expand
     from vllm.lora.ops.bgmv_expand_slice import bgmv_expand_slice
     from vllm.lora.ops.bgmv_shrink import bgmv_shrink
@@ -63,6 +67,7 @@ def convert_mapping(
     vocab_size: int,
     extra_vocab_size: int,
     long_lora_context: Optional["LongContextLoRAContext"] = None,
+    device: str = "cuda",
 ) -> Tuple[torch.Tensor, torch.Tensor, torch.Tensor, torch.Tensor,
            Optional[torch.Tensor], List[int]]:
     """Converts LoRAMapping to index tensors.
@@ -74,6 +79,7 @@ def convert_mapping(
         vocab_size: Model vocab size.
         extra_vocab_size: Extra vocab size each LoRA can have.
         long_lora_context: Passed if there are long context lora in a batch.
+        device: Device where the index tensors are created.
 
     Returns:
         A tuple of tensors:
@@ -104,7 +110,7 @@ def convert_mapping(
     long_lora_offsets: Optional[torch.Tensor] = None
     if long_lora_context:
         long_lora_offsets = torch.zeros(len(index_mapping_indices),
-                                        device="cuda",
+                                        device=device,
                                         dtype=torch.long)
     prompt_mapping: List[int] = [
         lora_index_to_id.index(x) if x > 0 else -1
@@ -131,9 +137,9 @@ def convert_mapping(
     if long_lora_context:
         assert long_lora_offsets is not None
         indices_list.append(long_lora_offsets)
-    indices = torch.tensor(indices_list, dtype=torch.long, device="cuda")
+    indices = torch.tensor(indices_list, dtype=torch.long, device=device)
     prompt_mapping_tensor = torch.tensor(prompt_mapping,
-                                         device="cuda",
+                                         device=device,
                                          dtype=torch.long)
     embeddings_indices = torch.stack([
         indices[2] * extra_vocab_size,
@@ -145,7 +151,7 @@ def convert_mapping(
     sampler_indices_padded = sampler_indices.clone()
     sampler_indices_padded[sampler_indices_padded == -1] = max_loras - 1
     sampler_indices_padded = torch.arange(
-        0, len(sampler_indices_padded), device="cuda", dtype=torch.long) + (
+        0, len(sampler_indices_padded), device=device, dtype=torch.long) + (
             sampler_indices_padded * len(sampler_indices_padded))
     long_lora_indices = None
     long_lora_indices_len: Optional[int] = None
@@ -184,6 +190,7 @@ class PunicaWrapper:
 
     def __init__(self, max_num_batched_tokens: int, max_batches: int,
                  device: str):
+        self.device = device
         self._token_lora_indices = torch.empty(max_num_batched_tokens,
                                                dtype=torch.long,
                                                device=device)
@@ -264,6 +271,7 @@ class PunicaWrapper:
             vocab_size,
             extra_vocab_size,
             long_lora_context,
+            self.device,
         )
         self._token_lora_indices[:base_indices.shape[0]].copy_(base_indices)
         self._sampler_indices[:sampler_indices.shape[0]].copy_(sampler_indices)
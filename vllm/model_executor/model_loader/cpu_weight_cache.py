@@ -0,0 +1,291 @@
+"""On-disk cache of the CPU model weights after loading and packing.
+
+Loading a checkpoint on the CPU backend converts every weight to the model
+dtype, byte-swaps it on big-endian hosts and lets the quantization methods
+repack it in process_weights_after_loading(). With VLLM_CPU_WEIGHT_CACHE_DIR
+set, the first start of a model writes the resulting parameters of each
+worker to a cache file, and later starts map that file and use its pages as
+the parameters, skipping the checkpoint and all of the processing. With
+VLLM_CPU_WEIGHT_STREAMING the first start writes the file one decoder layer
+at a time, see load_and_save_weights().
+
+Entries are keyed by _CACHE_VERSION, the vLLM version, the checkpoint (model,
+revision and the name, size and modification time of its weight files), the
+model dtype, the quantization and LoRA configs, the parallel rank of the
+worker and the vector ISA of the CPU kernels. Bump _CACHE_VERSION whenever a
+CPU quantization method or kernel changes the layout it packs weights into.
+
+A cache file is the tensors, each at an offset aligned to _ALIGNMENT, the
+JSON header and its 8 byte little-endian size. The header comes last, so
+that the tensors can be written before all of them are known.
+"""
+import hashlib
+import json
+import os
+import re
+import sys
+import tempfile
+from typing import Any, Callable, Dict, Iterable, List, Optional, Tuple
+
+import torch
+from torch import nn
+
+from vllm import _custom_ops as ops
+from vllm.config import LoRAConfig, ModelConfig
+from vllm.distributed import (get_pp_group, get_tensor_model_parallel_rank,
+                              get_tensor_model_parallel_world_size)
+from vllm.logger import init_logger
+from vllm.version import __version__ as VLLM_VERSION
+
+logger = init_logger(__name__)
+
+_CACHE_VERSION = 2
+
+# Page aligned, so that the mapped tensors are aligned for any vector load.
+_ALIGNMENT = 4096
+
+# The prefix of the decoder layer of a checkpoint tensor, e.g. model.layers.3
+# of model.layers.3.mlp.down_proj.weight.
+_LAYER_PREFIX = re.compile(r"(.+?\.\d+)\.")
+
+
+def cache_key(model_config: ModelConfig, lora_config: Optional[LoRAConfig],
+              weight_files: List[str]) -> Dict[str, Any]:
+    """Everything the processed weights of this worker depend on. The
+    checkpoint is identified by the metadata of its files, hashing their
+    content would take as long as loading them."""
+    files = []
+    for path in sorted(weight_files):
+        stat = os.stat(path)
+        files.append([os.path.basename(path), stat.st_size, stat.st_mtime_ns])
+    pp_group = get_pp_group()
+    return {
+        "version": _CACHE_VERSION,
+        "vllm_version": VLLM_VERSION,
+        "model": model_config.model,
+        "revision": model_config.revision,
+        "files": files,
+        "dtype": str(model_config.dtype),
+        "quantization": model_config.quantization,
+        "quantization_config": json.dumps(getattr(model_config.hf_config,
+                                                  "quantization_config",
+                                                  None),
+                                          sort_keys=True,
+                                          default=str),
+        "lora_config": repr(lora_config),
+        "tp": [
+            get_tensor_model_parallel_rank(),
+            get_tensor_model_parallel_world_size()
+        ],
+        "pp": [pp_group.rank_in_group, pp_group.world_size],
+        "isa": ops.get_cpu_vec_op_isa(),
+        "byteorder": sys.byteorder,
+    }
+
+
+def cache_path(cache_dir: str, key: Dict[str, Any]) -> str:
+    digest = hashlib.sha256(json.dumps(key, sort_keys=True).encode())
+    return os.path.join(cache_dir, f"{digest.hexdigest()[:32]}.bin")
+
+
+def _dtype_name(dtype: torch.dtype) -> str:
+    return str(dtype).split(".")[-1]
+
+
+def _is_dense(tensor: torch.Tensor) -> bool:
+    """Whether the elements of tensor fill a range of its storage without
+    gaps or overlaps, in any dimension order."""
+    expected = 1
+    for stride, size in sorted(zip(tensor.stride(), tensor.shape)):
+        if size != 1 and stride != expected:
+            return False
+        expected *= size
+    return True
+
+
+def decoder_layers(model: nn.Module) -> List[nn.Module]:
+    """The layers of the nn.ModuleList of model with the most parameter
+    bytes, e.g. model.model.layers, which hold parameters."""
+    best: List[nn.Module] = []
+    best_bytes = 0
+    for module in model.modules():
+        if not isinstance(module, nn.ModuleList):
+            continue
+        layers = [
+            layer for layer in module
+            if any(True for _ in layer.parameters())
+        ]
+        layer_bytes = sum(p.numel() * p.element_size() for layer in layers
+                          for p in layer.parameters())
+        if layer_bytes > best_bytes:
+            best, best_bytes = layers, layer_bytes
+    return best
+
+
+class CacheWriter:
+    """Writes tensors to a new cache file one at a time. The file appears at
+    path on commit(), abort() removes it."""
+
+    def __init__(self, path: str, key: Dict[str, Any]) -> None:
+        self.path = path
+        self.header: Dict[str, Any] = {"key": key, "tensors": {}}
+        self.offset = 0
+        directory = os.path.dirname(path) or "."
+        os.makedirs(directory, exist_ok=True)
+        # Atomic replace, other workers and processes may read the same key.
+        fd, self.tmp_path = tempfile.mkstemp(dir=directory, suffix=".tmp")
+        self.file = os.fdopen(fd, "wb")
+
+    def __contains__(self, name: str) -> bool:
+        return name in self.header["tensors"]
+
+    def write(self, name: str, tensor: torch.Tensor) -> None:
+        """Dense tensors keep their strides, e.g. the transposed weights of
+        the int8 GEMMs."""
+        if not _is_dense(tensor):
+            tensor = tensor.contiguous()
+        self.header["tensors"][name] = {
+            "dtype": _dtype_name(tensor.dtype),
+            "shape": list(tensor.shape),
+            "stride": list(tensor.stride()),
+            "offset": self.offset,
+        }
+        # The elements in memory order.
+        flat = tensor.as_strided((tensor.numel(), ), (1, ))
+        self.file.seek(self.offset)
+        self.file.write(memoryview(flat.view(torch.uint8).numpy()))
+        self.offset += -(-tensor.numel() * tensor.element_size() //
+                         _ALIGNMENT) * _ALIGNMENT
+
+    def commit(self) -> None:
+        header_bytes = json.dumps(self.header).encode()
+        self.file.seek(self.offset)
+        self.file.write(header_bytes)
+        self.file.write(len(header_bytes).to_bytes(8, "little"))
+        self.file.close()
+        os.replace(self.tmp_path, self.path)
+        logger.info("Saved the CPU weights to the cache file %s (%.2f GiB)",
+                    self.path, self.offset / (1 << 30))
+
+    def abort(self) -> None:
+        self.file.close()
+        os.unlink(self.tmp_path)
+
+
+def save_weights(model: nn.Module, path: str, key: Dict[str, Any]) -> None:
+    """Writes the parameters of model to the cache file at path."""
+    writer = CacheWriter(path, key)
+    try:
+        for name, param in model.named_parameters():
+            writer.write(name, param.data)
+        writer.commit()
+    except BaseException:
+        writer.abort()
+        raise
+
+
+def load_and_save_weights(model: nn.Module,
+                          weights: Iterable[Tuple[str, torch.Tensor]],
+                          weight_names: Iterable[str],
+                          process_module: Callable[[nn.Module], None],
+                          path: str, key: Dict[str, Any]) -> None:
+    """Loads weights into model with model.load_weights() and writes the
+    parameters to the cache file at path one decoder layer at a time, for
+    models larger than the memory of the host. Once the last of weight_names
+    under the prefix of a layer is loaded, process_module() processes each
+    module of the layer, and its parameters are written and released. The
+    rest of the model follows at the end. Only the layers of the checkpoint
+    shard being read are resident. Afterwards the parameters are views of
+    the mapped file, without read-ahead."""
+    module_names = {module: name for name, module in model.named_modules()}
+    layers = {module_names[layer]: layer for layer in decoder_layers(model)}
+    # The checkpoint tensors of each layer left to load.
+    pending: Dict[str, int] = {}
+    for name in weight_names:
+        match = _LAYER_PREFIX.match(name)
+        if match and match.group(1) in layers:
+            pending[match.group(1)] = pending.get(match.group(1), 0) + 1
+
+    writer = CacheWriter(path, key)
+    processed = set()
+
+    def save(prefix: str, module: nn.Module) -> None:
+        for submodule in module.modules():
+            if submodule not in processed:
+                process_module(submodule)
+                processed.add(submodule)
+        for name, param in module.named_parameters(prefix=prefix):
+            if name in writer:
+                continue
+            writer.write(name, param.data)
+            # Released, the parameters are mapped from the complete file.
+            param.data = torch.empty((), dtype=param.dtype).expand(param.shape)
+
+    def layer_weights() -> Iterable[Tuple[str, torch.Tensor]]:
+        for name, weight in weights:
+            yield name, weight
+            # Resumed once load_weights() has loaded the tensor.
+            match = _LAYER_PREFIX.match(name)
+            prefix = match.group(1) if match else None
+            if prefix in pending:
+                pending[prefix] -= 1
+                if pending[prefix] == 0:
+                    save(prefix, layers[prefix])
+
+    try:
+        model.load_weights(layer_weights())
+        save("", model)
+        writer.commit()
+    except BaseException:
+        writer.abort()
+        raise
+    if not load_weights(model, path, key, read_ahead=False):
+        raise RuntimeError(f"Failed to map the CPU weight cache file {path}")
+
+
+def load_weights(model: nn.Module,
+                 path: str,
+                 key: Dict[str, Any],
+                 read_ahead: bool = True) -> bool:
+    """Replaces the data of the parameters of model, which must have been
+    processed after loading already, by views of the mapped cache file at
+    path. Without read_ahead the pages are only read when the weights are
+    used, see VLLM_CPU_WEIGHT_STREAMING. Returns False, leaving model
+    untouched, if the file does not match the key or the parameters."""
+    data = ops.map_cpu_weights_file(path, read_ahead)
+    try:
+        header_end = data.numel() - 8
+        header_size = int.from_bytes(data[header_end:].numpy().tobytes(),
+                                     "little")
+        if header_end < 0 or header_size > header_end:
+            raise ValueError("truncated header")
+        header = json.loads(data[header_end -
+                                 header_size:header_end].numpy().tobytes())
+    except ValueError:
+        logger.warning("Ignoring the corrupt CPU weight cache file %s", path)
+        return False
+
+    params = dict(model.named_parameters())
+    entries = header.get("tensors", {})
+    if header.get("key") != key or entries.keys() != params.keys():
+        logger.warning("Ignoring the CPU weight cache file %s, it does not "
+                       "match the model", path)
+        return False
+    weights: Dict[str, torch.Tensor] = {}
+    for name, param in params.items():
+        entry = entries[name]
+        dtype = getattr(torch, entry["dtype"])
+        if dtype != param.dtype or entry["shape"] != list(param.shape):
+            logger.warning(
+                "Ignoring the CPU weight cache file %s, %s does not "
+                "match the model", path, name)
+            return False
+        numel = param.numel()
+        begin = entry["offset"]
+        flat = data[begin:begin + numel * dtype.itemsize].view(dtype)
+        weights[name] = flat.as_strided(entry["shape"], entry["stride"])
+
+    for name, param in params.items():
+        param.data = weights[name]
+    logger.info("Loaded the CPU weights from the cache file %s", path)
+    return True
@@ -21,6 +21,7 @@ from torch import nn
 from transformers import AutoModelForCausalLM, PretrainedConfig
 from transformers.utils import SAFE_WEIGHTS_INDEX_NAME
 
+import vllm.envs as envs
 from vllm.config import (CacheConfig, DeviceConfig, LoadConfig, LoadFormat,
                          LoRAConfig, ModelConfig, MultiModalConfig,
                          ParallelConfig, SchedulerConfig)
@@ -30,6 +31,7 @@ from vllm.envs import VLLM_USE_MODELSCOPE
 from vllm.logger import init_logger
 from vllm.model_executor.layers.quantization.base_config import (
     QuantizationConfig)
+from vllm.model_executor.model_loader import cpu_weight_cache
 from vllm.model_executor.model_loader.tensorizer import (
     TensorizerConfig, is_vllm_tensorized, load_with_tensorizer,
     serialize_vllm_model, tensorizer_weights_iterator)
@@ -39,7 +41,8 @@ from vllm.model_executor.model_loader.weight_utils import (
     download_safetensors_index_file_from_hf, download_weights_from_hf,
     filter_duplicate_safetensors_files, filter_files_not_needed_for_inference,
     get_gguf_extra_tensor_names, get_quant_config, gguf_quant_weights_iterator,
-    initialize_dummy_weights, np_cache_weights_iterator, pt_weights_iterator,
+    initialize_dummy_weights, mmap_safetensors_weights_iterator,
+    np_cache_weights_iterator, pt_weights_iterator,
     safetensors_weights_iterator)
 from vllm.model_executor.models.interfaces import (has_inner_state,
                                                    supports_lora,
@@ -342,6 +345,10 @@ class DefaultModelLoader(BaseModelLoader):
             weights_iterator = np_cache_weights_iterator(
                 source.model_or_path, self.load_config.download_dir, hf_folder,
                 hf_weights_files)
+        elif use_safetensors and (current_platform.is_cpu()
+                                  and envs.VLLM_CPU_MMAP_WEIGHTS):
+            weights_iterator = mmap_safetensors_weights_iterator(
+                hf_weights_files)
         elif use_safetensors:
             weights_iterator = safetensors_weights_iterator(hf_weights_files)
         else:
@@ -394,26 +401,91 @@ class DefaultModelLoader(BaseModelLoader):
                    scheduler_config: SchedulerConfig,
                    cache_config: CacheConfig) -> nn.Module:
         target_device = torch.device(device_config.device)
+        cache_key = cache_path = None
+        use_safetensors = False
+        if current_platform.is_cpu() and envs.VLLM_CPU_WEIGHT_CACHE_DIR:
+            _, weight_files, use_safetensors = self._prepare_weights(
+                model_config.model,
+                model_config.revision,
+                fall_back_to_pt=True)
+            cache_key = cpu_weight_cache.cache_key(model_config, lora_config,
+                                                   weight_files)
+            cache_path = cpu_weight_cache.cache_path(
+                envs.VLLM_CPU_WEIGHT_CACHE_DIR, cache_key)
+
         with set_default_torch_dtype(model_config.dtype):
             with target_device:
                 model = _initialize_model(model_config, self.load_config,
                                           lora_config, cache_config,
                                           scheduler_config)
 
-            model.load_weights(self._get_all_weights(model_config, model))
+            if cache_path is not None and os.path.exists(cache_path):
+                # The cached weights are processed already, the parameters
+                # take their processed shapes and dtypes first.
+                self._process_weights_after_loading(model, target_device)
+                if cpu_weight_cache.load_weights(
+                        model,
+                        cache_path,
+                        cache_key,
+                        read_ahead=not envs.VLLM_CPU_WEIGHT_STREAMING):
+                    return model.eval()
+                with target_device:
+                    model = _initialize_model(model_config, self.load_config,
+                                              lora_config, cache_config,
+                                              scheduler_config)
+
+            if (cache_path is not None and envs.VLLM_CPU_WEIGHT_STREAMING
+                    and use_safetensors
+                    and not getattr(model, "secondary_weights", ())):
+                # The model may not fit in memory, each decoder layer is
+                # written to the cache file and released once it is loaded.
+                from safetensors.torch import safe_open
+                weight_names: List[str] = []
+                for path in weight_files:
+                    with safe_open(path, framework="pt") as f:
+                        weight_names.extend(f.keys())
+                cpu_weight_cache.load_and_save_weights(
+                    model, self._get_all_weights(model_config, model),
+                    weight_names,
+                    lambda module: self._process_module_after_loading(
+                        module, target_device), cache_path, cache_key)
+                return model.eval()
 
-            for _, module in model.named_modules():
-                quant_method = getattr(module, "quant_method", None)
-                if quant_method is not None:
-                    # When quant methods need to process weights after loading
-                    # (for repacking, quantizing, etc), they expect parameters
-                    # to be on the global target device. This scope is for the
-                    # case where cpu offloading is used, where we will move the
-                    # parameters onto device for processing and back off after.
-                    with device_loading_context(module, target_device):
-                        quant_method.process_weights_after_loading(module)
+            model.load_weights(self._get_all_weights(model_config, model))
+            self._process_weights_after_loading(model, target_device)
+
+        if cache_path is not None:
+            cpu_weight_cache.save_weights(model, cache_path, cache_key)
+            if envs.VLLM_CPU_WEIGHT_STREAMING:
+                # Streamed weights must be backed by the file, the loaded
+                # ones are freed. Checkpoints of .bin files or of several
+                # sources are loaded as a whole first.
+                cpu_weight_cache.load_weights(model,
+                                              cache_path,
+                                              cache_key,
+                                              read_ahead=False)
         return model.eval()
 
+    @staticmethod
+    def _process_weights_after_loading(model: nn.Module,
+                                       target_device: torch.device) -> None:
+        for _, module in model.named_modules():
+            DefaultModelLoader._process_module_after_loading(
+                module, target_device)
+
+    @staticmethod
+    def _process_module_after_loading(module: nn.Module,
+                                      target_device: torch.device) -> None:
+        quant_method = getattr(module, "quant_method", None)
+        if quant_method is not None:
+            # When quant methods need to process weights after loading
+            # (for repacking, quantizing, etc), they expect parameters
+            # to be on the global target device. This scope is for the
+            # case where cpu offloading is used, where we will move the
+            # parameters onto device for processing and back off after.
+            with device_loading_context(module, target_device):
+                quant_method.process_weights_after_loading(module)
+
 
 class DummyModelLoader(BaseModelLoader):
     """Model loader that will set model weights to random values."""
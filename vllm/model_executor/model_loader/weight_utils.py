@@ -4,6 +4,7 @@ import glob
 import hashlib
 import json
 import os
+import sys
 import tempfile
 from collections import defaultdict
 from typing import Any, Dict, Generator, Iterable, List, Optional, Tuple, Union
@@ -17,6 +18,8 @@ from huggingface_hub import HfFileSystem, hf_hub_download, snapshot_download
 from safetensors.torch import load_file, safe_open, save_file
 from tqdm.auto import tqdm
 
+import vllm.envs as envs
+from vllm import _custom_ops as ops
 from vllm.config import LoadConfig, ModelConfig
 from vllm.distributed import get_tensor_model_parallel_rank
 from vllm.logger import init_logger
@@ -409,6 +412,93 @@ def safetensors_weights_iterator(
                 yield name, param
 
 
+# safetensors dtype names of the dtypes the mapped iterator views in place.
+_SAFETENSORS_DTYPES = {
+    "F64": torch.float64,
+    "F32": torch.float32,
+    "F16": torch.float16,
+    "BF16": torch.bfloat16,
+    "I64": torch.int64,
+    "I32": torch.int32,
+    "I16": torch.int16,
+    "I8": torch.int8,
+    "U8": torch.uint8,
+    "BOOL": torch.bool,
+    "F8_E4M3": torch.float8_e4m3fn,
+    "F8_E5M2": torch.float8_e5m2,
+}
+
+# Safetensors stores little-endian tensors. On big-endian hosts (s390x) these
+# are byte-swapped by ops.convert_le_weight: the source format and the dtype
+# converted to, the one of the checkpoint or FP32 when the op cannot produce
+# it.
+_SAFETENSORS_LE_FORMATS = {
+    "F32": ("fp32", torch.float32),
+    "F16": ("fp16", torch.float32),
+    "BF16": ("bf16", torch.bfloat16),
+}
+
+
+def _convert_le_weight(name: str, weight: torch.Tensor, le_format: str,
+                       dtype: torch.dtype, shape: List[int]) -> torch.Tensor:
+    converted = torch.empty(shape, dtype=dtype)
+    verify = envs.VLLM_CPU_VERIFY_WEIGHT_CONVERSION
+    mismatches = ops.convert_le_weight(converted, weight, le_format, verify)
+    if mismatches:
+        raise RuntimeError(
+            f"{mismatches} of {converted.numel()} elements of {name} differ "
+            f"from the reference conversion from little-endian {le_format}.")
+    return converted
+
+
+def mmap_safetensors_weights_iterator(
+    hf_weights_files: List[str]
+) -> Generator[Tuple[str, torch.Tensor], None, None]:
+    """Iterate over the weights in the model safetensor files as views of the
+    mapped files (CPU backend only). The weight loaders copy them from the
+    page cache straight into the parameters, converting the dtype on the
+    way, instead of reading every tensor into a buffer first. On big-endian
+    hosts, the multi-byte tensors are converted into host byte order
+    instead."""
+    big_endian = sys.byteorder == "big"
+    enable_tqdm = not torch.distributed.is_initialized(
+    ) or torch.distributed.get_rank() == 0
+    for st_file in tqdm(
+            hf_weights_files,
+            desc="Loading safetensors checkpoint shards",
+            disable=not enable_tqdm,
+            bar_format=_BAR_FORMAT,
+    ):
+        data = ops.map_cpu_weights_file(st_file)
+        # An 8 byte little-endian header size, the JSON header, the data.
+        header_size = int.from_bytes(data[:8].numpy().tobytes(), "little")
+        header = json.loads(data[8:8 + header_size].numpy().tobytes())
+        header.pop("__metadata__", None)
+        data_start = 8 + header_size
+        # In file order, so that the kernel's read-ahead stays in front.
+        for name, info in sorted(header.items(),
+                                 key=lambda item: item[1]["data_offsets"]):
+            dtype = _SAFETENSORS_DTYPES.get(info["dtype"])
+            le_format = _SAFETENSORS_LE_FORMATS.get(info["dtype"])
+            if dtype is None or (big_endian and dtype.itemsize > 1
+                                 and le_format is None):
+                with safe_open(st_file, framework="pt") as f:
+                    yield name, f.get_tensor(name)
+                continue
+            begin, end = info["data_offsets"]
+            weight = data[data_start + begin:data_start + end]
+            if big_endian and dtype.itemsize > 1:
+                yield name, _convert_le_weight(name, weight, *le_format,
+                                               info["shape"])
+                continue
+            if (data_start + begin) % dtype.itemsize:
+                # Unaligned tensors cannot be viewed in place.
+                weight = weight.clone()
+            yield name, weight.view(dtype).view(info["shape"])
+        # The file is unmapped once the loaders released the last view.
+        del data
+
+
 def pt_weights_iterator(
     hf_weights_files: List[str]
 ) -> Generator[Tuple[str, torch.Tensor], None, None]:
@@ -538,7 +628,9 @@ def default_weight_loader(param: torch.Tensor,
                 f"Attempted to load weight ({loaded_weight.size()}) "
                 f"into parameter ({param.size()})")
 
-            param.data.copy_(loaded_weight)
+            if not (current_platform.is_cpu()
+                    and ops.cpu_convert_(param.data, loaded_weight)):
+                param.data.copy_(loaded_weight)
     except Exception:
         # NOTE: This exception is added for the purpose of setting breakpoint to
         # debug weight loading issues.
@@ -0,0 +1,134 @@
+"""Fused decode steps of the Llama decoder layer on the CPU backend.
+
+Unfused, a decode step of a LlamaDecoderLayer is about ten ops: rms_norm,
+the QKV projection, rotary_embedding, reshape_and_cache, paged attention, the
+output projection, fused_add_rms_norm, the gate_up projection, silu_and_mul
+and the down projection. Each is dispatched through PyTorch, starts its own
+OpenMP parallel region and passes its activations on through memory, which
+dominates the step for small batches. ops.llama_decoder_layer() runs all of
+them in one parallel region instead, see csrc/cpu/decoder_layer.cpp.
+
+Decode batches of at most VLLM_CPU_FUSED_DECODER_LAYER_MAX_TOKENS tokens take
+the fused path in the layers it supports: unquantized weights without biases
+or LoRA, a single tensor parallel rank, the rotary embedding of
+ops.rotary_embedding() and the native paged attention without ALiBi, sliding
+window or block-sparse pattern. Everything else runs unfused.
+"""
+from typing import Optional, Tuple
+
+import torch
+from torch import nn
+
+import vllm.envs as envs
+from vllm import _custom_ops as ops
+from vllm.attention import AttentionMetadata
+from vllm.distributed import get_tensor_model_parallel_world_size
+from vllm.model_executor.layers.linear import (LinearBase,
+                                               UnquantizedLinearMethod)
+from vllm.model_executor.layers.rotary_embedding import RotaryEmbedding
+from vllm.utils import is_cpu
+
+
+def enabled() -> bool:
+    return is_cpu() and envs.VLLM_CPU_FUSED_DECODER_LAYER_MAX_TOKENS > 0
+
+
+def _is_plain_linear(module: nn.Module) -> bool:
+    # LoRA replaces the layer by a wrapper, which is no LinearBase.
+    return (isinstance(module, LinearBase)
+            and type(module.quant_method) is UnquantizedLinearMethod
+            and getattr(module, "bias", None) is None)
+
+
+def _has_supported_shapes(layer: nn.Module) -> bool:
+    """Whether the sizes of layer meet the requirements of the op."""
+    hidden_size, intermediate_size = layer.mlp.down_proj.weight.shape
+    head_size = layer.self_attn.head_dim
+    rot_dim = layer.self_attn.rotary_emb.rotary_dim
+    return (hidden_size % 8 == 0 and intermediate_size % 8 == 0
+            and head_size % 8 == 0 and rot_dim % 2 == 0
+            and rot_dim <= head_size)
+
+
+def is_supported(layer: nn.Module) -> bool:
+    """Whether ops.llama_decoder_layer() computes the decode steps of
+    layer, a LlamaDecoderLayer. Checked on the first step, after LoRA has
+    wrapped the layers it applies to."""
+    from vllm.attention.backends.torch_sdpa import TorchSDPABackendImpl
+
+    self_attn = layer.self_attn
+    rotary_emb = self_attn.rotary_emb
+    impl = self_attn.attn.impl
+    linears = [
+        self_attn.qkv_proj, self_attn.o_proj, layer.mlp.gate_up_proj,
+        layer.mlp.down_proj
+    ]
+    return (get_tensor_model_parallel_world_size() == 1
+            and all(_is_plain_linear(linear) for linear in linears)
+            and isinstance(rotary_emb, RotaryEmbedding)
+            and type(rotary_emb).forward is RotaryEmbedding.forward
+            and type(rotary_emb).forward_cuda is RotaryEmbedding.forward_cuda
+            and isinstance(impl, TorchSDPABackendImpl)
+            and impl.supports_fused_decoder_layer()
+            and layer.input_layernorm.variance_epsilon ==
+            layer.post_attention_layernorm.variance_epsilon
+            and _has_supported_shapes(layer))
+
+
+def can_run(layer: nn.Module, hidden_states: torch.Tensor,
+            kv_cache: Optional[torch.Tensor],
+            attn_metadata: AttentionMetadata) -> bool:
+    num_tokens = hidden_states.shape[0]
+    if (attn_metadata.num_prefills > 0 or kv_cache is None
+            or kv_cache.numel() == 0
+            or num_tokens > envs.VLLM_CPU_FUSED_DECODER_LAYER_MAX_TOKENS
+            or not hidden_states.is_contiguous()):
+        return False
+    if layer.cpu_fused_supported is None:
+        layer.cpu_fused_supported = is_supported(layer)
+    return layer.cpu_fused_supported
+
+
+def forward(
+    layer: nn.Module,
+    positions: torch.Tensor,
+    hidden_states: torch.Tensor,
+    kv_cache: torch.Tensor,
+    attn_metadata: AttentionMetadata,
+    residual: Optional[torch.Tensor],
+) -> Tuple[torch.Tensor, torch.Tensor]:
+    """LlamaDecoderLayer.forward() of a decode step, for which can_run()
+    returned True."""
+    from vllm.attention.ops.paged_attn import PagedAttention
+
+    self_attn = layer.self_attn
+    rotary_emb = self_attn.rotary_emb
+    key_cache, value_cache = PagedAttention.split_kv_cache(
+        kv_cache, self_attn.num_kv_heads, self_attn.head_dim)
+    rotary_emb.cos_sin_cache = rotary_emb.cos_sin_cache.to(
+        dtype=hidden_states.dtype)
+
+    add_residual = residual is not None
+    if residual is None:
+        # The input of the first layer, e.g. the embeddings passed by the
+        # caller, is left untouched as by the unfused layer.
+        residual = torch.empty_like(hidden_states)
+        hidden_states = hidden_states.clone()
+    weights = [
+        layer.input_layernorm.weight,
+        self_attn.qkv_proj.weight,
+        self_attn.o_proj.weight,
+        layer.post_attention_layernorm.weight,
+        layer.mlp.gate_up_proj.weight,
+        layer.mlp.down_proj.weight,
+    ]
+    ops.llama_decoder_layer(hidden_states, residual, add_residual,
+                            positions, weights,
+                            layer.input_layernorm.variance_epsilon,
+                            rotary_emb.cos_sin_cache,
+                            rotary_emb.is_neox_style, key_cache, value_cache,
+                            attn_metadata.slot_mapping,
+                            attn_metadata.block_tables,
+                            attn_metadata.seq_lens_tensor,
+                            self_attn.num_heads, self_attn.scaling)
+    return hidden_states, residual
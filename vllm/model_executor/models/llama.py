@@ -51,6 +51,7 @@ from vllm.model_executor.sampling_metadata import SamplingMetadata
 from vllm.sequence import IntermediateTensors
 from vllm.utils import is_hip
 
+from . import cpu_fused_llama
 from .interfaces import SupportsLoRA
 from .utils import PPMissingLayer, is_pp_missing_parameter, make_layers
 
@@ -232,6 +233,11 @@ class LlamaDecoderLayer(nn.Module):
                                        eps=config.rms_norm_eps)
         self.post_attention_layernorm = RMSNorm(config.hidden_size,
                                                 eps=config.rms_norm_eps)
+        # Small decode batches on CPU may run the whole layer as one native
+        # op, see cpu_fused_llama. Whether it supports the layer is checked
+        # on the first step.
+        self.cpu_fused = cpu_fused_llama.enabled()
+        self.cpu_fused_supported: Optional[bool] = None
 
     def forward(
         self,
@@ -241,6 +247,11 @@ class LlamaDecoderLayer(nn.Module):
         attn_metadata: AttentionMetadata,
         residual: Optional[torch.Tensor],
     ) -> Tuple[torch.Tensor, torch.Tensor]:
+        if self.cpu_fused and cpu_fused_llama.can_run(
+                self, hidden_states, kv_cache, attn_metadata):
+            return cpu_fused_llama.forward(self, positions, hidden_states,
+                                           kv_cache, attn_metadata, residual)
+
         # Self Attention
         if residual is None:
             residual = hidden_states
@@ -1,7 +1,8 @@
 import dataclasses
 import weakref
 from dataclasses import dataclass
-from typing import TYPE_CHECKING, Any, Dict, List, Optional, Tuple, Type, Union
+from typing import (TYPE_CHECKING, Any, Dict, List, Optional, Set, Tuple,
+                    Type, Union)
 
 import torch
 from torch import nn
@@ -11,10 +12,15 @@ from vllm.config import (CacheConfig, DeviceConfig, LoadConfig, LoRAConfig,
                          ModelConfig, ParallelConfig, PromptAdapterConfig,
                          SchedulerConfig)
 from vllm.logger import init_logger
+from vllm.lora.layers import LoRAMapping
+from vllm.lora.request import LoRARequest
+from vllm.lora.worker_manager import LRUCacheWorkerLoRAManager
 from vllm.model_executor import SamplingMetadata
 from vllm.model_executor.layers.rotary_embedding import MRotaryEmbedding
 from vllm.model_executor.layers.sampler import SamplerOutput
 from vllm.model_executor.model_loader import get_model
+from vllm.model_executor.models.interfaces import (supports_lora,
+                                                   supports_multimodal)
 from vllm.multimodal import (MULTIMODAL_REGISTRY, BatchedTensorInputs,
                              MultiModalInputs)
 from vllm.sequence import (IntermediateTensors, SequenceData,
@@ -47,6 +53,8 @@ class ModelInputForCPU(ModelRunnerInputBase):
     virtual_engine: Optional[int] = None
     seq_lens: Optional[List[int]] = None
     query_lens: Optional[List[int]] = None
+    lora_mapping: Optional["LoRAMapping"] = None
+    lora_requests: Optional[Set[LoRARequest]] = None
 
     def as_broadcastable_tensor_dict(
             self) -> Dict[str, Union[int, torch.Tensor]]:
@@ -54,6 +62,8 @@ class ModelInputForCPU(ModelRunnerInputBase):
             "input_tokens": self.input_tokens,
             "input_positions": self.input_positions,
             "multi_modal_kwargs": self.multi_modal_kwargs,
+            "lora_requests": self.lora_requests,
+            "lora_mapping": self.lora_mapping,
         }
         _add_attn_metadata_broadcastable_dict(tensor_dict, self.attn_metadata)
 
@@ -82,6 +92,8 @@ class ModelInputForCPUWithSamplingMetadata(ModelInputForCPU):
         tensor_dict = {
             "input_tokens": self.input_tokens,
             "input_positions": self.input_positions,
+            "lora_requests": self.lora_requests,
+            "lora_mapping": self.lora_mapping,
         }
         _add_attn_metadata_broadcastable_dict(tensor_dict, self.attn_metadata)
         _add_sampling_metadata_broadcastable_dict(tensor_dict,
@@ -115,6 +127,7 @@ class ModelInputForCPUBuilder(ModelRunnerInputBuilderBase[ModelInputForCPU]):
         self.block_size = self.runner.block_size
         self.device = self.runner.device
         self.multi_modal_input_mapper = self.runner.multi_modal_input_mapper
+        self.enable_lora = self.runner.lora_config is not None
 
     def add_seq_group(self, seq_group_metadata: SequenceGroupMetadata):
         self.seq_group_metadata_list.append(seq_group_metadata)
@@ -135,6 +148,9 @@ class ModelInputForCPUBuilder(ModelRunnerInputBuilderBase[ModelInputForCPU]):
                  self.seq_group_metadata_list)
             seq_lens = []
 
+        lora_requests, lora_mapping = self._prepare_lora_input(
+            self.seq_group_metadata_list, is_prompt)
+
         return self.model_input_cls(
             input_tokens=input_tokens,
             input_positions=input_positions,
@@ -145,8 +161,41 @@ class ModelInputForCPUBuilder(ModelRunnerInputBuilderBase[ModelInputForCPU]):
             # just use seq_lens instead.
             seq_lens=seq_lens,
             query_lens=seq_lens,
+            lora_mapping=lora_mapping,
+            lora_requests=lora_requests,
         )
 
+    def _prepare_lora_input(
+        self, seq_group_metadata_list: List[SequenceGroupMetadata],
+        is_prompt: bool
+    ) -> Tuple[Set[LoRARequest], Optional[LoRAMapping]]:
+        """If LoRA is enabled, compute LoRA index and prompt mapping."""
+        if not self.enable_lora:
+            return set(), None
+
+        lora_requests: Set[LoRARequest] = set()
+        lora_index_mapping: List[int] = []
+        lora_prompt_mapping: List[int] = []
+        for seq_group_metadata in seq_group_metadata_list:
+            lora_id = seq_group_metadata.lora_int_id
+            if lora_id > 0:
+                lora_requests.add(seq_group_metadata.lora_request)
+            for seq_data in seq_group_metadata.seq_data.values():
+                query_len = (seq_data.get_len() -
+                             seq_data.get_num_computed_tokens()
+                             if is_prompt else 1)
+                lora_index_mapping += [lora_id] * query_len
+                lora_prompt_mapping += [lora_id] * (
+                    query_len if seq_group_metadata.sampling_params and
+                    seq_group_metadata.sampling_params.prompt_logprobs
+                    is not None else 1)
+
+        lora_mapping = LoRAMapping(
+            **dict(index_mapping=lora_index_mapping,
+                   prompt_mapping=lora_prompt_mapping,
+                   is_prefill=is_prompt))
+        return lora_requests, lora_mapping
+
     def _compute_multi_modal_input(self, seq_data: SequenceData, mm_data,
                                    computed_len: int):
         mm_kwargs = self.multi_modal_input_mapper(mm_data)
@@ -316,8 +365,6 @@ class ModelInputForCPUBuilder(ModelRunnerInputBuilderBase[ModelInputForCPU]):
                 else:
                     input_positions.append(position)
 
-                seq_len = seq_len if self.sliding_window is None else min(
-                    seq_len, self.sliding_window)
                 seq_lens.append(seq_len)
 
                 block_table = seq_group_metadata.block_tables[seq_id]
@@ -326,10 +373,8 @@ class ModelInputForCPUBuilder(ModelRunnerInputBuilderBase[ModelInputForCPU]):
                 slot = block_number * self.block_size + block_offset
                 slot_mapping.append(slot)
 
-                if self.sliding_window is not None:
-                    sliding_window_blocks = (self.sliding_window //
-                                             self.block_size)
-                    block_table = block_table[-sliding_window_blocks:]
+                # The attention kernels skip the blocks outside of the
+                # sliding window themselves.
                 block_tables.append(block_table)
 
         if any(input_mrope_positions):
@@ -433,6 +478,8 @@ class CPUModelRunner(ModelRunnerBase[ModelInputForCPU]):
 
         # Lazy initialization.
         self.model: nn.Module  # Set after init_Model
+        # Set after load_model.
+        self.lora_manager: Optional[LRUCacheWorkerLoRAManager] = None
 
         if self.model_config.is_encoder_decoder_model:
             raise NotImplementedError(
@@ -456,6 +503,60 @@ class CPUModelRunner(ModelRunnerBase[ModelInputForCPU]):
                                scheduler_config=self.scheduler_config,
                                cache_config=self.cache_config)
 
+        if self.lora_config:
+            assert supports_lora(self.model), "Model does not support LoRA"
+            assert not supports_multimodal(
+                self.model
+            ), "To be tested: Multi-modal model with LoRA settings."
+
+            # Adapters evicted from the active slots stay in the LRU cache
+            # (up to max_cpu_loras) in host memory, which is also where the
+            # model runs, so switching between cached adapters never goes
+            # back to disk.
+            self.lora_manager = LRUCacheWorkerLoRAManager(
+                self.scheduler_config.max_num_seqs,
+                self.scheduler_config.max_num_batched_tokens,
+                self.model_config.get_vocab_size(),
+                self.lora_config,
+                self.device,
+                self.model.embedding_modules,
+                self.model.embedding_padding_modules,
+                max_position_embeddings=self.model.config.
+                max_position_embeddings,
+            )
+            self.model = self.lora_manager.create_lora_manager(self.model)
+
+    def remove_all_loras(self):
+        if not self.lora_manager:
+            raise RuntimeError("LoRA is not enabled.")
+        self.lora_manager.remove_all_adapters()
+
+    def set_active_loras(self, lora_requests: Set[LoRARequest],
+                         lora_mapping: LoRAMapping) -> None:
+        if not self.lora_manager:
+            raise RuntimeError("LoRA is not enabled.")
+        self.lora_manager.set_active_adapters(lora_requests, lora_mapping)
+
+    def add_lora(self, lora_request: LoRARequest) -> bool:
+        if not self.lora_manager:
+            raise RuntimeError("LoRA is not enabled.")
+        return self.lora_manager.add_adapter(lora_request)
+
+    def remove_lora(self, lora_id: int) -> bool:
+        if not self.lora_manager:
+            raise RuntimeError("LoRA is not enabled.")
+        return self.lora_manager.remove_adapter(lora_id)
+
+    def pin_lora(self, lora_id: int) -> bool:
+        if not self.lora_manager:
+            raise RuntimeError("LoRA is not enabled.")
+        return self.lora_manager.pin_adapter(lora_id)
+
+    def list_loras(self) -> Set[int]:
+        if not self.lora_manager:
+            raise RuntimeError("LoRA is not enabled.")
+        return self.lora_manager.list_adapters()
+
     def make_model_input_from_broadcasted_tensor_dict(
         self,
         tensor_dict: Dict[str, Any],
@@ -518,6 +619,12 @@ class CPUModelRunner(ModelRunnerBase[ModelInputForCPU]):
             raise ValueError(
                 "CPU worker does not support multi-step execution.")
 
+        if self.lora_config:
+            assert model_input.lora_requests is not None
+            assert model_input.lora_mapping is not None
+            self.set_active_loras(model_input.lora_requests,
+                                  model_input.lora_mapping)
+
         model_executable = self.model
         execute_model_kwargs = {
             "input_ids":
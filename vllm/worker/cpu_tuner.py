@@ -0,0 +1,512 @@
+"""Autotuner of the CPU kernel launch configurations.
+
+Benchmarks the candidate configurations of the CPU paged attention decode
+kernels (v1 or v2, partition size, head unroll factor, OpenMP schedule and
+thread subteam size) and of the LoRA GEMMs (weight blocking and thread
+subteam size) for the shapes of the served model. Tuning runs at startup
+with VLLM_CPU_AUTOTUNE=1, or offline:
+
+    python -m vllm.worker.cpu_tuner --num-heads 32 --num-kv-heads 8 \
+        --head-size 128 --dtype bfloat16 --max-num-seqs 64 \
+        --max-model-len 4096
+
+The winners are persisted in the JSON cache at VLLM_CPU_TUNING_CACHE, keyed
+by the CPU model and the number of OpenMP threads, and dispatched from at
+runtime: the decode path picks v1/v2 and the partition size through
+decode_kwargs(), the kernels look up the rest in the table installed through
+ops.set_cpu_kernel_config().
+"""
+import argparse
+import dataclasses
+import functools
+import json
+import os
+import platform
+import re
+import statistics
+import tempfile
+import time
+from typing import Any, Callable, Dict, List, Optional, Tuple
+
+import torch
+
+import vllm.envs as envs
+from vllm import _custom_ops as ops
+from vllm.logger import init_logger
+from vllm.utils import STR_DTYPE_TO_TORCH_DTYPE, create_kv_caches_with_random
+
+logger = init_logger(__name__)
+
+_CACHE_VERSION = 1
+
+# Candidates, see cpu_tuner::KernelConfig in csrc/cpu/kernel_tuner.hpp.
+_PARTITION_SIZES = (256, 512, 1024)
+_HEAD_UNROLLS = (8, 16)
+_SCHEDULE_STATIC, _SCHEDULE_DYNAMIC = 1, 2
+_LORA_ROW_BLOCKS = (1, 2, 4, 8, 16)
+_LORA_COL_BLOCKS = (16, 32, 64, 128, 256)
+
+# Tuned shapes. The configuration of a tuned shape is installed for all power
+# of two buckets closest to it.
+_NUM_SEQS_GRID = (1, 4, 16, 64, 256)
+_SEQ_LEN_GRID = (256, 1024, 4096, 16384, 65536)
+_NUM_TOKENS_GRID = (1, 4, 16, 64, 256, 1024)
+# Context tokens of the KV cache allocated for one attention shape at most.
+_MAX_BENCH_TOKENS = 1 << 18
+
+_WARMUP_ITERS = 2
+_BENCH_ITERS = 5
+
+
+@dataclasses.dataclass
+class KernelConfig:
+    thread_num: int = 0
+    head_unroll: int = 16
+    block: int = 0
+    schedule: int = 0
+
+    def to_list(self) -> List[int]:
+        return [self.thread_num, self.head_unroll, self.block, self.schedule]
+
+
+@dataclasses.dataclass
+class DecodeConfig:
+    use_v1: bool
+    partition_size: int
+    kernel: KernelConfig
+
+    @property
+    def kernel_name(self) -> str:
+        return "paged_attention_v1" if self.use_v1 else "paged_attention_v2"
+
+
+@dataclasses.dataclass
+class AttentionShape:
+    num_heads: int
+    num_kv_heads: int
+    head_size: int
+    dtype: torch.dtype
+    block_size: int
+
+
+# Tuned decode configurations by shape key, filled by install().
+_decode_configs: Dict[Tuple[int, ...], DecodeConfig] = {}
+
+
+def shape_bucket(size: int) -> int:
+    """Next power of two, same as cpu_tuner::shape_bucket."""
+    return 1 << (size - 1).bit_length() if size > 0 else 0
+
+
+def attention_key(element_size: int, num_heads: int, num_kv_heads: int,
+                  head_size: int, num_seqs: int,
+                  max_seq_len: int) -> Tuple[int, ...]:
+    """Shape key of lookupAttentionConfig in csrc/cpu/attention.cpp."""
+    return (element_size, num_heads, num_kv_heads, head_size,
+            shape_bucket(num_seqs), shape_bucket(max_seq_len))
+
+
+def lora_key(element_size: int, num_tokens: int, weight_rows: int,
+             weight_cols: int) -> Tuple[int, ...]:
+    """Shape key of lookup_lora_config in csrc/cpu/lora.cpp."""
+    return (element_size, shape_bucket(num_tokens), weight_rows, weight_cols)
+
+
+def decode_kwargs(query: torch.Tensor, num_kv_heads: int,
+                  max_seq_len: int) -> Dict[str, Any]:
+    """Tuned use_v1 and partition_size of PagedAttention.forward_decode,
+    empty for untuned shapes."""
+    if not _decode_configs:
+        return {}
+    num_seqs, num_heads, head_size = query.shape
+    config = _decode_configs.get(
+        attention_key(query.element_size(), num_heads, num_kv_heads,
+                      head_size, num_seqs, max_seq_len))
+    if config is None:
+        return {}
+    return dict(use_v1=config.use_v1, partition_size=config.partition_size)
+
+
+def cpu_signature() -> str:
+    """Cache key of this machine: the CPU model and the OpenMP threads."""
+    model = platform.machine()
+    try:
+        with open("/proc/cpuinfo") as f:
+            cpuinfo = f.read()
+        # x86 "model name", POWER "cpu", s390x "machine = <type>".
+        for pattern in (r"^model name\s*:\s*(.+)$", r"^cpu\s*:\s*(.+)$",
+                        r"machine\s*=\s*(\w+)"):
+            match = re.search(pattern, cpuinfo, re.MULTILINE)
+            if match:
+                model = f"{model} {match.group(1).strip()}"
+                break
+    except OSError:
+        pass
+    return f"{model}|{torch.get_num_threads()}"
+
+
+def _key_str(key: Tuple[int, ...]) -> str:
+    return ",".join(map(str, key))
+
+
+def _parse_key(key: str) -> Tuple[int, ...]:
+    return tuple(int(v) for v in key.split(","))
+
+
+class TuningCache:
+    """On-disk tuning cache, shared by all machines and processes using the
+    same path. Writes merge with the current file content."""
+
+    def __init__(self, path: str) -> None:
+        self.path = path
+        self.signature = cpu_signature()
+
+    def _read(self) -> Dict[str, Any]:
+        try:
+            with open(self.path) as f:
+                data = json.load(f)
+        except (OSError, ValueError):
+            return {"version": _CACHE_VERSION, "machines": {}}
+        if data.get("version") != _CACHE_VERSION:
+            logger.warning("Ignoring CPU tuning cache %s of version %s",
+                           self.path, data.get("version"))
+            return {"version": _CACHE_VERSION, "machines": {}}
+        return data
+
+    def load(self) -> Dict[str, Dict[str, Any]]:
+        """Entries of this machine by kernel and shape key."""
+        return self._read()["machines"].get(self.signature, {})
+
+    def update(self, kernel: str, entries: Dict[str, Any]) -> None:
+        data = self._read()
+        machine = data["machines"].setdefault(self.signature, {})
+        machine.setdefault(kernel, {}).update(entries)
+        directory = os.path.dirname(self.path) or "."
+        os.makedirs(directory, exist_ok=True)
+        # Atomic replace, TP ranks may write concurrently.
+        fd, tmp_path = tempfile.mkstemp(dir=directory, suffix=".tmp")
+        with os.fdopen(fd, "w") as f:
+            json.dump(data, f, indent=1, sort_keys=True)
+        os.replace(tmp_path, self.path)
+
+
+def _time_us(fn: Callable[[], Any]) -> float:
+    for _ in range(_WARMUP_ITERS):
+        fn()
+    times = []
+    for _ in range(_BENCH_ITERS):
+        start = time.perf_counter()
+        fn()
+        times.append((time.perf_counter() - start) * 1e6)
+    return statistics.median(times)
+
+
+def _thread_candidates() -> List[int]:
+    threads = torch.get_num_threads()
+    return [0] + [threads // d for d in (2, 4) if threads // d >= 1]
+
+
+def _coordinate_search(
+        initial: Any, axes: List[Tuple[str, List[Any]]],
+        run: Callable[[Any], float]) -> Tuple[Any, float]:
+    """Tunes one field at a time, keeping the best value of each."""
+    best, best_us = initial, run(initial)
+    for field, values in axes:
+        for value in values:
+            if value == getattr(best, field):
+                continue
+            candidate = dataclasses.replace(best, **{field: value})
+            candidate_us = run(candidate)
+            if candidate_us < best_us:
+                best, best_us = candidate, candidate_us
+    return best, best_us
+
+
+@dataclasses.dataclass
+class _DecodeCandidate:
+    use_v1: bool
+    partition_size: int
+    head_unroll: int = 16
+    schedule: int = 0
+    thread_num: int = 0
+
+    def to_config(self) -> DecodeConfig:
+        return DecodeConfig(
+            self.use_v1, self.partition_size,
+            KernelConfig(thread_num=self.thread_num,
+                         head_unroll=self.head_unroll,
+                         schedule=self.schedule))
+
+
+def _run_decode(decode: Callable[..., torch.Tensor], key: Tuple[int, ...],
+                candidate: _DecodeCandidate) -> float:
+    config = candidate.to_config()
+    ops.set_cpu_kernel_config(config.kernel_name, list(key),
+                              config.kernel.to_list())
+    return _time_us(
+        functools.partial(decode,
+                          use_v1=config.use_v1,
+                          partition_size=config.partition_size))
+
+
+def tune_paged_attention(shape: AttentionShape, max_num_seqs: int,
+                         max_seq_len: int) -> Dict[str, Any]:
+    """Returns the tuned decode configurations by shape key string."""
+    from vllm.attention.ops.paged_attn import PagedAttention
+
+    element_size = torch.tensor([], dtype=shape.dtype).element_size()
+    scale = shape.head_size**-0.5
+    results: Dict[str, Any] = {}
+    for num_seqs in _NUM_SEQS_GRID:
+        if num_seqs > shape_bucket(max_num_seqs):
+            break
+        for seq_len in _SEQ_LEN_GRID:
+            if (seq_len > shape_bucket(max_seq_len)
+                    or num_seqs * seq_len > _MAX_BENCH_TOKENS):
+                break
+            blocks_per_seq = (seq_len + shape.block_size -
+                              1) // shape.block_size
+            num_blocks = num_seqs * blocks_per_seq
+            key_caches, value_caches = create_kv_caches_with_random(
+                num_blocks, shape.block_size, 1, shape.num_kv_heads,
+                shape.head_size, "auto", shape.dtype, device="cpu")
+            block_tables = torch.randperm(num_blocks, dtype=torch.int).view(
+                num_seqs, blocks_per_seq)
+            seq_lens = torch.full((num_seqs, ), seq_len, dtype=torch.int)
+            query = torch.randn(num_seqs,
+                                shape.num_heads,
+                                shape.head_size,
+                                dtype=shape.dtype)
+            key = attention_key(element_size, shape.num_heads,
+                                shape.num_kv_heads, shape.head_size,
+                                num_seqs, seq_len)
+            decode = functools.partial(PagedAttention.forward_decode, query,
+                                       key_caches[0], value_caches[0],
+                                       block_tables, seq_lens, seq_len,
+                                       "auto", shape.num_kv_heads, scale,
+                                       None, 1.0, 1.0)
+            run = functools.partial(_run_decode, decode, key)
+
+            # v1 against v2 with each partition size, then the in-kernel
+            # knobs of the winner.
+            best, best_us = None, float("inf")
+            for use_v1, partition_size in [(True, _PARTITION_SIZES[0])] + [
+                (False, size) for size in _PARTITION_SIZES
+            ]:
+                candidate = _DecodeCandidate(use_v1, partition_size)
+                candidate_us = run(candidate)
+                if candidate_us < best_us:
+                    best, best_us = candidate, candidate_us
+            best, best_us = _coordinate_search(best, [
+                ("head_unroll", list(_HEAD_UNROLLS)),
+                ("schedule", [_SCHEDULE_STATIC, _SCHEDULE_DYNAMIC]),
+                ("thread_num", _thread_candidates()),
+            ], run)
+            config = best.to_config()
+            results[_key_str(key)] = dict(
+                use_v1=config.use_v1,
+                partition_size=config.partition_size,
+                time_us=best_us,
+                **dataclasses.asdict(config.kernel))
+            logger.debug("Tuned CPU paged attention %s: %s (%.1f us)", key,
+                         config, best_us)
+    ops.clear_cpu_kernel_configs()
+    return results
+
+
+def _run_lora(kernel: str, key: Tuple[int, ...], fn: Callable[[], None],
+              config: KernelConfig) -> float:
+    ops.set_cpu_kernel_config(kernel, list(key), config.to_list())
+    return _time_us(fn)
+
+
+def tune_lora(dtype: torch.dtype, max_lora_rank: int, hidden_size: int,
+              max_num_tokens: int) -> Dict[str, Dict[str, Any]]:
+    """Returns the tuned lora_shrink and lora_expand configurations by shape
+    key string."""
+    element_size = torch.tensor([], dtype=dtype).element_size()
+    results: Dict[str, Dict[str, Any]] = {
+        "lora_shrink": {},
+        "lora_expand": {}
+    }
+    lora_a = torch.randn(1, max_lora_rank, hidden_size, dtype=dtype)
+    lora_b = torch.randn(1, hidden_size, max_lora_rank, dtype=dtype)
+    for num_tokens in _NUM_TOKENS_GRID:
+        if num_tokens > shape_bucket(max_num_tokens):
+            break
+        x = torch.randn(num_tokens, hidden_size, dtype=dtype)
+        buffer = torch.zeros(num_tokens, max_lora_rank, dtype=torch.float)
+        y = torch.zeros(num_tokens, hidden_size, dtype=dtype)
+        indices = torch.zeros(num_tokens, dtype=torch.long)
+        kernels = [("lora_shrink", lora_a, _LORA_ROW_BLOCKS,
+                    functools.partial(ops.bgmv_shrink, x, lora_a, buffer,
+                                      indices, 1.0))]
+        # The expand kernel vectorizes over the rank.
+        if max_lora_rank % 16 == 0:
+            kernels.append(("lora_expand", lora_b, _LORA_COL_BLOCKS,
+                            functools.partial(ops.bgmv_expand, buffer,
+                                              lora_b, y, indices, True)))
+        for kernel, weights, blocks, fn in kernels:
+            key = lora_key(element_size, num_tokens, weights.size(1),
+                           weights.size(2))
+            run = functools.partial(_run_lora, kernel, key, fn)
+            best, best_us = _coordinate_search(
+                KernelConfig(block=blocks[len(blocks) // 2]), [
+                    ("block", list(blocks)),
+                    ("thread_num", _thread_candidates()),
+                ], run)
+            results[kernel][_key_str(key)] = dict(
+                time_us=best_us, **dataclasses.asdict(best))
+    ops.clear_cpu_kernel_configs()
+    return results
+
+
+def _nearest(key: Tuple[int, ...], tuned: List[Tuple[int, ...]],
+             bucket_dims: Tuple[int, ...]) -> Optional[Tuple[int, ...]]:
+    """Tuned key with the same exact dims and the closest buckets in log
+    space."""
+    best, best_distance = None, None
+    for candidate in tuned:
+        if any(candidate[i] != key[i] for i in range(len(key))
+               if i not in bucket_dims):
+            continue
+        distance = sum(
+            abs(candidate[i].bit_length() - key[i].bit_length())
+            for i in bucket_dims)
+        if best_distance is None or distance < best_distance:
+            best, best_distance = candidate, distance
+    return best
+
+
+def _expand_buckets(entries: Dict[str, Any], bucket_dims: Tuple[int, ...],
+                    limits: Dict[int, int]) -> Dict[Tuple[int, ...], Any]:
+    """Assigns every power of two bucket up to the limits of bucket_dims the
+    entry of its nearest tuned key."""
+    tuned = [_parse_key(key) for key in entries]
+    expanded: Dict[Tuple[int, ...], Any] = {}
+    for tuned_key in tuned:
+        keys = [tuned_key]
+        for dim in bucket_dims:
+            keys = [
+                key[:dim] + (1 << exp, ) + key[dim + 1:] for key in keys
+                for exp in range(limits[dim].bit_length())
+            ]
+        for key in keys:
+            if key in expanded:
+                continue
+            nearest = _nearest(key, tuned, bucket_dims)
+            if nearest is not None:
+                expanded[key] = entries[_key_str(nearest)]
+    return expanded
+
+
+def install(entries: Dict[str, Dict[str, Any]]) -> None:
+    """Installs cached entries as the runtime dispatch configurations."""
+    ops.clear_cpu_kernel_configs()
+    _decode_configs.clear()
+    bucket_limit = 1 << 20
+    for key, entry in _expand_buckets(entries.get("paged_attention", {}),
+                                      (4, 5), {
+                                          4: bucket_limit,
+                                          5: bucket_limit
+                                      }).items():
+        kernel = KernelConfig(**{
+            field.name: entry[field.name]
+            for field in dataclasses.fields(KernelConfig)
+        })
+        config = DecodeConfig(entry["use_v1"], entry["partition_size"],
+                              kernel)
+        _decode_configs[key] = config
+        ops.set_cpu_kernel_config(config.kernel_name, list(key),
+                                  kernel.to_list())
+    for kernel_name in ("lora_shrink", "lora_expand"):
+        for key, entry in _expand_buckets(entries.get(kernel_name, {}),
+                                          (1, ), {
+                                              1: bucket_limit
+                                          }).items():
+            kernel = KernelConfig(**{
+                field.name: entry[field.name]
+                for field in dataclasses.fields(KernelConfig)
+            })
+            ops.set_cpu_kernel_config(kernel_name, list(key),
+                                      kernel.to_list())
+
+
+def init_tuning(shape: AttentionShape,
+                max_num_seqs: int,
+                max_seq_len: int,
+                lora_shape: Optional[Tuple[int, int, int]] = None,
+                tune_attention: bool = True) -> None:
+    """Loads the tuning cache of this machine, tunes the missing shapes if
+    VLLM_CPU_AUTOTUNE is set and installs the configurations.
+
+    lora_shape is (max_lora_rank, hidden_size, max_num_batched_tokens).
+    tune_attention is False if decoding doesn't run the native kernels."""
+    cache = TuningCache(envs.VLLM_CPU_TUNING_CACHE)
+    entries = cache.load()
+    if envs.VLLM_CPU_AUTOTUNE:
+        element_size = torch.tensor([], dtype=shape.dtype).element_size()
+        prefix = _key_str((element_size, shape.num_heads, shape.num_kv_heads,
+                           shape.head_size))
+        if tune_attention and not any(
+                key.startswith(prefix + ",")
+                for key in entries.get("paged_attention", {})):
+            logger.info("Tuning the CPU paged attention kernels for %s",
+                        shape)
+            cache.update("paged_attention",
+                         tune_paged_attention(shape, max_num_seqs,
+                                              max_seq_len))
+        if lora_shape is not None:
+            max_lora_rank, hidden_size, max_num_tokens = lora_shape
+            shrink_suffix = _key_str((max_lora_rank, hidden_size))
+            if not any(
+                    key.endswith("," + shrink_suffix)
+                    for key in entries.get("lora_shrink", {})):
+                logger.info("Tuning the CPU LoRA kernels for rank %d",
+                            max_lora_rank)
+                for kernel, tuned in tune_lora(shape.dtype, max_lora_rank,
+                                               hidden_size,
+                                               max_num_tokens).items():
+                    cache.update(kernel, tuned)
+        entries = cache.load()
+    if entries:
+        install(entries)
+        logger.info("Installed the CPU kernel configurations of %s from %s",
+                    cache.signature, cache.path)
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(
+        description="Tune the CPU kernels for a model offline.")
+    parser.add_argument("--num-heads", type=int, required=True)
+    parser.add_argument("--num-kv-heads", type=int, required=True)
+    parser.add_argument("--head-size", type=int, required=True)
+    parser.add_argument("--dtype",
+                        type=str,
+                        choices=["bfloat16", "float"],
+                        default="bfloat16")
+    parser.add_argument("--block-size", type=int, default=16)
+    parser.add_argument("--max-num-seqs", type=int, default=256)
+    parser.add_argument("--max-model-len", type=int, default=4096)
+    parser.add_argument("--max-lora-rank", type=int, default=0)
+    parser.add_argument("--hidden-size", type=int, default=0)
+    parser.add_argument("--max-num-batched-tokens", type=int, default=1024)
+    args = parser.parse_args()
+
+    dtype = STR_DTYPE_TO_TORCH_DTYPE[args.dtype]
+    shape = AttentionShape(args.num_heads, args.num_kv_heads, args.head_size,
+                           dtype, args.block_size)
+    cache = TuningCache(envs.VLLM_CPU_TUNING_CACHE)
+    cache.update(
+        "paged_attention",
+        tune_paged_attention(shape, args.max_num_seqs, args.max_model_len))
+    if args.max_lora_rank > 0 and args.hidden_size > 0:
+        for kernel, tuned in tune_lora(dtype, args.max_lora_rank,
+                                       args.hidden_size,
+                                       args.max_num_batched_tokens).items():
+            cache.update(kernel, tuned)
+    print(f"Wrote the configurations of {cache.signature} to {cache.path}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,61 @@
+"""Layer-ahead weight streaming of the CPU worker.
+
+With VLLM_CPU_WEIGHT_STREAMING=1 the weights stay in the file of the CPU
+weight cache (VLLM_CPU_WEIGHT_CACHE_DIR) instead of being resident, so that
+a model larger than the memory of the host runs from NVMe. A native
+background thread reads the VLLM_CPU_WEIGHT_STREAMING_AHEAD decoder layers
+after the computing one into memory, and each layer is paged out again once
+it has run. The embedding, the final norm and the LM head are left to the
+page cache.
+
+Before a layer runs, its forward pre-hook waits until the layer is resident.
+That wait is the I/O stall the prefetching did not hide, reported per layer
+by ops.get_cpu_weight_streaming_stats(). Prefill-heavy batches compute long
+enough per layer to hide most of it.
+"""
+import functools
+
+from torch import nn
+
+from vllm import _custom_ops as ops
+from vllm.logger import init_logger
+from vllm.model_executor.model_loader.cpu_weight_cache import decoder_layers
+
+logger = init_logger(__name__)
+
+
+class CPUWeightStreamer:
+    """Streams the decoder layers of a model whose weights are views of a
+    mapped file, see cpu_weight_cache.load_weights()."""
+
+    def __init__(self, model: nn.Module, ahead: int) -> None:
+        self.layers = decoder_layers(model)
+        if not self.layers:
+            raise ValueError(
+                "VLLM_CPU_WEIGHT_STREAMING found no decoder layers in "
+                f"{type(model).__name__}")
+        self.ahead = max(1, min(ahead, len(self.layers) - 1))
+        for idx, layer in enumerate(self.layers):
+            ops.register_cpu_streamed_layer(
+                idx, [param.data for param in layer.parameters()])
+            layer.register_forward_pre_hook(
+                functools.partial(self._before_layer, idx))
+            layer.register_forward_hook(
+                functools.partial(self._after_layer, idx))
+        for idx in range(self.ahead):
+            ops.prefetch_cpu_streamed_layer(idx)
+        layer_bytes = sum(p.numel() * p.element_size()
+                          for p in self.layers[0].parameters())
+        logger.info(
+            "Streaming the weights of %d layers of %.2f GiB, %d read ahead",
+            len(self.layers), layer_bytes / (1 << 30), self.ahead)
+
+    def _before_layer(self, idx: int, module: nn.Module, args) -> None:
+        ops.wait_cpu_streamed_layer(idx)
+        # Wraps around to the first layers of the next step.
+        for ahead in range(1, self.ahead + 1):
+            ops.prefetch_cpu_streamed_layer((idx + ahead) % len(self.layers))
+
+    def _after_layer(self, idx: int, module: nn.Module, args,
+                     output) -> None:
+        ops.release_cpu_streamed_layer(idx)
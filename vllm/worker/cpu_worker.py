@@ -1,23 +1,29 @@
 """A CPU worker class."""
-from typing import Dict, List, Optional, Tuple
+import math
+from typing import Any, Dict, List, Optional, Set, Tuple, Union
 
 import torch
 import torch.distributed
 
 import vllm.envs as envs
+from vllm import _custom_ops as ops
 from vllm.attention import get_attn_backend
 from vllm.config import (CacheConfig, DeviceConfig, LoadConfig, LoRAConfig,
                          ModelConfig, ParallelConfig, PromptAdapterConfig,
                          SchedulerConfig)
 from vllm.distributed import (ensure_model_parallel_initialized,
-                              init_distributed_environment)
+                              get_tp_group, init_distributed_environment)
+from vllm.distributed.device_communicators.cpu_shm_broadcast import (
+    CPUShmBroadcaster)
 from vllm.logger import init_logger
+from vllm.lora.request import LoRARequest
 from vllm.model_executor import set_random_seed
 from vllm.sequence import ExecuteModelRequest
 from vllm.utils import STR_DTYPE_TO_TORCH_DTYPE
+from vllm.worker import cpu_tuner
 from vllm.worker.cpu_model_runner import CPUModelRunner
-from vllm.worker.worker_base import (LocalOrDistributedWorkerBase,
-                                     LoraNotSupportedWorkerBase, WorkerInput)
+from vllm.worker.cpu_weight_streamer import CPUWeightStreamer
+from vllm.worker.worker_base import LocalOrDistributedWorkerBase, WorkerInput
 
 logger = init_logger(__name__)
 
@@ -71,13 +77,36 @@ class CPUCacheEngine:
         self,
         num_blocks: int,
     ) -> List[torch.Tensor]:
-        """Allocates KV cache on CPU."""
+        """Allocates KV cache on CPU.
+
+        Each layer is mapped by the native allocator on the NUMA node of the
+        OpenMP threads, backed by huge pages as selected by
+        VLLM_CPU_KVCACHE_HUGE_PAGES and pre-faulted by the threads, since
+        paged attention jumps between scattered blocks."""
+        huge_pages = envs.VLLM_CPU_KVCACHE_HUGE_PAGES
+        if huge_pages not in ops.CPU_HUGE_PAGES:
+            raise ValueError(
+                f"Invalid VLLM_CPU_KVCACHE_HUGE_PAGES {huge_pages!r}, "
+                f"expected one of {list(ops.CPU_HUGE_PAGES)}.")
         kv_cache_shape = self.attn_backend.get_kv_cache_shape(
             num_blocks, self.block_size, self.num_heads, self.head_size)
+        num_bytes = (math.prod(kv_cache_shape) *
+                     torch.tensor([], dtype=self.dtype).element_size())
         kv_cache: List[torch.Tensor] = []
         for _ in range(self.num_layers):
+            layer_cache = ops.allocate_cpu_kv_cache(num_bytes, huge_pages)
             kv_cache.append(
-                torch.empty(kv_cache_shape, dtype=self.dtype, device="cpu"))
+                layer_cache.view(self.dtype).view(kv_cache_shape))
+
+        # Page size, bytes backed by huge pages and NUMA node of the first
+        # layer, the others are mapped alike.
+        self.placement = ops.get_cpu_memory_placement(kv_cache[0])
+        page_size, huge_page_bytes, numa_node = self.placement
+        logger.info(
+            "CPU KV cache: %d layers of %.2f GiB on NUMA node %d, %d KiB "
+            "pages, %.0f%% backed by huge pages", self.num_layers,
+            num_bytes / (1 << 30), numa_node, page_size // 1024,
+            100.0 * huge_page_bytes / max(num_bytes, 1))
         return kv_cache
 
     def swap_in(self, src_to_dst: Dict[int, int]) -> None:
@@ -111,7 +140,7 @@ class CPUCacheEngine:
         return dtype_size * total
 
 
-class CPUWorker(LoraNotSupportedWorkerBase, LocalOrDistributedWorkerBase):
+class CPUWorker(LocalOrDistributedWorkerBase):
     """A worker class that executes (a partition of) the model on a CPU socket.
 
     Each worker is associated with a single CPU socket. The worker is 
@@ -178,6 +207,10 @@ class CPUWorker(LoraNotSupportedWorkerBase, LocalOrDistributedWorkerBase):
         # initialize_cache.
         self.cache_engine: List[CPUCacheEngine]
         self.cpu_cache: List[List[torch.Tensor]]
+        # Set by load_model with VLLM_CPU_WEIGHT_STREAMING.
+        self.weight_streamer: Optional[CPUWeightStreamer] = None
+        # Set by init_distributed_environment with VLLM_CPU_SHM_BROADCAST.
+        self.shm_broadcaster: Optional[CPUShmBroadcaster] = None
 
         # Torch profiler. Enabled and configured through env vars:
         # VLLM_TORCH_PROFILER_DIR=/path/to/save/trace
@@ -206,16 +239,128 @@ class CPUWorker(LoraNotSupportedWorkerBase, LocalOrDistributedWorkerBase):
         self.profiler.stop()
 
     def init_device(self) -> None:
+        # Set before binding the OpenMP threads, which opens their hardware
+        # counters at level 3.
+        if envs.VLLM_CPU_KERNEL_PROFILE > 0:
+            ops.set_cpu_kernel_profiling(envs.VLLM_CPU_KERNEL_PROFILE)
+        if envs.VLLM_CPU_PREFETCH_DISTANCE is not None:
+            ops.set_cpu_prefetch_distance(envs.VLLM_CPU_PREFETCH_DISTANCE)
         if self.local_omp_cpuid != "all":
             ret = torch.ops._C_utils.init_cpu_threads_env(self.local_omp_cpuid)
             logger.info(ret)
+        self.init_thread_subteams()
+        # After binding the threads, so that the pools of the caching
+        # allocator map their blocks on the node of the threads. Its blocks
+        # are pre-faulted, streamed weights are allocated before it.
+        if (envs.VLLM_CPU_CACHING_ALLOCATOR
+                and not envs.VLLM_CPU_WEIGHT_STREAMING):
+            ops.enable_cpu_caching_allocator()
 
         self.init_distributed_environment()
         # Set random seed.
         set_random_seed(self.model_config.seed)
 
     def load_model(self):
+        if (envs.VLLM_CPU_WEIGHT_STREAMING
+                and not envs.VLLM_CPU_WEIGHT_CACHE_DIR):
+            raise ValueError(
+                "VLLM_CPU_WEIGHT_STREAMING streams the weights from the "
+                "file of the CPU weight cache, set VLLM_CPU_WEIGHT_CACHE_DIR.")
         self.model_runner.load_model()
+        if envs.VLLM_CPU_WEIGHT_STREAMING:
+            if envs.VLLM_CPU_CACHING_ALLOCATOR:
+                ops.enable_cpu_caching_allocator()
+            self.weight_streamer = CPUWeightStreamer(
+                self.model_runner.model,
+                envs.VLLM_CPU_WEIGHT_STREAMING_AHEAD)
+        self._init_kernel_tuning()
+        if envs.VLLM_CPU_CACHING_ALLOCATOR:
+            # Drops the blocks cached for the temporaries of weight loading
+            # and tuning, the decode loop maps its own sizes once.
+            ops.empty_cpu_allocator_cache()
+
+    def _init_kernel_tuning(self) -> None:
+        """Installs the tuned CPU kernel configurations of the model shapes,
+        tuning the missing ones first if VLLM_CPU_AUTOTUNE is set."""
+        from vllm.attention.backends import torch_sdpa
+        model_config = self.model_config
+        shape = cpu_tuner.AttentionShape(
+            model_config.get_num_attention_heads(self.parallel_config),
+            model_config.get_num_kv_heads(self.parallel_config),
+            model_config.get_head_size(), model_config.dtype,
+            self.cache_config.block_size)
+        lora_shape = None
+        if self.lora_config is not None:
+            lora_shape = (self.lora_config.max_lora_rank,
+                          model_config.get_hidden_size(),
+                          self.scheduler_config.max_num_batched_tokens)
+        cpu_tuner.init_tuning(
+            shape,
+            self.scheduler_config.max_num_seqs,
+            model_config.max_model_len,
+            lora_shape=lora_shape,
+            tune_attention=(torch_sdpa._support_autotune
+                            and self.cache_config.cache_dtype == "auto"))
+
+    def init_thread_subteams(self) -> None:
+        subteams = envs.VLLM_CPU_THREAD_SUBTEAMS
+        if subteams not in ops.CPU_THREAD_SUBTEAMS:
+            raise ValueError(
+                f"Invalid VLLM_CPU_THREAD_SUBTEAMS {subteams!r}, "
+                f"expected one of {list(ops.CPU_THREAD_SUBTEAMS)}.")
+        if subteams == "none":
+            return
+        if self.local_omp_cpuid == "all":
+            logger.warning(
+                "VLLM_CPU_THREAD_SUBTEAMS needs the OpenMP threads bound "
+                "with VLLM_CPU_OMP_THREADS_BIND, running the kernels on the "
+                "whole team.")
+            return
+        groups = ops.set_cpu_thread_subteams(subteams)
+        logger.info("Running the attention and per-token kernels on %d "
+                    "thread subteams sharing an %s cache.",
+                    len(set(groups)), subteams.upper())
+
+    def collect_kernel_stats(
+            self) -> List[Dict[str, Union[str, int, float]]]:
+        """Kernel-level stats of the CPU ops since the last call, recorded
+        if VLLM_CPU_KERNEL_PROFILE is set."""
+        return ops.collect_cpu_kernel_stats()
+
+    def collect_allocator_stats(
+            self,
+            reset_peak: bool = False) -> Dict[str, Union[int, float]]:
+        """Peak, cached and fragmentation stats of the CPU caching
+        allocator, enabled by VLLM_CPU_CACHING_ALLOCATOR."""
+        return ops.get_cpu_allocator_stats(reset_peak)
+
+    def collect_weight_streaming_stats(
+            self,
+            reset: bool = False) -> List[Dict[str, Union[int, float]]]:
+        """I/O stall and read stats of each decoder layer, recorded with
+        VLLM_CPU_WEIGHT_STREAMING."""
+        return ops.get_cpu_weight_streaming_stats(reset)
+
+    def collect_broadcast_stats(
+            self,
+            reset: bool = False) -> Optional[Dict[str, Union[int, float]]]:
+        """Messages and wait time of this rank in the shared memory
+        broadcast of the model inputs, None without it."""
+        if self.shm_broadcaster is None:
+            return None
+        return self.shm_broadcaster.stats(reset)
+
+    def add_lora(self, lora_request: LoRARequest) -> bool:
+        return self.model_runner.add_lora(lora_request)
+
+    def remove_lora(self, lora_id: int) -> bool:
+        return self.model_runner.remove_lora(lora_id)
+
+    def pin_lora(self, lora_id: int) -> bool:
+        return self.model_runner.pin_lora(lora_id)
+
+    def list_loras(self) -> Set[int]:
+        return self.model_runner.list_loras()
 
     def determine_num_available_blocks(self) -> Tuple[int, int]:
         """Determine the number of blocks available for the KV cache.
@@ -296,15 +441,20 @@ class CPUWorker(LoraNotSupportedWorkerBase, LocalOrDistributedWorkerBase):
             self.cpu_cache[ve] is not None
             for ve in range(self.parallel_config.pipeline_parallel_size))
 
-        # Populate the cache to warmup the memory
-        for ve in range(self.parallel_config.pipeline_parallel_size):
-            for layer_cache in self.cpu_cache[ve]:
-                layer_cache.fill_(0)
+        # The KV cache is zeroed and pre-faulted by its allocator already.
 
     @property
     def do_metadata_broadcast(self) -> bool:
         return self.parallel_config.tensor_parallel_size > 1
 
+    def _broadcast_tensor_dict(
+        self,
+        tensor_dict: Optional[Dict[str, Union[torch.Tensor, Any]]] = None
+    ) -> Optional[Dict[str, Union[torch.Tensor, Any]]]:
+        if self.shm_broadcaster is None:
+            return super()._broadcast_tensor_dict(tensor_dict)
+        return self.shm_broadcaster.broadcast_tensor_dict(tensor_dict)
+
     @property
     def kv_cache(self) -> Optional[List[List[torch.Tensor]]]:
         return self.cpu_cache
@@ -356,6 +506,11 @@ class CPUWorker(LoraNotSupportedWorkerBase, LocalOrDistributedWorkerBase):
             parallel_config.tensor_parallel_size,
             parallel_config.pipeline_parallel_size)
 
+        if (envs.VLLM_CPU_SHM_BROADCAST
+                and parallel_config.tensor_parallel_size > 1):
+            self.shm_broadcaster = CPUShmBroadcaster.create(
+                get_tp_group(), envs.VLLM_CPU_SHM_BROADCAST_SPIN_US)
+
     def get_cache_block_size_bytes(self) -> int:
         """Return the size in bytes of a single KV cache block.
         """
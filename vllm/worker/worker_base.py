@@ -221,6 +221,15 @@ class LocalOrDistributedWorkerBase(WorkerBase):
         """
         raise NotImplementedError
 
+    def _broadcast_tensor_dict(
+        self,
+        tensor_dict: Optional[Dict[str, Union[torch.Tensor, Any]]] = None
+    ) -> Optional[Dict[str, Union[torch.Tensor, Any]]]:
+        """Broadcasts the inputs of a step from the driver worker to the
+        other workers in the TP group. Workers with a faster transport
+        between their ranks override it."""
+        return broadcast_tensor_dict(tensor_dict, src=0)
+
     def _get_worker_input_from_broadcast(
         self
     ) -> Optional[Tuple[BroadcastableModelInput, WorkerInput, Dict[
@@ -228,7 +237,7 @@ class LocalOrDistributedWorkerBase(WorkerBase):
         """ Get the worker input from the broadcasted tensor dict. """
         assert self.do_metadata_broadcast
         assert not self.is_driver_worker
-        broadcast_data = broadcast_tensor_dict(src=0)
+        broadcast_data = self._broadcast_tensor_dict()
         if not broadcast_data:
             return None
 
@@ -261,7 +270,7 @@ class LocalOrDistributedWorkerBase(WorkerBase):
             broadcast_data = worker_input.as_broadcastable_tensor_dict()
             broadcast_data.update(model_input.as_broadcastable_tensor_dict())
             broadcast_data.update(kwargs)
-            broadcast_tensor_dict(broadcast_data, src=0)
+            self._broadcast_tensor_dict(broadcast_data)
 
         if execute_model_req.async_callback:
             model_input = dataclasses.replace(  # type: ignore
@@ -286,7 +295,7 @@ class LocalOrDistributedWorkerBase(WorkerBase):
                     # broadcast_tensor_dict, and it stops the loop when the
                     # driver broadcasts an empty input. Send an empty input to
                     # notify all other workers to stop their execution loop.
-                    broadcast_tensor_dict({}, src=0)
+                    self._broadcast_tensor_dict({})
                 return None
             return self._get_driver_input_and_broadcast(execute_model_req)
         else: